@@ -0,0 +1,11 @@
+#pragma once
+
+#include <stddef.h>
+
+struct arena;
+
+struct arena *arena_create(size_t);
+void *arena_alloc(struct arena *, size_t);
+char *arena_strndup(struct arena *, const char *, size_t);
+char *arena_strdup(struct arena *, const char *);
+void arena_free(struct arena *);
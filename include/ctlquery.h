@@ -0,0 +1,21 @@
+#pragma once
+
+#include "clock.h"
+
+#include <stddef.h>
+
+// The base name of the program whose monitors are queried by default.
+#define CTLQUERY_DEFAULT_PREFIX "sysvrun"
+
+// A query to a single monitor.  The name is set by the caller (or by
+// ctlquery_discover()); the response and error are set by ctlquery_run().
+struct ctlquery {
+    char *name;     // service name, without the .service suffix
+    char *response; // response line, or NULL if the query failed
+    int error;      // errno value if the query failed
+};
+
+struct ctlquery *ctlquery_discover(const char *, size_t *);
+struct ctlquery *ctlquery_create(size_t);
+int ctlquery_run(const char *, struct ctlquery *, size_t, const char *, usec_t);
+void ctlquery_free(struct ctlquery *, size_t);
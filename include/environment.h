@@ -1,11 +1,10 @@
 #pragma once
 
-#include "pair.h"
-
 #include <fsdyn/bytearray.h>
 #include <fsdyn/list.h>
 
 #include <stdbool.h>
+#include <stddef.h>
 
 struct environment *environment_create(void);
 struct environment *environment_clone(struct environment *);
@@ -14,7 +13,12 @@ void environment_merge(struct environment *, struct environment *, bool);
 int environment_set(struct environment *, const char *, const char *, bool);
 int environment_put(struct environment *, const char *, bool);
 const char *environment_get(struct environment *, const char *);
+int environment_unset(struct environment *, const char *);
 void environment_remove_keys(struct environment *, list_t *);
+int environment_load(struct environment *, const char *);
+list_t *environment_expand_args(struct environment *, list_t *);
+size_t environment_size(struct environment *);
+char *const *environment_vector(struct environment *);
 list_t *environment_list(struct environment *);
 byte_array_t *environment_to_byte_array(struct environment *, byte_array_t *);
 char *environment_to_string(struct environment *);
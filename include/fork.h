@@ -3,6 +3,7 @@
 #include <unistd.h>
 
 typedef int (*child_func)(void *);
+typedef int (*spawn_func)(void *);
 
 typedef union {
     int pipe[2];
@@ -19,4 +20,6 @@ typedef struct {
 
 pid_t daemonize_function(child_func, void *, fork_io *);
 pid_t fork_function(child_func, void *, fork_io *);
+pid_t fork_keep(const int *, size_t);
+pid_t spawn_function(spawn_func, void *, fork_io *);
 void report_ready(void);
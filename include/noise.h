@@ -12,12 +12,33 @@ extern enum noise {
     DEBUG = 2
 } noisy;
 
+// Trace categories, which can be enabled individually to obtain detailed
+// information about a specific subsystem.
+enum noise_category {
+    NC_PROCWATCH,
+    NC_CN_PROC,
+    NC_CONTROL,
+    NC_FORK,
+    NC_COMMAND,
+    NC_NOTIFY,
+    //
+    NC_MAX
+};
+
+#define NOISE_TRACE_ALL ((1U << NC_MAX) - 1)
+
+extern unsigned int noise_trace;
+
 int noise_set_level(char);
 int noise_override(const char *);
+const char *noise_category_name(enum noise_category);
+int noise_trace_parse(const char *, unsigned int *);
 
 extern FILE *noisef;
 
 int fs_debug(const char *, ...) __attribute__((__format__(__printf__, 1, 2)));
+int fs_trace(enum noise_category, const char *, ...)
+    __attribute__((__format__(__printf__, 2, 3)));
 int fs_verbose(const char *, ...) __attribute__((__format__(__printf__, 1, 2)));
 int fs_info(const char *, ...) __attribute__((__format__(__printf__, 1, 2)));
 int fs_warning(const char *, ...) __attribute__((__format__(__printf__, 1, 2)));
@@ -34,17 +55,25 @@ void fs_fatalx(int, const char *, ...)
             fs_debug(__VA_ARGS__); \
         }                          \
     } while (0)
-#define debug2(...)                \
-    do {                           \
-        if (noisy >= DEBUG + 1) {  \
-            fs_debug(__VA_ARGS__); \
-        }                          \
-    } while (0)
 #else
 #define debug(...) (void)0
-#define debug2(...) (void)0
 #endif
 
+// Trace sites cost a single, predictably not-taken branch when their category
+// is disabled, and are removed entirely when building with NTRACE defined.
+#ifndef NTRACE
+#define trace_enabled(cat) \
+    __builtin_expect((noise_trace & (1U << (cat))) != 0, 0)
+#else
+#define trace_enabled(cat) 0
+#endif
+#define trace(cat, ...)                   \
+    do {                                  \
+        if (trace_enabled(cat)) {         \
+            fs_trace((cat), __VA_ARGS__); \
+        }                                 \
+    } while (0)
+
 #define verbose(...)                 \
     do {                             \
         if (noisy >= VERBOSE)        \
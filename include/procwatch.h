@@ -16,6 +16,7 @@ struct process {
 typedef enum {
     PROCWATCH_EVENT_EXEC,
     PROCWATCH_EVENT_SETSID,
+    PROCWATCH_EVENT_FORK,
 } procwatch_event;
 
 typedef enum {
@@ -23,6 +24,18 @@ typedef enum {
     PROCWATCH_ACTION_DROP,
 } procwatch_action;
 
+// Counters maintained since procwatch_start() was called.
+struct procwatch_stats {
+    unsigned long long events;   // events received
+    unsigned long long ignored;  // events for untracked processes
+    unsigned long long forks;    // processes added
+    unsigned long long execs;    // execve() calls
+    unsigned long long setsids;  // setsid() calls
+    unsigned long long exits;    // processes terminated
+    unsigned long long drops;    // processes dropped by the callback
+    unsigned long long connects; // connections to the process connector
+};
+
 typedef procwatch_action (*procwatch_callback)(procwatch_event,
                                                const struct process *,
                                                void *);
@@ -42,3 +55,4 @@ bool procwatch_reconnect(void);
 bool procwatch_ingest(int);
 void procwatch_drain(void);
 int procwatch_fd(void);
+void procwatch_get_stats(struct procwatch_stats *);
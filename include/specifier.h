@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stddef.h>
+
+// Returns the value of a specifier, or NULL if it is unknown or cannot be
+// resolved.  The value must remain valid until the expansion is complete.
+typedef const char *(*specifier_func)(void *, char);
+
+struct specifier_template;
+
+struct specifier_template *specifier_compile(const char *);
+const struct specifier_template *specifier_intern(const char *);
+char *specifier_expand(const struct specifier_template *,
+                       specifier_func,
+                       void *);
+char *specifier_unescape(const char *, size_t);
+void specifier_free(struct specifier_template *);
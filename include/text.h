@@ -6,10 +6,13 @@ struct text {
     const struct text *parent;
     const char *beg, *end;
     size_t len;
+    // length of the mapping if the text was mapped from a file, otherwise 0
+    size_t maplen;
 };
 
 struct text *text_create(const char *, size_t);
 struct text *text_from_file(const char *);
+struct text *text_map_file(const char *);
 struct text *text_line_from_stream(FILE *);
 struct text *text_narrow(const struct text *, const char *, size_t);
 struct text *text_first_line(const struct text *);
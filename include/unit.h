@@ -15,4 +15,5 @@ int unit_get_bool(struct unit *, const char *, const char *);
 int unit_delete_value(struct unit *u, const char *, const char *);
 void unit_free(struct unit *);
 byte_array_t *unit_to_byte_array(struct unit *, byte_array_t *);
+int unit_apply_binary(struct unit *, const char *, size_t);
 char *unit_to_string(struct unit *);
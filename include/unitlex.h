@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stddef.h>
+
+// A tokenizer for systemd unit files.  Tokens refer directly to the input,
+// except for values which had to be rewritten, which refer to a buffer owned
+// by the tokenizer and are only valid until the next call.  None of the
+// strings are null-terminated.
+struct unitlex {
+    const char *cur, *end;
+    // the current section
+    const char *section;
+    size_t section_len;
+    // line number of the current line, and a description of the last error
+    unsigned int line;
+    const char *error;
+    // buffer for rewritten values
+    char *buf;
+    size_t size;
+};
+
+struct unitlex_token {
+    const char *section, *key, *value;
+    size_t section_len, key_len, value_len;
+    unsigned int line;
+};
+
+void unitlex_init(struct unitlex *, const char *, size_t);
+int unitlex_next(struct unitlex *, struct unitlex_token *);
+void unitlex_fini(struct unitlex *);
@@ -0,0 +1,109 @@
+#include "arena.h"
+
+#include <fsdyn/fsalloc.h>
+
+#include <stdalign.h>
+#include <stddef.h>
+#include <string.h>
+
+#define ARENA_ALIGN alignof(max_align_t)
+#define ARENA_ROUND(n) (((n) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+#define ARENA_DEFAULT_CHUNK 4096
+
+// A bump allocator.  Memory is carved out of a list of chunks, each at least
+// the size requested when the arena was created, and is only ever released
+// all at once, when the arena is freed.  Requests which are larger than half
+// a chunk get a chunk of their own, so they do not waste the remainder of the
+// current one.
+struct arena_chunk {
+    struct arena_chunk *next;
+    size_t size, used;
+    alignas(max_align_t) unsigned char data[];
+};
+
+struct arena {
+    struct arena_chunk *chunks;
+    size_t chunk_size;
+};
+
+static struct arena_chunk *arena_chunk_create(size_t size)
+{
+    struct arena_chunk *c;
+
+    c = fsalloc(sizeof(*c) + size);
+    c->next = NULL;
+    c->size = size;
+    c->used = 0;
+    return c;
+}
+
+// Creates an arena which allocates memory in chunks of the given size, or a
+// reasonable default if zero.
+struct arena *arena_create(size_t chunk_size)
+{
+    struct arena *a;
+
+    a = fsalloc(sizeof(*a));
+    a->chunk_size = ARENA_ROUND(chunk_size > 0 ? chunk_size
+                                               : ARENA_DEFAULT_CHUNK);
+    a->chunks = arena_chunk_create(a->chunk_size);
+    return a;
+}
+
+// Returns a block of memory of the given size, suitably aligned for any
+// type, which remains valid until the arena is freed.
+void *arena_alloc(struct arena *a, size_t size)
+{
+    struct arena_chunk *c = a->chunks;
+    void *ptr;
+
+    size = ARENA_ROUND(size > 0 ? size : 1);
+    if (c->size - c->used < size) {
+        if (size > a->chunk_size / 2) {
+            // Give it a chunk of its own, behind the current one.
+            c = arena_chunk_create(size);
+            c->next = a->chunks->next;
+            a->chunks->next = c;
+        } else {
+            c = arena_chunk_create(a->chunk_size);
+            c->next = a->chunks;
+            a->chunks = c;
+        }
+    }
+    ptr = c->data + c->used;
+    c->used += size;
+    return ptr;
+}
+
+// Copies a string of the given length into the arena and null-terminates
+// it.  It is assumed that the string does not contain null characters within
+// the specified length.
+char *arena_strndup(struct arena *a, const char *str, size_t len)
+{
+    char *copy;
+
+    copy = arena_alloc(a, len + 1);
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+// Copies a string into the arena.
+char *arena_strdup(struct arena *a, const char *str)
+{
+    return arena_strndup(a, str, strlen(str));
+}
+
+// Frees the arena along with everything allocated from it.
+void arena_free(struct arena *a)
+{
+    struct arena_chunk *c, *next;
+
+    if (a != NULL) {
+        for (c = a->chunks; c != NULL; c = next) {
+            next = c->next;
+            fsfree(c);
+        }
+        fsfree(a);
+    }
+}
@@ -180,6 +180,11 @@ bool cn_proc_receive_event(struct proc_event *ev, int timeout)
     if ((size_t)rlen < PROC_EVENT_MIN_SIZE) {
         fatal("struct proc_event size mismatch");
     }
+    trace(NC_CN_PROC,
+          "event 0x%08x cpu %u length %zd",
+          ev->what,
+          ev->cpu,
+          rlen);
     return true;
 }
 
@@ -205,11 +210,11 @@ bool cn_proc_listen(bool endis, int timeout)
     while (cn_proc_receive_event(&ev, timeout)) {
         if (ev.what == PROC_EVENT_NONE) {
             if (ev.ack.err != 0) {
-                debug("cn_proc: error %u", ev.ack.err);
+                trace(NC_CN_PROC, "error %u", ev.ack.err);
                 errno = ev.ack.err;
                 return false;
             }
-            debug("cn_proc: success");
+            trace(NC_CN_PROC, "success");
             listening = endis;
             return true;
         }
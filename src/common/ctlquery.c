@@ -0,0 +1,322 @@
+#define _GNU_SOURCE
+
+#include "ctlquery.h"
+
+#include "noise.h"
+
+#include <fsdyn/charstr.h>
+#include <fsdyn/fsalloc.h>
+#include <fsdyn/list.h>
+
+#include <errno.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define CTLQUERY_SUFFIX ".service"
+#define CTLQUERY_PROC_NET_UNIX "/proc/net/unix"
+// __SO_ACCEPTCON, which the kernel does not export
+#define CTLQUERY_SO_ACCEPTCON 0x00010000
+// maximum number of connections in flight
+#define CTLQUERY_MAX_CONNS 128
+
+// A connection to a monitor.  The monitor speaks first, sending a banner
+// containing its protocol version; we then send the request and wait for a
+// single-line response.
+struct ctlquery_conn {
+    struct ctlquery *q;
+    int fd;
+    bool sent;
+    size_t len;
+    char buf[4096];
+};
+
+static int ctlquery_cmp(const void *a, const void *b)
+{
+    const struct ctlquery *qa = a, *qb = b;
+
+    return strcmp(qa->name, qb->name);
+}
+
+// Allocates an array of queries.  The caller must fill in the names.
+struct ctlquery *ctlquery_create(size_t n)
+{
+    return fscalloc(n > 0 ? n : 1, sizeof(struct ctlquery));
+}
+
+// Frees an array of queries.
+void ctlquery_free(struct ctlquery *queries, size_t n)
+{
+    if (queries != NULL) {
+        for (size_t i = 0; i < n; i++) {
+            fsfree(queries[i].name);
+            fsfree(queries[i].response);
+        }
+        fsfree(queries);
+    }
+}
+
+// Finds every listening control socket belonging to a monitor run by the
+// program with the given base name, by scanning the list of Unix sockets in
+// /proc rather than probing for each known service.  Returns an array of
+// queries sorted by service name, and stores the number of entries in the
+// location pointed to by the second argument, or returns NULL on error.
+struct ctlquery *ctlquery_discover(const char *prefix, size_t *np)
+{
+    struct ctlquery *queries;
+    unsigned long flags;
+    unsigned int type, state;
+    size_t len, plen, slen, size = 0, n;
+    char *line = NULL, *path;
+    list_t *names;
+    FILE *f;
+    int off;
+
+    if ((f = fopen(CTLQUERY_PROC_NET_UNIX, "re")) == NULL) {
+        return NULL;
+    }
+    plen = strlen(prefix);
+    slen = strlen(CTLQUERY_SUFFIX);
+    names = make_list();
+    while (getline(&line, &size, f) > 0) {
+        off = 0;
+        if (sscanf(line,
+                   "%*x: %*x %*x %lx %x %x %*u %n",
+                   &flags,
+                   &type,
+                   &state,
+                   &off)
+                != 3
+            || off == 0) {
+            continue;
+        }
+        if (!(flags & CTLQUERY_SO_ACCEPTCON) || type != SOCK_STREAM) {
+            continue;
+        }
+        // abstract sockets are listed with a leading @
+        path = line + off;
+        path[strcspn(path, "\n")] = '\0';
+        len = strlen(path);
+        if (path[0] != '@' || strncmp(path + 1, prefix, plen) != 0
+            || path[1 + plen] != '/' || len <= 2 + plen + slen
+            || strcmp(path + len - slen, CTLQUERY_SUFFIX) != 0) {
+            continue;
+        }
+        path += 2 + plen;
+        len -= 2 + plen + slen;
+        if (memchr(path, '/', len) != NULL) {
+            continue;
+        }
+        list_append(names, charstr_dupsubstr(path, path + len));
+    }
+    free(line);
+    fclose(f);
+    n = list_size(names);
+    queries = ctlquery_create(n);
+    for (size_t i = 0; i < n; i++) {
+        queries[i].name = (char *)list_pop_first(names);
+    }
+    destroy_list(names);
+    qsort(queries, n, sizeof(*queries), ctlquery_cmp);
+    *np = n;
+    debug("discovered %zu monitors", n);
+    return queries;
+}
+
+// Starts a query by connecting to the monitor's control socket.
+static int ctlquery_connect(const char *prefix, struct ctlquery_conn *conn)
+{
+    struct sockaddr_un sun = { .sun_family = AF_UNIX };
+    socklen_t sunlen;
+    int res, serrno;
+
+    res = snprintf(sun.sun_path,
+                   sizeof(sun.sun_path),
+                   "%c%s/%s%s",
+                   '\0',
+                   prefix,
+                   conn->q->name,
+                   CTLQUERY_SUFFIX);
+    if (res < 0) {
+        return -1;
+    }
+    if ((size_t)res >= sizeof(sun.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    sunlen = offsetof(struct sockaddr_un, sun_path) + res;
+    conn->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (conn->fd < 0) {
+        return -1;
+    }
+    if (connect(conn->fd, (struct sockaddr *)&sun, sunlen) != 0) {
+        serrno = errno;
+        close(conn->fd);
+        conn->fd = -1;
+        errno = serrno;
+        return -1;
+    }
+    conn->sent = false;
+    conn->len = 0;
+    return 0;
+}
+
+// Finishes a query, successfully if the response is not NULL.
+static void ctlquery_finish(struct ctlquery_conn *conn,
+                            const char *response,
+                            int error)
+{
+    if (response != NULL) {
+        conn->q->response = charstr_dupstr(response);
+        trace(NC_CONTROL, "%s: <\"%s\"", conn->q->name, response);
+    } else {
+        conn->q->error = error;
+        debug("%s: query failed: %s", conn->q->name, strerror(error));
+    }
+    close(conn->fd);
+    conn->fd = -1;
+    conn->q = NULL;
+}
+
+// Reads from a monitor.  On receiving the banner, sends the request; on
+// receiving the response, finishes the query.
+static void ctlquery_ingest(struct ctlquery_conn *conn, const char *request)
+{
+    char *eol, *p;
+    ssize_t res;
+    size_t len;
+
+    res = read(conn->fd, conn->buf + conn->len, sizeof(conn->buf) - conn->len);
+    if (res < 0 && (errno == EAGAIN || errno == EINTR)) {
+        return;
+    }
+    if (res <= 0) {
+        ctlquery_finish(conn, NULL, res < 0 ? errno : ECONNRESET);
+        return;
+    }
+    conn->len += res;
+    while ((eol = memchr(conn->buf, '\n', conn->len)) != NULL) {
+        for (p = eol; p > conn->buf && p[-1] == '\r'; p--) {
+            // nothing
+        }
+        *p = '\0';
+        if (conn->sent) {
+            ctlquery_finish(conn, conn->buf, 0);
+            return;
+        }
+        // banner received, send request
+        trace(NC_CONTROL, "%s: >\"%s\"", conn->q->name, request);
+        len = strlen(request);
+        if (send(conn->fd, request, len, MSG_NOSIGNAL) != (ssize_t)len
+            || send(conn->fd, "\n", 1, MSG_NOSIGNAL) != 1) {
+            ctlquery_finish(conn, NULL, errno);
+            return;
+        }
+        conn->sent = true;
+        conn->len -= eol + 1 - conn->buf;
+        memmove(conn->buf, eol + 1, conn->len);
+    }
+    if (conn->len == sizeof(conn->buf)) {
+        ctlquery_finish(conn, NULL, EMSGSIZE);
+    }
+}
+
+// Sends the same request to the monitors of the specified services.  All
+// queries are in flight at the same time, up to a limit, so the total time
+// is roughly that of the slowest monitor rather than the sum.  Queries which
+// have not completed by the timeout fail with ETIMEDOUT.  Returns the number
+// of successful queries, or -1 on error.
+int ctlquery_run(const char *prefix,
+                 struct ctlquery *queries,
+                 size_t n,
+                 const char *request,
+                 usec_t timeout)
+{
+    struct ctlquery_conn *conns;
+    struct pollfd *pfds;
+    usec_t deadline, now;
+    size_t nconns, next = 0, active, done = 0;
+    int res, err = ETIMEDOUT, ok = 0;
+
+    nconns = n < CTLQUERY_MAX_CONNS ? n : CTLQUERY_MAX_CONNS;
+    if (nconns == 0) {
+        return 0;
+    }
+    conns = fscalloc(nconns, sizeof(*conns));
+    pfds = fscalloc(nconns, sizeof(*pfds));
+    for (size_t i = 0; i < nconns; i++) {
+        conns[i].fd = -1;
+    }
+    deadline = clock_usec() + timeout;
+    while (done < n) {
+        // fill empty slots with pending queries
+        active = 0;
+        for (size_t i = 0; i < nconns; i++) {
+            while (conns[i].q == NULL && next < n) {
+                conns[i].q = &queries[next++];
+                fsfree(conns[i].q->response);
+                conns[i].q->response = NULL;
+                conns[i].q->error = 0;
+                if (ctlquery_connect(prefix, &conns[i]) != 0) {
+                    debug("%s: connect failed: %m", conns[i].q->name);
+                    conns[i].q->error = errno;
+                    conns[i].q = NULL;
+                    done++;
+                }
+            }
+            pfds[i].fd = conns[i].q != NULL ? conns[i].fd : -1;
+            pfds[i].events = POLLIN;
+            pfds[i].revents = 0;
+            if (conns[i].q != NULL) {
+                active++;
+            }
+        }
+        if (active == 0) {
+            break;
+        }
+        now = clock_usec();
+        if (now >= deadline) {
+            break;
+        }
+        res = poll(pfds, nconns, (int)us2ms(deadline - now));
+        if (res < 0 && errno != EINTR) {
+            err = errno;
+            break;
+        }
+        for (size_t i = 0; res > 0 && i < nconns; i++) {
+            if (pfds[i].revents && conns[i].q != NULL) {
+                ctlquery_ingest(&conns[i], request);
+                if (conns[i].q == NULL) {
+                    done++;
+                }
+            }
+        }
+    }
+    // whatever is left has timed out, unless poll() failed
+    for (size_t i = 0; i < nconns; i++) {
+        if (conns[i].q != NULL) {
+            ctlquery_finish(&conns[i], NULL, err);
+        }
+    }
+    while (next < n) {
+        queries[next++].error = err;
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (queries[i].response != NULL) {
+            ok++;
+        }
+    }
+    fsfree(pfds);
+    fsfree(conns);
+    if (err != ETIMEDOUT) {
+        errno = err;
+        return -1;
+    }
+    return ok;
+}
@@ -1,50 +1,221 @@
 #include "environment.h"
 
 #include "common.h"
+#include "text.h"
 
 #include <fsdyn/bytearray.h>
 #include <fsdyn/charstr.h>
 #include <fsdyn/fsalloc.h>
-#include <fsdyn/hashtable.h>
 #include <fsdyn/list.h>
 
+#include <ctype.h>
 #include <errno.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 
+// A variable, stored as a single NAME=VALUE string which may be shared by
+// several vectors.
+struct envvar {
+    unsigned int refs;
+    char str[];
+};
+
+// A vector of variables, sorted by name and terminated by a NULL pointer, so
+// that it can be passed to execve() as is.  It may be shared by several
+// environments, and is copied before it is modified if it is.
+struct envvec {
+    unsigned int refs;
+    size_t count, size;
+    char *vars[];
+};
+
 struct environment {
-    hash_table_t *variables;
+    struct envvec *vec;
 };
 
+static inline struct envvar *envvar_of(const char *str)
+{
+    return (struct envvar *)(str - offsetof(struct envvar, str));
+}
+
+static char *envvar_create(const char *name,
+                           size_t nlen,
+                           const char *value,
+                           size_t vlen)
+{
+    struct envvar *var;
+
+    var = fsalloc(sizeof(*var) + nlen + 1 + vlen + 1);
+    var->refs = 1;
+    memcpy(var->str, name, nlen);
+    var->str[nlen] = '=';
+    memcpy(var->str + nlen + 1, value, vlen);
+    var->str[nlen + 1 + vlen] = '\0';
+    return var->str;
+}
+
+static inline char *envvar_ref(char *str)
+{
+    envvar_of(str)->refs++;
+    return str;
+}
+
+static inline void envvar_unref(char *str)
+{
+    struct envvar *var = envvar_of(str);
+
+    if (--var->refs == 0) {
+        fsfree(var);
+    }
+}
+
+// Compares a name with the name of a variable.
+static int envvar_compare(const char *name, size_t nlen, const char *str)
+{
+    size_t i;
+
+    for (i = 0; i < nlen && str[i] != '='; i++) {
+        if (name[i] != str[i]) {
+            return (unsigned char)name[i] - (unsigned char)str[i];
+        }
+    }
+    if (i < nlen) {
+        return 1;
+    }
+    return str[i] == '=' ? 0 : -1;
+}
+
+static struct envvec *envvec_create(size_t size)
+{
+    struct envvec *vec;
+
+    vec = fsalloc(sizeof(*vec) + (size + 1) * sizeof(char *));
+    vec->refs = 1;
+    vec->count = 0;
+    vec->size = size;
+    vec->vars[0] = NULL;
+    return vec;
+}
+
+static void envvec_unref(struct envvec *vec)
+{
+    if (--vec->refs == 0) {
+        for (size_t i = 0; i < vec->count; i++) {
+            envvar_unref(vec->vars[i]);
+        }
+        fsfree(vec);
+    }
+}
+
+// Ensures that an environment has a vector of its own with room for at least
+// one more variable.
+static void environment_unshare(struct environment *env)
+{
+    struct envvec *vec = env->vec;
+    size_t size;
+
+    if (vec->refs == 1 && vec->count < vec->size) {
+        return;
+    }
+    size = vec->count < vec->size ? vec->size : vec->size * 2 + 8;
+    if (vec->refs == 1) {
+        vec = fsrealloc(vec, sizeof(*vec) + (size + 1) * sizeof(char *));
+        vec->size = size;
+        env->vec = vec;
+        return;
+    }
+    env->vec = envvec_create(size);
+    for (size_t i = 0; i < vec->count; i++) {
+        env->vec->vars[i] = envvar_ref(vec->vars[i]);
+    }
+    env->vec->count = vec->count;
+    env->vec->vars[vec->count] = NULL;
+    envvec_unref(vec);
+}
+
+// Looks up a variable by name.  Returns true if it was found.  Either way,
+// sets *pos to the position where it is or would be.
+static bool environment_find(struct environment *env,
+                             const char *name,
+                             size_t nlen,
+                             size_t *pos)
+{
+    size_t lo = 0, hi = env->vec->count, mid;
+    int cmp;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        cmp = envvar_compare(name, nlen, env->vec->vars[mid]);
+        if (cmp == 0) {
+            *pos = mid;
+            return true;
+        }
+        if (cmp < 0) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    *pos = lo;
+    return false;
+}
+
+// Adds a variable to the environment, taking ownership of the caller's
+// reference to it, unless it is already there and overwrite is false.
+static int environment_insert(struct environment *env,
+                              char *str,
+                              size_t nlen,
+                              bool overwrite)
+{
+    size_t pos;
+
+    if (environment_find(env, str, nlen, &pos)) {
+        if (overwrite) {
+            environment_unshare(env);
+            envvar_unref(env->vec->vars[pos]);
+            env->vec->vars[pos] = str;
+        } else {
+            envvar_unref(str);
+        }
+        errno = EEXIST;
+        return -1;
+    }
+    environment_unshare(env);
+    memmove(env->vec->vars + pos + 1,
+            env->vec->vars + pos,
+            (env->vec->count - pos + 1) * sizeof(char *));
+    env->vec->vars[pos] = str;
+    env->vec->count++;
+    return 0;
+}
+
 struct environment *environment_create(void)
 {
     struct environment *env;
 
     env = fscalloc(1, sizeof(*env));
-    env->variables = make_hash_table(256, (void *)hash_string, (void *)strcmp);
+    env->vec = envvec_create(0);
     return env;
 }
 
+// Creates a copy of an environment.  The copy shares the original's variables
+// until either of them is modified, so this is cheap.
 struct environment *environment_clone(struct environment *other)
 {
     struct environment *env;
 
-    env = environment_create();
-    environment_merge(env, other, true);
+    env = fscalloc(1, sizeof(*env));
+    env->vec = other->vec;
+    env->vec->refs++;
     return env;
 }
 
 void environment_free(struct environment *env)
 {
-    hash_elem_t *e;
-
     if (env != NULL) {
-        while ((e = hash_table_pop_any(env->variables)) != NULL) {
-            pair_free(DQ(hash_elem_get_value(e)));
-            destroy_hash_element(e);
-        }
-        destroy_hash_table(env->variables);
+        envvec_unref(env->vec);
         fsfree(env);
     }
 }
@@ -56,28 +227,69 @@ void environment_merge(struct environment *env,
                        struct environment *other,
                        bool overwrite)
 {
-    hash_elem_t *e;
-    const struct pair *p;
+    struct envvec *vec, *a = env->vec, *b = other->vec;
+    size_t i = 0, j = 0;
+    const char *eq;
+    int cmp;
+
+    if (b->count == 0 || a == b) {
+        return;
+    }
+    if (a->count == 0) {
+        envvec_unref(a);
+        env->vec = b;
+        b->refs++;
+        return;
+    }
+    // both are sorted, so merge them in a single pass
+    vec = envvec_create(a->count + b->count);
+    while (i < a->count || j < b->count) {
+        if (i == a->count) {
+            cmp = 1;
+        } else if (j == b->count) {
+            cmp = -1;
+        } else {
+            eq = strchr(a->vars[i], '=');
+            cmp = envvar_compare(a->vars[i], eq - a->vars[i], b->vars[j]);
+        }
+        if (cmp < 0 || (cmp == 0 && !overwrite)) {
+            vec->vars[vec->count++] = envvar_ref(a->vars[i]);
+        } else {
+            vec->vars[vec->count++] = envvar_ref(b->vars[j]);
+        }
+        i += cmp <= 0;
+        j += cmp >= 0;
+    }
+    vec->vars[vec->count] = NULL;
+    envvec_unref(a);
+    env->vec = vec;
+}
+
+// Removes a variable from the environment.  Returns -1 if it was not there.
+int environment_unset(struct environment *env, const char *name)
+{
+    size_t pos;
 
-    for (e = hash_table_get_any(other->variables); e != NULL;
-         e = hash_table_get_other(e)) {
-        p = hash_elem_get_value(e);
-        environment_set(env, p->key, p->value, overwrite);
+    if (!environment_find(env, name, strlen(name), &pos)) {
+        errno = ENOENT;
+        return -1;
     }
+    environment_unshare(env);
+    envvar_unref(env->vec->vars[pos]);
+    memmove(env->vec->vars + pos,
+            env->vec->vars + pos + 1,
+            (env->vec->count - pos) * sizeof(char *));
+    env->vec->count--;
+    return 0;
 }
 
-// Remove all keys present in a second environment from this one.
+// Remove all keys present in a list from this environment.
 void environment_remove_keys(struct environment *env, list_t *list)
 {
-    hash_elem_t *he;
-    list_elem_t *le;
+    list_elem_t *e;
 
-    for (le = list_get_first(list); le != NULL; le = list_next(le)) {
-        he = hash_table_pop(env->variables, list_elem_get_value(le));
-        if (he != NULL) {
-            pair_free(DQ(hash_elem_get_value(he)));
-            destroy_hash_element(he);
-        }
+    for (e = list_get_first(list); e != NULL; e = list_next(e)) {
+        environment_unset(env, list_elem_get_value(e));
     }
 }
 
@@ -89,21 +301,12 @@ int environment_set(struct environment *env,
                     const char *value,
                     bool overwrite)
 {
-    hash_elem_t *e;
-    struct pair *p;
+    size_t nlen = strlen(name);
 
-    e = hash_table_get(env->variables, name);
-    if (e == NULL || overwrite) {
-        p = pair_create(name, value);
-        hash_table_put(env->variables, p->key, p);
-    }
-    if (e != NULL) {
-        pair_free(DQ(hash_elem_get_value(e)));
-        destroy_hash_element(e);
-        errno = EEXIST;
-        return -1;
-    }
-    return 0;
+    return environment_insert(env,
+                              envvar_create(name, nlen, value, strlen(value)),
+                              nlen,
+                              overwrite);
 }
 
 // Adds a variable to the environment, replacing any prior instance if and only
@@ -115,48 +318,243 @@ int environment_put(struct environment *env,
                     const char *name_value,
                     bool overwrite)
 {
-    hash_elem_t *e;
-    struct pair *p;
-    const char *name, *eq, *value, *end;
+    const char *eq, *value;
 
-    for (eq = name = name_value; *eq != '\0' && *eq != '='; eq++) {
+    for (eq = name_value; *eq != '\0' && *eq != '='; eq++) {
         // XXX should check that chars are valid
         // nothing
     }
-    if (*eq == '=') {
-        for (end = value = eq + 1; *end != '\0'; end++) {
+    value = *eq == '=' ? eq + 1 : eq;
+    return environment_insert(
+        env,
+        envvar_create(name_value, eq - name_value, value, strlen(value)),
+        eq - name_value,
+        overwrite);
+}
+
+static inline bool isnamestart(int ch)
+{
+    return isalpha(ch) || ch == '_';
+}
+
+static inline bool isnamechar(int ch)
+{
+    return isalnum(ch) || ch == '_';
+}
+
+// Reads variables from an environment file, as specified by EnvironmentFile=
+// in systemd.exec(5), and adds them to the environment, replacing any prior
+// instance.  Each line is a single assignment, except that a backslash at the
+// end of a line continues it on the next.  Lines starting with '#' or ';' are
+// comments.  Values may be enclosed, in whole or in part, in single quotes,
+// within which every character is literal, or double quotes, within which a
+// backslash escapes '"', '\', '`' and '$'.  Outside of quotes, a backslash
+// escapes any character, and whitespace around the value is discarded.
+// Malformed lines are ignored.  Returns -1 if the file cannot be read.
+int environment_load(struct environment *env, const char *path)
+{
+    struct text *txt;
+    byte_array_t *value;
+    const char *p, *end, *key;
+    size_t klen, keep;
+    char *name;
+
+    if ((txt = text_map_file(path)) == NULL) {
+        return -1;
+    }
+    value = make_byte_array(SIZE_MAX);
+    for (p = txt->beg, end = txt->end; p < end;) {
+        if (isspace(*p)) {
+            p++;
+            continue;
+        }
+        if (*p == '#' || *p == ';' || !isnamestart(*p)) {
+            // comment or malformed line
+            while (p < end && *p != '\n') {
+                p++;
+            }
+            continue;
+        }
+        for (key = p; p < end && isnamechar(*p); p++) {
+            // nothing
+        }
+        klen = p - key;
+        while (p < end && isblank(*p)) {
+            p++;
+        }
+        if (p >= end || *p != '=') {
+            while (p < end && *p != '\n') {
+                p++;
+            }
+            continue;
+        }
+        for (p++; p < end && isblank(*p); p++) {
             // nothing
         }
-    } else {
-        end = value = eq;
+        byte_array_clear(value);
+        keep = 0;
+        while (p < end && *p != '\n') {
+            if (*p == '\'') {
+                for (p++; p < end && *p != '\''; p++) {
+                    byte_array_append(value, p, 1);
+                }
+                p++;
+                keep = byte_array_size(value);
+            } else if (*p == '"') {
+                for (p++; p < end && *p != '"'; p++) {
+                    if (*p == '\\' && p + 1 < end) {
+                        if (p[1] == '\n') {
+                            p++;
+                            continue;
+                        }
+                        if (strchr("\"\\`$", p[1]) != NULL) {
+                            p++;
+                        }
+                    }
+                    byte_array_append(value, p, 1);
+                }
+                p++;
+                keep = byte_array_size(value);
+            } else if (*p == '\\' && p + 1 < end) {
+                if (p[1] != '\n') {
+                    byte_array_append(value, p + 1, 1);
+                    keep = byte_array_size(value);
+                }
+                p += 2;
+            } else {
+                byte_array_append(value, p, 1);
+                if (!isspace(*p)) {
+                    keep = byte_array_size(value);
+                }
+                p++;
+            }
+        }
+        byte_array_resize(value, keep, 0);
+        byte_array_append(value, "", 1);
+        name = charstr_dupsubstr(key, key + klen);
+        environment_set(env, name, byte_array_data(value), true);
+        fsfree(name);
     }
-    e = hash_table_get(env->variables, name);
-    if (e == NULL || overwrite) {
-        p = pair_create_len(name, eq - name, value, end - value);
-        e = hash_table_put(env->variables, p->key, p);
+    destroy_byte_array(value);
+    text_free(txt);
+    return 0;
+}
+
+// Appends a word to a list of arguments, replacing each ${NAME} with the
+// value of the variable of that name, or nothing if it is not defined, and
+// each $$ with a single $.
+static void environment_expand_word(struct environment *env,
+                                    const char *word,
+                                    list_t *args)
+{
+    byte_array_t *ba;
+    const char *p, *q, *value;
+    char *name;
+
+    if (strchr(word, '$') == NULL) {
+        list_append(args, charstr_dupstr(word));
+        return;
     }
-    if (e != NULL) {
-        pair_free(DQ(hash_elem_get_value(e)));
-        destroy_hash_element(e);
-        errno = EEXIST;
-        return -1;
+    ba = make_byte_array(SIZE_MAX);
+    for (p = word; *p != '\0'; p++) {
+        if (p[0] == '$' && p[1] == '$') {
+            byte_array_append(ba, p++, 1);
+            continue;
+        }
+        if (p[0] == '$' && p[1] == '{' && isnamestart(p[2])) {
+            for (q = p + 3; isnamechar(*q); q++) {
+                // nothing
+            }
+            if (*q == '}') {
+                name = charstr_dupsubstr(p + 2, q);
+                if ((value = environment_get(env, name)) != NULL) {
+                    byte_array_append(ba, value, strlen(value));
+                }
+                fsfree(name);
+                p = q;
+                continue;
+            }
+        }
+        byte_array_append(ba, p, 1);
     }
-    return 0;
+    byte_array_append(ba, "", 1);
+    list_append(args, charstr_dupstr(byte_array_data(ba)));
+    destroy_byte_array(ba);
+}
+
+// Substitutes variables in a command line, as described in systemd.service(5).
+// A word which consists solely of $NAME is replaced by the value of the
+// variable split at whitespace, which may result in any number of words.
+// Within a word, ${NAME} is replaced by the value of the variable, and $$ by
+// a single $.  Undefined variables are treated as empty.  The first word, the
+// program to execute, is left as is.  Returns a new list of words.
+list_t *environment_expand_args(struct environment *env, list_t *words)
+{
+    list_elem_t *e;
+    list_t *args;
+    const char *word, *value, *p, *q;
+
+    args = make_list();
+    for (e = list_get_first(words); e != NULL; e = list_next(e)) {
+        word = list_elem_get_value(e);
+        if (e == list_get_first(words)) {
+            list_append(args, charstr_dupstr(word));
+            continue;
+        }
+        if (word[0] != '$' || !isnamestart(word[1])) {
+            environment_expand_word(env, word, args);
+            continue;
+        }
+        for (p = word + 2; isnamechar(*p); p++) {
+            // nothing
+        }
+        if (*p != '\0') {
+            environment_expand_word(env, word, args);
+            continue;
+        }
+        if ((value = environment_get(env, word + 1)) == NULL) {
+            continue;
+        }
+        for (p = value; *p != '\0'; p = q) {
+            while (isspace(*p)) {
+                p++;
+            }
+            for (q = p; *q != '\0' && !isspace(*q); q++) {
+                // nothing
+            }
+            if (q > p) {
+                list_append(args, charstr_dupsubstr(p, q));
+            }
+        }
+    }
+    return args;
 }
 
 // Returns the value of an environment variable, or NULL if it is not
 // defined.
 const char *environment_get(struct environment *env, const char *name)
 {
-    hash_elem_t *e;
-    const struct pair *p;
+    size_t nlen = strlen(name), pos;
 
-    if ((e = hash_table_get(env->variables, name)) == NULL) {
+    if (!environment_find(env, name, nlen, &pos)) {
         errno = ENOENT;
         return NULL;
     }
-    p = hash_elem_get_value(e);
-    return p->value;
+    return env->vec->vars[pos] + nlen + 1;
+}
+
+// Returns the number of variables in the environment.
+size_t environment_size(struct environment *env)
+{
+    return env->vec->count;
+}
+
+// Returns the environment as a NULL-terminated vector of NAME=VALUE strings,
+// sorted by name, suitable for execve().  The vector belongs to the
+// environment and is only valid until the environment is modified or freed.
+char *const *environment_vector(struct environment *env)
+{
+    return env->vec->vars;
 }
 
 // Returns a copy of the environment in the form of a list of key=value
@@ -164,14 +562,10 @@ const char *environment_get(struct environment *env, const char *name)
 list_t *environment_list(struct environment *env)
 {
     list_t *list;
-    hash_elem_t *e;
-    const struct pair *p;
 
     list = make_list();
-    for (e = hash_table_get_any(env->variables); e != NULL;
-         e = hash_table_get_other(e)) {
-        p = hash_elem_get_value(e);
-        list_append(list, charstr_printf("%s=%s", p->key, p->value));
+    for (size_t i = 0; i < env->vec->count; i++) {
+        list_append(list, charstr_dupstr(env->vec->vars[i]));
     }
     return list;
 }
@@ -180,16 +574,12 @@ byte_array_t *environment_to_byte_array(struct environment *env,
                                         byte_array_t *ba)
 {
     byte_array_t *nba = NULL;
-    hash_elem_t *e;
-    const struct pair *p;
 
     if (ba == NULL) {
         ba = nba = make_byte_array(SIZE_MAX);
     }
-    for (e = hash_table_get_any(env->variables); e != NULL;
-         e = hash_table_get_other(e)) {
-        p = hash_elem_get_value(e);
-        if (!byte_array_appendf(ba, "%s=%s\n", p->key, p->value)) {
+    for (size_t i = 0; i < env->vec->count; i++) {
+        if (!byte_array_appendf(ba, "%s\n", env->vec->vars[i])) {
             goto fail;
         }
     }
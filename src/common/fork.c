@@ -6,16 +6,26 @@
 #include "exitcode.h"
 #include "noise.h"
 
-#include <fsdyn/integer.h>
-#include <fsdyn/list.h>
 #include <unixkit/unixkit.h>
 
 #include <errno.h>
 #include <fcntl.h>
 #include <paths.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/syscall.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+#ifndef CLOSE_RANGE_CLOEXEC
+#define CLOSE_RANGE_CLOEXEC (1U << 2)
+#endif
+
+// Stack for a spawned child, which only needs to set up descriptors and
+// credentials before calling execve().
+#define SPAWN_STACK_SIZE 16384
+
 // Within this code, we have three separate processes: the parent, an optional
 // intermediate process, and the child.  When daemonizing, the intermediate
 // process is necessary to ensure that the child is immediately reparented and
@@ -57,6 +67,119 @@ static void df_fd_setup(fork_pipe *report, fork_io *io)
     }
 }
 
+// Closes descriptors first through last inclusive.  Async-signal-safe.
+static int fork_close_range(unsigned int first, unsigned int last)
+{
+#ifdef SYS_close_range
+    return syscall(SYS_close_range, first, last, 0);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+// Returns true if fd is one of the n descriptors in keep.
+static bool fork_kept(int fd, const int *keep, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        if (keep[i] == fd) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Closes every descriptor not in keep by walking /proc/self/fd, or the
+// entire descriptor table if that is not available.  Does not allocate
+// memory, so it is safe to call in a child of a multithreaded process.
+static void fork_close_scan(const int *keep, size_t n)
+{
+    struct dirent64 {
+        uint64_t d_ino;
+        int64_t d_off;
+        unsigned short d_reclen;
+        unsigned char d_type;
+        char d_name[];
+    } *de;
+    char buf[4096];
+    long len, maxfd;
+    int dfd, fd;
+
+    dfd = open("/proc/self/fd", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dfd < 0) {
+        if ((maxfd = sysconf(_SC_OPEN_MAX)) < 0) {
+            maxfd = 1024;
+        }
+        for (fd = 0; fd < maxfd; fd++) {
+            if (!fork_kept(fd, keep, n)) {
+                (void)close(fd);
+            }
+        }
+        return;
+    }
+    while ((len = syscall(SYS_getdents64, dfd, buf, sizeof(buf))) > 0) {
+        for (long off = 0; off < len; off += de->d_reclen) {
+            de = (struct dirent64 *)(buf + off);
+            if (de->d_name[0] < '0' || de->d_name[0] > '9') {
+                continue;
+            }
+            fd = 0;
+            for (const char *p = de->d_name; *p >= '0' && *p <= '9'; p++) {
+                fd = fd * 10 + (*p - '0');
+            }
+            if (fd != dfd && !fork_kept(fd, keep, n)) {
+                (void)close(fd);
+            }
+        }
+    }
+    (void)close(dfd);
+}
+
+// Closes every descriptor not in keep.  The kept descriptors are sorted and
+// close_range() is applied to the gaps between them, so the cost depends on
+// the number of kept descriptors rather than on the size of the descriptor
+// table.  Async-signal-safe.
+static void fork_close_except(const int *keep, size_t n)
+{
+    int fds[n], fd;
+    unsigned int first = 0;
+    size_t i, j;
+
+    for (i = 0; i < n; i++) {
+        fd = keep[i];
+        for (j = i; j > 0 && fds[j - 1] > fd; j--) {
+            fds[j] = fds[j - 1];
+        }
+        fds[j] = fd;
+    }
+    for (i = 0; i < n; i++) {
+        if (fds[i] < 0 || (unsigned int)fds[i] < first) {
+            continue;
+        }
+        if ((unsigned int)fds[i] > first
+            && fork_close_range(first, fds[i] - 1) != 0) {
+            fork_close_scan(fds, n);
+            return;
+        }
+        first = fds[i] + 1;
+    }
+    if (fork_close_range(first, ~0U) != 0) {
+        fork_close_scan(fds, n);
+    }
+}
+
+// Forks, closing every descriptor in the child except the n listed in keep.
+// Returns the same as fork().
+pid_t fork_keep(const int *keep, size_t n)
+{
+    pid_t pid;
+
+    if ((pid = fork()) == 0) {
+        fork_close_except(keep, n);
+    }
+    return pid;
+}
+
 static void df_child(child_func func, void *ptr, fork_pipe *report, fork_io *io)
 {
     pid_t pid;
@@ -82,8 +205,13 @@ static void df_child(child_func func, void *ptr, fork_pipe *report, fork_io *io)
 
 static void df_inter(child_func func, void *ptr, fork_pipe *report, fork_io *io)
 {
+    static const int keep[] = {
+        STDIN_FILENO,
+        STDOUT_FILENO,
+        STDERR_FILENO,
+        REPORT_FILENO,
+    };
     fork_io null_io;
-    list_t *keep;
     pid_t pid;
 
     // If the caller did not provide pipes for stdin / stdout / stderr, point
@@ -121,12 +249,7 @@ static void df_inter(child_func func, void *ptr, fork_pipe *report, fork_io *io)
     df_fd_setup(report, io);
     // Fork, closing everything except stdin / stdout / stderr and the
     // reporting pipe.
-    keep = make_list();
-    list_append(keep, as_integer(STDIN_FILENO));
-    list_append(keep, as_integer(STDOUT_FILENO));
-    list_append(keep, as_integer(STDERR_FILENO));
-    list_append(keep, as_integer(REPORT_FILENO));
-    pid = unixkit_fork(keep);
+    pid = fork_keep(keep, sizeof(keep) / sizeof(keep[0]));
     if (pid < 0) {
         // there is no EXIT_FORK
         fatalx(EXIT_FAILURE, "failed to fork child process: %m");
@@ -137,13 +260,18 @@ static void df_inter(child_func func, void *ptr, fork_pipe *report, fork_io *io)
         df_child(func, ptr, NULL, NULL);
         abort();
     }
+    trace(NC_FORK,
+          "intermediate %u forked child %u",
+          (unsigned int)getpid(),
+          (unsigned int)pid);
     _exit(EXIT_SUCCESS);
 }
 
 static pid_t df_parent(child_func func, void *ptr, fork_io *io, bool daemonize)
 {
     fork_pipe report;
-    list_t *keep;
+    int keep[7];
+    size_t nkeep = 0;
     ssize_t res;
     pid_t pid;
     int ex;
@@ -153,17 +281,16 @@ static pid_t df_parent(child_func func, void *ptr, fork_io *io, bool daemonize)
     }
     // Fork, closing everything except stdin / stdout / stderr and the child end
     // of our I/O and reporting pipes.
-    keep = make_list();
-    list_append(keep, as_integer(STDIN_FILENO));
-    list_append(keep, as_integer(STDOUT_FILENO));
-    list_append(keep, as_integer(STDERR_FILENO));
+    keep[nkeep++] = STDIN_FILENO;
+    keep[nkeep++] = STDOUT_FILENO;
+    keep[nkeep++] = STDERR_FILENO;
     if (io != NULL) {
-        list_append(keep, as_integer(io->in.child));
-        list_append(keep, as_integer(io->out.child));
-        list_append(keep, as_integer(io->err.child));
+        keep[nkeep++] = io->in.child;
+        keep[nkeep++] = io->out.child;
+        keep[nkeep++] = io->err.child;
     }
-    list_append(keep, as_integer(report.child));
-    pid = unixkit_fork(keep);
+    keep[nkeep++] = report.child;
+    pid = fork_keep(keep, nkeep);
     if (pid < 0) {
         error("failed to fork intermediate process: %m");
         close(report.parent);
@@ -186,6 +313,10 @@ static pid_t df_parent(child_func func, void *ptr, fork_io *io, bool daemonize)
         abort();
     }
     // Parent.
+    trace(NC_FORK,
+          "forked %s process %u",
+          daemonize ? "intermediate" : "child",
+          (unsigned int)pid);
     close(report.child);
     if (daemonize) {
         (void)waitpid(pid, NULL, 0);
@@ -201,6 +332,7 @@ static pid_t df_parent(child_func func, void *ptr, fork_io *io, bool daemonize)
         close(report.parent);
         return -EXIT_FAILURE;
     }
+    trace(NC_FORK, "child %u reported in", (unsigned int)pid);
     // Wait for second report (only on failure)
     res = read(report.parent, &ex, sizeof(ex));
     close(report.parent);
@@ -209,6 +341,7 @@ static pid_t df_parent(child_func func, void *ptr, fork_io *io, bool daemonize)
         return -EXIT_FAILURE;
     }
     if (res == 0 || ex == 0) {
+        trace(NC_FORK, "child %u reported success", (unsigned int)pid);
         return pid;
     }
     // Try to collect the child, but not too hard.
@@ -237,6 +370,136 @@ pid_t fork_function(child_func func, void *ptr, fork_io *io)
     return df_parent(func, ptr, io, false);
 }
 
+// Everything a spawned child needs, prepared by the parent.
+struct spawn_args {
+    spawn_func func;
+    void *ptr;
+    fork_io *io;
+    fork_pipe report;
+    // the parent's signal mask, to restore in the child
+    sigset_t sigmask;
+    // upper bound on descriptor numbers, in case close_range() is missing
+    int maxfd;
+};
+
+// Sent over the reporting pipe by a spawned child which failed.
+struct spawn_report {
+    int ex;
+    int err;
+};
+
+// Marks every descriptor from lowfd up close-on-exec.  Async-signal-safe.
+static void spawn_cloexec_from(int lowfd, int maxfd)
+{
+#ifdef SYS_close_range
+    if (syscall(SYS_close_range, lowfd, ~0U, CLOSE_RANGE_CLOEXEC) == 0) {
+        return;
+    }
+#endif
+    for (int fd = lowfd; fd < maxfd; fd++) {
+        (void)fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+}
+
+// Runs in the spawned child.  Unless clone() failed and we fell back to
+// fork(), the child shares the parent's memory until it calls execve() or
+// exits, so this must only make async-signal-safe calls and must not modify
+// anything the parent relies on.
+static int spawn_child(void *arg)
+{
+    struct spawn_args *sa = arg;
+    struct sigaction dfl = { .sa_handler = SIG_DFL }, old;
+    struct spawn_report rep;
+    fork_pipe report = sa->report;
+
+    // The parent's signal handlers must not run on our stack.
+    for (int sig = 1; sig < NSIG; sig++) {
+        if (sigaction(sig, NULL, &old) == 0 && old.sa_handler != SIG_DFL
+            && old.sa_handler != SIG_IGN) {
+            (void)sigaction(sig, &dfl, NULL);
+        }
+    }
+    (void)sigprocmask(SIG_SETMASK, &sa->sigmask, NULL);
+    df_fd_setup(&report, sa->io);
+    spawn_cloexec_from(REPORT_FILENO + 1, sa->maxfd);
+    rep.ex = sa->func(sa->ptr);
+    rep.err = errno;
+    OK(write(REPORT_FILENO, &rep, sizeof(rep)));
+    _exit(rep.ex > 0 && rep.ex <= 255 ? rep.ex : EXIT_FAILURE);
+}
+
+// Spawns a child process which calls a function that is expected to end in a
+// call to execve().  This is cheaper than fork_function() because the child
+// shares the parent's memory instead of copying its page tables, and the parent
+// is suspended until the child has either called execve() or terminated.  The
+// function must therefore only make async-signal-safe calls and must not modify
+// the parent's data; on failure, it returns a systemd exit code with errno
+// set.  Descriptors other than stdin, stdout and stderr are not inherited by
+// the executed program.  Falls back to fork() if clone() is not permitted.
+// Returns the child's PID if successful, a negative value corresponding to a
+// systemd exit code otherwise, with errno set to the error reported by the
+// child.  The caller is responsible for collecting the child process.
+pid_t spawn_function(spawn_func func, void *ptr, fork_io *io)
+{
+    char stack[SPAWN_STACK_SIZE] __attribute__((aligned(16)));
+    struct spawn_args sa = { .func = func, .ptr = ptr, .io = io };
+    struct spawn_report rep;
+    sigset_t all;
+    ssize_t res;
+    pid_t pid;
+    int serrno;
+
+    if (!unixkit_pipe(sa.report.pipe)) {
+        return -EXIT_FAILURE;
+    }
+    if ((sa.maxfd = sysconf(_SC_OPEN_MAX)) < 0) {
+        sa.maxfd = 1024;
+    }
+    sigfillset(&all);
+    sigprocmask(SIG_SETMASK, &all, &sa.sigmask);
+    pid = clone(spawn_child,
+                stack + sizeof(stack),
+                CLONE_VM | CLONE_VFORK | SIGCHLD,
+                &sa);
+    if (pid < 0 && (errno == ENOSYS || errno == EINVAL || errno == EPERM)) {
+        trace(NC_FORK, "clone() failed, falling back to fork(): %m");
+        if ((pid = fork()) == 0) {
+            spawn_child(&sa);
+        }
+    }
+    serrno = errno;
+    sigprocmask(SIG_SETMASK, &sa.sigmask, NULL);
+    close(sa.report.child);
+    if (pid < 0) {
+        errno = serrno;
+        error("failed to spawn child process: %m");
+        close(sa.report.parent);
+        return -EXIT_FAILURE;
+    }
+    trace(NC_FORK, "spawned child %u", (unsigned int)pid);
+    // The reporting pipe is close-on-exec, so we get EOF on success.
+    res = read(sa.report.parent, &rep, sizeof(rep));
+    close(sa.report.parent);
+    if (res == 0) {
+        trace(NC_FORK, "child %u reported success", (unsigned int)pid);
+        return pid;
+    }
+    if (res != sizeof(rep)) {
+        if (res < 0) {
+            error("failed to read child report: %m");
+        } else {
+            error("short child report");
+        }
+        rep.ex = EXIT_FAILURE;
+        rep.err = EPROTO;
+    }
+    // The child exits right after reporting.
+    (void)waitpid(pid, NULL, 0);
+    verbose("child reported exit code %d", rep.ex);
+    errno = rep.err;
+    return rep.ex > 0 ? -rep.ex : -EXIT_FAILURE;
+}
+
 // Signal ancestor process that the service is ready by closing the report
 // socket.  To avoid the trouble that would ensue if the descriptor was
 // reused for some other purpose (e.g. syslog), we close it by replacing it
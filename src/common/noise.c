@@ -15,6 +15,9 @@
 // How noisy do we want to be?
 enum noise noisy;
 
+// Which trace categories are enabled, as a bit mask.
+unsigned int noise_trace;
+
 // Which file to print to; set to NULL for syslog.
 FILE *noisef;
 
@@ -30,9 +33,15 @@ static const char *prefix[] = {
     [LOG_WARNING] = "WARNING: ", [LOG_ERR] = "ERROR: ",
 };
 
-static int fs_vlog(int pri, const char *, va_list)
-    __attribute__((__format__(printf, 2, 0)));
-static int fs_vlog(int pri, const char *fmt, va_list ap)
+static const char *category_names[NC_MAX] = {
+    [NC_PROCWATCH] = "procwatch", [NC_CN_PROC] = "cn_proc",
+    [NC_CONTROL] = "control",     [NC_FORK] = "fork",
+    [NC_COMMAND] = "command",     [NC_NOTIFY] = "notify",
+};
+
+static int fs_vlog(int pri, const char *, const char *, va_list)
+    __attribute__((__format__(printf, 3, 0)));
+static int fs_vlog(int pri, const char *tag, const char *fmt, va_list ap)
 {
     char *p, *q;
     char *msg;
@@ -51,16 +60,24 @@ static int fs_vlog(int pri, const char *fmt, va_list ap)
         if (noisef != NULL) {
             now = clock_realtime_usec();
             fprintf(noisef,
-                    "%llu.%06llu [%u] %s%.*s\n%n",
+                    "%llu.%06llu [%u] %s%s%s%.*s\n%n",
                     now / 1000000,
                     now % 1000000,
                     (unsigned int)getpid(),
                     prefix[pri],
+                    tag ? tag : "",
+                    tag ? ": " : "",
                     (int)(q - p),
                     p,
                     &n);
         } else {
-            syslog(pri, "%.*s%n", (int)(q - p), p, &n);
+            syslog(pri,
+                   "%s%s%.*s%n",
+                   tag ? tag : "",
+                   tag ? ": " : "",
+                   (int)(q - p),
+                   p,
+                   &n);
         }
     }
     fsfree(msg);
@@ -80,7 +97,21 @@ int fs_debug(const char *fmt, ...)
         return 0;
     }
     va_start(ap, fmt);
-    res = fs_vlog(LOG_DEBUG, fmt, ap);
+    res = fs_vlog(LOG_DEBUG, NULL, fmt, ap);
+    va_end(ap);
+    return res;
+}
+
+int fs_trace(enum noise_category cat, const char *fmt, ...)
+{
+    va_list ap;
+    int res;
+
+    if (cat >= NC_MAX || !(noise_trace & (1U << cat))) {
+        return 0;
+    }
+    va_start(ap, fmt);
+    res = fs_vlog(LOG_DEBUG, category_names[cat], fmt, ap);
     va_end(ap);
     return res;
 }
@@ -94,7 +125,7 @@ int fs_verbose(const char *fmt, ...)
         return 0;
     }
     va_start(ap, fmt);
-    res = fs_vlog(LOG_INFO, fmt, ap);
+    res = fs_vlog(LOG_INFO, NULL, fmt, ap);
     va_end(ap);
     return res;
 }
@@ -108,7 +139,7 @@ int fs_info(const char *fmt, ...)
         return 0;
     }
     va_start(ap, fmt);
-    res = fs_vlog(LOG_NOTICE, fmt, ap);
+    res = fs_vlog(LOG_NOTICE, NULL, fmt, ap);
     va_end(ap);
     return res;
 }
@@ -122,7 +153,7 @@ int fs_warning(const char *fmt, ...)
         return 0;
     }
     va_start(ap, fmt);
-    res = fs_vlog(LOG_WARNING, fmt, ap);
+    res = fs_vlog(LOG_WARNING, NULL, fmt, ap);
     va_end(ap);
     return res;
 }
@@ -133,7 +164,7 @@ int fs_error(const char *fmt, ...)
     int res;
 
     va_start(ap, fmt);
-    res = fs_vlog(LOG_ERR, fmt, ap);
+    res = fs_vlog(LOG_ERR, NULL, fmt, ap);
     va_end(ap);
     return res;
 }
@@ -143,7 +174,7 @@ void fs_fatal(const char *fmt, ...)
     va_list ap;
 
     va_start(ap, fmt);
-    (void)fs_vlog(LOG_ERR, fmt, ap);
+    (void)fs_vlog(LOG_ERR, NULL, fmt, ap);
     va_end(ap);
     _exit(EXIT_FAILURE);
 }
@@ -153,7 +184,7 @@ void fs_fatalx(int code, const char *fmt, ...)
     va_list ap;
 
     va_start(ap, fmt);
-    (void)fs_vlog(LOG_ERR, fmt, ap);
+    (void)fs_vlog(LOG_ERR, NULL, fmt, ap);
     va_end(ap);
     _exit(code);
 }
@@ -161,15 +192,16 @@ void fs_fatalx(int code, const char *fmt, ...)
 // Sets the noise level as specified by the argument: 's'ilent, 'q'uiet,
 // 'v'erbose, 'd'ebug.  If called multiple times, only the last call applies,
 // with one exception: multiple calls with 'd' will increase the noise level
-// beyond DEBUG, which may result in an unmanageable amount of detail.  Returns
-// zero if the argument was valid; otherwise, returns a negative value and sets
-// errno to EINVAL.
+// beyond DEBUG and enable all trace categories, which may result in an
+// unmanageable amount of detail.  Returns zero if the argument was valid;
+// otherwise, returns a negative value and sets errno to EINVAL.
 int noise_set_level(char ch)
 {
     switch (tolower(ch)) {
         case 'd':
             if (noisy >= DEBUG) {
                 noisy++;
+                noise_trace = NOISE_TRACE_ALL;
             } else {
                 noisy = DEBUG;
             }
@@ -190,18 +222,105 @@ int noise_set_level(char ch)
     return 0;
 }
 
-// Processes a noise override string, which is either one of the words “silent”,
-// “quiet”, “normal”, “verbose”, or “debug”, or a sequence of characters each of
-// which is a valid argument to noise_set_level().  If the argument is NULL,
+// Returns the name of the specified trace category, or NULL if it is not a
+// valid category.
+const char *noise_category_name(enum noise_category cat)
+{
+    if (cat >= NC_MAX) {
+        return NULL;
+    }
+    return category_names[cat];
+}
+
+// Looks up a single trace category name, or one of the words “all” or “none”,
+// and updates the specified bit mask accordingly.  Returns zero if the name
+// was recognized and a negative value otherwise.
+static int noise_trace_word(const char *word, size_t len, unsigned int *mask)
+{
+    unsigned int cat;
+
+    if (len == 3 && strncasecmp(word, "all", len) == 0) {
+        *mask = NOISE_TRACE_ALL;
+        return 0;
+    }
+    if (len == 4 && strncasecmp(word, "none", len) == 0) {
+        *mask = 0;
+        return 0;
+    }
+    for (cat = 0; cat < NC_MAX; cat++) {
+        if (strlen(category_names[cat]) == len
+            && strncasecmp(word, category_names[cat], len) == 0) {
+            *mask |= 1U << cat;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Parses a comma-separated list of trace category names into the specified
+// bit mask, which is not cleared first, so that “none” must be used to reset
+// it.  Returns zero on success; otherwise, returns a negative value, sets
+// errno to EINVAL, and leaves the bit mask unchanged.
+int noise_trace_parse(const char *str, unsigned int *mask)
+{
+    unsigned int smask;
+    size_t len;
+
+    smask = *mask;
+    for (; *str != '\0'; str += len + (str[len] == ',')) {
+        len = strcspn(str, ",");
+        if (len > 0 && noise_trace_word(str, len, &smask) != 0) {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+    *mask = smask;
+    return 0;
+}
+
+// Processes a single word of a noise override string.  Returns zero if the
+// word is valid and a negative value otherwise.
+static int noise_override_word(const char *word, size_t len)
+{
+    if (noise_trace_word(word, len, &noise_trace) == 0) {
+        return 0;
+    }
+    if (len == 5 && strncasecmp(word, "debug", len) == 0) {
+        noisy = DEBUG;
+    } else if (len == 7 && strncasecmp(word, "verbose", len) == 0) {
+        noisy = VERBOSE;
+    } else if (len == 6 && strncasecmp(word, "normal", len) == 0) {
+        noisy = NORMAL;
+    } else if (len == 5 && strncasecmp(word, "quiet", len) == 0) {
+        noisy = QUIET;
+    } else if (len == 6 && strncasecmp(word, "silent", len) == 0) {
+        noisy = SILENT;
+    } else {
+        for (; len > 0; word++, len--) {
+            if (noise_set_level(*word) != 0) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Processes a noise override string, which is a comma-separated list of
+// words.  Each word is either one of the words “silent”, “quiet”, “normal”,
+// “verbose”, or “debug”, a sequence of characters each of which is a valid
+// argument to noise_set_level(), or the name of a trace category (or “all”
+// or “none”) as accepted by noise_trace_parse().  If the argument is NULL,
 // uses the value of the SYSVKIT_NOISE environment variable instead.  Returns
 // zero if the argument is valid or empty, or the argument is NULL but the value
 // of the SYSVKIT_NOISE environment variable is valid or empty, or the argument
 // is NULL and the SYSVKIT_NOISE environment variable is unset; otherwise,
 // returns a negative value, sets errno to EINVAL, and leaves the noise level
-// unchanged.
+// and trace categories unchanged.
 int noise_override(const char *str)
 {
     enum noise snoisy;
+    unsigned int strace;
+    size_t len;
 
     if (str == NULL) {
         str = getenv(NOISE_ENVVAR);
@@ -210,24 +329,14 @@ int noise_override(const char *str)
         }
     }
     snoisy = noisy;
-    if (strcasecmp(str, "debug") == 0) {
-        noisy = DEBUG;
-    } else if (strcasecmp(str, "verbose") == 0) {
-        noisy = VERBOSE;
-    } else if (strcasecmp(str, "normal") == 0) {
-        noisy = NORMAL;
-    } else if (strcasecmp(str, "quiet") == 0) {
-        noisy = QUIET;
-    } else if (strcasecmp(str, "silent") == 0) {
-        noisy = SILENT;
-    } else {
-        while (*str != '\0') {
-            if (noise_set_level(*str) != 0) {
-                noisy = snoisy;
-                errno = EINVAL;
-                return -1;
-            }
-            str++;
+    strace = noise_trace;
+    for (; *str != '\0'; str += len + (str[len] == ',')) {
+        len = strcspn(str, ",");
+        if (len > 0 && noise_override_word(str, len) != 0) {
+            noisy = snoisy;
+            noise_trace = strace;
+            errno = EINVAL;
+            return -1;
         }
     }
     return 0;
@@ -10,12 +10,14 @@
 
 #include <errno.h>
 #include <signal.h>
+#include <string.h>
 #include <unistd.h>
 
 static hash_table_t *processes;
 static list_t *ready;
 
 static struct process *proc_init, *proc_self;
+static struct procwatch_stats stats;
 
 // Frees the memory used by a process.
 void process_destroy(struct process *proc)
@@ -308,13 +310,14 @@ static void process_dump(void)
         byte_array_appendf(ba, " %u(%u)", proc->pid, proc->ppid);
         e = hash_table_get_other(e);
     }
-    debug("%s", (const char *)byte_array_data(ba));
+    trace(NC_PROCWATCH, "%s", (const char *)byte_array_data(ba));
     destroy_byte_array(ba);
 }
 
 bool procwatch_reconnect(void)
 {
     cn_proc_disconnect();
+    stats.connects++;
     if (cn_proc_connect()) {
         if (cn_proc_listen(true, 1000)) {
             return true;
@@ -330,6 +333,7 @@ bool procwatch_start(void)
     if (processes != NULL) {
         fatal("procwatch_start() called twice");
     }
+    memset(&stats, 0, sizeof(stats));
     processes_init();
     if (!procwatch_reconnect()) {
         processes_fini();
@@ -357,10 +361,15 @@ void procwatch_set_callback(procwatch_callback function, void *data)
 static procwatch_action callback(procwatch_event event,
                                  const struct process *proc)
 {
+    procwatch_action action = PROCWATCH_ACTION_DEFAULT;
+
     if (callback_function != NULL) {
-        return callback_function(event, proc, callback_data);
+        action = callback_function(event, proc, callback_data);
+    }
+    if (action == PROCWATCH_ACTION_DROP) {
+        stats.drops++;
     }
-    return PROCWATCH_ACTION_DEFAULT;
+    return action;
 }
 
 // Receives and processes a single process event.  The timeout is in
@@ -373,18 +382,22 @@ bool procwatch_ingest(int timeout)
     if (!cn_proc_receive_event(&ev, timeout)) {
         return false;
     }
+    stats.events++;
     if (ev.what == PROC_EVENT_NONE) {
         // This means another process either started or stopped listening.
         // Either way, the ack to their control message will also be broadcast
         // to existing listeners.
-        debug2("ack %u", ev.ack.err);
+        trace(NC_PROCWATCH, "ack %u", ev.ack.err);
         return true;
     }
     if (process_get(ev.actor.tgid) == NULL) {
-        debug2("ignoring event for process %u", ev.actor.tgid);
+        trace(NC_PROCWATCH,
+              "ignoring event for process %u",
+              ev.actor.tgid);
+        stats.ignored++;
         return true;
     }
-    if (noisy > DEBUG) {
+    if (trace_enabled(NC_PROCWATCH)) {
         process_dump();
     }
     switch (ev.what) {
@@ -394,19 +407,37 @@ bool procwatch_ingest(int timeout)
                 break;
             }
             if (ev.fork.parent.tgid == 1) {
-                debug2("ignoring process %u forked by init",
-                       ev.fork.child.tgid);
+                trace(NC_PROCWATCH,
+                      "ignoring process %u forked by init",
+                      ev.fork.child.tgid);
                 break;
             }
-            debug2("proc %u fork %u", ev.fork.parent.tgid, ev.fork.child.tgid);
-            process_insert(ev.fork.child.tgid,
-                           ev.fork.parent.tgid,
-                           0 /* sid unknown, will copy from parent */);
+            trace(NC_PROCWATCH,
+                  "proc %u fork %u",
+                  ev.fork.parent.tgid,
+                  ev.fork.child.tgid);
+            proc = process_insert(ev.fork.child.tgid,
+                                  ev.fork.parent.tgid,
+                                  0 /* sid unknown, will copy from parent */);
+            if (proc != NULL) {
+                stats.forks++;
+                switch (callback(PROCWATCH_EVENT_FORK, proc)) {
+                    case PROCWATCH_ACTION_DEFAULT:
+                        break;
+                    case PROCWATCH_ACTION_DROP:
+                        process_drop(proc->pid);
+                        break;
+                    default:
+                        /* error? */
+                        break;
+                }
+            }
             break;
         case PROC_EVENT_EXEC:
-            debug2("proc %u exec", ev.exec.process.tgid);
+            trace(NC_PROCWATCH, "proc %u exec", ev.exec.process.tgid);
             proc = process_get(ev.exec.process.tgid);
             if (proc != NULL) {
+                stats.execs++;
                 switch (callback(PROCWATCH_EVENT_EXEC, proc)) {
                     case PROCWATCH_ACTION_DEFAULT:
                         break;
@@ -420,23 +451,29 @@ bool procwatch_ingest(int timeout)
             }
             break;
         case PROC_EVENT_UID:
-            debug2("proc %u euid %u ruid %u",
-                   ev.id.process.tgid,
-                   ev.id.e.uid,
-                   ev.id.r.uid);
+            trace(NC_PROCWATCH,
+                  "proc %u euid %u ruid %u",
+                  ev.id.process.tgid,
+                  ev.id.e.uid,
+                  ev.id.r.uid);
             // We don't currently track credentials.
             break;
         case PROC_EVENT_GID:
-            debug2("proc %u egid %u rgid %u",
-                   ev.id.process.tgid,
-                   ev.id.e.gid,
-                   ev.id.r.gid);
+            trace(NC_PROCWATCH,
+                  "proc %u egid %u rgid %u",
+                  ev.id.process.tgid,
+                  ev.id.e.gid,
+                  ev.id.r.gid);
             // We don't currently track credentials.
             break;
         case PROC_EVENT_SID:
             // undocumented, but safe to assume sid == tgid
-            debug2("proc %u sid %u", ev.sid.process.tgid, ev.sid.process.tgid);
+            trace(NC_PROCWATCH,
+                  "proc %u sid %u",
+                  ev.sid.process.tgid,
+                  ev.sid.process.tgid);
             proc = process_insert(ev.sid.process.tgid, 0, ev.sid.process.tgid);
+            stats.setsids++;
             switch (callback(PROCWATCH_EVENT_SETSID, proc)) {
                 case PROCWATCH_ACTION_DEFAULT:
                     break;
@@ -449,11 +486,16 @@ bool procwatch_ingest(int timeout)
             }
             break;
         case PROC_EVENT_COMM:
-            debug2("proc %u name %s", ev.comm.process.tgid, ev.comm.comm);
+            trace(NC_PROCWATCH,
+                  "proc %u name %s",
+                  ev.comm.process.tgid,
+                  ev.comm.comm);
             // We don't currently track process names.
             break;
         case PROC_EVENT_COREDUMP:
-            debug2("proc %u core dumped", ev.coredump.process.tgid);
+            trace(NC_PROCWATCH,
+                  "proc %u core dumped",
+                  ev.coredump.process.tgid);
             // Purely informational; an exit event will follow.
             break;
         case PROC_EVENT_EXIT:
@@ -462,15 +504,19 @@ bool procwatch_ingest(int timeout)
                 break;
             }
             if (WIFSIGNALED(ev.exit.code)) {
-                debug2("proc %u signal %u",
-                       ev.exit.process.tgid,
-                       WTERMSIG(ev.exit.code));
+                trace(NC_PROCWATCH,
+                      "proc %u signal %u",
+                      ev.exit.process.tgid,
+                      WTERMSIG(ev.exit.code));
             } else {
-                debug2("proc %u exit %u",
-                       ev.exit.process.tgid,
-                       WEXITSTATUS(ev.exit.code));
+                trace(NC_PROCWATCH,
+                      "proc %u exit %u",
+                      ev.exit.process.tgid,
+                      WEXITSTATUS(ev.exit.code));
+            }
+            if (process_exit(ev.exit.process.tgid, ev.exit.code)) {
+                stats.exits++;
             }
-            process_exit(ev.exit.process.tgid, ev.exit.code);
             break;
         default:
             debug("unhandled process event 0x%08x", ev.what);
@@ -485,6 +531,12 @@ void procwatch_drain(void)
     processes_init();
 }
 
+// Copies the event counters.
+void procwatch_get_stats(struct procwatch_stats *st)
+{
+    *st = stats;
+}
+
 // Returns a file descriptor that can be used to poll for events.  If not
 // connected, returns -1 and sets errno to EBADF.
 int procwatch_fd(void)
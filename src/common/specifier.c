@@ -0,0 +1,199 @@
+#include "specifier.h"
+
+#include <fsdyn/charstr.h>
+#include <fsdyn/fsalloc.h>
+#include <fsdyn/hashtable.h>
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+
+// Systemd specifiers are a percent sign followed by a single letter, which
+// are replaced with information about the unit or the system, e.g. %n is the
+// name of the unit and %h is the home directory of the user it runs as.  A
+// double percent sign stands for a single one.
+//
+// A value is compiled once into a template: a sequence of parts, each of
+// which is either a literal span of the value or a specifier slot, so that
+// expanding it, for each command and each instance of a template unit, is a
+// matter of looking up the slots and copying.
+
+struct specifier_part {
+    // literal span, or NULL for a specifier slot
+    const char *str;
+    size_t len;
+    char spec;
+};
+
+struct specifier_template {
+    size_t nparts;
+    // total length of the literal spans
+    size_t len;
+    struct specifier_part parts[];
+};
+
+// Compiles a value into a template.  Returns NULL with errno set to EINVAL if
+// the value contains a percent sign which is not followed by a letter or
+// another percent sign.
+struct specifier_template *specifier_compile(const char *value)
+{
+    struct specifier_template *tpl;
+    struct specifier_part *part;
+    const char *p, *q;
+    size_t n = 0, vlen;
+    char *copy;
+
+    // Each specifier adds at most two parts: itself and the literal after.
+    for (p = value; (p = strchr(p, '%')) != NULL; p += 2) {
+        if (p[1] != '%' && !isalpha((unsigned char)p[1])) {
+            errno = EINVAL;
+            return NULL;
+        }
+        n += 2;
+    }
+    vlen = strlen(value);
+    tpl = fsalloc(sizeof(*tpl) + (n + 1) * sizeof(*part) + vlen + 1);
+    copy = (char *)&tpl->parts[n + 1];
+    memcpy(copy, value, vlen + 1);
+    tpl->nparts = 0;
+    tpl->len = 0;
+    for (p = copy; *p != '\0'; p = q) {
+        part = &tpl->parts[tpl->nparts];
+        if (*p == '%' && p[1] != '%') {
+            *part = (struct specifier_part){ NULL, 0, p[1] };
+            tpl->nparts++;
+            q = p + 2;
+            continue;
+        }
+        // A literal span, which a double percent sign ends after its first
+        // character.
+        if (*p == '%') {
+            q = p + 2;
+            *part = (struct specifier_part){ p, 1, 0 };
+        } else {
+            for (q = p; *q != '\0' && *q != '%'; q++) {
+                // nothing
+            }
+            *part = (struct specifier_part){ p, q - p, 0 };
+        }
+        // Merge adjacent literal spans
+        if (tpl->nparts > 0 && part[-1].str != NULL
+            && part[-1].str + part[-1].len == part->str) {
+            part[-1].len += part->len;
+        } else {
+            tpl->nparts++;
+        }
+        tpl->len += part->len;
+    }
+    return tpl;
+}
+
+// Templates compiled by specifier_intern(), indexed by the value they were
+// compiled from.  They are kept for the lifetime of the process.
+static hash_table_t *specifier_templates;
+
+// Returns the template for a value, compiling it on first use.  Returns NULL
+// with errno set to EINVAL if the value is malformed.
+const struct specifier_template *specifier_intern(const char *value)
+{
+    struct specifier_template *tpl;
+    hash_elem_t *he;
+
+    if (specifier_templates == NULL) {
+        specifier_templates =
+            make_hash_table(64, (void *)hash_string, (void *)strcmp);
+    }
+    if ((he = hash_table_get(specifier_templates, value)) != NULL) {
+        return hash_elem_get_value(he);
+    }
+    if ((tpl = specifier_compile(value)) == NULL) {
+        return NULL;
+    }
+    hash_table_put(specifier_templates, charstr_dupstr(value), tpl);
+    return tpl;
+}
+
+// Expands a template, looking up the value of each specifier slot using the
+// provided function.  Returns NULL with errno set to EINVAL if a specifier
+// cannot be resolved.
+char *specifier_expand(const struct specifier_template *tpl,
+                       specifier_func lookup,
+                       void *ctx)
+{
+    const struct specifier_part *part;
+    const char *value;
+    size_t len = tpl->len;
+    char *str, *p;
+
+    for (size_t i = 0; i < tpl->nparts; i++) {
+        part = &tpl->parts[i];
+        if (part->str == NULL) {
+            if ((value = lookup(ctx, part->spec)) == NULL) {
+                errno = EINVAL;
+                return NULL;
+            }
+            len += strlen(value);
+        }
+    }
+    p = str = fsalloc(len + 1);
+    for (size_t i = 0; i < tpl->nparts; i++) {
+        part = &tpl->parts[i];
+        if (part->str != NULL) {
+            memcpy(p, part->str, part->len);
+            p += part->len;
+        } else {
+            value = lookup(ctx, part->spec);
+            len = strlen(value);
+            memcpy(p, value, len);
+            p += len;
+        }
+    }
+    *p = '\0';
+    return str;
+}
+
+static inline int hexval(int ch)
+{
+    if (ch >= '0' && ch <= '9') {
+        return ch - '0';
+    }
+    if (ch >= 'a' && ch <= 'f') {
+        return ch - 'a' + 10;
+    }
+    if (ch >= 'A' && ch <= 'F') {
+        return ch - 'A' + 10;
+    }
+    return -1;
+}
+
+// Reverses systemd's escaping of unit names, where a dash stands for a slash
+// and a \xNN sequence for the byte with that hexadecimal value.
+char *specifier_unescape(const char *str, size_t len)
+{
+    const char *end = str + len;
+    char *buf, *p;
+    int hi, lo;
+
+    p = buf = fsalloc(len + 1);
+    while (str < end) {
+        if (*str == '-') {
+            *p++ = '/';
+            str++;
+        } else if (*str == '\\' && end - str >= 4 && str[1] == 'x'
+                   && (hi = hexval(str[2])) >= 0
+                   && (lo = hexval(str[3])) >= 0) {
+            *p++ = hi << 4 | lo;
+            str += 4;
+        } else {
+            *p++ = *str++;
+        }
+    }
+    *p = '\0';
+    return buf;
+}
+
+void specifier_free(struct specifier_template *tpl)
+{
+    fsfree(tpl);
+}
@@ -1,5 +1,7 @@
 #include "text.h"
 
+#include "common.h"
+
 #include <fsdyn/fsalloc.h>
 
 #include <errno.h>
@@ -8,6 +10,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
@@ -22,9 +25,11 @@ struct text *text_create(const char *buf, size_t len)
     struct text *txt;
 
     txt = fsalloc(sizeof(*txt));
+    txt->parent = NULL;
     txt->beg = buf;
     txt->end = buf + len;
     txt->len = len;
+    txt->maplen = 0;
     return txt;
 }
 
@@ -48,9 +53,42 @@ struct text *text_from_file(const char *path)
         return NULL;
     }
     buf[rsize] = '\0';
+    txt->parent = NULL;
     txt->beg = buf;
     txt->end = txt->beg + rsize;
     txt->len = rsize;
+    txt->maplen = 0;
+    return txt;
+}
+
+// Maps a file into memory instead of reading it.  Unlike the one returned by
+// text_from_file(), the text is not null-terminated.  Files which cannot be
+// mapped, such as empty files, are read instead.
+struct text *text_map_file(const char *path)
+{
+    struct stat sb;
+    struct text *txt;
+    void *map;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &sb) != 0 || !S_ISREG(sb.st_mode) || sb.st_size == 0) {
+        close(fd);
+        return text_from_file(path);
+    }
+    map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return text_from_file(path);
+    }
+    txt = fsalloc(sizeof(*txt));
+    txt->parent = NULL;
+    txt->beg = map;
+    txt->end = txt->beg + sb.st_size;
+    txt->len = sb.st_size;
+    txt->maplen = sb.st_size;
     return txt;
 }
 
@@ -81,6 +119,8 @@ struct text *text_line_from_stream(FILE *s)
         fsfree(txt);
         return NULL;
     }
+    txt->parent = NULL;
+    txt->maplen = 0;
     txt->beg = buf;
     txt->end = txt->beg + txt->len;
     return txt;
@@ -98,6 +138,7 @@ struct text *text_narrow(const struct text *parent, const char *beg, size_t len)
     }
     txt = fsalloc(sizeof(*txt));
     txt->parent = parent;
+    txt->maplen = 0;
     txt->beg = beg;
     txt->end = beg + len;
     txt->len = len;
@@ -114,6 +155,7 @@ struct text *text_first_line(const struct text *txt)
 
     line = fsalloc(sizeof(*line));
     line->parent = txt;
+    line->maplen = 0;
     for (line->beg = line->end = txt->beg;
          line->end < txt->end && *line->end != '\0' && *line->end != '\n';
          line->end++) {
@@ -158,6 +200,7 @@ struct text *text_first_word(const struct text *txt)
 
     word = fsalloc(sizeof(*word));
     word->parent = txt;
+    word->maplen = 0;
     for (word->beg = txt->beg;
          word->beg < txt->end && *word->beg != '\0' && isspace(*word->beg);
          word->beg++) {
@@ -356,5 +399,8 @@ struct text *text_next_line_equals(struct text *line,
 
 void text_free(struct text *txt)
 {
+    if (txt != NULL && txt->maplen > 0) {
+        munmap(DQ(txt->beg), txt->maplen);
+    }
     fsfree(txt);
 }
@@ -1,75 +1,297 @@
+#define _GNU_SOURCE
+
 #include "unit.h"
 
-#include "common.h"
-#include "pair.h"
+#include "arena.h"
 #include "strbool.h"
 
 #include <fsdyn/bytearray.h>
 #include <fsdyn/charstr.h>
-#include <fsdyn/hashtable.h>
 
 #include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
 #include <string.h>
 
-struct section {
-    char *name;
-    struct unit *parent;
-    hash_table_t *pairs;
+// A unit lives entirely in an arena, which is freed in one go.  Sections and
+// keys are kept in small vectors in the order in which they were first set,
+// since a unit rarely has more than a handful of sections or more than a few
+// dozen keys per section, and a linear scan over those beats hashing.  The
+// names of well-known sections and keys are interned, so they are not copied
+// and can usually be matched by comparing pointers.  Values which are
+// appended to are kept as a rope of pieces and only joined on lookup.
+
+struct unit_piece {
+    struct unit_piece *next;
+    size_t len;
+    char str[];
+};
+
+struct unit_key {
+    const char *name;
+    // the value, if it has been joined, otherwise its first piece
+    const char *value;
+    // pieces appended since the value was last joined, and the length of
+    // the joined value; the key itself moves when the vector it is in grows
+    // or shrinks, so it must not be pointed into
+    struct unit_piece *head, *last;
+    size_t len;
+};
+
+struct unit_section {
+    const char *name;
+    struct unit_key *keys;
+    size_t nkeys, size;
 };
 
-struct section *section_create(struct unit *u, const char *name)
+struct unit {
+    struct arena *arena;
+    const char *name;
+    struct unit_section *sections;
+    size_t nsections, size;
+};
+
+#define UNIT_ARENA_CHUNK 4096
+#define UNIT_VECTOR_MIN 8
+
+// Section and key names used by the services we run and the units we read,
+// in strcmp() order.
+static const char *const unit_known_names[] = {
+    "After",
+    "Alias",
+    "Before",
+    "Conflicts",
+    "Description",
+    "Documentation",
+    "Environment",
+    "EnvironmentFile",
+    "ExecReload",
+    "ExecStart",
+    "ExecStartPost",
+    "ExecStartPre",
+    "ExecStop",
+    "ExecStopPost",
+    "Group",
+    "Install",
+    "KillMode",
+    "KillSignal",
+    "NotifyAccess",
+    "PIDFile",
+    "PassEnvironment",
+    "RemainAfterExit",
+    "RequiredBy",
+    "Requires",
+    "Restart",
+    "RestartMaxDelaySec",
+    "RestartSec",
+    "RestartSteps",
+    "RootDirectory",
+    "Service",
+    "StartLimitBurst",
+    "StartLimitInterval",
+    "StartLimitIntervalSec",
+    "SupplementaryGroups",
+    "TimeoutSec",
+    "TimeoutStartSec",
+    "TimeoutStopSec",
+    "Type",
+    "UMask",
+    "Unit",
+    "UnsetEnvironment",
+    "User",
+    "WantedBy",
+    "Wants",
+    "WatchdogSec",
+    "WorkingDirectory",
+};
+
+// Keys which take a list, in strcmp() order.  Assigning to one of these
+// appends to it, while assigning to any other key replaces its value.
+static const char *const unit_list_names[] = {
+    "After",
+    "Alias",
+    "Before",
+    "Conflicts",
+    "Documentation",
+    "Environment",
+    "EnvironmentFile",
+    "ExecReload",
+    "ExecStart",
+    "ExecStartPost",
+    "ExecStartPre",
+    "ExecStop",
+    "ExecStopPost",
+    "PassEnvironment",
+    "RequiredBy",
+    "Requires",
+    "SupplementaryGroups",
+    "UnsetEnvironment",
+    "WantedBy",
+    "Wants",
+};
+
+static int unit_name_cmp(const void *a, const void *b)
 {
-    struct section *s;
+    return strcmp(a, *(const char *const *)b);
+}
 
-    s = fsalloc(sizeof(*s));
-    s->name = charstr_dupstr(name);
-    s->parent = u;
-    s->pairs = make_hash_table(256, (void *)hash_string, (void *)strcmp);
-    return s;
+static bool unit_is_list(const char *name)
+{
+    return bsearch(name,
+                   unit_list_names,
+                   sizeof(unit_list_names) / sizeof(*unit_list_names),
+                   sizeof(*unit_list_names),
+                   unit_name_cmp)
+        != NULL;
+}
+
+// Returns the interned copy of a well-known name, or NULL.
+static const char *unit_known_name(const char *name)
+{
+    const char *const *p;
+
+    p = bsearch(name,
+                unit_known_names,
+                sizeof(unit_known_names) / sizeof(*unit_known_names),
+                sizeof(*unit_known_names),
+                unit_name_cmp);
+    return p != NULL ? *p : NULL;
 }
 
-void section_free(struct section *s)
+// Returns a copy of a name which lives as long as the unit.
+static const char *unit_intern(struct unit *u, const char *name)
 {
-    hash_elem_t *e;
+    const char *known;
 
-    if (s != NULL) {
-        while ((e = hash_table_pop_any(s->pairs)) != NULL) {
-            pair_free(DQ(hash_elem_get_value(e)));
-            destroy_hash_element(e);
+    if ((known = unit_known_name(name)) != NULL) {
+        return known;
+    }
+    return arena_strdup(u->arena, name);
+}
+
+static inline bool unit_name_eq(const char *a, const char *b)
+{
+    return a == b || strcmp(a, b) == 0;
+}
+
+// Grows a vector allocated from the arena.  The old vector is abandoned, but
+// since the size doubles each time, at most half the memory is wasted.
+static void *unit_grow(struct unit *u, void *vec, size_t *size, size_t elem)
+{
+    size_t nsize = *size > 0 ? *size * 2 : UNIT_VECTOR_MIN;
+    void *nvec;
+
+    nvec = arena_alloc(u->arena, nsize * elem);
+    if (*size > 0) {
+        memcpy(nvec, vec, *size * elem);
+    }
+    *size = nsize;
+    return nvec;
+}
+
+static struct unit_section *unit_find_section(const struct unit *u,
+                                              const char *name)
+{
+    for (size_t i = 0; i < u->nsections; i++) {
+        if (unit_name_eq(u->sections[i].name, name)) {
+            return &u->sections[i];
         }
-        destroy_hash_table(s->pairs);
-        fsfree(s->name);
-        fsfree(s);
     }
+    return NULL;
 }
 
-struct unit {
-    char *name;
-    hash_table_t *sections;
-};
+static struct unit_section *unit_add_section(struct unit *u, const char *name)
+{
+    struct unit_section *s;
+
+    if (u->nsections == u->size) {
+        u->sections = unit_grow(u, u->sections, &u->size, sizeof(*s));
+    }
+    s = &u->sections[u->nsections++];
+    s->name = unit_intern(u, name);
+    s->keys = NULL;
+    s->nkeys = s->size = 0;
+    return s;
+}
+
+static struct unit_key *unit_find_key(const struct unit_section *s,
+                                      const char *name)
+{
+    for (size_t i = 0; i < s->nkeys; i++) {
+        if (unit_name_eq(s->keys[i].name, name)) {
+            return &s->keys[i];
+        }
+    }
+    return NULL;
+}
+
+static void unit_key_set(struct unit *u, struct unit_key *k, const char *value)
+{
+    k->len = strlen(value);
+    k->value = arena_strndup(u->arena, value, k->len);
+    k->head = k->last = NULL;
+}
+
+// Appends a piece to a value, to be joined when the value is looked up.
+static void unit_key_append(struct unit *u,
+                            struct unit_key *k,
+                            const char *value)
+{
+    struct unit_piece *piece;
+    size_t len = strlen(value);
+
+    piece = arena_alloc(u->arena, sizeof(*piece) + len + 1);
+    piece->next = NULL;
+    piece->len = len;
+    memcpy(piece->str, value, len + 1);
+    if (k->last != NULL) {
+        k->last->next = piece;
+    } else {
+        k->head = piece;
+    }
+    k->last = piece;
+    k->len += 1 + len;
+}
+
+// Joins the pieces of a value, separated by single spaces.
+static const char *unit_key_value(struct unit *u, struct unit_key *k)
+{
+    const struct unit_piece *piece;
+    char *buf, *p;
+
+    if (k->head == NULL) {
+        return k->value;
+    }
+    p = buf = arena_alloc(u->arena, k->len + 1);
+    p = mempcpy(p, k->value, strlen(k->value));
+    for (piece = k->head; piece != NULL; piece = piece->next) {
+        *p++ = ' ';
+        p = mempcpy(p, piece->str, piece->len);
+    }
+    *p = '\0';
+    k->value = buf;
+    k->head = k->last = NULL;
+    return buf;
+}
 
 struct unit *unit_create(const char *name)
 {
+    struct arena *arena;
     struct unit *u;
 
-    u = fsalloc(sizeof(*u));
-    u->name = charstr_dupstr(name);
-    u->sections = make_hash_table(16, (void *)hash_string, (void *)strcmp);
+    arena = arena_create(UNIT_ARENA_CHUNK);
+    u = arena_alloc(arena, sizeof(*u));
+    u->arena = arena;
+    u->name = arena_strdup(arena, name);
+    u->sections = NULL;
+    u->nsections = u->size = 0;
     return u;
 }
 
 void unit_free(struct unit *u)
 {
-    hash_elem_t *e;
-
     if (u != NULL) {
-        while ((e = hash_table_pop_any(u->sections)) != NULL) {
-            section_free(DQ(hash_elem_get_value(e)));
-            destroy_hash_element(e);
-        }
-        destroy_hash_table(u->sections);
-        fsfree(u->name);
-        fsfree(u);
+        arena_free(u->arena);
     }
 }
 
@@ -84,38 +306,32 @@ int unit_update_value(struct unit *u,
                       const char *value,
                       bool append)
 {
-    hash_elem_t *e;
-    struct section *s;
-    struct pair *o = NULL, *p = NULL;
-    char *buf;
+    struct unit_section *s;
+    struct unit_key *k;
 
-    if ((e = hash_table_get(u->sections, section)) == NULL) {
-        // Section does not yet exist
-        s = section_create(u, section);
-        // always successful since the section does not yet exist
-        (void)hash_table_put(u->sections, s->name, s);
-    } else {
-        s = DQ(hash_elem_get_value(e));
-    }
-    if ((e = hash_table_get(s->pairs, key)) != NULL) {
-        o = DQ(hash_elem_get_value(e));
-    }
-    if (value == NULL) {
-        // nothing
-    } else if (append && e != NULL) {
-        buf = charstr_printf("%s %s", o->value, value);
-        p = pair_create(key, buf);
-        fsfree(buf);
-        hash_table_put(s->pairs, p->key, p);
-    } else {
-        p = pair_create(key, value);
-        hash_table_put(s->pairs, p->key, p);
+    if ((s = unit_find_section(u, section)) == NULL) {
+        s = unit_add_section(u, section);
     }
-    if (e != NULL) {
-        pair_free(o);
-        destroy_hash_element(e);
+    if ((k = unit_find_key(s, key)) != NULL) {
+        if (value == NULL) {
+            // The memory is reclaimed when the unit is freed.
+            s->nkeys--;
+            memmove(k, k + 1, (s->keys + s->nkeys - k) * sizeof(*k));
+        } else if (append) {
+            unit_key_append(u, k, value);
+        } else {
+            unit_key_set(u, k, value);
+        }
         return 1;
     }
+    if (value != NULL) {
+        if (s->nkeys == s->size) {
+            s->keys = unit_grow(u, s->keys, &s->size, sizeof(*k));
+        }
+        k = &s->keys[s->nkeys++];
+        k->name = unit_intern(u, key);
+        unit_key_set(u, k, value);
+    }
     return 0;
 }
 
@@ -146,21 +362,15 @@ int unit_delete_key(struct unit *u, const char *section, const char *key)
 // Returns the value of the given key in the given section.
 const char *unit_get_value(struct unit *u, const char *section, const char *key)
 {
-    hash_elem_t *e;
-    const struct section *s;
-    const struct pair *p;
+    struct unit_section *s;
+    struct unit_key *k;
 
-    if ((e = hash_table_get(u->sections, section)) == NULL) {
-        errno = ENOENT;
-        return NULL;
-    }
-    s = hash_elem_get_value(e);
-    if ((e = hash_table_get(s->pairs, key)) == NULL) {
+    if ((s = unit_find_section(u, section)) == NULL
+        || (k = unit_find_key(s, key)) == NULL) {
         errno = ENOENT;
         return NULL;
     }
-    p = hash_elem_get_value(e);
-    return p->value;
+    return unit_key_value(u, k);
 }
 
 int unit_get_bool(struct unit *u, const char *section, const char *key)
@@ -171,9 +381,8 @@ int unit_get_bool(struct unit *u, const char *section, const char *key)
 byte_array_t *unit_to_byte_array(struct unit *u, byte_array_t *ba)
 {
     byte_array_t *nba = NULL;
-    hash_elem_t *se, *pe;
-    const struct section *s;
-    const struct pair *p;
+    struct unit_section *s;
+    struct unit_key *k;
 
 #define appendf(...)                                \
     do {                                            \
@@ -185,14 +394,12 @@ byte_array_t *unit_to_byte_array(struct unit *u, byte_array_t *ba)
     if (ba == NULL) {
         ba = nba = make_byte_array(SIZE_MAX);
     }
-    for (se = hash_table_get_any(u->sections); se != NULL;
-         se = hash_table_get_other(se)) {
-        s = hash_elem_get_value(se);
+    for (size_t i = 0; i < u->nsections; i++) {
+        s = &u->sections[i];
         appendf("[%s]\n", s->name);
-        for (pe = hash_table_get_any(s->pairs); pe != NULL;
-             pe = hash_table_get_other(pe)) {
-            p = hash_elem_get_value(pe);
-            appendf("%s=%s\n", p->key, p->value);
+        for (size_t j = 0; j < s->nkeys; j++) {
+            k = &s->keys[j];
+            appendf("%s=%s\n", k->name, unit_key_value(u, k));
         }
     }
     return ba;
@@ -203,6 +410,41 @@ fail:
     return NULL;
 }
 
+// Applies a sequence of assignments to a unit.  The assignments are
+// section, key and value triples, each string terminated by a NUL character.
+// As in a unit file, an empty value resets the key, while any other value is
+// appended to it if the key takes a list and replaces it otherwise.  Returns
+// -1 with errno set to EINVAL, without modifying the unit, if the data is
+// malformed.
+int unit_apply_binary(struct unit *u, const char *buf, size_t len)
+{
+    const char *str[3], *end = buf + len, *p;
+    size_t n = 0;
+    unsigned int i;
+
+    for (p = buf; p < end; p++) {
+        if (*p == '\0') {
+            n++;
+        }
+    }
+    if ((len > 0 && end[-1] != '\0') || n % 3 != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    for (p = buf, i = 0; p < end; p += strlen(p) + 1) {
+        str[i++] = p;
+        if (i == 3) {
+            unit_update_value(u,
+                              str[0],
+                              str[1],
+                              str[2],
+                              *str[2] != '\0' && unit_is_list(str[1]));
+            i = 0;
+        }
+    }
+    return 0;
+}
+
 char *unit_to_string(struct unit *u)
 {
     byte_array_t *ba;
@@ -0,0 +1,239 @@
+#include "unitlex.h"
+
+#include <fsdyn/fsalloc.h>
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <string.h>
+
+// Define to 1 to normalize whitespace in values: tabs are replaced with spaces,
+// multiple consecutive spaces are collapsed into one, and trailing space is
+// removed.
+#define NORMALIZE_WHITESPACE 1
+
+static inline int issectionname(int ch)
+{
+    return isprint(ch) && ch != '[' && ch != ']';
+}
+
+static inline int iskey(int ch)
+{
+    return isdigit(ch) || isalpha(ch) || ch == '-';
+}
+
+static inline int isvalue(int ch)
+{
+    return isprint(ch) || ch == '\t';
+}
+
+void unitlex_init(struct unitlex *lx, const char *buf, size_t len)
+{
+    memset(lx, 0, sizeof(*lx));
+    lx->cur = buf;
+    lx->end = buf + len;
+    lx->line = 1;
+}
+
+void unitlex_fini(struct unitlex *lx)
+{
+    fsfree(lx->buf);
+    lx->buf = NULL;
+    lx->size = 0;
+}
+
+// Stores a character in the value buffer, growing it as needed.
+static void unitlex_putc(struct unitlex *lx, size_t *len, char ch)
+{
+    if (*len >= lx->size) {
+        lx->size = lx->size > 0 ? lx->size * 2 : 256;
+        lx->buf = fsrealloc(lx->buf, lx->size);
+    }
+    lx->buf[(*len)++] = ch;
+}
+
+// Copies a value which spans several lines or whose whitespace must be
+// normalized into the value buffer.  Returns a pointer to the character which
+// terminated the value.
+static const char *unitlex_rewrite(struct unitlex *lx,
+                                   const char *q,
+                                   struct unitlex_token *tok)
+{
+    const char *r, *end = lx->end;
+    size_t v = 0;
+    char ch;
+
+    for (r = q; r < end && isvalue(*r); r++) {
+        ch = *r;
+        if (ch == '\\' && r + 1 < end && r[1] == '\n') {
+            // Line continuation
+            ch = ' ';
+            r++; // now at end of line
+            lx->line++;
+            // Skip comment lines
+            while (r + 1 < end && (r[1] == '#' || r[1] == ';')) {
+                do {
+                    r++;
+                } while (r < end && *r != '\0' && *r != '\n');
+                // now at end of line
+                lx->line++;
+            }
+        }
+#if NORMALIZE_WHITESPACE
+        // Replace tabs with spaces
+        if (ch == '\t') {
+            ch = ' ';
+        }
+        // Collapse consecutive spaces into one
+        if (ch == ' ' && v > 0 && lx->buf[v - 1] == ' ') {
+            continue;
+        }
+#endif
+        unitlex_putc(lx, &v, ch);
+    }
+#if NORMALIZE_WHITESPACE
+    // Remove trailing space
+    if (v > 0 && lx->buf[v - 1] == ' ') {
+        v--;
+    }
+#endif
+    tok->value = lx->buf;
+    tok->value_len = v;
+    return r;
+}
+
+// Scans a value.  In the common case, where the value fits on a single line
+// and its whitespace needs no normalization, the token refers directly to the
+// input; otherwise, the value is rewritten.  Returns a pointer to the
+// character which terminated the value.
+static const char *unitlex_value(struct unitlex *lx,
+                                 const char *q,
+                                 struct unitlex_token *tok)
+{
+    const char *r, *end = lx->end;
+    bool rewrite = false;
+
+    for (r = q; r < end && isvalue(*r); r++) {
+#if NORMALIZE_WHITESPACE
+        if (*r == '\t' || (*r == ' ' && r > q && r[-1] == ' ')) {
+            rewrite = true;
+            break;
+        }
+#endif
+    }
+    if (r < end && *r == '\n' && r > q && r[-1] == '\\') {
+        rewrite = true;
+    }
+    if (rewrite) {
+        return unitlex_rewrite(lx, q, tok);
+    }
+    tok->value = q;
+    tok->value_len = r - q;
+#if NORMALIZE_WHITESPACE
+    // Remove trailing space
+    if (tok->value_len > 0 && q[tok->value_len - 1] == ' ') {
+        tok->value_len--;
+    }
+#endif
+    return r;
+}
+
+// Returns the next key-value pair in the input.  Returns 1 if a token was
+// found, 0 at the end of the input, and -1 if the input is malformed, in
+// which case the error field describes the problem, the line field is the
+// number of the offending line and the cur field points to its beginning.
+int unitlex_next(struct unitlex *lx, struct unitlex_token *tok)
+{
+    const char *cur, *end = lx->end;
+    const char *p, *q, *r;
+
+    for (; (cur = lx->cur) < end; lx->line++) {
+        if (*cur == '\0') {
+            goto eof;
+        } else if (*cur == '\n') {
+            // Blank line
+            lx->cur = cur + 1;
+        } else if (*cur == '#' || *cur == ';') {
+            // Comment line
+            if ((p = memchr(cur, '\n', end - cur)) == NULL
+                || memchr(cur, '\0', p - cur) != NULL) {
+                goto eof;
+            }
+            lx->cur = p + 1;
+        } else if (*cur == '[') {
+            // Section header
+            for (p = q = cur + 1; q < end && issectionname(*q); q++) {
+                // nothing
+            }
+            if (q >= end || *q == '\0') {
+                goto eof;
+            }
+            if (q == p) {
+                lx->error = "expected section name";
+                return -1;
+            }
+            if (*q != ']') {
+                lx->error = "expected ']'";
+                return -1;
+            }
+            r = q + 1;
+            if (r >= end || *r == '\0') {
+                goto eof;
+            }
+            if (*r != '\n') {
+                lx->error = "expected end of line";
+                return -1;
+            }
+            lx->section = p;
+            lx->section_len = q - p;
+            lx->cur = r + 1;
+        } else {
+            // Key-value pair
+            for (p = cur; p < end && iskey(*p); p++) {
+                // nothing
+            }
+            if (p >= end || *p == '\0') {
+                goto eof;
+            }
+            if (p == cur) {
+                lx->error = "expected key";
+                return -1;
+            }
+            for (q = p; q < end && isblank(*q); q++) {
+                // nothing
+            }
+            if (q >= end || *q == '\0') {
+                goto eof;
+            }
+            if (*q != '=') {
+                lx->error = "expected '='";
+                return -1;
+            }
+            for (q++; q < end && isblank(*q); q++) {
+                // nothing
+            }
+            if (q >= end || *q == '\0') {
+                goto eof;
+            }
+            if (lx->section == NULL) {
+                lx->error = "key-value pair before first section";
+                return -1;
+            }
+            tok->line = lx->line;
+            r = unitlex_value(lx, q, tok);
+            if (r >= end || *r == '\0') {
+                goto eof;
+            }
+            tok->section = lx->section;
+            tok->section_len = lx->section_len;
+            tok->key = cur;
+            tok->key_len = p - cur;
+            lx->cur = r + 1;
+            lx->line++;
+            return 1;
+        }
+    }
+    return 0;
+eof:
+    lx->error = "unexpected end of unit file";
+    return -1;
+}
@@ -15,7 +15,10 @@
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <sys/wait.h>
 #include <syslog.h>
 #include <unistd.h>
@@ -142,6 +145,43 @@ static int mockd_raise(const char *act, const char *arg)
     return 0;
 }
 
+static int mockd_notify(const char *act, const char *arg)
+{
+    struct sockaddr_un sun = { .sun_family = AF_UNIX };
+    const char *path;
+    socklen_t len;
+    int sock;
+
+    if (arg == NULL) {
+        arg = "READY=1";
+    }
+    if ((path = getenv("NOTIFY_SOCKET")) == NULL) {
+        error("%s: NOTIFY_SOCKET not set", act);
+        return -1;
+    }
+    if (strlen(path) >= sizeof(sun.sun_path)) {
+        error("%s: socket name too long", act);
+        return -1;
+    }
+    strcpy(sun.sun_path, path);
+    len = offsetof(struct sockaddr_un, sun_path) + strlen(path);
+    if (*path == '@') {
+        sun.sun_path[0] = '\0';
+    }
+    verbose("sending %s to %s", arg, path);
+    if ((sock = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0)) < 0) {
+        error("socket(): %m");
+        return -1;
+    }
+    if (sendto(sock, arg, strlen(arg), 0, (struct sockaddr *)&sun, len) < 0) {
+        error("sendto(): %m");
+        close(sock);
+        return -1;
+    }
+    close(sock);
+    return 0;
+}
+
 static int mockd_pidfile(const char *act, const char *arg)
 {
     FILE *f;
@@ -258,6 +298,8 @@ static int mockd_action(const char *act, const char *arg)
         return mockd_daemon(act, arg);
     } else if (strcmp(act, "exit") == 0) {
         return mockd_exit(act, arg);
+    } else if (strcmp(act, "notify") == 0) {
+        return mockd_notify(act, arg);
     } else if (strcmp(act, "pidfile") == 0) {
         return mockd_pidfile(act, arg);
     } else if (strcmp(act, "raise") == 0) {
@@ -298,6 +340,7 @@ static void usage(void)
             "Available actions:\n"
             "    daemon\n"
             "    exit[:status]\n"
+            "    notify[:message]\n"
             "    pidfile[:path]\n"
             "    raise[:signal]\n"
             "    sleep[:duration]\n"
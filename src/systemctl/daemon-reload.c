@@ -0,0 +1,63 @@
+#include "systemctl.h"
+
+#include "ctlquery.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DAEMON_RELOAD_TIMEOUT_MS 5000
+
+static void usage(const struct command *cmd)
+{
+    printf("systemctl [options] %s\n", cmd->name);
+}
+
+// Asks the monitor of every running sysvrun service to reload its unit file
+// and drop-ins.  The changes take effect the next time each service starts.
+// Services which are not run by sysvrun have nothing to reload.  Returns a
+// non-zero exit code if any of the monitors refused or failed to reload.
+int daemon_reload_main(const struct command *cmd, int argc, char *argv[])
+{
+    struct ctlquery *queries;
+    size_t n;
+    int res = EXIT_SUCCESS;
+
+    if (getopt_none(cmd, argc, argv) < 0) {
+        usage(cmd);
+        return EXIT_FAILURE;
+    }
+    if ((queries = ctlquery_discover(CTLQUERY_DEFAULT_PREFIX, &n)) == NULL) {
+        fprintf(stderr, "%s: %m\n", cmd->name);
+        return EXIT_FAILURE;
+    }
+    ctlquery_run(CTLQUERY_DEFAULT_PREFIX,
+                 queries,
+                 n,
+                 "daemon-reload",
+                 ms2us(DAEMON_RELOAD_TIMEOUT_MS));
+    for (size_t i = 0; i < n; i++) {
+        if (queries[i].response == NULL) {
+            // the monitor exited after we found it
+            if (queries[i].error == ECONNREFUSED) {
+                continue;
+            }
+            errno = queries[i].error;
+            fprintf(stderr, "%s: %s: %m\n", cmd->name, queries[i].name);
+            res = EXIT_FAILURE;
+        } else if (strcmp(queries[i].response, "ok") != 0) {
+            fprintf(stderr,
+                    "%s: %s: %s\n",
+                    cmd->name,
+                    queries[i].name,
+                    queries[i].response);
+            res = EXIT_FAILURE;
+        }
+    }
+    ctlquery_free(queries, n);
+    return res;
+}
+
+const struct command cmd_daemon_reload = { "daemon-reload",
+                                           daemon_reload_main };
@@ -0,0 +1,307 @@
+#define _GNU_SOURCE
+
+#include "systemctl.h"
+
+#include <fsdyn/bytearray.h>
+#include <fsdyn/fsalloc.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Number of services to operate on at the same time
+int jobs = JOBS_DEFAULT;
+
+// How often to check for exited jobs when pidfds are not available
+#define JOBS_REAP_INTERVAL_MS 50
+
+// Size of the chunks in which a job's output is read
+#define JOB_READ_SIZE 4096
+
+struct job {
+    struct service *svc;
+    pid_t pid;
+    // read ends of the pipes connected to the child's standard output and
+    // error, or -1 once they have reached EOF or the child has exited
+    int out, err;
+    // becomes readable when the child exits, or -1 if not supported
+    int pidfd;
+    byte_array_t *obuf, *ebuf;
+    int result;
+    bool done;
+};
+
+// Runs the operation in a child process with its output redirected to pipes.
+static int job_start(const struct command *cmd, struct job *job, job_func func)
+{
+    int opipe[2], epipe[2], res;
+
+    if (pipe2(opipe, O_CLOEXEC) != 0) {
+        return -1;
+    }
+    if (pipe2(epipe, O_CLOEXEC) != 0) {
+        close(opipe[0]);
+        close(opipe[1]);
+        return -1;
+    }
+    // don't let the child inherit anything we haven't printed yet
+    fflush(stdout);
+    fflush(stderr);
+    if ((job->pid = fork()) < 0) {
+        close(opipe[0]);
+        close(opipe[1]);
+        close(epipe[0]);
+        close(epipe[1]);
+        return -1;
+    }
+    if (job->pid == 0) {
+        // child
+        if (dup2(opipe[1], STDOUT_FILENO) < 0
+            || dup2(epipe[1], STDERR_FILENO) < 0) {
+            _exit(EXIT_FAILURE);
+        }
+        res = func(cmd, job->svc);
+        fflush(stdout);
+        fflush(stderr);
+        _exit(res);
+    }
+    // parent
+    close(opipe[1]);
+    close(epipe[1]);
+    // The child may leave a daemon behind which inherits the pipes, so they
+    // are drained without blocking and the child is reaped when it exits
+    // rather than when they reach EOF.
+    (void)fcntl(opipe[0], F_SETFL, O_NONBLOCK);
+    (void)fcntl(epipe[0], F_SETFL, O_NONBLOCK);
+    job->out = opipe[0];
+    job->err = epipe[0];
+#ifdef SYS_pidfd_open
+    job->pidfd = syscall(SYS_pidfd_open, job->pid, 0);
+#endif
+    job->obuf = make_byte_array(SIZE_MAX);
+    job->ebuf = make_byte_array(SIZE_MAX);
+    debug("%s: started job %d", job->svc->name, (int)job->pid);
+    return 0;
+}
+
+// Reads from one of a job's pipes, closing it on EOF or error.  Returns the
+// number of bytes read, which is 0 if nothing was available.
+static ssize_t job_read(int *fd, byte_array_t *buf)
+{
+    char iobuf[JOB_READ_SIZE];
+    ssize_t res;
+
+    if (*fd < 0) {
+        return 0;
+    }
+    while ((res = read(*fd, iobuf, sizeof(iobuf))) < 0 && errno == EINTR) {
+        continue;
+    }
+    if (res > 0) {
+        byte_array_append(buf, iobuf, res);
+        return res;
+    }
+    if (res < 0 && errno == EAGAIN) {
+        return 0;
+    }
+    close(*fd);
+    *fd = -1;
+    return 0;
+}
+
+// Closes a job's pipes and pidfd.
+static void job_close(struct job *job)
+{
+    if (job->out >= 0) {
+        close(job->out);
+        job->out = -1;
+    }
+    if (job->err >= 0) {
+        close(job->err);
+        job->err = -1;
+    }
+    if (job->pidfd >= 0) {
+        close(job->pidfd);
+        job->pidfd = -1;
+    }
+}
+
+// Collects a job if it has exited, or once it exits if flags is 0.  Whatever
+// it wrote before exiting is still in its pipes and is read before they are
+// closed; anything written later comes from processes it left behind.
+// Returns true if the job was collected.
+static bool job_reap(struct job *job, int flags)
+{
+    pid_t res;
+    int status;
+
+    while ((res = waitpid(job->pid, &status, flags)) < 0 && errno == EINTR) {
+        continue;
+    }
+    if (res == 0) {
+        return false;
+    }
+    if (res < 0) {
+        status = EXIT_FAILURE << 8;
+    }
+    while (job_read(&job->out, job->obuf) == JOB_READ_SIZE) {
+        continue;
+    }
+    while (job_read(&job->err, job->ebuf) == JOB_READ_SIZE) {
+        continue;
+    }
+    job_close(job);
+    if (WIFEXITED(status)) {
+        job->result = WEXITSTATUS(status);
+    } else {
+        job->result = EXIT_FAILURE;
+    }
+    debug("%s: job %d returned %d",
+          job->svc->name,
+          (int)job->pid,
+          job->result);
+    job->done = true;
+    return true;
+}
+
+// Prints a job's output.
+static void job_print(struct job *job)
+{
+    if (job->obuf != NULL) {
+        fwrite(byte_array_data(job->obuf),
+               1,
+               byte_array_size(job->obuf),
+               stdout);
+        fflush(stdout);
+        destroy_byte_array(job->obuf);
+    }
+    if (job->ebuf != NULL) {
+        fwrite(byte_array_data(job->ebuf),
+               1,
+               byte_array_size(job->ebuf),
+               stderr);
+        fflush(stderr);
+        destroy_byte_array(job->ebuf);
+    }
+}
+
+// Performs an operation on each of the named services, up to the number set
+// by the --jobs option at a time.  Each operation runs in a child process
+// whose output is collected and printed once it and all the operations
+// before it have completed, so the output is the same as if the services had
+// been processed one after the other.  With a single job, or a single
+// service, operations are performed directly, in order.  Returns an array of
+// the results in the same order as the names, or NULL if one of the services
+// does not exist, in which case no operation is performed.
+int *jobs_run(const struct command *cmd, int argc, char *argv[], job_func func)
+{
+    struct job *job, *jobv;
+    struct pollfd *pfds;
+    int *results;
+    int i, next = 0, printed = 0, running = 0, npfds, timeout;
+
+    jobv = fscalloc(argc, sizeof(*jobv));
+    results = fscalloc(argc, sizeof(*results));
+    for (i = 0; i < argc; i++) {
+        if ((jobv[i].svc = service_find(argv[i])) == NULL) {
+            fprintf(stderr, "service '%s' not found: %m\n", argv[i]);
+            goto fail;
+        }
+        jobv[i].out = jobv[i].err = jobv[i].pidfd = -1;
+    }
+    if (jobs <= 1 || argc == 1) {
+        for (i = 0; i < argc; i++) {
+            results[i] = func(cmd, jobv[i].svc);
+        }
+        goto done;
+    }
+    if (jobs > argc) {
+        jobs = argc;
+    }
+    pfds = fscalloc(3 * jobs, sizeof(*pfds));
+    while (printed < argc) {
+        while (running < jobs && next < argc) {
+            job = &jobv[next++];
+            if (job_start(cmd, job, func) != 0) {
+                fprintf(stderr, "%s: %s: %m\n", cmd->name, job->svc->name);
+                job->result = EXIT_FAILURE;
+                job->done = true;
+                continue;
+            }
+            running++;
+        }
+        npfds = 0;
+        timeout = -1;
+        for (i = printed; i < next; i++) {
+            if (jobv[i].done) {
+                continue;
+            }
+            if (jobv[i].out >= 0) {
+                pfds[npfds++] = (struct pollfd){ jobv[i].out, POLLIN, 0 };
+            }
+            if (jobv[i].err >= 0) {
+                pfds[npfds++] = (struct pollfd){ jobv[i].err, POLLIN, 0 };
+            }
+            if (jobv[i].pidfd >= 0) {
+                pfds[npfds++] = (struct pollfd){ jobv[i].pidfd, POLLIN, 0 };
+            } else {
+                timeout = JOBS_REAP_INTERVAL_MS;
+            }
+        }
+        if (running > 0 && poll(pfds, npfds, timeout) < 0 && errno != EINTR) {
+            fprintf(stderr, "%s: %m\n", cmd->name);
+            // Close the pipes first so that no child blocks writing to them.
+            for (i = printed; i < next; i++) {
+                if (!jobv[i].done) {
+                    job_close(&jobv[i]);
+                    job_reap(&jobv[i], 0);
+                }
+            }
+            break;
+        }
+        for (i = printed; i < next; i++) {
+            job = &jobv[i];
+            if (job->done) {
+                continue;
+            }
+            for (int j = 0; j < npfds; j++) {
+                if (!pfds[j].revents) {
+                    continue;
+                }
+                if (pfds[j].fd == job->out) {
+                    job_read(&job->out, job->obuf);
+                } else if (pfds[j].fd == job->err) {
+                    job_read(&job->err, job->ebuf);
+                }
+            }
+            if (job_reap(job, WNOHANG)) {
+                running--;
+            }
+        }
+        while (printed < next && jobv[printed].done) {
+            job_print(&jobv[printed]);
+            results[printed] = jobv[printed].result;
+            printed++;
+        }
+    }
+    fsfree(pfds);
+    if (printed < argc) {
+        goto fail;
+    }
+    goto done;
+fail:
+    fsfree(results);
+    results = NULL;
+done:
+    for (i = 0; i < argc; i++) {
+        service_free(jobv[i].svc);
+    }
+    fsfree(jobv);
+    return results;
+}
@@ -0,0 +1,81 @@
+#include "systemctl.h"
+
+#include <fsdyn/charstr.h>
+#include <fsdyn/fsalloc.h>
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void usage(const struct command *cmd)
+{
+    printf("systemctl [options] %s\n", cmd->name);
+}
+
+// Returns a word describing the outcome of a status request.
+static const char *active_state(const struct service *svc)
+{
+    if (svc->status < 0) {
+        return "unknown";
+    }
+    if (svc->status == 0) {
+        return "active";
+    }
+    if (svc->state != NULL && strcmp(svc->state, "failed") == 0) {
+        return "failed";
+    }
+    return "inactive";
+}
+
+// Lists services along with whether they are enabled and running.  Unless
+// the --all option was specified, only running services are listed.
+int list_units_main(const struct command *cmd, int argc, char *argv[])
+{
+    struct service **svcs;
+    char *unit;
+    size_t n, width = strlen("UNIT");
+    int res;
+
+    res = getopt_none(cmd, argc, argv);
+    if (res < 0 || res != argc) {
+        usage(cmd);
+        return EXIT_FAILURE;
+    }
+    if ((svcs = service_find_all(&n)) == NULL) {
+        fprintf(stderr, "%s: %m\n", cmd->name);
+        return EXIT_FAILURE;
+    }
+    service_status_all(svcs, n);
+    for (size_t i = 0; i < n; i++) {
+        if (strlen(svcs[i]->name) + strlen(".service") > width) {
+            width = strlen(svcs[i]->name) + strlen(".service");
+        }
+    }
+    if (noisy > QUIET) {
+        printf("%-*s %-8s %-8s %s\n",
+               (int)width,
+               "UNIT",
+               "ENABLED",
+               "ACTIVE",
+               "SUB");
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (!all && svcs[i]->status != 0) {
+            continue;
+        }
+        res = service_is_enabled(svcs[i]);
+        unit = charstr_printf("%s.service", svcs[i]->name);
+        printf("%-*s %-8s %-8s %s\n",
+               (int)width,
+               unit,
+               res < 0 ? "unknown" : res > 0 ? "enabled" : "disabled",
+               active_state(svcs[i]),
+               svcs[i]->state != NULL ? svcs[i]->state : "-");
+        fsfree(unit);
+    }
+    service_free_all(svcs, n);
+    return EXIT_SUCCESS;
+}
+
+const struct command cmd_list_units = { "list-units", list_units_main };
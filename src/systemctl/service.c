@@ -1,7 +1,9 @@
 #include "systemctl.h"
 
+#include "ctlquery.h"
+#include "fork.h"
+
 #include <fsdyn/charstr.h>
-#include <fsdyn/integer.h>
 #include <unixkit/unixkit.h>
 
 #include <dirent.h>
@@ -45,6 +47,15 @@ static char *stop_link(const char *name)
 
 #define DOT_SERVICE ".service"
 
+// How long to wait for monitors to respond to a status request.
+#define STATUS_TIMEOUT_MS 2000
+
+// Returns an allocated buffer containing the path of the init directory.
+static char *init_dir_path(void)
+{
+    return charstr_printf("%s/etc/init.d", root);
+}
+
 // Locates the service with the specified name and returns either a pointer to a
 // struct describing it, or NULL if it was not found or some other error
 // occurred.
@@ -85,10 +96,133 @@ fail:
     return NULL;
 }
 
+static int service_cmp(const void *a, const void *b)
+{
+    const struct service *const *sa = a, *const *sb = b;
+
+    return strcmp((*sa)->name, (*sb)->name);
+}
+
+// Returns an array of every executable file in the init directory, sorted by
+// name, and stores the number of entries in the location pointed to by the
+// argument, or returns NULL if the directory could not be read.
+struct service **service_find_all(size_t *np)
+{
+    struct service **svcs, *svc;
+    struct dirent *de;
+    list_t *found;
+    char *dir;
+    DIR *dirp;
+    size_t n;
+
+    dir = init_dir_path();
+    dirp = opendir(dir);
+    fsfree(dir);
+    if (dirp == NULL) {
+        return NULL;
+    }
+    found = make_list();
+    while ((de = readdir(dirp)) != NULL) {
+        if (de->d_name[0] == '.' || strcmp(de->d_name, "README") == 0
+            || strcmp(de->d_name, "skeleton") == 0) {
+            continue;
+        }
+        if ((svc = service_find(de->d_name)) == NULL) {
+            continue;
+        }
+        if (!S_ISREG(svc->sb.st_mode) || !(svc->sb.st_mode & 0111)) {
+            service_free(svc);
+            continue;
+        }
+        list_append(found, svc);
+    }
+    closedir(dirp);
+    n = list_size(found);
+    svcs = fscalloc(n > 0 ? n : 1, sizeof(*svcs));
+    for (size_t i = 0; i < n; i++) {
+        svcs[i] = (struct service *)list_pop_first(found);
+    }
+    destroy_list(found);
+    qsort(svcs, n, sizeof(*svcs), service_cmp);
+    *np = n;
+    return svcs;
+}
+
 // Frees a struct previously returned by service_find().
 void service_free(struct service *svc)
 {
-    fsfree(svc);
+    if (svc != NULL) {
+        fsfree(svc->monitor);
+        fsfree(svc->unit);
+        fsfree(svc->state);
+        fsfree(svc->path);
+        fsfree(svc->name);
+        fsfree(svc);
+    }
+}
+
+// Frees an array previously returned by service_find_all().
+void service_free_all(struct service **svcs, size_t n)
+{
+    if (svcs != NULL) {
+        for (size_t i = 0; i < n; i++) {
+            service_free(svcs[i]);
+        }
+        fsfree(svcs);
+    }
+}
+
+// Checks whether the service's init script was generated by sysvrun, i.e.
+// whether it contains a line of the form
+//
+//     exec /path/to/sysvrun -u "$0" unit "$@"
+//
+// and if so, records the base name of the sysvrun binary, which is part of
+// the name of the monitor's control socket, and the name of the unit.
+// Returns 1 if it was, 0 if it was not, and -1 if an error occurred.
+int service_probe(struct service *svc)
+{
+    static const char marker[] = " -u \"$0\" ";
+    char buf[4096], *line, *eol, *p, *q, *r;
+    ssize_t len;
+    int fd;
+
+    if (svc->monitor != NULL) {
+        return 1;
+    }
+    if ((fd = open(svc->path, O_RDONLY | O_CLOEXEC)) < 0) {
+        return -1;
+    }
+    len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (len < 0) {
+        return -1;
+    }
+    buf[len] = '\0';
+    for (line = buf; line != NULL && *line != '\0'; line = eol) {
+        if ((eol = strchr(line, '\n')) != NULL) {
+            *eol++ = '\0';
+        }
+        if (strncmp(line, "exec /", 6) != 0
+            || (p = strstr(line, marker)) == NULL) {
+            continue;
+        }
+        // base name of the program
+        for (q = p; q > line + 5 && q[-1] != '/'; q--) {
+            // nothing
+        }
+        // unit name
+        r = p + strlen(marker);
+        if (q == p || strchr(line + 5, ' ') != p
+            || strcmp(r + strcspn(r, " "), " \"$@\"") != 0) {
+            continue;
+        }
+        svc->monitor = charstr_dupsubstr(q, p);
+        svc->unit = charstr_dupsubstr(r, r + strcspn(r, " "));
+        debug("%s: generated by %s for %s", svc->name, svc->monitor, svc->unit);
+        return 1;
+    }
+    return 0;
 }
 
 static void service_child(const char *, const char *, int, bool)
@@ -125,19 +259,17 @@ fail:
 // script's output will be suppressed, unless noisy is VERBOSE or higher.
 int service_invoke(struct service *svc, const char *command, bool silent)
 {
-    list_t *keep;
     pid_t pid;
-    int chan[2], res, status;
+    int chan[2], keep[4], res, status;
 
     if (!unixkit_pipe(chan)) {
         return -1;
     }
-    keep = make_list();
-    list_append(keep, as_integer(STDIN_FILENO));
-    list_append(keep, as_integer(STDOUT_FILENO));
-    list_append(keep, as_integer(STDERR_FILENO));
-    list_append(keep, as_integer(chan[1]));
-    pid = unixkit_fork(keep);
+    keep[0] = STDIN_FILENO;
+    keep[1] = STDOUT_FILENO;
+    keep[2] = STDERR_FILENO;
+    keep[3] = chan[1];
+    pid = fork_keep(keep, 4);
     if (pid < 0) {
         close(chan[1]);
         close(chan[0]);
@@ -318,3 +450,79 @@ int service_enable(struct service *svc)
 {
     return service_manip(svc, false, true);
 }
+
+// Determines the status of several services, in the same terms as the init
+// script's status command.  Services whose init scripts were generated by
+// sysvrun are looked up by querying their monitors directly, all at once, and
+// are considered stopped if there is no monitor; the others, and any whose
+// monitor fails to respond, are queried by invoking their init scripts in
+// turn.  The result is stored in each service's status field, and for
+// sysvrun services, the monitor state is stored in the state field.
+void service_status_all(struct service **svcs, size_t n)
+{
+    struct ctlquery *queries;
+    struct service *svc;
+    const char *prefix;
+    size_t *index, m;
+    bool *done;
+
+    index = fscalloc(n > 0 ? n : 1, sizeof(*index));
+    done = fscalloc(n > 0 ? n : 1, sizeof(*done));
+    queries = ctlquery_create(n);
+    for (size_t i = 0; i < n; i++) {
+        fsfree(svcs[i]->state);
+        svcs[i]->state = NULL;
+        if (service_probe(svcs[i]) <= 0) {
+            done[i] = true;
+        }
+    }
+    // Query the monitors, one sysvrun binary at a time (normally there is
+    // only one).
+    for (size_t i = 0; i < n; i++) {
+        if (done[i]) {
+            continue;
+        }
+        prefix = svcs[i]->monitor;
+        for (size_t j = m = 0; j < n; j++) {
+            if (!done[j] && strcmp(svcs[j]->monitor, prefix) == 0) {
+                queries[m].name = svcs[j]->unit;
+                index[m++] = j;
+                done[j] = true;
+            }
+        }
+        ctlquery_run(prefix, queries, m, "status", ms2us(STATUS_TIMEOUT_MS));
+        for (size_t k = 0; k < m; k++) {
+            svc = svcs[index[k]];
+            if (queries[k].response == NULL) {
+                if (queries[k].error == ECONNREFUSED) {
+                    svc->state = charstr_dupstr("stopped");
+                    svc->status = 3; // program is not running
+                } else {
+                    svc->status = -1; // fall back to the init script
+                }
+            } else if (strcmp(queries[k].response, "stopped") == 0
+                       || strcmp(queries[k].response, "failed") == 0
+                       || strcmp(queries[k].response, "dead") == 0) {
+                svc->state = charstr_dupstr(queries[k].response);
+                svc->status = 3; // program is not running
+            } else if (strcmp(queries[k].response, "denied") == 0
+                       || strcmp(queries[k].response, "error") == 0) {
+                svc->status = -1;
+            } else {
+                svc->state = charstr_dupstr(queries[k].response);
+                svc->status = 0; // program is running or service is OK
+            }
+            fsfree(queries[k].response);
+            queries[k].response = NULL;
+            queries[k].name = NULL;
+        }
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (svcs[i]->monitor == NULL || svcs[i]->status < 0) {
+            svcs[i]->status = service_invoke(svcs[i], "status", true);
+        }
+    }
+    ctlquery_free(queries, n);
+    fsfree(done);
+    fsfree(index);
+}
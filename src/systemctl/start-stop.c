@@ -1,5 +1,7 @@
 #include "systemctl.h"
 
+#include <fsdyn/fsalloc.h>
+
 #include <getopt.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -57,7 +59,7 @@ static int start_stop(const struct command *cmd, struct service *svc)
 // Starts or stops a service.
 int start_stop_main(const struct command *cmd, int argc, char *argv[])
 {
-    struct service *svc;
+    int *results;
     int i, res, ret;
 
     res = getopt_none(cmd, argc, argv);
@@ -68,18 +70,16 @@ int start_stop_main(const struct command *cmd, int argc, char *argv[])
     argc -= res;
     argv += res;
 
+    if ((results = jobs_run(cmd, argc, argv, start_stop)) == NULL) {
+        return EXIT_FAILURE;
+    }
     ret = 0; // assume success, fail if any service fails
     for (i = 0; i < argc; i++) {
-        if ((svc = service_find(argv[i])) == NULL) {
-            fprintf(stderr, "service '%s' not found: %m\n", argv[i]);
-            return EXIT_FAILURE;
-        }
-        res = start_stop(cmd, svc);
-        if (res != 0) {
-            ret = res;
+        if (results[i] != 0) {
+            ret = results[i];
         }
-        service_free(svc);
     }
+    fsfree(results);
     return ret;
 }
 
@@ -1,5 +1,7 @@
 #include "systemctl.h"
 
+#include <fsdyn/fsalloc.h>
+
 #include <getopt.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -8,9 +10,16 @@
 static void usage(const struct command *cmd)
 {
     printf("systemctl [options] %s service [...]\n", cmd->name);
+    if (cmd == &cmd_status) {
+        printf("systemctl [options] %s --all\n", cmd->name);
+    }
 }
 
-static int status(const struct command *cmd, struct service *svc)
+// Reports whether a service is enabled and running.  If queried is true, the
+// service's status field has already been filled in by service_status_all().
+static int status(const struct command *cmd,
+                  struct service *svc,
+                  bool queried)
 {
     bool enabled = false, running = false;
     int res;
@@ -30,7 +39,7 @@ static int status(const struct command *cmd, struct service *svc)
         // when the service is not running.  Unfortunately, this is not
         // universally true.  We'll just have to trust that the ones we care
         // about (i.e. the ones we wrote and installed ourselves) do.
-        res = service_invoke(svc, "status", true);
+        res = queried ? svc->status : service_invoke(svc, "status", true);
         if (res < 0) {
             fprintf(stderr, "%s: %s: %m\n", "status", svc->name);
             return EXIT_FAILURE;
@@ -73,13 +82,44 @@ static int status(const struct command *cmd, struct service *svc)
     return EXIT_FAILURE;
 }
 
+static int status_one(const struct command *cmd, struct service *svc)
+{
+    return status(cmd, svc, false);
+}
+
+// Reports whether every service is enabled and running.  The monitors of
+// services managed by sysvrun are queried in parallel.
+static int status_all(const struct command *cmd)
+{
+    struct service **svcs;
+    size_t n;
+    int res, ret = 0;
+
+    if ((svcs = service_find_all(&n)) == NULL) {
+        fprintf(stderr, "%s: %m\n", cmd->name);
+        return EXIT_FAILURE;
+    }
+    service_status_all(svcs, n);
+    for (size_t i = 0; i < n; i++) {
+        res = status(cmd, svcs[i], true);
+        if (res != 0) {
+            ret = res;
+        }
+    }
+    service_free_all(svcs, n);
+    return ret;
+}
+
 // Reports whether a service is enabled and running.
 int status_main(const struct command *cmd, int argc, char *argv[])
 {
-    struct service *svc;
+    int *results;
     int i, res, ret;
 
     res = getopt_none(cmd, argc, argv);
+    if (res == argc && all && cmd == &cmd_status) {
+        return status_all(cmd);
+    }
     if (res < 0 || res == argc) {
         usage(cmd);
         return EXIT_FAILURE;
@@ -92,12 +132,11 @@ int status_main(const struct command *cmd, int argc, char *argv[])
     } else {     // is-enabled, is-active
         ret = 3; // assume failure, succeed if any service succeeds
     }
+    if ((results = jobs_run(cmd, argc, argv, status_one)) == NULL) {
+        return EXIT_FAILURE;
+    }
     for (i = 0; i < argc; i++) {
-        if ((svc = service_find(argv[i])) == NULL) {
-            fprintf(stderr, "service '%s' not found: %m\n", argv[i]);
-            return EXIT_FAILURE;
-        }
-        res = status(cmd, svc);
+        res = results[i];
         if (cmd == &cmd_status) {
             if (res != 0) {
                 ret = res;
@@ -107,8 +146,8 @@ int status_main(const struct command *cmd, int argc, char *argv[])
                 ret = 0;
             }
         }
-        service_free(svc);
     }
+    fsfree(results);
     return ret;
 }
 
@@ -2,7 +2,9 @@
 
 #include "exitcode.h"
 
+#include <errno.h>
 #include <getopt.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -10,6 +12,9 @@
 // Root directory
 const char *root = "";
 
+// Operate on all services
+bool all;
+
 static void version(void)
 {
     printf("systemctl 1812 (f-secure)\n");
@@ -22,8 +27,10 @@ static void usage(void)
 
 // A subset of the real systemctl's global options
 static const struct option options[] = {
+    { "all", no_argument, 0, 'a' },
     { "debug", no_argument, 0, 'd' },
     { "help", no_argument, 0, 'h' },
+    { "jobs", required_argument, 0, 'j' },
     { "root", required_argument, 0, 'r' },
     { "quiet", no_argument, &noisy, QUIET },
     { "verbose", no_argument, &noisy, VERBOSE },
@@ -48,21 +55,39 @@ static const struct command *commands[] = {
     &cmd_try_reload_or_restart,
     &cmd_daemon_reload,
     &cmd_show,
+    &cmd_list_units,
     NULL,
 };
 
 int main(int argc, char *argv[])
 {
+    char *end;
+    long num;
     int opt = -1;
 
-    while ((opt = getopt_long(argc, argv, "dhqv", options, NULL)) != -1) {
+    while ((opt = getopt_long(argc, argv, "adhj:qv", options, NULL)) != -1) {
         switch (opt) {
             case 0:
                 // already handled by getopt_long()
                 break;
+            case 'a':
+                all = true;
+                break;
             case 'h':
                 usage();
                 return EXIT_SUCCESS;
+            case 'j':
+                errno = 0;
+                num = strtol(optarg, &end, 10);
+                if (num < 1 || end == optarg || *end != '\0') {
+                    error("invalid number of jobs: %s", optarg);
+                    return EX_USAGE;
+                }
+                if (errno == ERANGE || num > JOBS_MAX) {
+                    num = JOBS_MAX;
+                }
+                jobs = num;
+                break;
             case 'r':
                 root = optarg;
                 break;
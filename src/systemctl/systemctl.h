@@ -3,11 +3,20 @@
 #include "common.h"
 #include "noise.h"
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <sys/stat.h>
 
 extern const char *root;
+extern bool all;
+
+// default number of services to operate on at the same time
+#define JOBS_DEFAULT 8
+// each job uses three file descriptors, which must stay below the default
+// limit of 1024
+#define JOBS_MAX 256
+extern int jobs;
 
 struct command {
     const char *name;
@@ -23,19 +32,34 @@ extern const struct command cmd_enable, cmd_disable;
 extern const struct command cmd_status, cmd_is_enabled, cmd_is_active;
 extern const struct command cmd_daemon_reload;
 extern const struct command cmd_show;
+extern const struct command cmd_list_units;
 
 struct service {
     char *name;
     char *path;
     struct stat sb;
+    // for init scripts generated by sysvrun, the base name of the sysvrun
+    // binary and the name of the unit, otherwise NULL
+    char *monitor;
+    char *unit;
+    // result of service_status_all()
+    int status;
+    char *state;
 };
 
 struct service *service_find(const char *);
+struct service **service_find_all(size_t *);
 void service_free(struct service *);
+void service_free_all(struct service **, size_t);
+int service_probe(struct service *);
 int service_invoke(struct service *, const char *, bool);
+void service_status_all(struct service **, size_t);
 int service_is_enabled_rl(struct service *, int);
 int service_is_enabled(struct service *);
 int service_disable_rl(struct service *, int);
 int service_disable(struct service *);
 int service_enable_rl(struct service *, int);
 int service_enable(struct service *);
+
+typedef int (*job_func)(const struct command *, struct service *);
+int *jobs_run(const struct command *, int, char **, job_func);
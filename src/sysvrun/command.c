@@ -15,16 +15,17 @@
 
 #include <fsdyn/charstr.h>
 #include <fsdyn/fsalloc.h>
-#include <unixkit/unixkit.h>
 
 #include <errno.h>
+#include <fcntl.h>
 #include <grp.h>
 #include <limits.h>
+#include <linux/openat2.h>
 #include <paths.h>
-#include <pwd.h>
 #include <signal.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
@@ -35,141 +36,166 @@ static enum execflag prefix2flag[256] = {
 
 #define DEFAULT_UMASK 0022
 
-static int command_resolve_path_child(struct command *cmd,
-                                      const char *name,
-                                      bool search,
-                                      int pd)
+// Opens a path without following the final component into a regular open,
+// for the sole purpose of resolving it.  If rootfd is not negative, the path
+// is resolved as if rootfd were the root directory, as it would be after a
+// chroot() to it.
+static int command_open_path(int rootfd, const char *path)
 {
-    char root[PATH_MAX] = "";
-    char path[PATH_MAX] = "";
-    const char *p, *q;
-    ssize_t ret;
+    struct open_how how = {
+        .flags = O_PATH | O_CLOEXEC,
+        .resolve = RESOLVE_IN_ROOT,
+    };
+    int fd;
 
-    // Root directory
-    if (cmd->rootdir != NULL) {
-        debug("resolving root directory: %s", cmd->rootdir);
-        if (realpath(cmd->rootdir, root) == NULL) {
-            return -1;
-        }
-        debug("changing root directory to %s", root);
-        if (chroot(root) < 0) {
-            return -1;
-        }
+    if (rootfd < 0) {
+        return open(path, O_PATH | O_CLOEXEC);
     }
-    // Working directory
-    if (cmd->workdir != NULL) {
-        debug("resolving working directory: %s", cmd->workdir);
-        if (realpath(cmd->workdir, path) == NULL) {
-            return -1;
-        }
-        debug("changing working directory to %s", path);
-        if (chdir(path) < 0) {
-            return -1;
+    fd = syscall(SYS_openat2, rootfd, path, &how, sizeof(how));
+    if (fd < 0 && errno == ENOSYS) {
+        // Old kernel: absolute symlinks will escape the root.
+        trace(NC_COMMAND, "openat2() not available, resolving %s", path);
+        while (*path == '/') {
+            path++;
         }
-    } else {
-        if (chdir("/") < 0) {
-            return -1;
+        fd = openat(rootfd, *path != '\0' ? path : ".", O_PATH | O_CLOEXEC);
+    }
+    return fd;
+}
+
+// Returns the canonical path of an open file.
+static char *command_fd_path(int fd)
+{
+    char proc[64], path[PATH_MAX];
+    ssize_t len;
+
+    (void)snprintf(proc, sizeof(proc), "/proc/self/fd/%d", fd);
+    if ((len = readlink(proc, path, sizeof(path))) < 0) {
+        return NULL;
+    }
+    if ((size_t)len >= sizeof(path)) {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+    return charstr_dupsubstr(path, path + len);
+}
+
+// Resolves a path which does not exist (yet), such as a PID file, by
+// resolving its parent directory instead.  If that does not exist either,
+// returns the path as is, relative to the root directory.
+static char *command_resolve_missing(struct command *cmd,
+                                     int rootfd,
+                                     const char *path)
+{
+    const char *base;
+    char *dir, *str;
+    int fd;
+
+    base = strrchr(path, '/');
+    dir = base > path ? charstr_dupsubstr(path, base) : charstr_dupstr("/");
+    fd = command_open_path(rootfd, dir);
+    fsfree(dir);
+    if (fd < 0 || (dir = command_fd_path(fd)) == NULL) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return charstr_printf("%s%s",
+                              cmd->rootdir != NULL ? cmd->rootdir : "",
+                              path);
+    }
+    close(fd);
+    str = charstr_printf("%s/%s", strcmp(dir, "/") != 0 ? dir : "", base + 1);
+    fsfree(dir);
+    return str;
+}
+
+// Returns true if an open file is a regular file which someone can execute.
+static bool command_fd_executable(int fd)
+{
+    struct stat st;
+
+    return fstat(fd, &st) == 0 && S_ISREG(st.st_mode)
+        && (st.st_mode & (S_IXUSR | S_IXGRP | S_IXOTH)) != 0;
+}
+
+// Resolves a path relative to the command's root and / or working directory,
+// searching the command's PATH if requested and the name does not contain a
+// slash.  Returns the canonical path, including the root directory.  This is
+// done in-process using openat2() with RESOLVE_IN_ROOT rather than by forking
+// a child which calls chroot().
+static char *command_resolve_path(struct command *cmd,
+                                  const char *name,
+                                  bool search)
+{
+    const char *wd, *p, *q;
+    char *path = NULL, *str;
+    int rootfd = -1, fd = -1;
+
+    trace(NC_COMMAND, "resolving %s", name);
+    if (cmd->rootdir != NULL) {
+        rootfd = open(cmd->rootdir, O_PATH | O_DIRECTORY | O_CLOEXEC);
+        if (rootfd < 0) {
+            error("failed to open root directory %s: %m", cmd->rootdir);
+            return NULL;
         }
     }
+    wd = cmd->workdir != NULL ? cmd->workdir : "/";
     // Simple case: no PATH search
     if (!search || strchr(name, '/') != NULL) {
-        debug("resolving name: %s", name);
-        memset(path, 0, sizeof(path));
-        if (realpath(name, path) == NULL && errno != ENOENT) {
-            return -1;
+        if (name[0] == '/') {
+            str = charstr_dupstr(name);
+        } else {
+            str = charstr_printf("%s/%s", wd, name);
+        }
+        trace(NC_COMMAND, "resolving name: %s", str);
+        if ((fd = command_open_path(rootfd, str)) >= 0) {
+            path = command_fd_path(fd);
+        } else if (errno == ENOENT) {
+            path = command_resolve_missing(cmd, rootfd, str);
         }
-        goto found;
+        fsfree(str);
+        goto done;
     }
     // We're going to have to search for it; get PATH
-    environ = strlist_to_vector(environment_list(cmd->env));
-    if ((p = getenv("PATH")) == NULL) {
+    if ((p = environment_get(cmd->env, "PATH")) == NULL) {
         p = _PATH_STDPATH;
     }
     // Iterate over PATH
+    errno = ENOENT;
     do {
         for (q = p; *q != '\0' && *q != ':'; q++) {
             // nothing
         }
-        if (p == q || *p != '/') {
-            goto next;
-        }
-        // Compose full path
-        ret = snprintf(path, sizeof(path), "%.*s/%s", (int)(q - p), p, name);
-        if (ret < 0 || (size_t)ret >= sizeof(path)) {
-            goto next;
-        }
-        // Does it exist?
-        debug("trying %s", path);
-        if (access(path, R_OK | X_OK) == 0) {
-            goto found;
+        if (p != q && *p == '/') {
+            str = charstr_printf("%.*s/%s", (int)(q - p), p, name);
+            trace(NC_COMMAND, "trying %s", str);
+            fd = command_open_path(rootfd, str);
+            fsfree(str);
+            if (fd >= 0 && command_fd_executable(fd)) {
+                path = command_fd_path(fd);
+                goto done;
+            }
+            if (fd >= 0) {
+                close(fd);
+                fd = -1;
+            }
         }
-    next:
         p = q + 1;
     } while (*q != '\0');
     errno = ENOENT;
-    return -1;
-found:
-    debug("found %s%s", root, path);
-    if (write(pd, root, strlen(root)) < 0
-        || write(pd, path, strlen(path)) < 0) {
-        return -1;
-    }
-    return 0;
-}
-
-// Resolve a path relative to the command's root and / or working directory.
-static char *command_resolve_path(struct command *cmd,
-                                  const char *name,
-                                  bool search)
-{
-    char buf[PATH_MAX * 2];
-    ssize_t len;
-    pid_t pid;
-    int p[2], status;
-
-    debug("resolving %s", name);
-    if (!unixkit_pipe(p)) {
-        error("failed to create pipe: %m");
-        return NULL;
-    }
-    if ((pid = fork()) < 0) {
-        error("failed to fork path resolver: %m");
-        goto fail;
-    }
-    if (pid == 0) {
-        // child
-        if (command_resolve_path_child(cmd, name, search, p[1]) < 0) {
-            verbose("failed to resolve path '%s': %m", name);
-            _exit(errno);
-        }
-        _exit(0);
-    }
-    // parent
-    if (waitpid(pid, &status, 0) < 0) {
-        error("failed to collect path resolver: %m");
-        goto fail;
+done:
+    if (path != NULL) {
+        trace(NC_COMMAND, "found %s", path);
+    } else {
+        verbose("failed to resolve path '%s': %m", name);
     }
-    if (!WIFEXITED(status)) {
-        error("path resolver child killed by signal %d", WTERMSIG(status));
-        errno = EINTR; // XXX no better
-        goto fail;
+    if (fd >= 0) {
+        close(fd);
     }
-    errno = WEXITSTATUS(status);
-    if (errno != 0) {
-        error("failed to resolve path: %m");
-        goto fail;
+    if (rootfd >= 0) {
+        close(rootfd);
     }
-    if ((len = read(p[0], buf, sizeof(buf))) < 0) {
-        error("failed to receive result from path resolver: %m");
-        goto fail;
-    }
-    close(p[0]);
-    close(p[1]);
-    return charstr_dupsubstr(buf, buf + len);
-fail:
-    close(p[0]);
-    close(p[1]);
-    return NULL;
+    return path;
 }
 
 // Allocates and populates a command struct based on the contents of a unit
@@ -177,12 +203,11 @@ fail:
 struct command *command_from_service(struct service *svc, const char *cmdkey)
 {
     struct command *cmd;
-    struct passwd *pw;
-    struct group *gr;
+    struct environment *env;
     const char *key, *value;
     list_t *list;
     long num;
-    char *str, *end;
+    char *str, *end, *word;
 
     // Retrieve and split the command line
     value = unit_get_value(svc->u, "Service", cmdkey);
@@ -192,29 +217,50 @@ struct command *command_from_service(struct service *svc, const char *cmdkey)
     }
     cmd = fscalloc(1, sizeof(*cmd));
     cmd->svc = svc;
-    if (strchr(value, '$') != NULL) {
-        warning("variable substitution not implemented");
-    }
-    if (strchr(value, '%') != NULL) {
-        warning("specifiers not implemented");
-    }
     cmd->args = systemd_split_quoted(value);
     if (list_empty(cmd->args)) {
         error("command line empty");
         goto fail;
     }
+    // Specifiers are expanded in each word, so they cannot split it.
+    if (strchr(value, '%') != NULL) {
+        list = cmd->args;
+        cmd->args = make_list();
+        while ((str = DQ(list_pop_first(list))) != NULL) {
+            word = service_expand(svc, str);
+            fsfree(str);
+            if (word == NULL) {
+                strlist_free(list);
+                goto fail;
+            }
+            list_append(cmd->args, word);
+        }
+        destroy_list(list);
+    }
 
     // Prepare the environment
     cmd->env = environment_clone(Denv);
     value = unit_get_value(svc->u, "Service", "Environment");
     if (value != NULL) {
+        // As for the command line, specifiers are expanded in each
+        // assignment after splitting.
         list = systemd_split_quoted(value);
         while ((str = DQ(list_pop_first(list))) != NULL) {
-            environment_put(cmd->env, str, true);
+            word = service_expand(svc, str);
             fsfree(str);
+            if (word == NULL) {
+                strlist_free(list);
+                goto fail;
+            }
+            environment_put(cmd->env, word, true);
+            fsfree(word);
         }
         destroy_list(list);
     }
+    if ((env = service_environment_files(svc)) == NULL) {
+        goto fail;
+    }
+    environment_merge(cmd->env, env, true);
     value = unit_get_value(svc->u, "Service", "PassEnvironment");
     if (value != NULL) {
         list = systemd_split_quoted(value);
@@ -246,24 +292,45 @@ struct command *command_from_service(struct service *svc, const char *cmdkey)
         fsfree(str);
     }
 
+    // Variables are substituted once the environment is complete.
+    value = unit_get_value(svc->u, "Service", cmdkey);
+    if (strchr(value, '$') != NULL) {
+        list = cmd->args;
+        cmd->args = environment_expand_args(cmd->env, list);
+        strlist_free(list);
+    }
+
     // Root directory and working directory
     value = unit_get_value(svc->u, "Service", "RootDirectory");
     if (value != NULL) {
-        cmd->rootdir = charstr_printf("%s%s", root, value);
+        if ((str = service_expand(svc, value)) == NULL) {
+            goto fail;
+        }
+        cmd->rootdir = charstr_printf("%s%s", root, str);
+        fsfree(str);
     }
     value = unit_get_value(svc->u, "Service", "WorkingDirectory");
     if (value != NULL) {
-        cmd->workdir = charstr_printf("%s%s", root, value);
+        if ((str = service_expand(svc, value)) == NULL) {
+            goto fail;
+        }
+        cmd->workdir = charstr_printf("%s%s", root, str);
+        fsfree(str);
     }
 
     // PID file
     value = unit_get_value(svc->u, "Service", "PIDFile");
     if (value != NULL) {
-        cmd->pidfile = command_resolve_path(cmd, value, false);
+        if ((str = service_expand(svc, value)) == NULL) {
+            goto fail;
+        }
+        cmd->pidfile = command_resolve_path(cmd, str, false);
         if (cmd->pidfile == NULL) {
-            error("invalid PID file path %s: %m", value);
+            error("invalid PID file path %s: %m", str);
+            fsfree(str);
             goto fail;
         }
+        fsfree(str);
         environment_set(cmd->env, "PIDFILE", cmd->pidfile, true);
     }
 
@@ -286,33 +353,21 @@ struct command *command_from_service(struct service *svc, const char *cmdkey)
     }
 
     // Credentials
-    value = unit_get_value(svc->u, "Service", "User");
-    if (value != NULL) {
-        // XXX should look this up inside the chroot if there is one
-        if ((pw = getpwnam(value)) == NULL) {
-            error("user '%s' not found", value);
-            goto fail;
-        }
-        cmd->uid = pw->pw_uid;
+    if ((cmd->creds = service_credentials(svc)) == NULL) {
+        goto fail;
+    }
+    cmd->uid = cmd->creds->uid;
+    cmd->gid = cmd->creds->gid;
+    if (cmd->creds->user != NULL) {
         if (cmd->workdir != NULL && cmd->workdir[0] == '~'
             && cmd->workdir[1] == '\0') {
             fsfree(cmd->workdir);
-            cmd->workdir = charstr_dupstr(pw->pw_dir);
-        }
-        environment_set(cmd->env, "USER", pw->pw_name, false);
-        environment_set(cmd->env, "LOGNAME", pw->pw_name, false);
-        environment_set(cmd->env, "HOME", pw->pw_dir, false);
-        environment_set(cmd->env, "SHELL", pw->pw_shell, false);
-    }
-    value = unit_get_value(svc->u, "Service", "Group");
-    if (value != NULL) {
-        // XXX should look this up inside the chroot if there is one
-        if ((gr = getgrnam(value)) == NULL) {
-            error("group '%s' not found", value);
-            goto fail;
+            cmd->workdir = charstr_dupstr(cmd->creds->home);
         }
-        // XXX only primary group for now
-        cmd->gid = gr->gr_gid;
+        environment_set(cmd->env, "USER", cmd->creds->user, false);
+        environment_set(cmd->env, "LOGNAME", cmd->creds->user, false);
+        environment_set(cmd->env, "HOME", cmd->creds->home, false);
+        environment_set(cmd->env, "SHELL", cmd->creds->shell, false);
     }
 
     // File permission mask
@@ -346,6 +401,19 @@ fail:
     return NULL;
 }
 
+// Discards a command's argument and environment vectors.
+static void command_unprepare(struct command *cmd)
+{
+    fsfree(cmd->argv);
+    fsfree(cmd->watchdog_envv);
+    environment_free(cmd->execenv);
+    cmd->argv = NULL;
+    cmd->envv = NULL;
+    cmd->execenv = NULL;
+    cmd->watchdog_envv = NULL;
+    cmd->watchdog_pid = NULL;
+}
+
 void command_free(struct command *cmd)
 {
     if (cmd != NULL) {
@@ -355,63 +423,230 @@ void command_free(struct command *cmd)
         fsfree(cmd->pidfile);
         strlist_free(cmd->args);
         environment_free(cmd->env);
+        command_unprepare(cmd);
         fsfree(cmd);
     }
 }
 
-// Executes a command.  On failure, returns one of the systemd exit codes.
-// Suitable for use with fork_function() or daemonize_function().
-int command_exec_func(void *ptr)
+// Environment variable through which a service with a watchdog learns which
+// process is expected to send keep-alive notifications.
+#define WATCHDOG_PID "WATCHDOG_PID"
+
+// Builds the argument vector for a command in a single allocation, unless it
+// has already been built, so that a service can be restarted without
+// rebuilding it.  The environment vector is that of a copy of the command's
+// environment, which costs nothing.  If watchdog is true, the vector is
+// copied instead, with an extra WATCHDOG_PID entry which belongs to the
+// command rather than to the environment, so the child can fill in its own
+// PID without modifying data it shares with the parent.
+static void command_prepare(struct command *cmd, bool watchdog)
 {
-    struct command *cmd = ptr;
-    list_t *envl;
-    char **argv, **envv;
-
-    // Prepare argument and environment vectors
-    argv = strlist_to_vector(cmd->args);
-    envl = environment_list(cmd->env);
-    envv = strlist_to_vector(envl);
-    strlist_free(envl);
+    list_elem_t *e;
+    char *const *envv;
+    char **ptr, *buf;
+    size_t argc, envc, ssz;
+
+    if (cmd->argv != NULL && (cmd->watchdog_pid != NULL) == watchdog) {
+        return;
+    }
+    command_unprepare(cmd);
+    argc = list_size(cmd->args);
+    ssz = 0;
+    for (e = list_get_first(cmd->args); e != NULL; e = list_next(e)) {
+        ssz += strlen(list_elem_get_value(e)) + 1;
+    }
+    ptr = fscalloc(1, (argc + 1) * sizeof(char *) + ssz);
+    buf = (char *)(ptr + argc + 1);
+    cmd->argv = ptr;
+    for (e = list_get_first(cmd->args); e != NULL; e = list_next(e)) {
+        *ptr++ = buf;
+        buf = stpcpy(buf, list_elem_get_value(e)) + 1;
+    }
+    *ptr = NULL;
+    cmd->execenv = environment_clone(cmd->env);
+    if (!watchdog) {
+        cmd->envv = environment_vector(cmd->execenv);
+    } else {
+        environment_unset(cmd->execenv, WATCHDOG_PID);
+        envv = environment_vector(cmd->execenv);
+        envc = environment_size(cmd->execenv);
+        // the vector, then WATCHDOG_PID= with room for any PID
+        ptr = fscalloc(1,
+                       (envc + 2) * sizeof(char *) + sizeof(WATCHDOG_PID)
+                           + 21);
+        memcpy(ptr, envv, envc * sizeof(char *));
+        buf = (char *)(ptr + envc + 2);
+        ptr[envc] = buf;
+        cmd->watchdog_pid = stpcpy(stpcpy(buf, WATCHDOG_PID), "=");
+        cmd->watchdog_envv = ptr;
+        cmd->envv = ptr;
+    }
+}
+
+// Sets an environment variable for a command, discarding its prepared
+// environment vector if necessary.
+void command_setenv(struct command *cmd, const char *key, const char *value)
+{
+    environment_set(cmd->env, key, value, true);
+    command_unprepare(cmd);
+}
+
+// A command ready to be executed.
+struct command_exec {
+    struct command *cmd;
+    // the executable, opened when the command is prepared, or -1
+    int fd;
+};
+
+// Prepares to execute a command.  Everything that requires memory allocation
+// is done here, before forking or spawning, so that the child only has to make
+// system calls.
+static void command_exec_prepare(struct command *cmd,
+                                 struct command_exec *ce,
+                                 bool watchdog)
+{
+    ce->cmd = cmd;
+    // Pin the executable, so what we run is what we resolved.  If the root
+    // directory changes, we can no longer rely on its path.
+    ce->fd = open(cmd->path, O_PATH | O_CLOEXEC);
+    command_prepare(cmd, watchdog);
+}
+
+static void command_exec_release(struct command_exec *ce)
+{
+    if (ce->fd >= 0) {
+        close(ce->fd);
+    }
+}
+
+// Executes a prepared command.  Only makes async-signal-safe calls, so it is
+// suitable for use with spawn_function().  The only memory it writes to is
+// the value of the command's WATCHDOG_PID entry, which is set aside for it by
+// command_prepare() and not used by the parent.  On failure, returns one of
+// the systemd exit codes with errno set.
+static int command_exec_child(void *ptr)
+{
+    struct command_exec *ce = ptr;
+    struct command *cmd = ce->cmd;
+    char digits[20];
+    unsigned int pid, i;
+
+    if (cmd->watchdog_pid != NULL) {
+        pid = getpid();
+        i = 0;
+        do {
+            digits[i++] = '0' + pid % 10;
+            pid /= 10;
+        } while (pid > 0);
+        for (char *p = cmd->watchdog_pid; i > 0; p++) {
+            *p = digits[--i];
+            p[1] = '\0';
+        }
+    }
     // Change root directory if necessary
     if (cmd->rootdir != NULL) {
         if (chroot(cmd->rootdir) != 0 || chdir("/") != 0) {
-            error("failed to chroot to %s: %m", cmd->rootdir);
             return EXIT_CHROOT;
         }
     }
     // Change working directory if necessary
     if (cmd->workdir != NULL) {
         if (chdir(cmd->workdir) != 0) {
-            error("failed to chdir to %s: %m", cmd->workdir);
             return EXIT_CHDIR;
         }
     }
     // Switch credentials
-    if (cmd->gid != 0 && (cmd->flags & EF_PLUS) == 0) {
-        if (setregid(cmd->gid, cmd->gid) != 0) {
-            error("failed to set primary group to %d: %m", cmd->gid);
+    if ((cmd->flags & EF_PLUS) == 0) {
+        if (cmd->gid != 0 && setregid(cmd->gid, cmd->gid) != 0) {
             return EXIT_GROUP;
         }
-        // XXX only primary group for now
-        if (setgroups(1, &cmd->gid) != 0) {
-            error("failed to set supplemental groups: %m");
+        if (cmd->creds->ngroups >= 0
+            && setgroups(cmd->creds->ngroups, cmd->creds->groups) != 0) {
             return EXIT_GROUP;
         }
-    }
-    if (cmd->uid != 0 && (cmd->flags & EF_PLUS) == 0) {
-        if (setreuid(cmd->uid, cmd->uid) != 0) {
-            error("failed to set uid to %d: %m", cmd->uid);
+        if (cmd->uid != 0 && setreuid(cmd->uid, cmd->uid) != 0) {
             return EXIT_USER;
         }
     }
     // Set file permission mask
     umask(cmd->umask);
-    // And go!
-    execve(cmd->path, argv, envv);
-    error("failed to execute %s: %m", cmd->path);
+    // And go!  The kernel will not execute a script through a close-on-exec
+    // descriptor, as the interpreter would not be able to open it, so fall
+    // back to the path in that case.
+    if (ce->fd >= 0) {
+        syscall(SYS_execveat, ce->fd, "", cmd->argv, cmd->envv, AT_EMPTY_PATH);
+        if (errno != ENOENT && errno != ENOSYS) {
+            return EXIT_EXEC;
+        }
+    }
+    execve(cmd->path, cmd->argv, cmd->envv);
     return EXIT_EXEC;
 }
 
+// Logs the reason a command could not be executed, given the exit code
+// returned by command_exec_child() and the corresponding errno.
+static void command_exec_error(struct command *cmd, int ex)
+{
+    switch (ex) {
+        case EXIT_CHROOT:
+            error("failed to chroot to %s: %m", cmd->rootdir);
+            break;
+        case EXIT_CHDIR:
+            error("failed to chdir to %s: %m", cmd->workdir);
+            break;
+        case EXIT_GROUP:
+            error("failed to set groups for gid %d: %m", cmd->gid);
+            break;
+        case EXIT_USER:
+            error("failed to set uid to %d: %m", cmd->uid);
+            break;
+        case EXIT_EXEC:
+            error("failed to execute %s: %m", cmd->path);
+            break;
+        default:
+            break;
+    }
+}
+
+// Executes a command.  On failure, returns one of the systemd exit codes.
+// Suitable for use with fork_function() or daemonize_function().
+int command_exec_func(void *ptr)
+{
+    struct command_exec ce;
+    struct command *cmd = ptr;
+    int res, serrno;
+
+    command_exec_prepare(cmd, &ce, false);
+    res = command_exec_child(&ce);
+    serrno = errno;
+    command_exec_release(&ce);
+    errno = serrno;
+    command_exec_error(cmd, res);
+    return res;
+}
+
+// Spawns a child process which executes a command, with its standard input,
+// output and error redirected as specified by io if not NULL.  If watchdog is
+// true, the child is given its own PID in WATCHDOG_PID.  Returns the child's
+// PID if successful, a negative value corresponding to a systemd exit code
+// otherwise.
+pid_t command_spawn(struct command *cmd, fork_io *io, bool watchdog)
+{
+    struct command_exec ce;
+    pid_t pid;
+    int serrno;
+
+    command_exec_prepare(cmd, &ce, watchdog);
+    pid = spawn_function(command_exec_child, &ce, io);
+    serrno = errno;
+    command_exec_release(&ce);
+    if (pid < 0) {
+        errno = serrno;
+        command_exec_error(cmd, -pid);
+    }
+    return pid;
+}
+
 pid_t command_getpid(struct command *cmd)
 {
     struct text *text, *word;
@@ -485,7 +720,7 @@ pid_t command_daemonize(struct command *cmd)
 pid_t command_fork(struct command *cmd)
 {
     command_verbose(cmd);
-    return fork_function(command_exec_func, cmd, NULL);
+    return command_spawn(cmd, NULL, false);
 }
 
 // Executes a command and wait for it to terminate.  If successful, returns zero
@@ -497,7 +732,7 @@ int command_run(struct command *cmd)
     pid_t pid;
 
     command_verbose(cmd);
-    pid = fork_function(command_exec_func, cmd, NULL);
+    pid = command_spawn(cmd, NULL, false);
     if (pid < 0) {
         return pid;
     }
@@ -1,10 +1,14 @@
 #pragma once
 
+#include "fork.h"
+
 #include <fsdyn/bytearray.h>
 #include <fsdyn/list.h>
 
+#include <stdbool.h>
 #include <sys/types.h>
 
+struct credentials;
 struct service;
 
 struct command {
@@ -15,9 +19,20 @@ struct command {
     list_t *args;
     struct environment *env;
     unsigned int flags;
+    // cached in the service
+    const struct credentials *creds;
     uid_t uid;
     gid_t gid;
     int umask;
+    // argument vector, built on first use, and the environment it is
+    // executed with and its vector
+    char **argv;
+    struct environment *execenv;
+    char *const *envv;
+    // with a watchdog, a copy of that vector with a WATCHDOG_PID entry, and
+    // the value of that entry, which only the child writes to
+    char **watchdog_envv;
+    char *watchdog_pid;
     // after termination
     int wstatus;
 };
@@ -35,6 +50,8 @@ struct command *command_from_service(struct service *, const char *);
 void command_free(struct command *);
 int command_exec_func(void *);
 pid_t command_fork(struct command *);
+pid_t command_spawn(struct command *, fork_io *, bool);
+void command_setenv(struct command *, const char *, const char *);
 pid_t command_daemonize(struct command *);
 int command_run(struct command *);
 int command_kill(struct command *, int);
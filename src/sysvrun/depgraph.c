@@ -0,0 +1,478 @@
+#include "depgraph.h"
+
+#include "clock.h"
+#include "common.h"
+#include "monitor.h"
+#include "noise.h"
+#include "service.h"
+#include "systemd.h"
+#include "sysvinit.h"
+#include "timespan.h"
+
+#include <fsdyn/charstr.h>
+#include <fsdyn/fsalloc.h>
+#include <fsdyn/hashtable.h>
+#include <fsdyn/list.h>
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// A unit and its place in the start order.
+struct depnode {
+    struct service *svc;
+    // number of nodes which must be up before this one can start
+    unsigned int pending;
+    // scratch counter used to check for cycles
+    unsigned int unresolved;
+    // nodes which are ordered after this one
+    list_t *dependents;
+    // process starting this unit, or 0 if none
+    pid_t pid;
+};
+
+// Extra time allowed for a stop job beyond the unit's TimeoutStopSec, to
+// cover the monitor's own escalation to SIGKILL.
+#define DEPGRAPH_STOP_GRACE (5 * TS_SEC)
+
+// The units a service depends on, or which depend on it, with an edge from
+// each unit to every unit which must be processed after it.
+struct depgraph {
+    depgraph_mode mode;
+    struct depnode *root;
+    // all nodes, in the order they were discovered, and by name
+    list_t *nodes;
+    hash_table_t *names;
+};
+
+static struct depnode *depgraph_add(struct depgraph *dg, struct service *svc)
+{
+    struct depnode *node;
+
+    node = fscalloc(1, sizeof(*node));
+    node->svc = svc;
+    node->dependents = make_list();
+    list_append(dg->nodes, node);
+    hash_table_put(dg->names, svc->name, node);
+    return node;
+}
+
+static struct depnode *depgraph_get(struct depgraph *dg, const char *name)
+{
+    hash_elem_t *he;
+
+    if ((he = hash_table_get(dg->names, name)) == NULL) {
+        return NULL;
+    }
+    return DQ(hash_elem_get_value(he));
+}
+
+// Orders a node relative to every unit in the list which is part of the
+// graph: after them when starting, before them when stopping.
+static void depgraph_order(struct depgraph *dg,
+                           struct depnode *node,
+                           list_t *names)
+{
+    struct depnode *other, *before, *after;
+    list_elem_t *e;
+
+    for (e = list_get_first(names); e != NULL; e = list_next(e)) {
+        if ((other = depgraph_get(dg, list_elem_get_value(e))) == NULL) {
+            continue;
+        }
+        if (dg->mode == DG_START) {
+            before = other;
+            after = node;
+        } else {
+            before = node;
+            after = other;
+        }
+        if (list_get(before->dependents, after) == NULL) {
+            list_append(before->dependents, after);
+            after->pending++;
+        }
+    }
+}
+
+// Checks that the graph has no cycles by removing nodes which have no
+// remaining predecessors until none are left.  Any nodes which are never
+// removed are part of, or ordered after, a cycle.
+static int depgraph_check(struct depgraph *dg)
+{
+    struct depnode *node, *next;
+    list_t *ready;
+    list_elem_t *e;
+    char *names, *tmp;
+    size_t seen = 0;
+
+    ready = make_list();
+    for (e = list_get_first(dg->nodes); e != NULL; e = list_next(e)) {
+        node = DQ(list_elem_get_value(e));
+        if ((node->unresolved = node->pending) == 0) {
+            list_append(ready, node);
+        }
+    }
+    while ((node = DQ(list_pop_first(ready))) != NULL) {
+        seen++;
+        for (e = list_get_first(node->dependents); e != NULL;
+             e = list_next(e)) {
+            next = DQ(list_elem_get_value(e));
+            if (--next->unresolved == 0) {
+                list_append(ready, next);
+            }
+        }
+    }
+    destroy_list(ready);
+    if (seen == list_size(dg->nodes)) {
+        return 0;
+    }
+    names = charstr_dupstr("");
+    for (e = list_get_first(dg->nodes); e != NULL; e = list_next(e)) {
+        node = DQ(list_elem_get_value(e));
+        if (node->unresolved > 0) {
+            tmp = charstr_printf("%s %s", names, node->svc->name);
+            fsfree(names);
+            names = tmp;
+        }
+    }
+    error("dependency cycle involving:%s", names);
+    fsfree(names);
+    errno = ELOOP;
+    return -1;
+}
+
+// Adds every unit required, directly or indirectly, by the units already in
+// the graph.
+static int depgraph_add_required(struct depgraph *dg)
+{
+    struct depnode *node;
+    struct service *req;
+    const char *name;
+    list_elem_t *e, *f;
+
+    // The list grows as we walk it, so this visits every unit exactly once.
+    for (e = list_get_first(dg->nodes); e != NULL; e = list_next(e)) {
+        node = DQ(list_elem_get_value(e));
+        for (f = list_get_first(node->svc->required); f != NULL;
+             f = list_next(f)) {
+            name = list_elem_get_value(f);
+            if (depgraph_get(dg, name) != NULL) {
+                continue;
+            }
+            if ((req = service_find(name)) == NULL) {
+                if (errno == ENOENT) {
+                    error("service '%s' not found", name);
+                }
+                return -1;
+            }
+            debug("%s requires %s", node->svc->name, name);
+            depgraph_add(dg, req);
+        }
+    }
+    return 0;
+}
+
+// Loads every unit which has a systemd unit file or an init script of ours
+// and indexes them by the names of the units they require.  Units which fail
+// to load are skipped.  Returns a table mapping each required name to a list
+// of the units which require it; the units in the lists are owned by the list
+// of all units, which is returned in *allp.
+static hash_table_t *depgraph_index(struct service *svc, list_t **allp)
+{
+    hash_table_t *seen, *index;
+    hash_elem_t *he;
+    struct service *dep;
+    list_t *names, *all, *users;
+    list_elem_t *e;
+    const char *name;
+
+    seen = make_hash_table(64, (void *)hash_string, (void *)strcmp);
+    index = make_hash_table(64, (void *)hash_string, (void *)strcmp);
+    all = make_list();
+    names = systemd_list_services();
+    while ((name = list_pop_first(names)) != NULL) {
+        list_append(all, name);
+    }
+    destroy_list(names);
+    names = sysvinit_list_services();
+    while ((name = list_pop_first(names)) != NULL) {
+        list_append(all, name);
+    }
+    destroy_list(names);
+    // Replace each name with the unit it refers to, skipping duplicates and
+    // the service we are indexing for.
+    hash_table_put(seen, svc->name, svc);
+    names = all;
+    all = make_list();
+    while ((name = list_pop_first(names)) != NULL) {
+        if (hash_table_get(seen, name) != NULL) {
+            fsfree(DQ(name));
+            continue;
+        }
+        dep = service_find(name);
+        if (dep == NULL) {
+            debug("skipping %s: %m", name);
+            fsfree(DQ(name));
+            continue;
+        }
+        fsfree(DQ(name));
+        hash_table_put(seen, dep->name, dep);
+        list_append(all, dep);
+        for (e = list_get_first(dep->required); e != NULL; e = list_next(e)) {
+            name = list_elem_get_value(e);
+            if ((he = hash_table_get(index, name)) == NULL) {
+                users = make_list();
+                hash_table_put(index, name, users);
+            } else {
+                users = DQ(hash_elem_get_value(he));
+            }
+            list_append(users, dep);
+        }
+    }
+    destroy_list(names);
+    destroy_hash_table(seen);
+    *allp = all;
+    return index;
+}
+
+// Adds every unit which requires, directly or indirectly, the units already
+// in the graph.
+static void depgraph_add_requiring(struct depgraph *dg)
+{
+    hash_table_t *index;
+    hash_elem_t *he;
+    struct depnode *node;
+    struct service *dep;
+    list_t *all, *users;
+    list_elem_t *e, *f;
+
+    index = depgraph_index(dg->root->svc, &all);
+    // The list grows as we walk it, so this visits every unit exactly once.
+    for (e = list_get_first(dg->nodes); e != NULL; e = list_next(e)) {
+        node = DQ(list_elem_get_value(e));
+        if ((he = hash_table_get(index, node->svc->name)) == NULL) {
+            continue;
+        }
+        users = DQ(hash_elem_get_value(he));
+        for (f = list_get_first(users); f != NULL; f = list_next(f)) {
+            dep = DQ(list_elem_get_value(f));
+            if (depgraph_get(dg, dep->name) == NULL) {
+                debug("%s is required by %s", node->svc->name, dep->name);
+                depgraph_add(dg, dep);
+            }
+        }
+    }
+    // Units which made it into the graph are now owned by it.
+    while ((dep = DQ(list_pop_first(all))) != NULL) {
+        if (depgraph_get(dg, dep->name) == NULL) {
+            service_free(dep);
+        }
+    }
+    destroy_list(all);
+    while ((he = hash_table_pop_any(index)) != NULL) {
+        destroy_list(DQ(hash_elem_get_value(he)));
+        destroy_hash_element(he);
+    }
+    destroy_hash_table(index);
+}
+
+// Builds the graph of the units a service depends on.  When starting, the
+// graph contains the units the service requires, directly or indirectly, and
+// each unit is ordered after the units it requires.  When stopping, it
+// contains the units which require the service, directly or indirectly, and
+// each unit is ordered before the units it requires.  In both cases, units
+// are also ordered relative to the units they should be started after if
+// those are part of the graph.  Returns NULL and sets errno if one of the
+// units cannot be found or if the graph contains a cycle.  The service itself
+// remains the property of the caller.
+struct depgraph *depgraph_create(struct service *svc, depgraph_mode mode)
+{
+    struct depgraph *dg;
+    struct depnode *node;
+    list_elem_t *e;
+    int serrno;
+
+    dg = fscalloc(1, sizeof(*dg));
+    dg->mode = mode;
+    dg->nodes = make_list();
+    dg->names = make_hash_table(16, (void *)hash_string, (void *)strcmp);
+    dg->root = depgraph_add(dg, svc);
+    if (mode == DG_START) {
+        if (depgraph_add_required(dg) != 0) {
+            goto fail;
+        }
+    } else {
+        depgraph_add_requiring(dg);
+    }
+    for (e = list_get_first(dg->nodes); e != NULL; e = list_next(e)) {
+        node = DQ(list_elem_get_value(e));
+        depgraph_order(dg, node, node->svc->required);
+        depgraph_order(dg, node, node->svc->should);
+    }
+    if (depgraph_check(dg) != 0) {
+        goto fail;
+    }
+    return dg;
+fail:
+    serrno = errno;
+    depgraph_free(dg);
+    errno = serrno;
+    return NULL;
+}
+
+// Returns the number of seconds a job may run before it is killed, or zero if
+// there is no limit.  Stopping a unit may take up to its TimeoutStopSec, after
+// which the monitor kills it, so a layer of units being stopped together
+// takes no longer than the largest TimeoutStopSec among them.
+static unsigned int depgraph_job_timeout(struct depgraph *dg,
+                                         struct depnode *node)
+{
+    usec_t timeout = node->svc->stop_timeout;
+
+    if (dg->mode != DG_STOP || timeout == 0 || timeout == TS_INFINITY) {
+        return 0;
+    }
+    return us2s(timeout + DEPGRAPH_STOP_GRACE + TS_SEC - 1);
+}
+
+// Forks a process which applies the function to a node's unit.
+static int depgraph_fork(struct depgraph *dg,
+                         struct depnode *node,
+                         depgraph_func func)
+{
+    int res;
+
+    // don't let the child inherit anything we haven't printed yet
+    fflush(NULL);
+    if ((node->pid = fork()) < 0) {
+        error("failed to fork: %m");
+        node->pid = 0;
+        return -1;
+    }
+    if (node->pid == 0) {
+        // child: the parent's connections to monitors are not ours to use
+        monitor_control_disconnect();
+        // the default action for SIGALRM is to terminate
+        alarm(depgraph_job_timeout(dg, node));
+        res = func(node->svc);
+        fflush(NULL);
+        _exit(res);
+    }
+    debug("%s: started job %d", node->svc->name, (int)node->pid);
+    return 0;
+}
+
+// Applies the function, which starts or stops a service, to every unit in
+// the graph other than the one it was created for.  Each unit is processed in
+// a separate process as soon as every unit it is ordered after has been
+// processed, so independent units are processed concurrently.  When stopping,
+// each job is killed if it takes longer than the unit's TimeoutStopSec plus a
+// grace period.  If the function fails for a unit being started, the units
+// ordered after it are skipped, but those already in progress are allowed to
+// finish; a unit which fails to stop does not prevent the others from being
+// stopped.  Returns 0 if the function succeeded for every unit and -1
+// otherwise.
+int depgraph_run(struct depgraph *dg, depgraph_func func)
+{
+    struct depnode *node, *next;
+    const char *verb, *done;
+    list_t *ready;
+    list_elem_t *e;
+    unsigned int running = 0;
+    int status, ret = 0;
+    bool halt = false;
+    pid_t pid;
+
+    if (dg->mode == DG_START) {
+        verb = "start";
+        done = "started";
+    } else {
+        verb = "stop";
+        done = "stopped";
+    }
+    ready = make_list();
+    for (e = list_get_first(dg->nodes); e != NULL; e = list_next(e)) {
+        node = DQ(list_elem_get_value(e));
+        if (node != dg->root && node->pending == 0) {
+            list_append(ready, node);
+        }
+    }
+    for (;;) {
+        while (!halt && (node = DQ(list_pop_first(ready))) != NULL) {
+            if (depgraph_fork(dg, node, func) != 0) {
+                ret = -1;
+                halt = true;
+                break;
+            }
+            running++;
+        }
+        if (running == 0) {
+            break;
+        }
+        if ((pid = waitpid(-1, &status, 0)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            error("failed to collect job: %m");
+            ret = -1;
+            break;
+        }
+        for (e = list_get_first(dg->nodes); e != NULL; e = list_next(e)) {
+            node = DQ(list_elem_get_value(e));
+            if (node->pid == pid) {
+                break;
+            }
+        }
+        if (e == NULL) {
+            // not one of ours
+            continue;
+        }
+        node->pid = 0;
+        running--;
+        if (WIFSIGNALED(status) && WTERMSIG(status) == SIGALRM) {
+            error("timed out waiting for %s to %s", node->svc->name, verb);
+            ret = -1;
+        } else if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+            error("failed to %s %s", verb, node->svc->name);
+            ret = -1;
+        } else {
+            info("%s %s", done, node->svc->name);
+        }
+        if (ret != 0 && dg->mode == DG_START) {
+            halt = true;
+            continue;
+        }
+        for (e = list_get_first(node->dependents); e != NULL;
+             e = list_next(e)) {
+            next = DQ(list_elem_get_value(e));
+            if (--next->pending == 0 && next != dg->root) {
+                list_append(ready, next);
+            }
+        }
+    }
+    destroy_list(ready);
+    return ret;
+}
+
+void depgraph_free(struct depgraph *dg)
+{
+    struct depnode *node;
+
+    if (dg == NULL) {
+        return;
+    }
+    while ((node = DQ(list_pop_first(dg->nodes))) != NULL) {
+        if (node != dg->root) {
+            service_free(node->svc);
+        }
+        destroy_list(node->dependents);
+        fsfree(node);
+    }
+    destroy_list(dg->nodes);
+    destroy_hash_table(dg->names);
+    fsfree(dg);
+}
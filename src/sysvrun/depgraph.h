@@ -0,0 +1,15 @@
+#pragma once
+
+struct depgraph;
+struct service;
+
+typedef enum {
+    DG_START,
+    DG_STOP,
+} depgraph_mode;
+
+typedef int (*depgraph_func)(struct service *);
+
+struct depgraph *depgraph_create(struct service *, depgraph_mode);
+int depgraph_run(struct depgraph *, depgraph_func);
+void depgraph_free(struct depgraph *);
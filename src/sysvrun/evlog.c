@@ -0,0 +1,334 @@
+#include "evlog.h"
+
+#include "clock.h"
+#include "monitor.h"
+#include "noise.h"
+#include "service.h"
+#include "strbool.h"
+
+#include <fsdyn/charstr.h>
+#include <fsdyn/fsalloc.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// The event log is a fixed-size ring of fixed-size records in a file which
+// is mapped into the monitor's address space.  Since the mapping is shared,
+// every record that has been written is in the page cache and will survive
+// the monitor crashing, at the cost of a single memory copy per event.
+
+struct evlog {
+    struct evlog_header *hdr;
+    struct evlog_record *rec;
+    size_t size;
+};
+
+static const char *evlog_type_names[EV_MAX] = {
+    [EV_NONE] = "none",   [EV_START] = "start", [EV_STOP] = "stop",
+    [EV_STATE] = "state", [EV_FORK] = "fork",   [EV_EXEC] = "exec",
+    [EV_EXIT] = "exit",   [EV_KILL] = "kill",   [EV_CONTROL] = "control",
+    [EV_WATCHDOG] = "watchdog",
+};
+
+static const char *evlog_control_results[] = {
+    [EVC_OK] = "ok",
+    [EVC_DENIED] = "denied",
+    [EVC_ERROR] = "error",
+};
+
+// Returns the path of the event log for the specified service.  If the
+// SYSVKIT_EVENT_LOG environment variable is an absolute path, it names either
+// the log file or a directory in which to create sysvrun.<service>.evlog;
+// otherwise, if it is true, the log file is created in /var/log.  If it is
+// unset or false, returns NULL unless the fallback flag is set, in which case
+// the /var/log location is returned regardless.
+char *evlog_path(struct service *svc, bool fallback)
+{
+    struct stat sb;
+    const char *path;
+
+    path = getenv(EVLOG_ENVVAR);
+    if (path == NULL || *path != '/') {
+        if (!fallback && strbool(path) <= 0) {
+            return NULL;
+        }
+        path = EVLOG_DEFAULT_DIR;
+    }
+    if (stat(path, &sb) == 0 && S_ISDIR(sb.st_mode)) {
+        return charstr_printf("%s/sysvrun.%s.evlog", path, svc->name);
+    }
+    return charstr_dupstr(path);
+}
+
+// Opens the specified event log, creating or reinitializing it if it does not
+// exist or does not match the requested capacity.  An existing log is
+// appended to, so that events leading up to a crash are preserved when the
+// service is restarted.
+struct evlog *evlog_open(const char *path, uint32_t capacity, const char *name)
+{
+    struct evlog *evl;
+    struct stat sb;
+    void *map;
+    size_t size;
+    int fd, serrno;
+
+    size = sizeof(struct evlog_header) + capacity * sizeof(struct evlog_record);
+    if ((fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0640)) < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &sb) != 0
+        || ((size_t)sb.st_size != size && ftruncate(fd, size) != 0)) {
+        goto fail;
+    }
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        goto fail;
+    }
+    close(fd);
+    evl = fsalloc(sizeof(*evl));
+    evl->hdr = map;
+    evl->rec = (struct evlog_record *)(evl->hdr + 1);
+    evl->size = size;
+    if (memcmp(evl->hdr->magic, EVLOG_MAGIC, sizeof(evl->hdr->magic)) != 0
+        || evl->hdr->version != EVLOG_VERSION
+        || evl->hdr->record_size != sizeof(struct evlog_record)
+        || evl->hdr->capacity != capacity) {
+        debug("initializing event log %s", path);
+        memset(map, 0, size);
+        memcpy(evl->hdr->magic, EVLOG_MAGIC, sizeof(evl->hdr->magic));
+        evl->hdr->version = EVLOG_VERSION;
+        evl->hdr->record_size = sizeof(struct evlog_record);
+        evl->hdr->capacity = capacity;
+    }
+    snprintf(evl->hdr->name, sizeof(evl->hdr->name), "%s", name);
+    return evl;
+fail:
+    serrno = errno;
+    close(fd);
+    errno = serrno;
+    return NULL;
+}
+
+// Closes an event log.
+void evlog_close(struct evlog *evl)
+{
+    if (evl != NULL) {
+        munmap(evl->hdr, evl->size);
+        fsfree(evl);
+    }
+}
+
+// Claims the next record, invalidating it until evlog_commit() is called.
+static struct evlog_record *evlog_claim(struct evlog *evl,
+                                        evlog_type type,
+                                        pid_t pid)
+{
+    struct evlog_record *rec;
+
+    rec = &evl->rec[evl->hdr->head % evl->hdr->capacity];
+    __atomic_store_n(&rec->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    rec->time = clock_realtime_usec();
+    rec->type = type;
+    rec->flags = 0;
+    rec->pid = pid;
+    return rec;
+}
+
+// Publishes a record previously obtained from evlog_claim().
+static void evlog_commit(struct evlog *evl, struct evlog_record *rec)
+{
+    uint64_t head = evl->hdr->head + 1;
+
+    __atomic_store_n(&rec->seq, (uint32_t)head, __ATOMIC_RELEASE);
+    __atomic_store_n(&evl->hdr->head, head, __ATOMIC_RELEASE);
+}
+
+// Appends an event with up to two numeric arguments to the log.  Does nothing
+// if the log is NULL.
+void evlog_write(struct evlog *evl,
+                 evlog_type type,
+                 pid_t pid,
+                 int32_t arg0,
+                 int32_t arg1)
+{
+    struct evlog_record *rec;
+
+    if (evl == NULL) {
+        return;
+    }
+    rec = evlog_claim(evl, type, pid);
+    rec->data.arg[0] = arg0;
+    rec->data.arg[1] = arg1;
+    rec->data.arg[2] = 0;
+    evlog_commit(evl, rec);
+}
+
+// Appends an event with flags and a short string argument, which will be
+// truncated if necessary, to the log.  Does nothing if the log is NULL.
+void evlog_write_str(struct evlog *evl,
+                     evlog_type type,
+                     pid_t pid,
+                     int flags,
+                     const char *str)
+{
+    struct evlog_record *rec;
+
+    if (evl == NULL) {
+        return;
+    }
+    rec = evlog_claim(evl, type, pid);
+    rec->flags = flags;
+    memset(rec->data.str, 0, sizeof(rec->data.str));
+    memcpy(rec->data.str, str, strnlen(str, sizeof(rec->data.str)));
+    evlog_commit(evl, rec);
+}
+
+// Prints a single record in human-readable form.
+static void evlog_print_record(const struct evlog_record *rec, FILE *f)
+{
+    char tbuf[32];
+    struct tm tm;
+    time_t t;
+    int arg0 = rec->data.arg[0];
+
+    t = rec->time / 1000000;
+    strftime(tbuf, sizeof(tbuf), "%Y-%m-%d %H:%M:%S", localtime_r(&t, &tm));
+    fprintf(f,
+            "%s.%06llu %10u %-8s",
+            tbuf,
+            (unsigned long long)rec->time % 1000000,
+            rec->seq,
+            rec->type < EV_MAX ? evlog_type_names[rec->type] : "unknown");
+    switch (rec->type) {
+        case EV_START:
+        case EV_STOP:
+            fprintf(f, " monitor %d", rec->pid);
+            break;
+        case EV_STATE:
+            fprintf(f,
+                    " %s -> %s",
+                    monitor_state_name(arg0),
+                    monitor_state_name(rec->data.arg[1]));
+            break;
+        case EV_FORK:
+            fprintf(f, " %d -> %d", arg0, rec->pid);
+            break;
+        case EV_EXEC:
+            fprintf(f, " %d", rec->pid);
+            break;
+        case EV_EXIT:
+            if (WIFEXITED(arg0)) {
+                fprintf(f, " %d status %d", rec->pid, WEXITSTATUS(arg0));
+            } else if (WIFSIGNALED(arg0)) {
+                fprintf(f,
+                        " %d signal %d (%s)%s",
+                        rec->pid,
+                        WTERMSIG(arg0),
+                        strsignal(WTERMSIG(arg0)),
+                        WCOREDUMP(arg0) ? " (core dumped)" : "");
+            } else {
+                fprintf(f, " %d wstatus 0x%04x", rec->pid, arg0);
+            }
+            break;
+        case EV_KILL:
+            fprintf(f, " %d signal %d (%s)", rec->pid, arg0, strsignal(arg0));
+            break;
+        case EV_CONTROL:
+            fprintf(f,
+                    " %d \"%.*s\" %s",
+                    rec->pid,
+                    (int)sizeof(rec->data.str),
+                    rec->data.str,
+                    rec->flags <= EVC_ERROR ? evlog_control_results[rec->flags]
+                                            : "?");
+            break;
+        case EV_WATCHDOG:
+            fprintf(f, " %d timeout %d ms", rec->pid, arg0);
+            break;
+        default:
+            fprintf(f, " %d", rec->pid);
+            break;
+    }
+    fprintf(f, "\n");
+}
+
+// Copies a record out of the log.  Returns true if the copy is consistent and
+// is the record with the expected sequence number, and false if it is
+// incomplete or has been overwritten.
+static bool evlog_read_record(const struct evlog_record *rec,
+                              uint32_t seq,
+                              struct evlog_record *copy)
+{
+    if (__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) != seq) {
+        return false;
+    }
+    *copy = *rec;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&rec->seq, __ATOMIC_RELAXED) == seq;
+}
+
+// Prints the contents of the specified event log, oldest record first.
+// Returns zero on success and -1 on failure.
+int evlog_print(const char *path, FILE *f)
+{
+    const struct evlog_header *hdr;
+    const struct evlog_record *rec;
+    struct evlog_record copy;
+    struct stat sb;
+    void *map;
+    uint64_t head, n;
+    int fd, serrno;
+
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+        return -1;
+    }
+    if (fstat(fd, &sb) != 0) {
+        goto fail;
+    }
+    if ((size_t)sb.st_size < sizeof(*hdr)) {
+        errno = EINVAL;
+        goto fail;
+    }
+    map = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        goto fail;
+    }
+    close(fd);
+    hdr = map;
+    if (memcmp(hdr->magic, EVLOG_MAGIC, sizeof(hdr->magic)) != 0
+        || hdr->version != EVLOG_VERSION
+        || hdr->record_size != sizeof(*rec) || hdr->capacity == 0
+        || sizeof(*hdr) + hdr->capacity * sizeof(*rec) > (size_t)sb.st_size) {
+        munmap(map, sb.st_size);
+        errno = EINVAL;
+        return -1;
+    }
+    rec = (const struct evlog_record *)(hdr + 1);
+    head = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+    verbose("%s: %.*s, %llu events, capacity %u",
+            path,
+            (int)sizeof(hdr->name),
+            hdr->name,
+            (unsigned long long)head,
+            hdr->capacity);
+    for (n = head > hdr->capacity ? head - hdr->capacity : 0; n < head; n++) {
+        if (evlog_read_record(&rec[n % hdr->capacity], n + 1, &copy)) {
+            evlog_print_record(&copy, f);
+        }
+    }
+    munmap(map, sb.st_size);
+    return 0;
+fail:
+    serrno = errno;
+    close(fd);
+    errno = serrno;
+    return -1;
+}
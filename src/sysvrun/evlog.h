@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#define EVLOG_ENVVAR "SYSVKIT_EVENT_LOG"
+#define EVLOG_DEFAULT_DIR "/var/log"
+#define EVLOG_MAGIC "SVKEVLOG"
+#define EVLOG_VERSION 1
+#define EVLOG_CAPACITY 4096
+
+struct service;
+
+typedef enum {
+    EV_NONE,
+    EV_START,    // monitor started
+    EV_STOP,     // monitor stopped
+    EV_STATE,    // state transition: arg[0] = old, arg[1] = new
+    EV_FORK,     // process forked: arg[0] = parent
+    EV_EXEC,     // process executed a program
+    EV_EXIT,     // process terminated: arg[0] = wait status
+    EV_KILL,     // signal sent: arg[0] = signal
+    EV_CONTROL,  // control request: flags = result, str = request
+    EV_WATCHDOG, // watchdog expired: arg[0] = timeout in ms
+    //
+    EV_MAX
+} evlog_type;
+
+typedef enum {
+    EVC_OK,
+    EVC_DENIED,
+    EVC_ERROR,
+} evlog_control_result;
+
+// A single fixed-size record.  The sequence number is written last, so a
+// reader can detect records that were being written when the writer died or
+// that were overwritten while being read.
+struct evlog_record {
+    uint64_t time; // CLOCK_REALTIME, in microseconds
+    uint32_t seq;  // one more than the record's position in the stream
+    uint16_t type;
+    uint16_t flags;
+    int32_t pid;
+    union {
+        int32_t arg[3];
+        char str[12];
+    } data;
+};
+
+// The file header, followed by an array of capacity records.
+struct evlog_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t capacity;
+    uint32_t reserved;
+    uint64_t head; // number of records written since the file was created
+    char name[32];
+};
+
+struct evlog;
+
+char *evlog_path(struct service *, bool);
+struct evlog *evlog_open(const char *, uint32_t, const char *);
+void evlog_close(struct evlog *);
+void evlog_write(struct evlog *, evlog_type, pid_t, int32_t, int32_t);
+void evlog_write_str(struct evlog *, evlog_type, pid_t, int, const char *);
+int evlog_print(const char *, FILE *);
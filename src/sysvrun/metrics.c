@@ -0,0 +1,467 @@
+#define _GNU_SOURCE
+
+#include "metrics.h"
+
+#include "clock.h"
+#include "ctlquery.h"
+#include "monitor.h"
+#include "noise.h"
+#include "sysvrun.h"
+
+#include <fsdyn/fsalloc.h>
+
+#include <errno.h>
+#include <netdb.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define METRICS_PREFIX "sysvkit_"
+#define METRICS_CONTENT_TYPE "text/plain; version=0.0.4; charset=utf-8"
+#define METRICS_DEFAULT_HOST "127.0.0.1"
+
+// A metric derived from a key in the response to a monitor's stats request.
+// Consecutive entries with the same name share a single HELP and TYPE line
+// and are distinguished by their label.
+struct metric {
+    const char *key;
+    const char *name;
+    const char *type;
+    const char *help;
+    const char *label;
+    double scale;
+};
+
+static const struct metric metrics[] = {
+    { "pid", "main_pid", "gauge", "Main process ID", NULL, 1 },
+    { "processes", "processes", "gauge", "Tracked processes", NULL, 1 },
+    { "uptime",
+      "monitor_uptime_seconds",
+      "gauge",
+      "Time since the monitor started",
+      NULL,
+      1e-6 },
+    { "active_time",
+      "active_seconds",
+      "gauge",
+      "Time since the main process started",
+      NULL,
+      1e-6 },
+    { "restarts",
+      "restarts_total",
+      "counter",
+      "Automatic restarts",
+      NULL,
+      1 },
+    { "restart_delay",
+      "restart_delay_seconds",
+      "gauge",
+      "Delay before the most recent restart",
+      NULL,
+      1e-6 },
+    { "last_exit_code",
+      "last_exit_code",
+      "gauge",
+      "Exit status of the previous main process",
+      NULL,
+      1 },
+    { "last_exit_signal",
+      "last_exit_signal",
+      "gauge",
+      "Signal which terminated the previous main process",
+      NULL,
+      1 },
+    { "stdout_bytes",
+      "log_bytes_total",
+      "counter",
+      "Bytes read from the service's output streams",
+      "stream=\"stdout\"",
+      1 },
+    { "stderr_bytes",
+      "log_bytes_total",
+      "counter",
+      NULL,
+      "stream=\"stderr\"",
+      1 },
+    { "stdout_lines",
+      "log_lines_total",
+      "counter",
+      "Lines logged from the service's output streams",
+      "stream=\"stdout\"",
+      1 },
+    { "stderr_lines",
+      "log_lines_total",
+      "counter",
+      NULL,
+      "stream=\"stderr\"",
+      1 },
+    { "procwatch_events",
+      "procwatch_events_total",
+      "counter",
+      "Process events received, by kind",
+      "kind=\"all\"",
+      1 },
+    { "procwatch_ignored",
+      "procwatch_events_total",
+      "counter",
+      NULL,
+      "kind=\"ignored\"",
+      1 },
+    { "procwatch_forks",
+      "procwatch_events_total",
+      "counter",
+      NULL,
+      "kind=\"fork\"",
+      1 },
+    { "procwatch_execs",
+      "procwatch_events_total",
+      "counter",
+      NULL,
+      "kind=\"exec\"",
+      1 },
+    { "procwatch_setsids",
+      "procwatch_events_total",
+      "counter",
+      NULL,
+      "kind=\"setsid\"",
+      1 },
+    { "procwatch_exits",
+      "procwatch_events_total",
+      "counter",
+      NULL,
+      "kind=\"exit\"",
+      1 },
+    { "procwatch_drops",
+      "procwatch_events_total",
+      "counter",
+      NULL,
+      "kind=\"drop\"",
+      1 },
+    { "procwatch_connects",
+      "procwatch_connects_total",
+      "counter",
+      "Connections to the process event connector",
+      NULL,
+      1 },
+};
+
+// Finds a key in a flat JSON object and returns a pointer to its value, or
+// NULL if it is not present.
+static const char *metrics_json_find(const char *json, const char *key)
+{
+    size_t len = strlen(key);
+    const char *p;
+
+    for (p = json; (p = strchr(p, '"')) != NULL; p++) {
+        if (strncmp(p + 1, key, len) == 0 && p[len + 1] == '"'
+            && p[len + 2] == ':') {
+            p += len + 3;
+            while (*p == ' ') {
+                p++;
+            }
+            return p;
+        }
+    }
+    return NULL;
+}
+
+// Appends a label value, escaped as required by the exposition format.
+static void metrics_label_value(byte_array_t *ba, const char *str)
+{
+    for (const char *p = str; *p != '\0'; p++) {
+        if (*p == '"' || *p == '\\') {
+            byte_array_appendf(ba, "\\%c", *p);
+        } else if (*p == '\n') {
+            byte_array_appendf(ba, "\\n");
+        } else {
+            byte_array_appendf(ba, "%c", *p);
+        }
+    }
+}
+
+// Appends a sample for a single service.
+static void metrics_sample(byte_array_t *ba,
+                           const char *name,
+                           const char *service,
+                           const char *label,
+                           double value)
+{
+    byte_array_appendf(ba, METRICS_PREFIX "%s{service=\"", name);
+    metrics_label_value(ba, service);
+    byte_array_appendf(ba,
+                       "\"%s%s} %.15g\n",
+                       label != NULL ? "," : "",
+                       label != NULL ? label : "",
+                       value);
+}
+
+// Appends the HELP and TYPE lines for a metric.
+static void metrics_header(byte_array_t *ba,
+                           const char *name,
+                           const char *type,
+                           const char *help)
+{
+    byte_array_appendf(ba, "# HELP " METRICS_PREFIX "%s %s\n", name, help);
+    byte_array_appendf(ba, "# TYPE " METRICS_PREFIX "%s %s\n", name, type);
+}
+
+// Discovers all running monitors, queries them in parallel and returns their
+// statistics in the Prometheus text exposition format, or NULL on error.
+byte_array_t *metrics_collect(void)
+{
+    struct ctlquery *queries;
+    const struct metric *m;
+    byte_array_t *ba;
+    const char *p, *q;
+    char label[64], state[32];
+    usec_t t0;
+    size_t n;
+    int ok;
+
+    t0 = clock_usec();
+    if ((queries = ctlquery_discover(self_base, &n)) == NULL) {
+        return NULL;
+    }
+    if ((ok = ctlquery_run(self_base,
+                           queries,
+                           n,
+                           "stats",
+                           ms2us(METRICS_TIMEOUT_MS)))
+        < 0) {
+        ctlquery_free(queries, n);
+        return NULL;
+    }
+    ba = make_byte_array(SIZE_MAX);
+    metrics_header(ba, "up", "gauge", "Whether the monitor responded");
+    for (size_t i = 0; i < n; i++) {
+        metrics_sample(ba,
+                       "up",
+                       queries[i].name,
+                       NULL,
+                       queries[i].response != NULL
+                           && queries[i].response[0] == '{');
+    }
+    metrics_header(ba, "state", "gauge", "Current state of the service");
+    for (size_t i = 0; i < n; i++) {
+        if (queries[i].response == NULL
+            || (p = metrics_json_find(queries[i].response, "state")) == NULL
+            || *p++ != '"' || (q = strchr(p, '"')) == NULL
+            || (size_t)(q - p) >= sizeof(state)) {
+            continue;
+        }
+        memcpy(state, p, q - p);
+        state[q - p] = '\0';
+        for (monitor_state s = 0; s < MS_NUM_STATES; s++) {
+            snprintf(label,
+                     sizeof(label),
+                     "state=\"%s\"",
+                     monitor_state_name(s));
+            metrics_sample(ba,
+                           "state",
+                           queries[i].name,
+                           label,
+                           strcmp(state, monitor_state_name(s)) == 0);
+        }
+    }
+    for (m = metrics; m < metrics + sizeof(metrics) / sizeof(*metrics); m++) {
+        if (m->help != NULL) {
+            metrics_header(ba, m->name, m->type, m->help);
+        }
+        for (size_t i = 0; i < n; i++) {
+            if (queries[i].response != NULL
+                && (p = metrics_json_find(queries[i].response, m->key))
+                    != NULL) {
+                metrics_sample(ba,
+                               m->name,
+                               queries[i].name,
+                               m->label,
+                               strtod(p, NULL) * m->scale);
+            }
+        }
+    }
+    metrics_header(ba, "scrape_monitors", "gauge", "Monitors discovered");
+    byte_array_appendf(ba, METRICS_PREFIX "scrape_monitors %zu\n", n);
+    metrics_header(ba,
+                   "scrape_duration_seconds",
+                   "gauge",
+                   "Time taken to discover and query all monitors");
+    byte_array_appendf(ba,
+                       METRICS_PREFIX "scrape_duration_seconds %.6f\n",
+                       (clock_usec() - t0) / 1e6);
+    verbose("collected metrics from %d of %zu monitors in %llu us",
+            ok,
+            n,
+            clock_usec() - t0);
+    ctlquery_free(queries, n);
+    return ba;
+}
+
+// Prints metrics for all running monitors.
+int metrics_print(FILE *f)
+{
+    byte_array_t *ba;
+
+    if ((ba = metrics_collect()) == NULL) {
+        error("failed to collect metrics: %m");
+        return EXIT_FAILURE;
+    }
+    fwrite(byte_array_data(ba), 1, byte_array_size(ba), f);
+    destroy_byte_array(ba);
+    return fflush(f) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Creates a listening socket.  The address is either the path of a Unix
+// socket, an abstract Unix socket name prefixed with @, or a TCP port number,
+// optionally preceded by a numeric host address and a colon; the default host
+// is the IPv4 loopback address.
+static int metrics_listen(const char *addr)
+{
+    struct addrinfo hints = {}, *ai;
+    struct sockaddr_un sun = { .sun_family = AF_UNIX };
+    struct stat sb;
+    const char *colon;
+    char *host;
+    int one = 1, res, sd, serrno;
+
+    if (*addr == '/' || *addr == '@') {
+        if (strlen(addr) >= sizeof(sun.sun_path)) {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        memcpy(sun.sun_path, addr, strlen(addr));
+        if (*addr == '@') {
+            sun.sun_path[0] = '\0';
+        } else if (lstat(addr, &sb) == 0 && S_ISSOCK(sb.st_mode)) {
+            // stale socket from a previous run
+            (void)unlink(addr);
+        }
+        if ((sd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
+            return -1;
+        }
+        if (bind(sd,
+                 (struct sockaddr *)&sun,
+                 offsetof(struct sockaddr_un, sun_path) + strlen(addr))
+            != 0) {
+            goto fail;
+        }
+    } else {
+        if ((colon = strrchr(addr, ':')) != NULL) {
+            host = fsalloc(colon - addr + 1);
+            memcpy(host, addr, colon - addr);
+            host[colon - addr] = '\0';
+            addr = colon + 1;
+        } else {
+            host = fsalloc(sizeof(METRICS_DEFAULT_HOST));
+            memcpy(host, METRICS_DEFAULT_HOST, sizeof(METRICS_DEFAULT_HOST));
+        }
+        hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+        hints.ai_socktype = SOCK_STREAM;
+        // strip brackets around an IPv6 address
+        if (host[0] == '[' && host[strlen(host) - 1] == ']') {
+            host[strlen(host) - 1] = '\0';
+            res = getaddrinfo(host + 1, addr, &hints, &ai);
+        } else {
+            res = getaddrinfo(host, addr, &hints, &ai);
+        }
+        fsfree(host);
+        if (res != 0) {
+            error("invalid listen address: %s", gai_strerror(res));
+            errno = EINVAL;
+            return -1;
+        }
+        sd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, 0);
+        if (sd < 0) {
+            freeaddrinfo(ai);
+            return -1;
+        }
+        (void)setsockopt(sd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        res = bind(sd, ai->ai_addr, ai->ai_addrlen);
+        freeaddrinfo(ai);
+        if (res != 0) {
+            goto fail;
+        }
+    }
+    if (listen(sd, 8) != 0) {
+        goto fail;
+    }
+    return sd;
+fail:
+    serrno = errno;
+    close(sd);
+    errno = serrno;
+    return -1;
+}
+
+// Answers a single HTTP request.  Since the only thing we serve is the
+// metrics, the request line and headers are read but not inspected.
+static void metrics_respond(int sd)
+{
+    struct timeval tv = { .tv_sec = 1 };
+    char req[4096], hdr[256];
+    byte_array_t *ba;
+    size_t len = 0;
+    ssize_t res;
+    int n;
+
+    (void)setsockopt(sd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    while (len < sizeof(req) - 1) {
+        if ((res = read(sd, req + len, sizeof(req) - 1 - len)) <= 0) {
+            return;
+        }
+        len += res;
+        req[len] = '\0';
+        if (strstr(req, "\r\n\r\n") != NULL || strstr(req, "\n\n") != NULL) {
+            break;
+        }
+    }
+    debug("request: %.*s", (int)strcspn(req, "\r\n"), req);
+    if ((ba = metrics_collect()) == NULL) {
+        error("failed to collect metrics: %m");
+        n = snprintf(hdr,
+                     sizeof(hdr),
+                     "HTTP/1.0 500 Internal Server Error\r\n"
+                     "Content-Length: 0\r\n\r\n");
+        (void)send(sd, hdr, n, MSG_NOSIGNAL);
+        return;
+    }
+    n = snprintf(hdr,
+                 sizeof(hdr),
+                 "HTTP/1.0 200 OK\r\n"
+                 "Content-Type: " METRICS_CONTENT_TYPE "\r\n"
+                 "Content-Length: %zu\r\n\r\n",
+                 byte_array_size(ba));
+    if (send(sd, hdr, n, MSG_NOSIGNAL | MSG_MORE) == n) {
+        (void)send(sd, byte_array_data(ba), byte_array_size(ba), MSG_NOSIGNAL);
+    }
+    destroy_byte_array(ba);
+}
+
+// Serves metrics over HTTP on the given address until killed.  Requests are
+// answered one at a time, since each one already queries all monitors in
+// parallel.
+int metrics_serve(const char *addr)
+{
+    int sd, cd;
+
+    if ((sd = metrics_listen(addr)) < 0) {
+        error("failed to listen on %s: %m", addr);
+        return EXIT_FAILURE;
+    }
+    verbose("serving metrics on %s", addr);
+    for (;;) {
+        if ((cd = accept4(sd, NULL, NULL, SOCK_CLOEXEC)) < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            error("failed to accept connection: %m");
+            break;
+        }
+        metrics_respond(cd);
+        close(cd);
+    }
+    close(sd);
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <fsdyn/bytearray.h>
+
+#include <stdio.h>
+
+#define METRICS_TIMEOUT_MS 1000
+
+byte_array_t *metrics_collect(void);
+int metrics_print(FILE *);
+int metrics_serve(const char *);
@@ -4,6 +4,8 @@
 
 #include "clock.h"
 #include "command.h"
+#include "common.h"
+#include "evlog.h"
 #include "fork.h"
 #include "noise.h"
 #include "proctitle.h"
@@ -12,18 +14,24 @@
 #include "strbool.h"
 #include "systemd.h"
 #include "sysvrun.h"
+#include "timespan.h"
 
+#include <fsdyn/bytearray.h>
 #include <fsdyn/charstr.h>
 #include <fsdyn/fsalloc.h>
+#include <fsdyn/hashtable.h>
 
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <paths.h>
 #include <stdarg.h>
 #include <sys/poll.h>
+#include <sys/random.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/timerfd.h>
 #include <sys/un.h>
 #include <sys/wait.h>
 #include <syslog.h>
@@ -33,37 +41,97 @@
 #define POLLFD(_fd, _events) \
     (struct pollfd) { .fd = (_fd), .events = (_events) }
 
-#define MONITOR_CONTROL_VERSION 20220303
+#define MONITOR_CONTROL_VERSION 20261018
 #define MONITOR_CONTROL_BANNER_FORMAT "{\"version\": \"%u\"}"
-#define MONITOR_CONTROL_MAX_SESSION_DURATION (100 * 1000 /* 100 ms */)
+#define MONITOR_CONTROL_MAX_CLIENTS 16
+// first version to support persistent connections and request IDs
+#define MONITOR_CONTROL_PIPELINE_VERSION 20261018
+
+#define MONITOR_NOTIFY_SUFFIX "/notify"
+#define MONITOR_NOTIFY_MAX_FDS 16
 
 #define MONITOR_POLL_INTERVAL ms2us(500)
 #define MONITOR_KILL_INTERVAL s2us(3)
 
+struct monitor_conn {
+    int fd;
+    struct ucred cred;
+    bool privileged;
+    // the client asked to be told about state changes
+    bool watching;
+    // time of last request, for eviction
+    usec_t active;
+    // partial request
+    size_t len;
+    char buf[1024];
+};
+
+// Output logged from one of the service's streams.
+struct monitor_stream_stats {
+    unsigned long long bytes;
+    unsigned long long lines;
+};
+
 struct monitor {
     struct service *svc;
     struct command *cmd;
+    // svc and cmd were reloaded by the monitor, which must free them
+    bool reloaded;
+    // service and command loaded by daemon-reload, to be used from the next
+    // time the service starts
+    struct service *next_svc;
+    struct command *next_cmd;
+    // time the monitor started and number of restarts since
+    usec_t started;
+    unsigned long restarts;
     usec_t *start_times;
     usec_t start_limit_interval;
     unsigned long start_limit_burst;
     unsigned int start_time_cursor;
+    // restart backoff: consecutive automatic restarts, the current delay and
+    // the time the current run started or the next one will start
+    unsigned int restart_step;
+    usec_t restart_delay;
+    usec_t run_time;
     fork_io io;
     pid_t child;
     pid_t pid, sid;
     int wstatus;
+    // wait status of the previous main process, or -1 if none
+    int last_wstatus;
+    struct monitor_stream_stats out_stats, err_stats;
     monitor_state state;
+    // readiness has been reported to our parent
+    bool ready;
+    // the service is stopping because of a failure
+    bool failed;
+    // Type=notify: deadline for READY=1, or 0 if none
+    usec_t start_deadline;
     // control socket
     struct sockaddr_un sockaddr;
     socklen_t socklen;
     int sock;
+    struct monitor_conn conns[MONITOR_CONTROL_MAX_CLIENTS];
+    // notify socket, or -1 if disabled
+    struct sockaddr_un notify_addr;
+    socklen_t notify_len;
+    int notify;
+    // last status text received from the service
+    char *status;
+    // watchdog timer, or -1 if disabled, and its current timeout
+    int watchdog;
+    usec_t watchdog_usec;
+    bool watchdog_expired;
+    // event log, or NULL if disabled
+    struct evlog *evlog;
 };
 
 static const char *monitor_state_names[MS_NUM_STATES] = {
     [MS_IDLE] = "idle",           [MS_RESTARTING] = "restarting",
     [MS_STARTING] = "starting",   [MS_RUNNING] = "running",
-    [MS_REMAINING] = "remaining", [MS_STOPPING] = "stopping",
-    [MS_STOPPED] = "stopped",     [MS_FAILED] = "failed",
-    [MS_DEAD] = "dead",
+    [MS_REMAINING] = "remaining", [MS_RELOADING] = "reloading",
+    [MS_STOPPING] = "stopping",   [MS_STOPPED] = "stopped",
+    [MS_FAILED] = "failed",       [MS_DEAD] = "dead",
 };
 
 monitor_state monitor_state_from_name(const char *name)
@@ -97,7 +165,23 @@ static inline bool monitor_is_stopping(struct monitor *mon)
     return mon->state == MS_RESTARTING || mon->state == MS_STOPPING;
 }
 
-socklen_t monitor_socket_addr(struct service *svc, struct sockaddr_un *sun)
+// Returns true if the service is starting, running or reloading.
+static inline bool monitor_is_active(struct monitor *mon)
+{
+    return mon->state == MS_STARTING || mon->state == MS_RUNNING
+        || mon->state == MS_REMAINING || mon->state == MS_RELOADING;
+}
+
+// Returns true if the monitor is about to exit.
+static inline bool monitor_is_done(struct monitor *mon)
+{
+    return mon->state == MS_STOPPED || mon->state == MS_FAILED
+        || mon->state == MS_DEAD;
+}
+
+static socklen_t monitor_socket_addr_suffix(struct service *svc,
+                                            const char *suffix,
+                                            struct sockaddr_un *sun)
 {
     int res;
 
@@ -110,11 +194,12 @@ socklen_t monitor_socket_addr(struct service *svc, struct sockaddr_un *sun)
     // last close).
     res = snprintf(sun->sun_path,
                    sizeof(sun->sun_path),
-                   "%c%s/%s%s",
+                   "%c%s/%s%s%s",
                    '\0',
                    self_base,
                    svc->name,
-                   DOT_SERVICE);
+                   DOT_SERVICE,
+                   suffix);
     if (res < 0) {
         return 0;
     }
@@ -125,6 +210,43 @@ socklen_t monitor_socket_addr(struct service *svc, struct sockaddr_un *sun)
     return offsetof(struct sockaddr_un, sun_path) + res;
 }
 
+socklen_t monitor_socket_addr(struct service *svc, struct sockaddr_un *sun)
+{
+    return monitor_socket_addr_suffix(svc, "", sun);
+}
+
+static void monitor_control_conn_close(struct monitor_conn *conn)
+{
+    trace(NC_CONTROL, "(%d) closing", conn->fd);
+    close(conn->fd);
+    conn->fd = -1;
+    conn->watching = false;
+}
+
+// Sends the new state to every control connection which has sent a `watch`
+// request.  A client which can't keep up is disconnected.
+static void monitor_control_broadcast(struct monitor *mon)
+{
+    char buf[32];
+    int len;
+
+    len = snprintf(buf,
+                   sizeof(buf),
+                   "%s\r\n",
+                   monitor_state_name(mon->state));
+    for (unsigned int i = 0; i < MONITOR_CONTROL_MAX_CLIENTS; i++) {
+        if (!mon->conns[i].watching) {
+            continue;
+        }
+        trace(NC_CONTROL, "(%d) >\"%.*s\"", mon->conns[i].fd, len - 2, buf);
+        if (send(mon->conns[i].fd, buf, len, MSG_NOSIGNAL | MSG_DONTWAIT)
+            != len) {
+            error("control(%d): error: %m", mon->conns[i].fd);
+            monitor_control_conn_close(&mon->conns[i]);
+        }
+    }
+}
+
 static void monitor_set_state(struct monitor *mon, monitor_state state)
 {
     const char *argv[3];
@@ -134,7 +256,9 @@ static void monitor_set_state(struct monitor *mon, monitor_state state)
         verbose("monitor state %s -> %s",
                 monitor_state_name(mon->state),
                 monitor_state_name(state));
+        evlog_write(mon->evlog, EV_STATE, mon->pid, mon->state, state);
         mon->state = state;
+        monitor_control_broadcast(mon);
     }
     argv[0] = self_base;
     argv[1] = mon->svc->name;
@@ -142,16 +266,28 @@ static void monitor_set_state(struct monitor *mon, monitor_state state)
     set_argv(3, argv);
 }
 
+// Signal our parent that the service is ready.
+static void monitor_report_ready(struct monitor *mon)
+{
+    if (!mon->ready) {
+        report_ready();
+        mon->ready = true;
+    }
+}
+
 static int monitor_control_listen(struct monitor *mon)
 {
     int serrno;
 
+    for (unsigned int i = 0; i < MONITOR_CONTROL_MAX_CLIENTS; i++) {
+        mon->conns[i].fd = -1;
+    }
     mon->socklen = monitor_socket_addr(mon->svc, &mon->sockaddr);
     if (mon->socklen == 0) {
         return -1;
     }
     debug("creating control socket %s", mon->sockaddr.sun_path + 1);
-    if ((mon->sock = socket(AF_UNIX, SOCK_STREAM, 0)) < 0
+    if ((mon->sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0
         || bind(mon->sock, (struct sockaddr *)&mon->sockaddr, mon->socklen) != 0
         || listen(mon->sock, 8) != 0) {
         goto fail;
@@ -169,140 +305,793 @@ fail:
 
 static void monitor_control_close(struct monitor *mon)
 {
+    for (unsigned int i = 0; i < MONITOR_CONTROL_MAX_CLIENTS; i++) {
+        if (mon->conns[i].fd >= 0) {
+            monitor_control_conn_close(&mon->conns[i]);
+        }
+    }
     close(mon->sock);
     mon->sock = -1;
 }
 
-static int monitor_control_socket_ingest(struct monitor *mon)
+// Adds a pollfd for each open control connection to the array, which must have
+// room for MONITOR_CONTROL_MAX_CLIENTS entries.  Returns the number of entries
+// added.
+static unsigned int monitor_control_pollfds(struct monitor *mon,
+                                            struct pollfd *pfds)
 {
-    char buf[4096];
-    struct ucred ccred;
-    struct sockaddr_un sun;
-    struct pollfd pfds[1];
-    const char *str;
+    unsigned int n = 0;
+
+    for (unsigned int i = 0; i < MONITOR_CONTROL_MAX_CLIENTS; i++) {
+        if (mon->conns[i].fd >= 0) {
+            pfds[n++] = POLLFD(mon->conns[i].fd, POLLIN);
+        }
+    }
+    return n;
+}
+
+// Accepts a new control connection and sends the banner.  If all slots are in
+// use, the least recently active connection is closed to make room; its client
+// will simply reconnect.  Returns -1 if the listening socket failed, 0
+// otherwise.
+static int monitor_control_accept(struct monitor *mon)
+{
+    char buf[128];
+    struct monitor_conn *conn;
     socklen_t len;
-    ssize_t res;
-    usec_t deadline, now;
-    int csock;
-    bool privileged;
+    int csock, res;
 
-    debug("control socket %d ready", mon->sock);
-    len = sizeof(sun);
-    if ((csock = accept(mon->sock, (struct sockaddr *)&sun, &len)) < 0) {
+    trace(NC_CONTROL, "socket %d ready", mon->sock);
+    csock = accept4(mon->sock, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (csock < 0) {
+        if (errno == EAGAIN || errno == EINTR || errno == ECONNABORTED) {
+            return 0;
+        }
         error("failed to accept control client connection: %m");
         return -1;
     }
-    debug("control(%d): accepted", csock);
-    len = sizeof(ccred);
-    if (getsockopt(csock, SOL_SOCKET, SO_PEERCRED, &ccred, &len) != 0) {
+    trace(NC_CONTROL, "(%d) accepted", csock);
+    conn = &mon->conns[0];
+    for (unsigned int i = 0; i < MONITOR_CONTROL_MAX_CLIENTS; i++) {
+        if (mon->conns[i].fd < 0) {
+            conn = &mon->conns[i];
+            break;
+        }
+        if (mon->conns[i].active < conn->active) {
+            conn = &mon->conns[i];
+        }
+    }
+    if (conn->fd >= 0) {
+        trace(NC_CONTROL, "(%d) evicted", conn->fd);
+        monitor_control_conn_close(conn);
+    }
+    len = sizeof(conn->cred);
+    if (getsockopt(csock, SOL_SOCKET, SO_PEERCRED, &conn->cred, &len) != 0) {
         error("control(%d): failed to get credentials: %m", csock);
         close(csock);
-        return -1;
+        return 0;
     }
-    debug("control(%d) pid %u uid %u gid %u",
+    trace(NC_CONTROL,
+          "(%d) pid %u uid %u gid %u",
           csock,
-          (unsigned int)ccred.pid,
-          (unsigned int)ccred.uid,
-          (unsigned int)ccred.gid);
-    if (ccred.uid == 0 || ccred.uid == mon->cmd->uid) {
-        debug("control client is privileged");
-        privileged = true;
+          (unsigned int)conn->cred.pid,
+          (unsigned int)conn->cred.uid,
+          (unsigned int)conn->cred.gid);
+    if (conn->cred.uid == 0 || conn->cred.uid == mon->cmd->uid) {
+        trace(NC_CONTROL, "(%d) client is privileged", csock);
+        conn->privileged = true;
     } else {
-        privileged = false;
+        conn->privileged = false;
     }
     res = snprintf(buf,
                    sizeof(buf) - 2,
                    MONITOR_CONTROL_BANNER_FORMAT,
                    MONITOR_CONTROL_VERSION);
-    debug("control(%d): >\"%s\"", csock, buf);
+    trace(NC_CONTROL, "(%d) >\"%s\"", csock, buf);
     buf[res++] = '\r';
     buf[res++] = '\n';
-    buf[res] = '\0';
-    if (write(csock, buf, res) < 0) {
-        goto csockerr;
+    if (send(csock, buf, res, MSG_NOSIGNAL) != res) {
+        error("control(%d): error: %m", csock);
+        close(csock);
+        return 0;
+    }
+    conn->fd = csock;
+    conn->watching = false;
+    conn->len = 0;
+    conn->active = clock_usec();
+    return 0;
+}
+
+// Appends a string to a byte array as a JSON string literal.
+static bool monitor_json_string(byte_array_t *ba, const char *str)
+{
+    if (!byte_array_appendf(ba, "\"")) {
+        return false;
+    }
+    for (const unsigned char *p = (const unsigned char *)str; *p; p++) {
+        if (*p == '"' || *p == '\\') {
+            if (!byte_array_appendf(ba, "\\%c", *p)) {
+                return false;
+            }
+        } else if (*p < ' ') {
+            if (!byte_array_appendf(ba, "\\u%04x", *p)) {
+                return false;
+            }
+        } else if (!byte_array_appendf(ba, "%c", *p)) {
+            return false;
+        }
     }
-    pfds[0] = POLLFD(csock, POLLIN);
+    return byte_array_appendf(ba, "\"");
+}
+
+// Formats the monitor's statistics as a single-line JSON object with flat
+// keys, so that it can be scraped without a full JSON parser.  Times are in
+// microseconds; start_times lists the age of each start remembered for the
+// purpose of enforcing the start limit, oldest first.  Returns the provided
+// buffer, or NULL if it is too small.
+static const char *monitor_control_stats(struct monitor *mon,
+                                         char *resp,
+                                         size_t size)
+{
+    struct procwatch_stats pws;
+    byte_array_t *ba;
+    const char *sep;
+    usec_t now, t;
+    bool ok = true;
+
+#define STATS_APPEND(...)                               \
+    do {                                                \
+        ok = ok && byte_array_appendf(ba, __VA_ARGS__); \
+    } while (0)
     now = clock_usec();
-    deadline = now + MONITOR_CONTROL_MAX_SESSION_DURATION;
-    while (now < deadline) {
-        debug("control(%d): %llu us until deadline", csock, deadline - now);
-        res = poll(pfds, sizeof(pfds) / sizeof(pfds[0]), us2ms(deadline - now));
-        if (res < 0) {
-            goto csockerr;
+    procwatch_get_stats(&pws);
+    ba = make_byte_array(size - 1);
+    STATS_APPEND("{\"state\": \"%s\"", monitor_state_name(mon->state));
+    STATS_APPEND(", \"pid\": %d, \"sid\": %d", (int)mon->pid, (int)mon->sid);
+    STATS_APPEND(", \"processes\": %zu", process_count());
+    STATS_APPEND(", \"uptime\": %llu", now - mon->started);
+    if (mon->pid > 0 && monitor_is_active(mon) && now > mon->run_time) {
+        STATS_APPEND(", \"active_time\": %llu", now - mon->run_time);
+    }
+    STATS_APPEND(", \"restarts\": %lu", mon->restarts);
+    STATS_APPEND(", \"restart_step\": %u", mon->restart_step);
+    STATS_APPEND(", \"restart_delay\": %llu", mon->restart_delay);
+    if (mon->start_times != NULL) {
+        STATS_APPEND(", \"start_limit_burst\": %lu", mon->start_limit_burst);
+        STATS_APPEND(", \"start_limit_interval\": %llu",
+                     mon->start_limit_interval);
+        STATS_APPEND(", \"start_times\": [");
+        sep = "";
+        for (unsigned int i = 0; i < mon->start_limit_burst; i++) {
+            t = mon->start_times[(mon->start_time_cursor + i)
+                                 % mon->start_limit_burst];
+            if (t != 0) {
+                STATS_APPEND("%s%llu", sep, now > t ? now - t : 0);
+                sep = ", ";
+            }
         }
-        if (res == 0) {
-            break;
+        STATS_APPEND("]");
+    }
+    if (mon->last_wstatus >= 0) {
+        STATS_APPEND(", \"last_wstatus\": %d", mon->last_wstatus);
+        if (WIFEXITED(mon->last_wstatus)) {
+            STATS_APPEND(", \"last_exit_code\": %d",
+                         WEXITSTATUS(mon->last_wstatus));
+        } else if (WIFSIGNALED(mon->last_wstatus)) {
+            STATS_APPEND(", \"last_exit_signal\": %d",
+                         WTERMSIG(mon->last_wstatus));
         }
-        res = read(csock, buf, sizeof(buf));
-        if (res < 0) {
-            goto csockerr;
+    }
+    STATS_APPEND(", \"stdout_bytes\": %llu, \"stdout_lines\": %llu",
+                 mon->out_stats.bytes,
+                 mon->out_stats.lines);
+    STATS_APPEND(", \"stderr_bytes\": %llu, \"stderr_lines\": %llu",
+                 mon->err_stats.bytes,
+                 mon->err_stats.lines);
+    STATS_APPEND(", \"procwatch_events\": %llu, \"procwatch_ignored\": %llu",
+                 pws.events,
+                 pws.ignored);
+    STATS_APPEND(", \"procwatch_forks\": %llu, \"procwatch_execs\": %llu",
+                 pws.forks,
+                 pws.execs);
+    STATS_APPEND(", \"procwatch_setsids\": %llu, \"procwatch_exits\": %llu",
+                 pws.setsids,
+                 pws.exits);
+    STATS_APPEND(", \"procwatch_drops\": %llu, \"procwatch_connects\": %llu",
+                 pws.drops,
+                 pws.connects);
+    if (mon->status != NULL) {
+        STATS_APPEND(", \"status\": ");
+        ok = ok && monitor_json_string(ba, mon->status);
+    }
+    STATS_APPEND("}");
+#undef STATS_APPEND
+    if (ok) {
+        memcpy(resp, byte_array_data(ba), byte_array_size(ba));
+        resp[byte_array_size(ba)] = '\0';
+    }
+    destroy_byte_array(ba);
+    return ok ? resp : NULL;
+}
+
+// Reloads the service's unit file and drop-ins.  The new service and command
+// replace the current ones the next time the service is started, see
+// monitor_reload_apply(), so a running service keeps the settings it was
+// started with.  Changes which would require the notify socket to be set up
+// again are refused.
+static int monitor_reload(struct monitor *mon)
+{
+    struct service *svc;
+    struct command *cmd;
+    char *value;
+
+    if (mon->svc->path == NULL) {
+        errno = ENOENT;
+        return -1;
+    }
+    if ((svc = service_from_file(mon->svc->name, mon->svc->path)) == NULL) {
+        return -1;
+    }
+    if (svc->type != mon->svc->type
+        || svc->notify_access != mon->svc->notify_access) {
+        warning("type or notify access changed, restart required");
+        service_free(svc);
+        errno = EINVAL;
+        return -1;
+    }
+    if ((cmd = command_from_service(svc, "ExecStart")) == NULL) {
+        service_free(svc);
+        return -1;
+    }
+    if (mon->notify >= 0) {
+        value = charstr_printf("@%s", mon->notify_addr.sun_path + 1);
+        command_setenv(cmd, "NOTIFY_SOCKET", value);
+        fsfree(value);
+        if (svc->watchdog_timeout > 0) {
+            value = charstr_printf("%llu", svc->watchdog_timeout);
+            command_setenv(cmd, "WATCHDOG_USEC", value);
+            fsfree(value);
         }
-        if (res == 0) {
-            // closed
-            break;
+    }
+    if (mon->next_cmd != NULL) {
+        command_free(mon->next_cmd);
+        service_free(mon->next_svc);
+    }
+    mon->next_svc = svc;
+    mon->next_cmd = cmd;
+    return 0;
+}
+
+// Executes a single control request and returns the response, which is either
+// a static string or the provided buffer.
+static const char *monitor_control_request(struct monitor *mon,
+                                           struct monitor_conn *conn,
+                                           const char *req,
+                                           char *resp,
+                                           size_t size)
+{
+    evlog_control_result result;
+    const char *str;
+    unsigned int mask;
+    int csock = conn->fd;
+    bool privileged = conn->privileged;
+
+    trace(NC_CONTROL, "(%d) <\"%s\"", csock, req);
+    str = "denied";
+    if (strcmp(req, "status") == 0) {
+        verbose("control(%d): status requested", csock);
+        if (mon->state < MS_NUM_STATES) {
+            str = monitor_state_name(mon->state);
+        } else {
+            str = "unknown";
+        }
+    } else if (strcmp(req, "watch") == 0) {
+        verbose("control(%d): state changes requested", csock);
+        conn->watching = true;
+        str = monitor_state_name(mon->state);
+    } else if (strcmp(req, "stop") == 0) {
+        if (privileged) {
+            verbose("control(%d): stop requested", csock);
+            if (mon->state != MS_STOPPING && !monitor_is_done(mon)) {
+                monitor_set_state(mon, MS_STOPPING);
+            }
+            str = "ok";
         }
-        while (res > 0 && isspace((unsigned char)buf[res - 1])) {
-            buf[--res] = '\0';
+    } else if (strcmp(req, "restart") == 0) {
+        if (privileged) {
+            verbose("control(%d): restart requested", csock);
+            monitor_set_state(mon, MS_RESTARTING);
+            // A manual restart starts over from RestartSec.
+            mon->restart_step = 0;
+            str = "ok";
         }
-        debug("control(%d): <\"%s\"", csock, buf);
-        str = "denied";
-        if (strcmp(buf, "status") == 0) {
-            verbose("control(%d): status requested", csock);
-            if (mon->state < MS_NUM_STATES) {
-                str = monitor_state_name(mon->state);
+    } else if (strcmp(req, "daemon-reload") == 0) {
+        if (privileged) {
+            verbose("control(%d): reload of unit files requested", csock);
+            if (monitor_reload(mon) == 0) {
+                str = "ok";
             } else {
-                str = "unknown";
+                error("control(%d): reload failed: %m", csock);
+                str = "error";
             }
-        } else if (strcmp(buf, "stop") == 0) {
-            if (privileged) {
-                verbose("control(%d): stop requested", csock);
-                if (mon->state < MS_STOPPING) {
-                    monitor_set_state(mon, MS_STOPPING);
-                }
+        }
+    } else if (strcmp(req, "stats") == 0) {
+        verbose("control(%d): statistics requested", csock);
+        if ((str = monitor_control_stats(mon, resp, size)) == NULL) {
+            error("control(%d): statistics do not fit", csock);
+            str = "error";
+        }
+    } else if (strcmp(req, "noise=debug") == 0) {
+        if (privileged) {
+            noisy = DEBUG;
+            str = "ok";
+        }
+    } else if (strcmp(req, "noise=verbose") == 0) {
+        if (privileged) {
+            noisy = VERBOSE;
+            str = "ok";
+        }
+    } else if (strcmp(req, "noise=normal") == 0) {
+        if (privileged) {
+            noisy = NORMAL;
+            str = "ok";
+        }
+    } else if (strncmp(req, "trace=", 6) == 0) {
+        if (privileged) {
+            mask = 0;
+            if (noise_trace_parse(req + 6, &mask) == 0) {
+                noise_trace = mask;
                 str = "ok";
+            } else {
+                str = "error";
             }
-        } else if (strcmp(buf, "restart") == 0) {
-            if (privileged) {
-                verbose("control(%d): restart requested", csock);
-                monitor_set_state(mon, MS_RESTARTING);
-                str = "ok";
+        }
+    } else {
+        str = "error";
+    }
+    if (strcmp(str, "denied") == 0) {
+        result = EVC_DENIED;
+    } else if (strcmp(str, "error") == 0) {
+        result = EVC_ERROR;
+    } else {
+        result = EVC_OK;
+    }
+    evlog_write_str(mon->evlog, EV_CONTROL, conn->cred.pid, result, req);
+    trace(NC_CONTROL, "(%d) >\"%s\"", csock, str);
+    return str;
+}
+
+// Reads from a control connection and executes every complete request
+// received.  A request may be prefixed with an identifier of the form #<id>
+// followed by a space, which is echoed in the response, so a client can send
+// several requests at once and match up the responses.  All responses to a
+// single read are sent back in a single write unless they do not fit in the
+// output buffer.  Closes the connection on EOF or error.
+static void monitor_control_conn_ingest(struct monitor *mon,
+                                        struct monitor_conn *conn)
+{
+    char out[8192];
+    char resp[4096];
+    const char *id, *str;
+    char *line, *eol, *p;
+    size_t olen;
+    ssize_t res;
+    int idlen, n;
+
+    res = read(conn->fd, conn->buf + conn->len, sizeof(conn->buf) - conn->len);
+    if (res < 0 && (errno == EAGAIN || errno == EINTR)) {
+        return;
+    }
+    if (res <= 0) {
+        if (res < 0) {
+            error("control(%d): error: %m", conn->fd);
+        }
+        monitor_control_conn_close(conn);
+        return;
+    }
+    conn->len += res;
+    conn->active = clock_usec();
+    olen = 0;
+    line = conn->buf;
+    while ((eol = memchr(line, '\n', conn->buf + conn->len - line)) != NULL) {
+        for (p = eol; p > line && isspace((unsigned char)p[-1]); p--) {
+            // nothing
+        }
+        *p = '\0';
+        id = NULL;
+        idlen = 0;
+        if (*line == '#') {
+            id = line;
+            idlen = strcspn(line, " ");
+            line += idlen;
+            if (*line == ' ') {
+                line++;
             }
-        } else if (strcmp(buf, "noise=debug") == 0) {
-            if (privileged) {
-                noisy = DEBUG;
-                str = "ok";
+        }
+        str = monitor_control_request(mon, conn, line, resp, sizeof(resp));
+        if (conn->fd < 0) {
+            // A change of state was broadcast to this connection, which was
+            // watching, and the send failed.
+            return;
+        }
+        if (olen + idlen + strlen(str) + 3 >= sizeof(out)) {
+            // flush what we have to make room
+            if (send(conn->fd, out, olen, MSG_NOSIGNAL) != (ssize_t)olen) {
+                error("control(%d): error: %m", conn->fd);
+                monitor_control_conn_close(conn);
+                return;
             }
-        } else if (strcmp(buf, "noise=verbose") == 0) {
-            if (privileged) {
-                noisy = VERBOSE;
-                str = "ok";
+            olen = 0;
+        }
+        n = snprintf(out + olen,
+                     sizeof(out) - olen,
+                     "%.*s%s%s\r\n",
+                     idlen,
+                     id != NULL ? id : "",
+                     id != NULL ? " " : "",
+                     str);
+        if (n < 0 || (size_t)n >= sizeof(out) - olen) {
+            error("control(%d): response too long", conn->fd);
+            monitor_control_conn_close(conn);
+            return;
+        }
+        olen += n;
+        line = eol + 1;
+    }
+    conn->len -= line - conn->buf;
+    memmove(conn->buf, line, conn->len);
+    if (conn->len == sizeof(conn->buf)) {
+        error("control(%d): request too long", conn->fd);
+        monitor_control_conn_close(conn);
+        return;
+    }
+    if (olen > 0 && send(conn->fd, out, olen, MSG_NOSIGNAL) != (ssize_t)olen) {
+        error("control(%d): error: %m", conn->fd);
+        monitor_control_conn_close(conn);
+    }
+}
+
+// Serves the control socket and connections after a poll().  The pollfds must
+// be those filled in by monitor_control_pollfds() before the call, preceded by
+// the one for the listening socket.  Returns -1 if the listening socket
+// failed, 0 otherwise.
+static int monitor_control_ingest(struct monitor *mon,
+                                  struct pollfd *pfds,
+                                  unsigned int npfds)
+{
+    for (unsigned int i = 1; i < npfds; i++) {
+        if (!pfds[i].revents) {
+            continue;
+        }
+        for (unsigned int j = 0; j < MONITOR_CONTROL_MAX_CLIENTS; j++) {
+            if (mon->conns[j].fd == pfds[i].fd) {
+                monitor_control_conn_ingest(mon, &mon->conns[j]);
+                break;
             }
-        } else if (strcmp(buf, "noise=normal") == 0) {
-            if (privileged) {
-                noisy = NORMAL;
-                str = "ok";
+        }
+    }
+    if (pfds[0].revents) {
+        return monitor_control_accept(mon);
+    }
+    return 0;
+}
+
+// Creates the notify socket if the service may send notifications, and passes
+// its address to the service in the NOTIFY_SOCKET environment variable.  Like
+// the control socket, it is an abstract socket, so it is reachable from within
+// a RootDirectory and needs no cleanup.
+static int monitor_notify_listen(struct monitor *mon)
+{
+    char *name;
+    int one = 1;
+    int serrno;
+
+    mon->notify = -1;
+    if (mon->svc->notify_access == NA_NONE) {
+        return 0;
+    }
+    mon->notify_len = monitor_socket_addr_suffix(mon->svc,
+                                                 MONITOR_NOTIFY_SUFFIX,
+                                                 &mon->notify_addr);
+    if (mon->notify_len == 0) {
+        return -1;
+    }
+    debug("creating notify socket %s", mon->notify_addr.sun_path + 1);
+    if ((mon->notify = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0)) < 0
+        || setsockopt(mon->notify, SOL_SOCKET, SO_PASSCRED, &one, sizeof(one))
+               != 0
+        || bind(mon->notify,
+                (struct sockaddr *)&mon->notify_addr,
+                mon->notify_len)
+               != 0) {
+        goto fail;
+    }
+    // sd_notify() and friends use a leading @ to denote an abstract socket.
+    name = charstr_printf("@%s", mon->notify_addr.sun_path + 1);
+    command_setenv(mon->cmd, "NOTIFY_SOCKET", name);
+    fsfree(name);
+    return 0;
+fail:
+    serrno = errno;
+    if (mon->notify >= 0) {
+        close(mon->notify);
+        mon->notify = -1;
+    }
+    errno = serrno;
+    return -1;
+}
+
+static void monitor_notify_close(struct monitor *mon)
+{
+    if (mon->notify >= 0) {
+        close(mon->notify);
+        mon->notify = -1;
+    }
+}
+
+// Receives a single datagram from the notify socket.  Any file descriptors
+// passed along with it are closed, since we do not implement the file
+// descriptor store.  Returns the length of the message, which is
+// null-terminated, and sets *pidp to the sender's PID, or 0 if the sender did
+// not pass credentials.  Returns -1 and sets errno to EAGAIN if there are no
+// more messages.
+static ssize_t monitor_notify_recv(struct monitor *mon,
+                                   char *buf,
+                                   size_t size,
+                                   pid_t *pidp)
+{
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(struct ucred))
+                 + CMSG_SPACE(sizeof(int) * MONITOR_NOTIFY_MAX_FDS)];
+    } control;
+    struct ucred cred;
+    struct iovec iov = { .iov_base = buf, .iov_len = size - 1 };
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = &control,
+        .msg_controllen = sizeof(control),
+    };
+    struct cmsghdr *cmsg;
+    ssize_t res;
+    int fd;
+
+    *pidp = 0;
+    res = recvmsg(mon->notify, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+    if (res < 0) {
+        return -1;
+    }
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+         cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET) {
+            continue;
+        }
+        if (cmsg->cmsg_type == SCM_CREDENTIALS
+            && cmsg->cmsg_len == CMSG_LEN(sizeof(cred))) {
+            memcpy(&cred, CMSG_DATA(cmsg), sizeof(cred));
+            *pidp = cred.pid;
+        } else if (cmsg->cmsg_type == SCM_RIGHTS) {
+            for (size_t off = 0; CMSG_LEN(off + sizeof(fd)) <= cmsg->cmsg_len;
+                 off += sizeof(fd)) {
+                memcpy(&fd, CMSG_DATA(cmsg) + off, sizeof(fd));
+                close(fd);
             }
-        } else {
-            str = "error";
         }
-        res = snprintf(buf, sizeof(buf) - 2, "%s", str);
-        debug("control(%d): >\"%s\"", csock, buf);
-        buf[res++] = '\r';
-        buf[res++] = '\n';
-        buf[res] = '\0';
-        res = write(csock, buf, res);
-        if (res < 0) {
-            goto csockerr;
+    }
+    if (msg.msg_flags & MSG_TRUNC) {
+        warning("discarding oversized notification from %u",
+                (unsigned int)*pidp);
+        buf[0] = '\0';
+        return 0;
+    }
+    buf[res] = '\0';
+    return res;
+}
+
+// Discards any stale notifications left over from a previous instance.
+static void monitor_notify_drain(struct monitor *mon)
+{
+    char buf[4096];
+    pid_t pid;
+
+    if (mon->notify < 0) {
+        return;
+    }
+    while (monitor_notify_recv(mon, buf, sizeof(buf), &pid) >= 0) {
+        trace(NC_NOTIFY, "(%u) discarding \"%s\"", (unsigned int)pid, buf);
+    }
+}
+
+// Returns true if NotifyAccess allows the specified process to send
+// notifications.
+static bool monitor_notify_allowed(struct monitor *mon, pid_t pid)
+{
+    switch (mon->svc->notify_access) {
+        case NA_MAIN:
+        case NA_EXEC:
+            // We do not run any control processes, so `exec` is the same as
+            // `main`.
+            return pid > 0 && pid == mon->pid;
+        case NA_ALL:
+            return pid > 0 && process_get(pid) != NULL;
+        default:
+            return false;
+    }
+}
+
+// Creates the watchdog timer, which the service may enable by sending
+// WATCHDOG_USEC even if WatchdogSec is not set.  If it is set, it is passed to
+// the service in the WATCHDOG_USEC environment variable.
+static int monitor_watchdog_setup(struct monitor *mon)
+{
+    char *value;
+
+    mon->watchdog = -1;
+    if (mon->notify < 0) {
+        return 0;
+    }
+    mon->watchdog = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (mon->watchdog < 0) {
+        return -1;
+    }
+    if (mon->svc->watchdog_timeout > 0) {
+        value = charstr_printf("%llu", mon->svc->watchdog_timeout);
+        command_setenv(mon->cmd, "WATCHDOG_USEC", value);
+        fsfree(value);
+    }
+    return 0;
+}
+
+static void monitor_watchdog_close(struct monitor *mon)
+{
+    if (mon->watchdog >= 0) {
+        close(mon->watchdog);
+        mon->watchdog = -1;
+    }
+}
+
+// (Re)arms the watchdog timer to expire after the specified interval, or
+// disarms it if the interval is zero.
+static void monitor_watchdog_arm(struct monitor *mon, usec_t usec)
+{
+    struct itimerspec its = {};
+
+    if (mon->watchdog < 0) {
+        return;
+    }
+    its.it_value.tv_sec = usec / 1000000;
+    its.it_value.tv_nsec = (usec % 1000000) * 1000;
+    if (timerfd_settime(mon->watchdog, 0, &its, NULL) != 0) {
+        error("failed to arm watchdog timer: %m");
+    }
+}
+
+// Called when the watchdog timer expires.  Kills the service, and restarts it
+// if the restart policy says so.
+static void monitor_watchdog_expire(struct monitor *mon)
+{
+    struct service *svc = mon->svc;
+
+    error("watchdog timeout (limit %llu.%06llu s)",
+          mon->watchdog_usec / 1000000,
+          mon->watchdog_usec % 1000000);
+    evlog_write(mon->evlog,
+                EV_WATCHDOG,
+                mon->pid,
+                us2ms(mon->watchdog_usec),
+                0);
+    mon->watchdog_expired = true;
+    mon->failed = true;
+    if (svc->restart_policy == RP_ALWAYS || svc->restart_policy == RP_ON_FAILURE
+        || svc->restart_policy == RP_ON_ABNORMAL
+        || svc->restart_policy == RP_ON_WATCHDOG) {
+        monitor_set_state(mon, MS_RESTARTING);
+    } else {
+        verbose("restarting (policy: %s) not indicated",
+                restart_policy_names[svc->restart_policy]);
+        monitor_set_state(mon, MS_STOPPING);
+    }
+}
+
+// Processes a single notification, which consists of one or more
+// newline-separated assignments.  Returns 1 if the service announced that it
+// is stopping and 0 otherwise.
+static int monitor_notify_process(struct monitor *mon, pid_t pid, char *msg)
+{
+    char *line, *next, *end;
+    unsigned long num;
+    bool ready, reloading, stopping, ping;
+
+    ready = reloading = stopping = ping = false;
+    for (line = msg; line != NULL && *line != '\0'; line = next) {
+        if ((next = strchr(line, '\n')) != NULL) {
+            *next++ = '\0';
         }
-        now = clock_usec();
+        trace(NC_NOTIFY, "(%u) <\"%s\"", (unsigned int)pid, line);
+        if (strcmp(line, "READY=1") == 0) {
+            ready = true;
+        } else if (strcmp(line, "RELOADING=1") == 0) {
+            reloading = true;
+        } else if (strcmp(line, "STOPPING=1") == 0) {
+            stopping = true;
+        } else if (strcmp(line, "WATCHDOG=1") == 0) {
+            ping = true;
+        } else if (strcmp(line, "WATCHDOG=trigger") == 0) {
+            warning("service triggered the watchdog");
+            monitor_watchdog_arm(mon, 1);
+        } else if (strncmp(line, "WATCHDOG_USEC=", 14) == 0) {
+            errno = 0;
+            num = strtoul(line + 14, &end, 10);
+            if (end == line + 14 || *end != '\0' || errno != 0) {
+                warning("invalid watchdog timeout '%s'", line + 14);
+            } else {
+                verbose("watchdog timeout changed to %lu us", num);
+                mon->watchdog_usec = num;
+                ping = true;
+            }
+        } else if (strncmp(line, "STATUS=", 7) == 0) {
+            verbose("service status: %s", line + 7);
+            fsfree(mon->status);
+            mon->status = charstr_dupstr(line + 7);
+        } else if (strncmp(line, "MAINPID=", 8) == 0) {
+            errno = 0;
+            num = strtoul(line + 8, &end, 10);
+            if (end == line + 8 || *end != '\0' || errno != 0 || num == 0
+                || num > INT_MAX) {
+                warning("invalid main PID '%s'", line + 8);
+            } else if (process_get(num) == NULL) {
+                warning("ignoring main PID %lu: not a service process", num);
+            } else if ((pid_t)num != mon->pid) {
+                verbose("main process identified as %lu", num);
+                mon->pid = num;
+            }
+        }
+    }
+    // Each ping pushes the deadline back by one full interval.
+    if (ping) {
+        monitor_watchdog_arm(mon, mon->watchdog_usec);
+    }
+    // Process state changes in the same order as systemd.
+    if (stopping && monitor_is_active(mon)) {
+        verbose("service is stopping");
+        monitor_set_state(mon, MS_STOPPING);
+        return 1;
+    }
+    if (ready && mon->state == MS_STARTING) {
+        monitor_set_state(mon, MS_RUNNING);
+        monitor_report_ready(mon);
+    } else if (ready && mon->state == MS_RELOADING) {
+        monitor_set_state(mon, MS_RUNNING);
+    }
+    if (reloading && mon->state == MS_RUNNING) {
+        monitor_set_state(mon, MS_RELOADING);
     }
-    debug("control(%d): closing", csock);
-    close(csock);
     return 0;
-csockerr:
-    error("control(%d): error: %m", csock);
-    close(csock);
-    return -1;
+}
+
+// Receives and processes all pending notifications.  Returns 1 if the service
+// announced that it is stopping, 0 if it did not, and -1 on error.
+static int monitor_notify_ingest(struct monitor *mon)
+{
+    char buf[4096];
+    pid_t pid;
+    int ret = 0;
+
+    while (monitor_notify_recv(mon, buf, sizeof(buf), &pid) >= 0) {
+        if (!monitor_notify_allowed(mon, pid)) {
+            debug("ignoring notification from process %u",
+                  (unsigned int)pid);
+            continue;
+        }
+        if (monitor_notify_process(mon, pid, buf) > 0) {
+            ret = 1;
+        }
+    }
+    if (errno != EAGAIN && errno != EINTR) {
+        return -1;
+    }
+    return ret;
 }
 
 // Redirect logs to the specified file, or syslog if we fail to open
@@ -344,8 +1133,26 @@ void monitor_log_setup(struct monitor *mon)
             monitor_log_to_file(mon, "/var/log");
         }
     } else {
-        noisef = NULL;
+        noisef = NULL;
+    }
+}
+
+// Set up the event log, if enabled.
+static void monitor_evlog_setup(struct monitor *mon)
+{
+    char *path;
+
+    if ((path = evlog_path(mon->svc, false)) == NULL) {
+        return;
+    }
+    mon->evlog = evlog_open(path, EVLOG_CAPACITY, mon->svc->name);
+    if (mon->evlog == NULL) {
+        error("unable to open event log %s: %m", path);
+    } else {
+        verbose("recording events to %s", path);
+        evlog_write(mon->evlog, EV_START, getpid(), 0, 0);
     }
+    fsfree(path);
 }
 
 // Read from a file or socket descriptor and write to log.
@@ -355,8 +1162,8 @@ void monitor_log_setup(struct monitor *mon)
 // perhaps by moving this code into common/fork and keeping the state in
 // fork_io.  It is not safe to loop the read() (or to call fd_to_log() in a
 // loop) as we might end up blocking other operations if the source is producing
-// output at a very high rate.
-static int fd_to_log(int priority, int fd)
+// output at a very high rate.  Updates the stream statistics.
+static int fd_to_log(int priority, int fd, struct monitor_stream_stats *st)
 {
     char iobuf[4096];
     char *e, *p, *q;
@@ -371,6 +1178,7 @@ static int fd_to_log(int priority, int fd)
         }
         return -1;
     }
+    st->bytes += res;
     e = iobuf + res;
     for (p = iobuf; p < e; p = q + 1) {
         // find end of line
@@ -394,6 +1202,7 @@ static int fd_to_log(int priority, int fd)
                         p);
             }
             len += q - p;
+            st->lines++;
         }
     }
     if (noisef != NULL && len > 0) {
@@ -417,6 +1226,7 @@ static void monitor_kill(struct process *proc, void *ptr)
     if (proc->pid != getpid() && proc->pid != 1
         && (ko->all || proc->pid == ko->mon->pid)) {
         debug("ko: sending %s to %u", ko->signame, (unsigned int)proc->pid);
+        evlog_write(ko->mon->evlog, EV_KILL, proc->pid, ko->signal, 0);
         kill(proc->pid, ko->signal);
         kill(proc->pid, SIGCONT);
     } else {
@@ -483,7 +1293,10 @@ static procwatch_action monitor_proc_event(procwatch_event event,
             verbose("setting service sid to %u", proc->sid);
             mon->sid = proc->sid;
         }
+    } else if (event == PROCWATCH_EVENT_FORK) {
+        evlog_write(mon->evlog, EV_FORK, proc->pid, proc->ppid, 0);
     } else if (event == PROCWATCH_EVENT_EXEC) {
+        evlog_write(mon->evlog, EV_EXEC, proc->pid, 0, 0);
         report_proc_execve(proc->pid);
     }
     return PROCWATCH_ACTION_DEFAULT;
@@ -512,19 +1325,40 @@ static bool monitor_find_main_pid(struct monitor *mon)
     return false;
 }
 
+// Converts a deadline to a poll() timeout: -1 if there is no deadline, zero if
+// it has passed, or the number of milliseconds remaining, rounded up.
+static int monitor_poll_timeout(usec_t deadline)
+{
+    usec_t now;
+
+    if (deadline == 0) {
+        return -1;
+    }
+    now = clock_usec();
+    if (now >= deadline) {
+        return 0;
+    }
+    if (us2ms(deadline - now) >= INT_MAX) {
+        return -1;
+    }
+    return us2ms(deadline - now) + 1;
+}
+
 // Inner loop of service monitor.  Monitor the service and its descendants until
 // they have all terminated.  Returns the PID of the final descendant, or a
 // negative value on error.
 // XXX need to review the return value
 static int monitor_watch(struct monitor *mon)
 {
-    struct pollfd pfds[4] = {};
+    struct pollfd pfds[6 + MONITOR_CONTROL_MAX_CLIENTS] = {};
     struct kill_order ko = { .mon = mon };
     struct service *svc = mon->svc;
     struct command *cmd = mon->cmd;
     struct process *proc;
-    usec_t now;
+    usec_t deadline, now;
+    uint64_t expirations;
     pid_t pid;
+    unsigned int npfds;
     int res, ret, wstatus;
     int stopping;
 
@@ -532,25 +1366,62 @@ static int monitor_watch(struct monitor *mon)
     pfds[0] = POLLFD(procwatch_fd(), POLLIN);
     pfds[1] = POLLFD(mon->io.out.parent, POLLIN);
     pfds[2] = POLLFD(mon->io.err.parent, POLLIN);
-    pfds[3] = POLLFD(mon->sock, POLLIN);
+    pfds[3] = POLLFD(mon->notify, POLLIN);
+    pfds[4] = POLLFD(mon->watchdog, POLLIN);
+    pfds[5] = POLLFD(mon->sock, POLLIN);
     procwatch_set_callback(monitor_proc_event, mon);
     stopping = 0;
     ret = 0;
     for (;;) {
-        res = poll(pfds, sizeof(pfds) / sizeof(pfds[0]), -1);
+        npfds = 6 + monitor_control_pollfds(mon, pfds + 6);
+        // Wake up in time to escalate a stop order or enforce the start
+        // timeout even if nothing else happens.
+        deadline = 0;
+        if (monitor_is_stopping(mon) && svc->stop_timeout != TS_INFINITY) {
+            deadline = ko.sent + svc->stop_timeout + 1;
+        } else if (mon->state == MS_STARTING) {
+            deadline = mon->start_deadline;
+        }
+        res = poll(pfds, npfds, monitor_poll_timeout(deadline));
         if (res < 0 && errno != EINTR) {
             error("unrecoverable poll error: %m");
             ret = -1;
             break;
         }
         now = clock_usec();
-        // control socket connection
+        // control socket connections and requests
+        if (monitor_control_ingest(mon, pfds + 5, npfds - 5) < 0) {
+            error("unrecoverable control socket error: %m");
+            ret = -1;
+            break;
+        }
+        // service notification
         if (pfds[3].revents) {
-            if (monitor_control_socket_ingest(mon) < 0) {
-                error("unrecoverable control socket error: %m");
+            res = monitor_notify_ingest(mon);
+            if (res < 0) {
+                error("unrecoverable notify socket error: %m");
                 ret = -1;
                 break;
             }
+            if (res > 0) {
+                // The service is stopping on its own.  Give it one
+                // TimeoutStopSec interval before we step in.
+                ko.sent = now;
+            }
+        }
+        // watchdog expiry
+        if (pfds[4].revents) {
+            if (read(mon->watchdog, &expirations, sizeof(expirations)) > 0
+                && !monitor_is_stopping(mon)) {
+                monitor_watchdog_expire(mon);
+            }
+        }
+        // Type=notify: did the service fail to become ready in time?
+        if (mon->state == MS_STARTING && mon->start_deadline > 0
+            && now >= mon->start_deadline) {
+            error("service did not become ready in time");
+            mon->failed = true;
+            monitor_set_state(mon, MS_STOPPING);
         }
         // Did we get a stop or restart order?
         if (monitor_is_stopping(mon) && now - ko.sent > svc->stop_timeout) {
@@ -582,8 +1453,14 @@ static int monitor_watch(struct monitor *mon)
                     if (svc->kill_mode == KM_CGROUP) {
                         ko.all = true;
                     }
-                    ko.signal = SIGTERM;
-                    ko.signame = "SIGTERM";
+                    if (mon->watchdog_expired) {
+                        // XXX implement WatchdogSignal?
+                        ko.signal = SIGABRT;
+                        ko.signame = "SIGABRT";
+                    } else {
+                        ko.signal = SIGTERM;
+                        ko.signame = "SIGTERM";
+                    }
                 } else if (stopping == 2) {
                     // Second pass
                     if (svc->kill_mode == KM_MIXED) {
@@ -606,14 +1483,15 @@ static int monitor_watch(struct monitor *mon)
         }
         // data on stderr
         if (pfds[2].revents) {
-            if (fd_to_log(LOG_ERR, mon->io.err.parent) < 0) {
+            if (fd_to_log(LOG_ERR, mon->io.err.parent, &mon->err_stats) < 0) {
                 error("error reading from service stderr: %m");
                 dup2(STDIN_FILENO, mon->io.err.parent);
             }
         }
         // data on stdout
         if (pfds[1].revents) {
-            if (fd_to_log(LOG_NOTICE, mon->io.out.parent) < 0) {
+            if (fd_to_log(LOG_NOTICE, mon->io.out.parent, &mon->out_stats)
+                < 0) {
                 error("error reading from service stdout: %m");
                 dup2(STDIN_FILENO, mon->io.out.parent);
             }
@@ -657,6 +1535,7 @@ static int monitor_watch(struct monitor *mon)
             }
             pid = proc->pid;
             wstatus = proc->wstatus;
+            evlog_write(mon->evlog, EV_EXIT, pid, wstatus, 0);
             process_destroy(proc);
             if (pid == mon->child) {
                 // Direct child, collect it.
@@ -667,13 +1546,13 @@ static int monitor_watch(struct monitor *mon)
                     // XXX should we report a negative result if the exit status
                     // is non-zero?
                     monitor_set_state(mon, MS_RUNNING);
-                    report_ready();
+                    monitor_report_ready(mon);
                 }
                 mon->child = 0;
             }
             if (pid == mon->pid) {
                 // Main process exited
-                mon->wstatus = wstatus;
+                mon->wstatus = mon->last_wstatus = wstatus;
                 if (cmd->pidfile != NULL) {
                     command_rmpid(cmd);
                 }
@@ -686,7 +1565,7 @@ static int monitor_watch(struct monitor *mon)
         // non-zero?
         if (svc->type == ST_ONESHOT && mon->wstatus >= 0) {
             monitor_set_state(mon, MS_RUNNING);
-            report_ready();
+            monitor_report_ready(mon);
             break;
         }
         if (mon->wstatus >= 0) {
@@ -711,6 +1590,7 @@ static int monitor_watch(struct monitor *mon)
     }
     debug("monitor watch loop terminated in state %s",
           monitor_state_name(mon->state));
+    monitor_watchdog_arm(mon, 0);
     procwatch_set_callback(NULL, NULL);
     procwatch_drain();
     return ret;
@@ -723,9 +1603,10 @@ static int monitor_watch(struct monitor *mon)
 // close.
 static int monitor_wait(struct monitor *mon, usec_t deadline)
 {
-    struct pollfd pfds[2];
+    struct pollfd pfds[2 + MONITOR_CONTROL_MAX_CLIENTS];
     struct process *proc;
     usec_t t;
+    unsigned int npfds;
     int res, timeout;
     monitor_state state;
 
@@ -750,16 +1631,15 @@ static int monitor_wait(struct monitor *mon, usec_t deadline)
             debug("wait over: timer expired");
             break;
         }
-        res = poll(pfds, sizeof(pfds) / sizeof(pfds[0]), timeout);
+        npfds = 2 + monitor_control_pollfds(mon, pfds + 2);
+        res = poll(pfds, npfds, timeout);
         if (res < 0 && errno != EINTR) {
             error("unrecoverable poll error: %m");
             return -1;
         }
-        if (pfds[1].revents) {
-            if (monitor_control_socket_ingest(mon) < 0) {
-                error("unrecoverable control socket error: %m");
-                return -1;
-            }
+        if (monitor_control_ingest(mon, pfds + 1, npfds - 1) < 0) {
+            error("unrecoverable control socket error: %m");
+            return -1;
         }
         if (pfds[0].revents) {
             // Ingest all outstanding events.
@@ -788,6 +1668,109 @@ static int monitor_wait(struct monitor *mon, usec_t deadline)
 
 #define MAX_START_LIMIT_BURST 100
 
+// Returns x raised to the power of n.
+static double monitor_powi(double x, unsigned long n)
+{
+    double r = 1.0;
+
+    for (; n > 0; n >>= 1, x *= x) {
+        if (n & 1) {
+            r *= x;
+        }
+    }
+    return r;
+}
+
+// Computes the delay before the next automatic restart.  With RestartSteps,
+// the delay grows geometrically from RestartSec to RestartMaxDelaySec over
+// that many consecutive restarts, as in systemd: each step multiplies it by
+// the RestartSteps-th root of the ratio between the two, which we find by
+// bisection.  Up to a quarter of the delay is then shaved off at random so
+// that services which failed together do not all come back at the same
+// moment.
+static usec_t monitor_restart_delay(struct monitor *mon)
+{
+    struct service *svc = mon->svc;
+    usec_t base, delay;
+    uint64_t rnd;
+    unsigned long step;
+    double ratio, lo, hi, mid;
+
+    delay = svc->delay;
+    base = delay > 0 ? delay : TS_MSEC;
+    if (svc->restart_steps > 0 && svc->restart_max_delay > base) {
+        step = mon->restart_step < svc->restart_steps ? mon->restart_step
+                                                      : svc->restart_steps;
+        ratio = (double)svc->restart_max_delay / base;
+        for (lo = 1.0, hi = ratio, mid = 0; hi - lo > 1e-9;) {
+            mid = (lo + hi) / 2;
+            if (monitor_powi(mid, svc->restart_steps) < ratio) {
+                lo = mid;
+            } else {
+                hi = mid;
+            }
+        }
+        delay = base * monitor_powi(hi, step);
+        if (delay > svc->restart_max_delay) {
+            delay = svc->restart_max_delay;
+        }
+    }
+    if (getrandom(&rnd, sizeof(rnd), GRND_NONBLOCK) == sizeof(rnd)) {
+        delay -= rnd % (delay / 4 + 1);
+    }
+    return delay;
+}
+
+// Sets up the start limit from the service, forgetting earlier starts.
+static void monitor_start_limit_setup(struct monitor *mon)
+{
+    if (mon->start_times != NULL) {
+        fsfree(mon->start_times);
+        mon->start_times = NULL;
+    }
+    mon->start_limit_interval = mon->svc->start_limit_interval;
+    mon->start_limit_burst = mon->svc->start_limit_burst;
+    if (mon->start_limit_interval > 0 && mon->start_limit_burst > 1) {
+        if (mon->start_limit_burst > MAX_START_LIMIT_BURST) {
+            mon->start_limit_burst = MAX_START_LIMIT_BURST;
+            warning("capping StartLimitBurst at %lu", mon->start_limit_burst);
+        }
+        mon->start_times =
+            fscalloc(mon->start_limit_burst, sizeof(*mon->start_times));
+        mon->start_time_cursor = 0;
+        mon->start_times[mon->start_time_cursor] = clock_usec();
+        mon->start_time_cursor =
+            (mon->start_time_cursor + 1) % mon->start_limit_burst;
+    }
+}
+
+// Switches to the service and command loaded by the last daemon-reload, if
+// any.  Called just before the service is started.
+static void monitor_reload_apply(struct monitor *mon)
+{
+    bool limits_changed;
+
+    if (mon->next_cmd == NULL) {
+        return;
+    }
+    verbose("applying reloaded unit");
+    limits_changed =
+        mon->next_svc->start_limit_interval != mon->svc->start_limit_interval
+        || mon->next_svc->start_limit_burst != mon->svc->start_limit_burst;
+    if (mon->reloaded) {
+        command_free(mon->cmd);
+        service_free(mon->svc);
+    }
+    mon->svc = mon->next_svc;
+    mon->cmd = mon->next_cmd;
+    mon->next_svc = NULL;
+    mon->next_cmd = NULL;
+    mon->reloaded = true;
+    if (limits_changed) {
+        monitor_start_limit_setup(mon);
+    }
+}
+
 // Outer loop of the service monitor.  Run and monitor a command, restarting it
 // as needed.
 static int monitor_func(void *ptr)
@@ -799,6 +1782,8 @@ static int monitor_func(void *ptr)
 
     mon.cmd = ptr;
     mon.svc = mon.cmd->svc;
+    mon.started = clock_usec();
+    mon.last_wstatus = -1;
     monitor_set_state(&mon, MS_IDLE);
     // Point stdin at /dev/null and set up pipes for stdout and stderr. Note
     // that we do not use pipe2() because we only want O_NONBLOCK on the
@@ -813,36 +1798,44 @@ static int monitor_func(void *ptr)
         return EXIT_FAILURE;
     }
     monitor_log_setup(&mon);
+    monitor_evlog_setup(&mon);
     if (monitor_control_listen(&mon) != 0) {
         error("failed to open control socket: %m");
         return EXIT_FAILURE;
     }
+    if (monitor_notify_listen(&mon) != 0) {
+        error("failed to open notify socket: %m");
+        return EXIT_FAILURE;
+    }
+    if (monitor_watchdog_setup(&mon) != 0) {
+        error("failed to create watchdog timer: %m");
+        return EXIT_FAILURE;
+    }
     if (!procwatch_start()) {
         error("failed to start process event monitor");
         return EXIT_FAILURE;
     }
     next_start_time = clock_usec();
-    mon.start_limit_interval = mon.svc->start_limit_interval;
-    mon.start_limit_burst = mon.svc->start_limit_burst;
-    if (mon.start_limit_interval > 0 && mon.start_limit_burst > 1) {
-        if (mon.start_limit_burst > MAX_START_LIMIT_BURST) {
-            mon.start_limit_burst = MAX_START_LIMIT_BURST;
-            warning("capping StartLimitBurst at %lu", mon.start_limit_burst);
-        }
-        mon.start_times =
-            fscalloc(mon.start_limit_burst, sizeof(*mon.start_times));
-        mon.start_time_cursor = 0;
-        mon.start_times[mon.start_time_cursor] = clock_usec();
-        mon.start_time_cursor =
-            (mon.start_time_cursor + 1) % mon.start_limit_burst;
-    }
+    monitor_start_limit_setup(&mon);
     debug("monitor started");
     monitor_set_state(&mon, MS_STARTING);
-    while (mon.state < MS_STOPPED) {
+    while (!monitor_is_done(&mon)) {
         switch (mon.state) {
             case MS_RESTARTING:
+                // If the service stayed up for longer than the longest delay
+                // we would impose, it was not crash-looping, so start over.
+                if (mon.restart_step > 0 && mon.svc->restart_steps > 0
+                    && clock_usec() - mon.run_time
+                        >= mon.svc->restart_max_delay) {
+                    debug("resetting restart backoff");
+                    mon.restart_step = 0;
+                }
+                mon.restart_delay = monitor_restart_delay(&mon);
+                mon.restart_step++;
+                mon.restarts++;
                 // This is the approximate time we will restart.
-                next_start_time = clock_usec() + mon.svc->delay;
+                next_start_time = clock_usec() + mon.restart_delay;
+                mon.run_time = next_start_time;
                 // If applicable, check if restarting after the mandated delay
                 // would bust the start limit.
                 if (mon.start_times != NULL) {
@@ -867,8 +1860,8 @@ static int monitor_func(void *ptr)
                 }
                 verbose("restarting (policy: %s) after %llu.%06llu s delay",
                         restart_policy_names[mon.svc->restart_policy],
-                        mon.svc->delay / 1000000,
-                        mon.svc->delay % 1000000);
+                        mon.restart_delay / 1000000,
+                        mon.restart_delay % 1000000);
                 if (monitor_wait(&mon, next_start_time) < 0) {
                     // XXX wrong?
                     monitor_set_state(&mon, MS_DEAD);
@@ -878,9 +1871,18 @@ static int monitor_func(void *ptr)
                 }
                 /* fall through */
             case MS_STARTING:
+                monitor_reload_apply(&mon);
                 command_verbose(mon.cmd);
+                monitor_notify_drain(&mon);
+                mon.pid = 0;
                 mon.wstatus = -1;
-                mon.child = fork_function(command_exec_func, mon.cmd, &mon.io);
+                mon.failed = mon.watchdog_expired = false;
+                // The main process of a forking service is not known until
+                // it has written its PID file, so it gets no WATCHDOG_PID.
+                mon.child = command_spawn(mon.cmd,
+                                          &mon.io,
+                                          mon.svc->watchdog_timeout > 0
+                                              && mon.svc->type != ST_FORKING);
                 mon.sid = getsid(0); // Will be updated later
                 if (mon.child < 0) {
                     error("failed to start service: %m");
@@ -888,14 +1890,25 @@ static int monitor_func(void *ptr)
                     break;
                 }
                 verbose("started service child %u", (unsigned int)mon.child);
+                monitor_set_state(&mon, MS_STARTING);
+                mon.run_time = clock_usec();
+                mon.watchdog_usec = mon.svc->watchdog_timeout;
+                monitor_watchdog_arm(&mon, mon.watchdog_usec);
                 // Report readiness for Type=simple and Type=exec.  The
-                // fork_function() call above does not return until the child
+                // command_spawn() call above does not return until the child
                 // process has either called execve() or terminated, which is
                 // late for Type=simple, but all that matters is that we're not
                 // early.
                 if (mon.svc->type == ST_SIMPLE || mon.svc->type == ST_EXEC) {
                     monitor_set_state(&mon, MS_RUNNING);
-                    report_ready();
+                    monitor_report_ready(&mon);
+                }
+                // Type=notify is ready when it says so, which it must do
+                // within TimeoutStartSec.
+                mon.start_deadline = 0;
+                if (mon.svc->type == ST_NOTIFY && mon.svc->start_timeout > 0
+                    && mon.svc->start_timeout != TS_INFINITY) {
+                    mon.start_deadline = clock_usec() + mon.svc->start_timeout;
                 }
                 // For anything other than ST_FORKING, the child is also the
                 // main process.
@@ -938,7 +1951,14 @@ static int monitor_func(void *ptr)
                 } else {
                     debug("clean exit");
                 }
-                if (mon.state != MS_RUNNING) {
+                if (mon.state == MS_STARTING) {
+                    // Type=notify only: the service terminated before it
+                    // reported readiness, which is a failure even if it
+                    // exited cleanly.
+                    warning("service terminated before becoming ready");
+                    ucexit = true;
+                } else if (mon.state != MS_RUNNING
+                           && mon.state != MS_RELOADING) {
                     // already stopping or restarting
                     break;
                 }
@@ -969,7 +1989,7 @@ static int monitor_func(void *ptr)
                 break;
             case MS_STOPPING:
                 // If we're here, we're already stopped.
-                monitor_set_state(&mon, MS_STOPPED);
+                monitor_set_state(&mon, mon.failed ? MS_FAILED : MS_STOPPED);
                 break;
             case MS_REMAINING:
                 // Continue to serve control requests until  we get a stop
@@ -985,12 +2005,26 @@ static int monitor_func(void *ptr)
         }
     }
     procwatch_stop();
+    monitor_watchdog_close(&mon);
+    monitor_notify_close(&mon);
     monitor_control_close(&mon);
+    fsfree(mon.status);
+    if (mon.reloaded) {
+        command_free(mon.cmd);
+        service_free(mon.svc);
+    }
+    if (mon.next_cmd != NULL) {
+        command_free(mon.next_cmd);
+        service_free(mon.next_svc);
+    }
     if (mon.start_times != NULL) {
         fsfree(mon.start_times);
     }
+    evlog_write(mon.evlog, EV_STOP, getpid(), mon.state, 0);
+    evlog_close(mon.evlog);
     debug("monitor stopped");
-    if (pid < 0) {
+    if (pid < 0 || !mon.ready) {
+        // Let our parent know that the service never became ready.
         return EXIT_FAILURE;
     }
     return EXIT_SUCCESS;
@@ -1012,52 +2046,112 @@ pid_t command_monitor(struct command *cmd)
 }
 
 struct monitor_client {
+    char *name;
     struct sockaddr_un addr;
     socklen_t addrlen;
     int sock;
     struct ucred cred;
     unsigned int version;
+    // identifier of the next request
+    unsigned int seq;
+    // data received but not yet consumed
+    size_t len;
+    char buf[4096];
 };
 
+// Connections to monitors, keyed by service name.  They are kept open for the
+// lifetime of the process, so a command which talks to the same monitor
+// several times only connects once.
+static hash_table_t *monitor_clients;
+
+static void monitor_client_close(struct monitor_client *mc)
+{
+    int serrno = errno;
+    trace(NC_CONTROL, "closing control socket");
+    close(mc->sock);
+    fsfree(mc->name);
+    fsfree(mc);
+    errno = serrno;
+}
+
+// Reads a single line, stripped of trailing whitespace, from the monitor.
+// Returns the length of the line, or -1 on error.  Sets errno to ECONNRESET
+// if the monitor closed the connection.
+static ssize_t monitor_client_readline(struct monitor_client *mc,
+                                       char *line,
+                                       size_t size)
+{
+    char *eol;
+    size_t len;
+    ssize_t res;
+
+    while ((eol = memchr(mc->buf, '\n', mc->len)) == NULL) {
+        if (mc->len == sizeof(mc->buf)) {
+            errno = EPROTO;
+            return -1;
+        }
+        res = read(mc->sock, mc->buf + mc->len, sizeof(mc->buf) - mc->len);
+        if (res < 0) {
+            return -1;
+        }
+        if (res == 0) {
+            errno = ECONNRESET;
+            return -1;
+        }
+        mc->len += res;
+    }
+    for (len = eol - mc->buf;
+         len > 0 && isspace((unsigned char)mc->buf[len - 1]);
+         len--) {
+        // nothing
+    }
+    if (len >= size) {
+        len = size - 1;
+    }
+    memcpy(line, mc->buf, len);
+    line[len] = '\0';
+    mc->len -= eol + 1 - mc->buf;
+    memmove(mc->buf, eol + 1, mc->len);
+    return len;
+}
+
 static struct monitor_client *monitor_client_connect(struct service *svc)
 {
     char buf[4096];
     struct monitor_client *mc;
     socklen_t len;
-    ssize_t res;
 
     mc = fscalloc(1, sizeof(*mc));
     mc->sock = -1;
-    debug("opening control socket");
+    trace(NC_CONTROL, "opening control socket");
     mc->addrlen = monitor_socket_addr(svc, &mc->addr);
-    if ((mc->sock = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+    if ((mc->sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
         goto fail;
     }
-    debug("connecting to monitor");
+    trace(NC_CONTROL, "connecting to monitor");
     if (connect(mc->sock, (struct sockaddr *)&mc->addr, mc->addrlen) != 0) {
         goto fail;
     }
-    debug("control socket connected");
+    trace(NC_CONTROL, "control socket connected");
     len = sizeof(mc->cred);
     if (getsockopt(mc->sock, SOL_SOCKET, SO_PEERCRED, &mc->cred, &len) != 0) {
         goto fail;
     }
-    debug("monitor pid %u uid %u gid %u",
+    trace(NC_CONTROL,
+          "monitor pid %u uid %u gid %u",
           (unsigned int)mc->cred.pid,
           (unsigned int)mc->cred.uid,
           (unsigned int)mc->cred.gid);
-    if ((res = read(mc->sock, buf, sizeof(buf))) < 0) {
+    if (monitor_client_readline(mc, buf, sizeof(buf)) < 0) {
         goto fail;
     }
-    while (res > 0 && isspace((unsigned char)buf[res - 1])) {
-        buf[--res] = '\0';
-    }
-    debug("banner received: %s", buf);
+    trace(NC_CONTROL, "banner received: %s", buf);
     if (sscanf(buf, MONITOR_CONTROL_BANNER_FORMAT, &mc->version) != 1) {
         errno = EPROTO;
         goto fail;
     }
-    debug("monitor version: %d", mc->version);
+    trace(NC_CONTROL, "monitor version: %d", mc->version);
+    mc->name = charstr_dupstr(svc->name);
     return mc;
 fail:
     if (errno == ECONNRESET) {
@@ -1066,20 +2160,231 @@ fail:
         // caller as “monitor not running”.
         errno = ECONNREFUSED;
     }
-    if (mc->sock >= 0) {
-        close(mc->sock);
-    }
-    fsfree(mc);
+    monitor_client_close(mc);
     return NULL;
 }
 
-static void monitor_client_close(struct monitor_client *mc)
+// Returns true unless the monitor has closed a cached connection, which it
+// does when it exits or needs to make room for other clients.
+static bool monitor_client_alive(struct monitor_client *mc)
 {
-    int serrno = errno;
-    debug("closing control socket");
-    close(mc->sock);
-    fsfree(mc);
-    errno = serrno;
+    struct pollfd pfd = POLLFD(mc->sock, POLLIN);
+    char c;
+
+    if (poll(&pfd, 1, 0) <= 0) {
+        return true;
+    }
+    if (pfd.revents & (POLLHUP | POLLERR)) {
+        return false;
+    }
+    return recv(mc->sock, &c, 1, MSG_PEEK | MSG_DONTWAIT) > 0;
+}
+
+// Removes a connection from the cache and closes it.
+static void monitor_client_drop(struct monitor_client *mc)
+{
+    hash_elem_t *he;
+
+    if ((he = hash_table_pop(monitor_clients, mc->name)) != NULL) {
+        destroy_hash_element(he);
+    }
+    monitor_client_close(mc);
+}
+
+// Returns a connection to the service's monitor, reusing a cached one if
+// possible.  Sets *cached to indicate which.
+static struct monitor_client *monitor_client_get(struct service *svc,
+                                                 bool *cached)
+{
+    struct monitor_client *mc;
+    hash_elem_t *he;
+
+    if (monitor_clients == NULL) {
+        monitor_clients =
+            make_hash_table(64, (void *)hash_string, (void *)strcmp);
+    }
+    if ((he = hash_table_get(monitor_clients, svc->name)) != NULL) {
+        mc = DQ(hash_elem_get_value(he));
+        if (monitor_client_alive(mc)) {
+            *cached = true;
+            return mc;
+        }
+        trace(NC_CONTROL, "cached connection closed by monitor");
+        monitor_client_drop(mc);
+    }
+    *cached = false;
+    if ((mc = monitor_client_connect(svc)) == NULL) {
+        return NULL;
+    }
+    hash_table_put(monitor_clients, mc->name, mc);
+    return mc;
+}
+
+// Closes all cached connections.
+void monitor_control_disconnect(void)
+{
+    hash_elem_t *he;
+
+    if (monitor_clients == NULL) {
+        return;
+    }
+    while ((he = hash_table_pop_any(monitor_clients)) != NULL) {
+        monitor_client_close(DQ(hash_elem_get_value(he)));
+        destroy_hash_element(he);
+    }
+    destroy_hash_table(monitor_clients);
+    monitor_clients = NULL;
+}
+
+// Sends requests over a connection and reads the responses.  If the monitor
+// supports request IDs, the requests are tagged and as many as will fit are
+// sent in a single write; otherwise, they are sent one at a time.  Returns the
+// number of responses received, which is less than the number of requests if
+// an error occurred, and sets *sent to the number of requests sent.
+static size_t monitor_client_exchange(struct monitor_client *mc,
+                                      size_t n,
+                                      const char **requests,
+                                      char **responses,
+                                      size_t *sent)
+{
+    char buf[4096];
+    char line[4096];
+    const char *p;
+    unsigned int id;
+    size_t i, j, k, len;
+    int res;
+    bool pipeline;
+
+    pipeline = mc->version >= MONITOR_CONTROL_PIPELINE_VERSION;
+    *sent = 0;
+    for (i = 0; i < n; i = j) {
+        len = 0;
+        for (j = i; j < n && (j == i || pipeline); j++) {
+            if (pipeline) {
+                res = snprintf(buf + len,
+                               sizeof(buf) - len,
+                               "#%u %s\r\n",
+                               mc->seq + (unsigned int)(j - i),
+                               requests[j]);
+            } else {
+                res = snprintf(buf + len,
+                               sizeof(buf) - len,
+                               "%s\r\n",
+                               requests[j]);
+            }
+            if (res < 0 || (size_t)res >= sizeof(buf) - len) {
+                if (j == i) {
+                    debug("requested command is too long");
+                    errno = EINVAL;
+                    return i;
+                }
+                break;
+            }
+            trace(NC_CONTROL, ">%.*s", res - 2, buf + len);
+            len += res;
+        }
+        if (send(mc->sock, buf, len, MSG_NOSIGNAL) != (ssize_t)len) {
+            return i;
+        }
+        *sent = j;
+        for (k = i; k < j; k++) {
+            if (monitor_client_readline(mc, line, sizeof(line)) < 0) {
+                return k;
+            }
+            trace(NC_CONTROL, "<%s", line);
+            p = line;
+            if (pipeline) {
+                if (sscanf(line, "#%u", &id) != 1
+                    || id != mc->seq + (unsigned int)(k - i)
+                    || (p = strchr(line, ' ')) == NULL) {
+                    errno = EPROTO;
+                    return k;
+                }
+                p++;
+            }
+            responses[k] = charstr_dupstr(p);
+        }
+        mc->seq += j - i;
+    }
+    return n;
+}
+
+// Sends several commands to a running monitor and stores the responses, which
+// the caller must free, in the provided array.  Commands are pipelined if the
+// monitor supports it.  If a cached connection turns out to be stale, or the
+// connection fails before all of the commands have been sent, we reconnect
+// and send the rest.  A command which was sent but not answered is never sent
+// again, as the monitor may have carried it out, and many commands, such as
+// stop and restart, must not be repeated; the only exception is a cached
+// connection on which no command at all was answered, since the monitor had
+// then most likely closed it before we used it.  Returns 0 on success and -1
+// on failure, in which case no responses are returned.
+int monitor_control_batch(struct service *svc,
+                          size_t n,
+                          const char **commands,
+                          char **responses)
+{
+    struct monitor_client *mc;
+    size_t done, res, sent;
+    bool cached;
+    int serrno;
+
+    for (done = 0; done < n; done++) {
+        responses[done] = NULL;
+    }
+    done = 0;
+    while (done < n) {
+        if ((mc = monitor_client_get(svc, &cached)) == NULL) {
+            goto fail;
+        }
+        if (mc->version > MONITOR_CONTROL_VERSION) {
+            error("control protocol version mismatch: %u > %u",
+                  mc->version,
+                  MONITOR_CONTROL_VERSION);
+            monitor_client_drop(mc);
+            errno = EPROTO;
+            goto fail;
+        }
+        res = monitor_client_exchange(mc,
+                                      n - done,
+                                      commands + done,
+                                      responses + done,
+                                      &sent);
+        done += res;
+        if (done == n) {
+            break;
+        }
+        serrno = errno;
+        monitor_client_drop(mc);
+        errno = serrno;
+        if (errno == EINVAL || errno == EPROTO) {
+            goto fail;
+        }
+        // Try again if we made progress or used a cached connection;
+        // otherwise, the fresh connection we just dropped was no better.
+        if (res == 0 && !cached) {
+            goto fail;
+        }
+        // Do not repeat commands which may have been carried out.
+        if (sent > res && (res > 0 || !cached)) {
+            error("no response to '%s'", commands[done]);
+            errno = ECONNRESET;
+            goto fail;
+        }
+        trace(NC_CONTROL, "reconnecting: %m");
+    }
+    return 0;
+fail:
+    if (errno != ENOENT && errno != ECONNREFUSED) {
+        error("control socket error: %m");
+    } else {
+        debug("control socket error: %m");
+    }
+    for (done = 0; done < n; done++) {
+        fsfree(responses[done]);
+        responses[done] = NULL;
+    }
+    return -1;
 }
 
 // Connects to a running monitor and returns its PID and version.
@@ -1088,8 +2393,9 @@ unsigned int monitor_control_identify(struct service *svc,
                                       int *versionp)
 {
     struct monitor_client *mc;
+    bool cached;
 
-    if ((mc = monitor_client_connect(svc)) == NULL) {
+    if ((mc = monitor_client_get(svc, &cached)) == NULL) {
         return -1;
     }
     if (pidp != NULL) {
@@ -1098,61 +2404,18 @@ unsigned int monitor_control_identify(struct service *svc,
     if (versionp != NULL) {
         *versionp = mc->version;
     }
-    monitor_client_close(mc);
     return 0;
 }
 
 // Sends a single command to a running monitor and returns the response.
 char *monitor_control(struct service *svc, const char *command)
 {
-    char buf[4096];
-    struct monitor_client *mc;
-    ssize_t res;
+    char *response;
 
-    if ((mc = monitor_client_connect(svc)) == NULL) {
+    if (monitor_control_batch(svc, 1, &command, &response) != 0) {
         return NULL;
     }
-    if (mc->version > MONITOR_CONTROL_VERSION) {
-        error("control protocol version mismatch: %u > %u",
-              mc->version,
-              MONITOR_CONTROL_VERSION);
-        monitor_client_close(mc);
-        errno = EPROTO;
-        return NULL;
-    }
-    res = snprintf(buf, sizeof(buf) - 2, "%s", command);
-    if ((size_t)res >= sizeof(buf) - 2) {
-        debug("requested command is too long");
-        monitor_client_close(mc);
-        errno = EINVAL;
-        return NULL;
-    }
-    debug("control >%s", buf);
-    buf[res++] = '\r';
-    buf[res++] = '\n';
-    buf[res] = '\0';
-    res = write(mc->sock, buf, res);
-    if (res < 0) {
-        goto fail;
-    }
-    res = read(mc->sock, buf, sizeof(buf));
-    if (res < 0) {
-        goto fail;
-    }
-    while (res > 0 && isspace((unsigned char)buf[res - 1])) {
-        buf[--res] = '\0';
-    }
-    debug("control <%s", buf);
-    monitor_client_close(mc);
-    return charstr_dupstr(buf);
-fail:
-    if (errno != ENOENT && errno != ECONNREFUSED) {
-        error("control socket error: %m");
-    } else {
-        debug("control socket error: %m");
-    }
-    monitor_client_close(mc);
-    return NULL;
+    return response;
 }
 
 // Interrogates a running monitor and returns the current state of the service.
@@ -1186,12 +2449,100 @@ monitor_state monitor_control_get_state(struct service *svc)
     return state;
 }
 
+// Waits for a line from the monitor until the deadline, which is in
+// microseconds since the epoch of clock_usec(), or forever if zero.  Returns
+// the length of the line, or -1 on error, with errno set to ETIMEDOUT if the
+// deadline passed.
+static ssize_t monitor_client_readline_until(struct monitor_client *mc,
+                                             char *line,
+                                             size_t size,
+                                             usec_t deadline)
+{
+    struct pollfd pfd;
+    int res;
+
+    while (memchr(mc->buf, '\n', mc->len) == NULL) {
+        pfd = POLLFD(mc->sock, POLLIN);
+        res = poll(&pfd, 1, monitor_poll_timeout(deadline));
+        if (res < 0 && errno != EINTR) {
+            return -1;
+        }
+        if (res == 0) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        if (res > 0) {
+            break;
+        }
+    }
+    return monitor_client_readline(mc, line, size);
+}
+
+// Waits for a running monitor to reach one of the states in the mask by
+// asking it to report every change of state over a dedicated connection.
+// Returns the state if it is reached before the deadline.  Returns MS_ERROR
+// and sets errno to ETIMEDOUT if it is not, or to an appropriate value if an
+// error occurs.  Returns MS_ERROR and sets errno to ENOTSUP if the monitor is
+// not running, has closed the connection, or does not support the `watch`
+// request, in which case the caller should poll instead.
+static monitor_state monitor_control_watch(struct service *svc,
+                                           unsigned int mask,
+                                           usec_t deadline)
+{
+    char line[64];
+    struct monitor_client *mc;
+    monitor_state state;
+
+    if ((mc = monitor_client_connect(svc)) == NULL) {
+        if (errno == ENOENT || errno == ECONNREFUSED) {
+            if (mask & (1U << MS_STOPPED)) {
+                return MS_STOPPED;
+            }
+            errno = ENOTSUP;
+        }
+        return MS_ERROR;
+    }
+    trace(NC_CONTROL, ">watch");
+    if (send(mc->sock, "watch\r\n", 7, MSG_NOSIGNAL) != 7) {
+        errno = ENOTSUP;
+        state = MS_ERROR;
+        goto done;
+    }
+    for (;;) {
+        if (monitor_client_readline_until(mc, line, sizeof(line), deadline)
+            < 0) {
+            if (errno != ETIMEDOUT) {
+                // The monitor exited or evicted us.
+                errno = ENOTSUP;
+            }
+            state = MS_ERROR;
+            break;
+        }
+        trace(NC_CONTROL, "<%s", line);
+        state = monitor_state_from_name(line);
+        if (state == MS_ERROR) {
+            // Most likely a monitor which predates the watch request.
+            errno = ENOTSUP;
+            break;
+        }
+        if (mask & (1U << state)) {
+            verbose("service reached state %s", monitor_state_name(state));
+            break;
+        }
+    }
+done:
+    monitor_client_close(mc);
+    return state;
+}
+
 // Waits for a running monitor to reach one of the states in the zero-terminated
-// list.  The timeout is in milliseconds and will be rounded up to the nearest
-// multiple of MONITOR_POLL_INTERVAL; a negative timeout means infinity. Returns
-// the expected state if it is reached before the timeout expires.  Returns
-// MS_ERROR and sets errno to ETIMEDOUT if it does not.  Returns MS_ERROR and
-// sets errno to an appropriate value if an error occurs.
+// list.  The timeout is in milliseconds; a negative timeout means infinity.
+// The monitor reports changes of state as they happen; monitors which do not
+// support this are polled every MONITOR_POLL_INTERVAL instead, in which case
+// the timeout is rounded up to a multiple of it.  Returns the expected state
+// if it is reached before the timeout expires.  Returns MS_ERROR and sets
+// errno to ETIMEDOUT if it does not.  Returns MS_ERROR and sets errno to an
+// appropriate value if an error occurs.
 monitor_state monitor_control_wait(struct service *svc, int timeout, ...)
 {
     va_list ap;
@@ -1218,13 +2569,18 @@ monitor_state monitor_control_wait(struct service *svc, int timeout, ...)
     } else {
         deadline = now + ms2us(timeout);
     }
+    state = monitor_control_watch(svc, mask, timeout < 0 ? 0 : deadline);
+    if (state != MS_ERROR || errno != ENOTSUP) {
+        return state;
+    }
+    now = clock_usec();
     while (now < deadline) {
-        usleep(MONITOR_POLL_INTERVAL);
         state = monitor_control_get_state(svc);
         if (state == MS_ERROR || mask & (1U << state)) {
             verbose("service reached state %s", monitor_state_name(state));
             return state;
         }
+        usleep(MONITOR_POLL_INTERVAL);
         now = clock_usec();
     }
     errno = ETIMEDOUT;
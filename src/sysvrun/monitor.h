@@ -17,6 +17,8 @@ typedef enum {
     MS_STOPPED,
     MS_FAILED,
     MS_DEAD,
+    // new states go last, so the values of existing ones do not change
+    MS_RELOADING,
     //
     MS_NUM_STATES
 } monitor_state;
@@ -26,6 +28,8 @@ const char *monitor_state_name(monitor_state);
 
 pid_t command_monitor(struct command *);
 char *monitor_control(struct service *, const char *);
+int monitor_control_batch(struct service *, size_t, const char **, char **);
+void monitor_control_disconnect(void);
 unsigned int monitor_control_identify(struct service *, pid_t *, int *);
 monitor_state monitor_control_get_state(struct service *);
 monitor_state monitor_control_wait(struct service *, int, ...);
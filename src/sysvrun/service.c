@@ -2,15 +2,20 @@
 
 #include "command.h"
 #include "common.h"
+#include "depgraph.h"
+#include "environment.h"
+#include "evlog.h"
 #include "exitcode.h"
 #include "monitor.h"
 #include "noise.h"
+#include "specifier.h"
 #include "strlist.h"
 #include "systemd.h"
 #include "sysvinit.h"
 #include "sysvrun.h"
 #include "timespan.h"
 #include "unit.h"
+#include "unitcache.h"
 
 #include <fsdyn/charstr.h>
 #include <fsdyn/fsalloc.h>
@@ -20,16 +25,21 @@
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <grp.h>
+#include <limits.h>
+#include <pwd.h>
 #include <signal.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/utsname.h>
 #include <unistd.h>
 
 #define DEFAULT_SERVICETYPE ST_SIMPLE
 #define DEFAULT_KILL_MODE KM_CGROUP
+#define DEFAULT_START_TIMEOUT_US 90 * TS_SEC
 #define DEFAULT_STOP_TIMEOUT_US 90 * TS_SEC
 #define DEFAULT_RESTART_POLICY RP_NO
 #define DEFAULT_RESTART_DELAY_US 100 * TS_MSEC
@@ -64,7 +74,16 @@ const char *restart_policy_names[] = {
     [RP_ON_FAILURE] = "on-failure",
     [RP_ON_ABNORMAL] = "on-abnormal",
     [RP_ON_ABORT] = "on-abort",
-    // [RP_ON_WATCHDOG] = "on-watchdog", /* unsupported */
+    [RP_ON_WATCHDOG] = "on-watchdog",
+    //
+    NULL,
+};
+
+const char *notify_access_names[] = {
+    [NA_NONE] = "none",
+    [NA_MAIN] = "main",
+    [NA_EXEC] = "exec",
+    [NA_ALL] = "all",
     //
     NULL,
 };
@@ -79,7 +98,8 @@ static struct service *service_create(const char *name)
     return svc;
 }
 
-struct service *service_from_unit_file(const char *name, const struct text *txt)
+// Creates a service from a parsed unit, which the service takes ownership of.
+struct service *service_from_unit(const char *name, struct unit *u)
 {
     char buf[64];
     struct service *svc;
@@ -91,10 +111,7 @@ struct service *service_from_unit_file(const char *name, const struct text *txt)
     unsigned int i;
 
     svc = service_create(name);
-    if ((svc->u = systemd_parse_unit_file(name, txt)) == NULL) {
-        service_free(svc);
-        return NULL;
-    }
+    svc->u = u;
     verbose("extracting service info from unit");
 
     // Units required by this one.  Note that this does not imply an ordering.
@@ -208,6 +225,63 @@ struct service *service_from_unit_file(const char *name, const struct text *txt)
         verbose("kill mode: %s", kill_mode_names[svc->kill_mode]);
     }
 
+    // Determine watchdog timeout
+    value = unit_get_value(svc->u, "Service", "WatchdogSec");
+    if (value != NULL) {
+        svc->watchdog_timeout = timespan_from_str(value);
+        if (svc->watchdog_timeout == TS_INVALID) {
+            error("invalid watchdog timeout '%s'", value);
+            goto fail;
+        }
+        if (svc->watchdog_timeout == TS_INFINITY) {
+            svc->watchdog_timeout = 0;
+        }
+        timespan_to_str(buf, sizeof(buf), svc->watchdog_timeout);
+        verbose("watchdog timeout: %s", buf);
+    }
+
+    // Determine which processes may send notifications.  The default is
+    // `main` for Type=notify or if the watchdog is enabled, and `none` for
+    // everything else.
+    value = unit_get_value(svc->u, "Service", "NotifyAccess");
+    if (value == NULL) {
+        if (svc->type == ST_NOTIFY || svc->watchdog_timeout > 0) {
+            svc->notify_access = NA_MAIN;
+        } else {
+            svc->notify_access = NA_NONE;
+        }
+        debug("notify access not specified, defaulting to %s",
+              notify_access_names[svc->notify_access]);
+    } else {
+        for (i = 0; i < NA_MAX; i++) {
+            if (strcmp(value, notify_access_names[i]) == 0) {
+                svc->notify_access = i;
+                break;
+            }
+        }
+        if (i == NA_MAX) {
+            error("invalid or unsupported notify access '%s'", value);
+            goto fail;
+        }
+        verbose("notify access: %s", notify_access_names[svc->notify_access]);
+    }
+
+    // Determine start timeout (only used for Type=notify)
+    value = unit_get_value(svc->u, "Service", "TimeoutStartSec");
+    if (value == NULL) {
+        svc->start_timeout = DEFAULT_START_TIMEOUT_US;
+        timespan_to_str(buf, sizeof(buf), svc->start_timeout);
+        debug("start timeout not specified, defaulting to %s", buf);
+    } else {
+        svc->start_timeout = timespan_from_str(value);
+        if (svc->start_timeout == TS_INVALID) {
+            error("invalid start timeout '%s'", value);
+            goto fail;
+        }
+        timespan_to_str(buf, sizeof(buf), svc->start_timeout);
+        verbose("start timeout: %s", buf);
+    }
+
     // Determine stop timeout
     value = unit_get_value(svc->u, "Service", "TimeoutStopSec");
     if (value == NULL) {
@@ -261,6 +335,34 @@ struct service *service_from_unit_file(const char *name, const struct text *txt)
             timespan_to_str(buf, sizeof(buf), svc->delay);
             verbose("restart delay: %s", buf);
         }
+        // Determine restart backoff parameters
+        value = unit_get_value(svc->u, "Service", "RestartSteps");
+        if (value != NULL) {
+            errno = 0;
+            num = strtoul(value, &end, 10);
+            if (*value == '-' || end == value || *end != '\0' || errno != 0) {
+                error("invalid restart steps '%s'", value);
+                goto fail;
+            }
+            svc->restart_steps = num;
+            verbose("restart steps: %lu", svc->restart_steps);
+        }
+        value = unit_get_value(svc->u, "Service", "RestartMaxDelaySec");
+        if (value == NULL) {
+            svc->restart_max_delay = TS_INFINITY;
+        } else {
+            svc->restart_max_delay = timespan_from_str(value);
+            if (svc->restart_max_delay == TS_INVALID) {
+                error("invalid maximum restart delay '%s'", value);
+                goto fail;
+            }
+            timespan_to_str(buf, sizeof(buf), svc->restart_max_delay);
+            verbose("maximum restart delay: %s", buf);
+        }
+        if (svc->restart_steps > 0 && svc->restart_max_delay == TS_INFINITY) {
+            warning("RestartSteps has no effect without RestartMaxDelaySec");
+            svc->restart_steps = 0;
+        }
     }
     if (unit_get_bool(svc->u, "Service", "RemainAfterExit") > 0) {
         svc->remain_after_exit = true;
@@ -303,6 +405,20 @@ fail:
     return NULL;
 }
 
+struct service *service_from_unit_file(const char *name, const struct text *txt)
+{
+    struct unit *u;
+
+    if ((u = systemd_parse_unit_file(name, txt)) == NULL) {
+        return NULL;
+    }
+    if (systemd_apply_dropins(u, name) != 0) {
+        unit_free(u);
+        return NULL;
+    }
+    return service_from_unit(name, u);
+}
+
 struct service *service_from_init_script(const char *name,
                                          const struct text *txt)
 {
@@ -314,47 +430,521 @@ struct service *service_from_init_script(const char *name,
     return svc;
 }
 
+// Loads a service from a unit file or init script.  A unit file is loaded
+// from the cache if it is still valid, otherwise it is parsed and the result
+// is cached, and its drop-ins are then applied on top of it.  For an instance
+// of a template, the cache entry is shared by every instance, and the
+// template's drop-ins are applied before the instance's own.
 struct service *service_from_file(const char *name, const char *path)
 {
     struct service *svc = NULL;
     struct text *txt = NULL;
+    byte_array_t *frag;
+    struct unit *u;
+    struct stat sb;
+    char *base, *tmpl;
+    const char *key;
+    bool cache;
 
     verbose("loading '%s' service from %s", name, path);
-    if ((txt = text_from_file(path)) == NULL) {
-        return NULL;
+    base = charstr_dupstr(name);
+    deservicify(base);
+    tmpl = systemd_template_name(base);
+    key = tmpl != NULL ? tmpl : base;
+    cache = stat(path, &sb) == 0 && S_ISREG(sb.st_mode);
+    u = unit_create(name);
+    if (!cache || unitcache_apply(key, &sb, u) != 0) {
+        if ((txt = text_map_file(path)) == NULL) {
+            goto fail;
+        }
+        if (txt->len > 3 && txt->beg[0] == '#' && txt->beg[1] == '!') {
+            unit_free(u);
+            u = NULL;
+            svc = service_from_init_script(name, txt);
+            text_free(txt);
+            goto done;
+        }
+        frag = systemd_parse_fragment(name, txt);
+        text_free(txt);
+        if (frag == NULL) {
+            goto fail;
+        }
+        (void)unit_apply_binary(u,
+                                byte_array_data(frag),
+                                byte_array_size(frag));
+        if (cache) {
+            unitcache_store(key, &sb, frag);
+        }
+        destroy_byte_array(frag);
     }
-    if (txt->len > 3 && txt->beg[0] == '#' && txt->beg[1] == '!') {
-        svc = service_from_init_script(name, txt);
-    } else {
-        svc = service_from_unit_file(name, txt);
+    if ((tmpl != NULL && systemd_apply_dropins(u, tmpl) != 0)
+        || systemd_apply_dropins(u, base) != 0) {
+        goto fail;
     }
-    text_free(txt);
+    svc = service_from_unit(name, u);
+done:
+    fsfree(tmpl);
+    fsfree(base);
     if (svc == NULL) {
         if (errno == ENOENT) {
             fprintf(stderr, "service '%s' not found in %s\n", name, path);
         }
-        fsfree(svc);
         return NULL;
     }
+    svc->path = charstr_dupstr(path);
     return svc;
+fail:
+    unit_free(u);
+    goto done;
 }
 
+// Maps the name of every service we know of to the path of its unit file or
+// init script.  Built on first use and kept for the lifetime of the process.
+static hash_table_t *service_index;
+
+// Locates a service by its name and loads it.  A unit file takes precedence
+// over an init script of the same name.  An instance of a template, such as
+// foo@bar, is loaded from the template's unit file, foo@.service, unless it
+// has a unit file of its own.
 struct service *service_find(const char *name)
 {
-    struct service *svc;
+    hash_elem_t *he;
+    char *key, *tmpl;
 
-    if ((svc = systemd_find_service(name)) == NULL
-        && (svc = sysvinit_find_service(name)) == NULL) {
+    if (service_index == NULL) {
+        service_index =
+            make_hash_table(256, (void *)hash_string, (void *)strcmp);
+        systemd_index_services(service_index);
+        sysvinit_index_services(service_index);
+        debug("indexed %zu services", hash_table_size(service_index));
+    }
+    key = charstr_dupstr(name);
+    deservicify(key);
+    he = hash_table_get(service_index, key);
+    if (he == NULL && strcmp(key, name) != 0) {
+        // an init script with a suffix
+        he = hash_table_get(service_index, name);
+    }
+    if (he == NULL && (tmpl = systemd_template_name(key)) != NULL) {
+        // an instance of a template
+        he = hash_table_get(service_index, tmpl);
+        fsfree(tmpl);
+    }
+    fsfree(key);
+    if (he == NULL) {
+        debug("service %s not found", name);
+        errno = ENOENT;
         return NULL;
     }
-    return svc;
+    return service_from_file(name, hash_elem_get_value(he));
+}
+
+// Splits a service name into the part before the '@' and the instance after.
+static size_t service_prefix_len(const char *name)
+{
+    const char *at;
+
+    return (at = strchr(name, '@')) != NULL ? (size_t)(at - name)
+                                            : strlen(name);
+}
+
+// Reads the first line of a file under the root directory.
+static char *service_read_line(const char *path)
+{
+    struct text *txt;
+    char *fullpath, *line = NULL;
+    const char *end;
+
+    fullpath = charstr_printf("%s%s", root, path);
+    if ((txt = text_from_file(fullpath)) != NULL) {
+        end = memchr(txt->beg, '\n', txt->len);
+        line = charstr_dupsubstr(txt->beg, end != NULL ? end : txt->end);
+        text_free(txt);
+    }
+    fsfree(fullpath);
+    return line;
+}
+
+// Computes the value of a specifier for a service.  See the table in
+// systemd.unit(5).  Paths are those of the system manager.
+static char *service_specifier_value(struct service *svc, char spec)
+{
+    const struct credentials *creds;
+    const char *name = svc->name, *value, *user, *home, *shell;
+    struct passwd *pw;
+    struct group *gr;
+    struct utsname un;
+    char host[HOST_NAME_MAX + 1], *str, *p;
+    size_t plen = service_prefix_len(name);
+    uid_t uid;
+    bool group;
+
+    switch (spec) {
+        case 'n':
+            return charstr_printf("%s%s", name, DOT_SERVICE);
+        case 'N':
+            return charstr_dupstr(name);
+        case 'p':
+            return charstr_dupsubstr(name, name + plen);
+        case 'P':
+            return specifier_unescape(name, plen);
+        case 'i':
+            return charstr_dupstr(name[plen] == '@' ? name + plen + 1 : "");
+        case 'I':
+            value = name[plen] == '@' ? name + plen + 1 : "";
+            return specifier_unescape(value, strlen(value));
+        case 'f':
+            if (name[plen] == '@' && name[plen + 1] != '\0') {
+                str = specifier_unescape(name + plen + 1,
+                                         strlen(name + plen + 1));
+            } else {
+                str = specifier_unescape(name, plen);
+            }
+            p = charstr_printf("/%s", str[0] == '/' ? str + 1 : str);
+            fsfree(str);
+            return p;
+        case 't':
+            if (getuid() == 0) {
+                return charstr_dupstr("/run");
+            }
+            value = getenv("XDG_RUNTIME_DIR");
+            return value != NULL ? charstr_dupstr(value) : NULL;
+        case 'S':
+            return charstr_dupstr("/var/lib");
+        case 'C':
+            return charstr_dupstr("/var/cache");
+        case 'L':
+            return charstr_dupstr("/var/log");
+        case 'E':
+            return charstr_dupstr("/etc");
+        case 'T':
+            value = getenv("TMPDIR");
+            return charstr_dupstr(value != NULL ? value : "/tmp");
+        case 'V':
+            value = getenv("TMPDIR");
+            return charstr_dupstr(value != NULL ? value : "/var/tmp");
+        case 'h':
+        case 's':
+        case 'u':
+        case 'U':
+            if ((creds = service_credentials(svc)) == NULL) {
+                return NULL;
+            }
+            if (creds->user != NULL) {
+                user = creds->user;
+                home = creds->home;
+                shell = creds->shell;
+                uid = creds->uid;
+            } else if ((pw = getpwuid(getuid())) != NULL) {
+                user = pw->pw_name;
+                home = pw->pw_dir;
+                shell = pw->pw_shell;
+                uid = pw->pw_uid;
+            } else {
+                return NULL;
+            }
+            if (spec == 'h') {
+                return charstr_dupstr(home);
+            } else if (spec == 's') {
+                return charstr_dupstr(shell);
+            } else if (spec == 'u') {
+                return charstr_dupstr(user);
+            }
+            return charstr_printf("%u", (unsigned int)uid);
+        case 'g':
+        case 'G':
+            if ((creds = service_credentials(svc)) == NULL) {
+                return NULL;
+            }
+            group = creds->user != NULL
+                || unit_get_value(svc->u, "Service", "Group") != NULL;
+            if (spec == 'G') {
+                return charstr_printf("%u",
+                                      (unsigned int)(group ? creds->gid
+                                                           : getgid()));
+            }
+            if ((gr = getgrgid(group ? creds->gid : getgid())) == NULL) {
+                return NULL;
+            }
+            return charstr_dupstr(gr->gr_name);
+        case 'H':
+        case 'l':
+            if (gethostname(host, sizeof(host)) != 0) {
+                return NULL;
+            }
+            host[sizeof(host) - 1] = '\0';
+            if (spec == 'l' && (p = strchr(host, '.')) != NULL) {
+                *p = '\0';
+            }
+            return charstr_dupstr(host);
+        case 'm':
+            return service_read_line("/etc/machine-id");
+        case 'b':
+            if ((str = service_read_line("/proc/sys/kernel/random/boot_id"))
+                == NULL) {
+                return NULL;
+            }
+            // remove the dashes
+            for (value = p = str; *value != '\0'; value++) {
+                if (*value != '-') {
+                    *p++ = *value;
+                }
+            }
+            *p = '\0';
+            return str;
+        case 'v':
+            if (uname(&un) != 0) {
+                return NULL;
+            }
+            return charstr_dupstr(un.release);
+        case '%':
+            return charstr_dupstr("%");
+        default:
+            return NULL;
+    }
+}
+
+// Returns the value of a specifier for a service, computing it on first use.
+static const char *service_specifier(void *ptr, char spec)
+{
+    struct service *svc = ptr;
+    unsigned char idx = spec;
+
+    if (idx >= SERVICE_SPECIFIERS) {
+        return NULL;
+    }
+    if (svc->specifiers == NULL) {
+        svc->specifiers =
+            fscalloc(SERVICE_SPECIFIERS, sizeof(*svc->specifiers));
+    }
+    if (svc->specifiers[idx] == NULL) {
+        svc->specifiers[idx] = service_specifier_value(svc, spec);
+        if (svc->specifiers[idx] == NULL) {
+            error("failed to resolve specifier %%%c", spec);
+        }
+    }
+    return svc->specifiers[idx];
+}
+
+// Expands the specifiers in a value from the service's unit.  The value is
+// compiled into a template the first time it is seen, which is then reused
+// for every command and every instance.  Returns NULL if the value contains
+// an invalid specifier or one which cannot be resolved.
+char *service_expand(struct service *svc, const char *value)
+{
+    const struct specifier_template *tpl;
+    char *str;
+
+    if (strchr(value, '%') == NULL) {
+        return charstr_dupstr(value);
+    }
+    if ((tpl = specifier_intern(value)) == NULL) {
+        error("invalid specifier in '%s'", value);
+        return NULL;
+    }
+    if ((str = specifier_expand(tpl, service_specifier, svc)) == NULL) {
+        error("failed to expand '%s'", value);
+        return NULL;
+    }
+    return str;
+}
+
+static void credentials_free(struct credentials *creds)
+{
+    if (creds != NULL) {
+        fsfree(creds->user);
+        fsfree(creds->home);
+        fsfree(creds->shell);
+        fsfree(creds->groups);
+        fsfree(creds);
+    }
+}
+
+// Appends a group to a list of supplementary groups, unless it is already
+// there.
+static void credentials_add_group(struct credentials *creds, gid_t gid)
+{
+    for (int i = 0; i < creds->ngroups; i++) {
+        if (creds->groups[i] == gid) {
+            return;
+        }
+    }
+    creds->groups = fsrealloc(creds->groups,
+                              (creds->ngroups + 1) * sizeof(gid_t));
+    creds->groups[creds->ngroups++] = gid;
+}
+
+// Looks up the credentials specified by User=, Group= and
+// SupplementaryGroups=.  If User= is specified, the supplementary groups
+// include every group the user is a member of.  The result is cached in the
+// service, so the password and group databases, which may well be remote, are
+// only consulted once however many commands we build for it.  Returns NULL if
+// a user or group does not exist.
+const struct credentials *service_credentials(struct service *svc)
+{
+    struct credentials *creds;
+    struct passwd *pw = NULL;
+    struct group *gr;
+    const char *user, *group, *value;
+    list_t *list;
+    char *name;
+    gid_t *groups;
+    int ngroups;
+
+    if (svc->creds != NULL) {
+        return svc->creds;
+    }
+    creds = fscalloc(1, sizeof(*creds));
+    creds->ngroups = -1;
+    if (svc->u == NULL) {
+        return svc->creds = creds;
+    }
+    user = unit_get_value(svc->u, "Service", "User");
+    if (user != NULL) {
+        // XXX should look this up inside the chroot if there is one
+        if ((pw = getpwnam(user)) == NULL) {
+            error("user '%s' not found", user);
+            goto fail;
+        }
+        creds->user = charstr_dupstr(pw->pw_name);
+        creds->home = charstr_dupstr(pw->pw_dir);
+        creds->shell = charstr_dupstr(pw->pw_shell);
+        creds->uid = pw->pw_uid;
+        creds->gid = pw->pw_gid;
+    }
+    group = unit_get_value(svc->u, "Service", "Group");
+    if (group != NULL) {
+        // XXX should look this up inside the chroot if there is one
+        if ((gr = getgrnam(group)) == NULL) {
+            error("group '%s' not found", group);
+            goto fail;
+        }
+        creds->gid = gr->gr_gid;
+    }
+    if (user != NULL || group != NULL) {
+        creds->ngroups = 0;
+        credentials_add_group(creds, creds->gid);
+    }
+    if (user != NULL) {
+        ngroups = 16;
+        groups = fsalloc(ngroups * sizeof(gid_t));
+        while (getgrouplist(creds->user, creds->gid, groups, &ngroups) < 0) {
+            groups = fsrealloc(groups, ngroups * sizeof(gid_t));
+        }
+        for (int i = 0; i < ngroups; i++) {
+            credentials_add_group(creds, groups[i]);
+        }
+        fsfree(groups);
+    }
+    value = unit_get_value(svc->u, "Service", "SupplementaryGroups");
+    if (value != NULL) {
+        if (creds->ngroups < 0) {
+            creds->ngroups = 0;
+        }
+        list = systemd_split_quoted(value);
+        while ((name = DQ(list_pop_first(list))) != NULL) {
+            if ((gr = getgrnam(name)) == NULL) {
+                error("group '%s' not found", name);
+                fsfree(name);
+                strlist_free(list);
+                goto fail;
+            }
+            credentials_add_group(creds, gr->gr_gid);
+            fsfree(name);
+        }
+        destroy_list(list);
+    }
+    debug("credentials: uid %d gid %d with %d supplementary groups",
+          (int)creds->uid,
+          (int)creds->gid,
+          creds->ngroups);
+    return svc->creds = creds;
+fail:
+    credentials_free(creds);
+    errno = ENOENT;
+    return NULL;
+}
+
+// Reads the files listed in EnvironmentFile=, in order, into a single
+// environment.  Files whose names are prefixed with '-' are skipped if they
+// cannot be read.  Like the credentials, the result is cached in the service,
+// so each file is read once per generation of the service rather than once
+// per command.  Returns NULL with errno set if a required file cannot be
+// read.
+struct environment *service_environment_files(struct service *svc)
+{
+    struct environment *env;
+    const char *value, *name;
+    list_t *list;
+    char *str, *word, *path;
+    bool optional;
+    int serrno;
+
+    if (svc->envfiles != NULL) {
+        return svc->envfiles;
+    }
+    env = environment_create();
+    value = svc->u != NULL
+        ? unit_get_value(svc->u, "Service", "EnvironmentFile")
+        : NULL;
+    if (value == NULL) {
+        return svc->envfiles = env;
+    }
+    // Specifiers are expanded in each path, so they cannot split it.
+    list = systemd_split_quoted(value);
+    while ((word = DQ(list_pop_first(list))) != NULL) {
+        str = service_expand(svc, word);
+        fsfree(word);
+        if (str == NULL) {
+            serrno = errno;
+            strlist_free(list);
+            errno = serrno;
+            goto fail;
+        }
+        name = str;
+        if ((optional = *name == '-')) {
+            name++;
+        }
+        path = charstr_printf("%s%s", root, name);
+        if (environment_load(env, path) != 0) {
+            if (optional) {
+                debug("skipping environment file %s: %m", path);
+            } else {
+                serrno = errno;
+                error("failed to read environment file %s: %m", path);
+                fsfree(path);
+                fsfree(str);
+                strlist_free(list);
+                errno = serrno;
+                goto fail;
+            }
+        }
+        fsfree(path);
+        fsfree(str);
+    }
+    destroy_list(list);
+    return svc->envfiles = env;
+fail:
+    serrno = errno;
+    environment_free(env);
+    errno = serrno;
+    return NULL;
 }
 
 void service_free(struct service *svc)
 {
     if (svc != NULL) {
+        credentials_free(svc->creds);
+        environment_free(svc->envfiles);
         unit_free(svc->u);
         fsfree(svc->name);
+        fsfree(svc->path);
+        if (svc->specifiers != NULL) {
+            for (int i = 0; i < SERVICE_SPECIFIERS; i++) {
+                fsfree(svc->specifiers[i]);
+            }
+            fsfree(svc->specifiers);
+        }
         strlist_free(svc->required);
         strlist_free(svc->should);
         fsfree(svc);
@@ -528,35 +1118,31 @@ int service_show(struct service *svc, const char *output)
     return EXIT_SUCCESS;
 }
 
-static int service_start_prerequisites(list_t *req)
+static int service_start_one(struct service *, bool);
+
+// Starts a unit required by the service being started.  Its own
+// prerequisites are part of the same graph and have already been started.
+static int service_start_prerequisite(struct service *svc)
 {
-    struct service *svc;
-    const char *name;
-    list_elem_t *e;
-    int ret = 0;
-
-    for (e = list_get_first(req); e != NULL; e = list_next(e)) {
-        name = list_elem_get_value(e);
-        svc = service_find(name);
-        if (svc == NULL) {
-            if (errno == ENOENT) {
-                error("service '%s' not found", name);
-            }
-            return -1;
-        } else {
-            if (service_start(svc) != EXIT_SUCCESS) {
-                error("failed to start %s", svc->name);
-                ret = -1;
-            } else {
-                info("started %s", svc->name);
-            }
-            service_free(svc);
-        }
+    return service_start_one(svc, false);
+}
+
+// Starts every unit the service requires, directly or indirectly, in
+// dependency order, starting independent units concurrently.
+static int service_start_prerequisites(struct service *svc)
+{
+    struct depgraph *dg;
+    int ret;
+
+    if ((dg = depgraph_create(svc, DG_START)) == NULL) {
+        return -1;
     }
+    ret = depgraph_run(dg, service_start_prerequisite);
+    depgraph_free(dg);
     return ret;
 }
 
-int service_start(struct service *svc)
+static int service_start_one(struct service *svc, bool prerequisites)
 {
     struct command *cmd;
     monitor_state state;
@@ -579,7 +1165,8 @@ int service_start(struct service *svc)
             return EXIT_FAILURE;
         }
     }
-    if (state == MS_RUNNING || state == MS_REMAINING) {
+    if (state == MS_RUNNING || state == MS_REMAINING
+        || state == MS_RELOADING) {
         info("service is already running");
         return EXIT_SUCCESS;
     }
@@ -598,9 +1185,9 @@ int service_start(struct service *svc)
         }
         return EXIT_FAILURE;
     }
-    if (list_size(svc->required) > 0) {
+    if (prerequisites && list_size(svc->required) > 0) {
         verbose("checking prerequisites");
-        if (service_start_prerequisites(svc->required) != 0) {
+        if (service_start_prerequisites(svc) != 0) {
             error("failed to start prerequisites");
             return EXIT_FAILURE;
         }
@@ -615,14 +1202,50 @@ int service_start(struct service *svc)
     return EXIT_SUCCESS;
 }
 
-// Stops the service.
-int service_stop(struct service *svc)
+int service_start(struct service *svc)
+{
+    return service_start_one(svc, !ignore_dependencies);
+}
+
+static int service_stop_one(struct service *, bool);
+
+// Stops a unit which requires the service being stopped.  The units which
+// require it in turn are part of the same graph and have already been
+// stopped.
+static int service_stop_dependent(struct service *svc)
+{
+    return service_stop_one(svc, false);
+}
+
+// Stops every unit which requires the service, directly or indirectly, in
+// reverse dependency order, stopping independent units concurrently.
+static int service_stop_dependents(struct service *svc)
+{
+    struct depgraph *dg;
+    int ret;
+
+    if ((dg = depgraph_create(svc, DG_STOP)) == NULL) {
+        return -1;
+    }
+    ret = depgraph_run(dg, service_stop_dependent);
+    depgraph_free(dg);
+    return ret;
+}
+
+// Stops the service, after the units which require it if requested.
+static int service_stop_one(struct service *svc, bool dependents)
 {
     struct command *cmd;
     pid_t pid, pgid;
     int res, version;
     monitor_state state;
 
+    if (dependents) {
+        verbose("checking dependents");
+        if (service_stop_dependents(svc) != 0) {
+            warning("failed to stop dependents");
+        }
+    }
     // First, check if it's running.
     state = monitor_control_get_state(svc);
     if (state == MS_STOPPED) {
@@ -749,6 +1372,13 @@ int service_stop(struct service *svc)
     return 1;
 }
 
+// Stops the service and, unless told to ignore dependencies, every unit
+// which requires it.
+int service_stop(struct service *svc)
+{
+    return service_stop_one(svc, !ignore_dependencies);
+}
+
 int service_reload(struct service *svc)
 {
     struct command *cmd;
@@ -770,6 +1400,7 @@ int service_reload(struct service *svc)
             return 1;
         case MS_STARTING:
         case MS_RESTARTING:
+        case MS_RELOADING:
             // reloading is pointless
             return 0;
         case MS_RUNNING:
@@ -803,8 +1434,9 @@ int service_restart(struct service *svc)
         return 0;
     }
 #endif
-    // Plan B: stop, then start the service.
-    res = service_stop(svc);
+    // Plan B: stop, then start the service.  Units which require it are left
+    // running.
+    res = service_stop_one(svc, false);
     if (res != 0 && errno != ENOENT && errno != ESRCH) {
         return res;
     }
@@ -827,6 +1459,7 @@ int service_status(struct service *svc)
         case MS_STARTING:
         case MS_RUNNING:
         case MS_REMAINING:
+        case MS_RELOADING:
         case MS_STOPPING:
             // program is running or service is OK
             return 0;
@@ -871,7 +1504,24 @@ int service_control(struct service *svc)
             return EXIT_FAILURE;
         }
         printf("%s\n", response);
+        // the caller may be waiting for it before sending the next request
+        fflush(stdout);
         fsfree(response);
     }
     return ferror(stdin) ? EXIT_FAILURE : EXIT_SUCCESS;
 }
+
+// Prints the monitor's event log.
+int service_trace(struct service *svc)
+{
+    char *path;
+    int res;
+
+    path = evlog_path(svc, true);
+    res = evlog_print(path, stdout);
+    if (res != 0) {
+        error("failed to read event log %s: %m", path);
+    }
+    fsfree(path);
+    return res == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
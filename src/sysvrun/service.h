@@ -6,6 +6,8 @@
 #include <fsdyn/bytearray.h>
 #include <fsdyn/list.h>
 
+#include <sys/types.h>
+
 enum servicetype {
     ST_SIMPLE,
     ST_EXEC,
@@ -38,36 +40,78 @@ enum restartpolicy {
     RP_ON_FAILURE,
     RP_ON_ABNORMAL,
     RP_ON_ABORT,
-    // RP_ON_WATCHDOG, /* unsupported */
+    RP_ON_WATCHDOG,
     //
     RP_MAX
 };
 
 extern const char *restart_policy_names[];
 
+enum notifyaccess {
+    NA_NONE,
+    NA_MAIN,
+    NA_EXEC,
+    NA_ALL,
+    //
+    NA_MAX
+};
+
+extern const char *notify_access_names[];
+
+// Specifiers are single ASCII characters.
+#define SERVICE_SPECIFIERS 128
+
+// Credentials specified by User=, Group= and SupplementaryGroups=.
+struct credentials {
+    // from the password database if User= was specified, or NULL
+    char *user, *home, *shell;
+    uid_t uid;
+    gid_t gid;
+    // supplementary groups, or -1 if they should not be changed
+    int ngroups;
+    gid_t *groups;
+};
+
 struct service {
     char *name;
+    // path of the unit file or init script, if loaded from a file
+    char *path;
     // pointer to systemd unit if applicable
     struct unit *u;
     // type and policy
     enum servicetype type;
     enum killmode kill_mode;
+    enum notifyaccess notify_access;
+    usec_t start_timeout;
     usec_t stop_timeout;
+    usec_t watchdog_timeout;
     enum restartpolicy restart_policy;
     bool remain_after_exit;
     usec_t delay;
+    unsigned long restart_steps;
+    usec_t restart_max_delay;
     usec_t start_limit_interval;
     unsigned long start_limit_burst;
     // lists of dependencies
     list_t *required;
     list_t *should;
+    // credentials, looked up on first use
+    struct credentials *creds;
+    // contents of EnvironmentFile=, read on first use
+    struct environment *envfiles;
+    // values of specifiers, indexed by character, computed on first use
+    char **specifiers;
 };
 
 struct service *service_from_init_script(const char *, const struct text *);
+struct service *service_from_unit(const char *, struct unit *);
 struct service *service_from_unit_file(const char *, const struct text *);
 struct service *service_from_file(const char *, const char *);
 struct service *service_find(const char *);
+char *service_expand(struct service *, const char *);
 void service_free(struct service *);
+const struct credentials *service_credentials(struct service *);
+struct environment *service_environment_files(struct service *);
 byte_array_t *service_to_byte_array(struct service *, byte_array_t *);
 char *service_to_string(struct service *);
 int service_convert(struct service *, const char *);
@@ -78,3 +122,4 @@ int service_reload(struct service *);
 int service_restart(struct service *);
 int service_status(struct service *);
 int service_control(struct service *);
+int service_trace(struct service *);
@@ -4,6 +4,8 @@
 #include "service.h"
 #include "sysvrun.h"
 #include "unit.h"
+#include "unitcache.h"
+#include "unitlex.h"
 
 #include <fsdyn/bytearray.h>
 #include <fsdyn/charstr.h>
@@ -11,9 +13,11 @@
 #include <fsdyn/hashtable.h>
 
 #include <ctype.h>
+#include <dirent.h>
 #include <errno.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 
@@ -29,6 +33,19 @@ bool deservicify(char *str)
     return false;
 }
 
+// Returns the name of the template a service is an instance of, e.g. "foo@"
+// for "foo@bar", or NULL if it is not an instance.  The name must not have a
+// suffix.
+char *systemd_template_name(const char *name)
+{
+    const char *at;
+
+    if ((at = strchr(name, '@')) == NULL || at[1] == '\0') {
+        return NULL;
+    }
+    return charstr_dupsubstr(name, at + 1);
+}
+
 // Read and interpret systemd unit files in general, and service files in
 // particular.
 //
@@ -74,16 +91,15 @@ bool deservicify(char *str)
 // * XDG Desktop Entry Specification:
 //   https://specifications.freedesktop.org/desktop-entry-spec/latest/
 
+// The syntax is implemented by the tokenizer in unitlex.c, which places no
+// limit on the length of names or values and only copies a value when it spans
+// several lines or its whitespace must be normalized.
+
 // Note: we have no way of verifying the service name, as it is intentionally
 // not included in the unit file.  This allows the same unit file to be used for
 // multiple services, relying on symlinks and specifiers to differentiate them
 // (e.g. `ExecStart=/usr/sbin/%p --config /etc/%p/%i.conf`).
 
-// Define to 1 to normalize whitespace in values: tabs are replaced with spaces,
-// multiple consecutive spaces are collapsed into one, and trailing space is
-// removed.
-#define NORMALIZE_WHITESPACE 1
-
 // Standard C escapes
 static const char escape[256] = {
     ['a'] = '\a',  ['b'] = '\b', ['f'] = '\f',  ['n'] = '\n',
@@ -171,253 +187,264 @@ list_t *systemd_split_quoted(const char *string)
     return list;
 }
 
-static inline int issectionname(int ch)
+// Parses a systemd unit file or drop-in into a fragment: the sequence of
+// section, key and value triples it assigns, in order, in the format expected
+// by unit_apply_binary().  Since an empty value resets a key while any other
+// value replaces it or, for keys which take a list, is appended to it, the
+// fragment can be applied on top of another unit with the same result as if
+// the files had been concatenated.
+byte_array_t *systemd_parse_fragment(const char *name, const struct text *txt)
 {
-    return isprint(ch) && ch != '[' && ch != ']';
+    struct unitlex_token tok;
+    struct unitlex lx;
+    byte_array_t *frag;
+    const char *p;
+    int res;
+
+    verbose("parsing unit file for '%s' service", name);
+
+    frag = make_byte_array(SIZE_MAX);
+    unitlex_init(&lx, txt->beg, txt->len);
+    while ((res = unitlex_next(&lx, &tok)) > 0) {
+        byte_array_append(frag, tok.section, tok.section_len);
+        byte_array_append(frag, "", 1);
+        byte_array_append(frag, tok.key, tok.key_len);
+        byte_array_append(frag, "", 1);
+        byte_array_append(frag, tok.value, tok.value_len);
+        byte_array_append(frag, "", 1);
+    }
+    if (res == 0) {
+        unitlex_fini(&lx);
+        return frag;
+    }
+    error("%s", lx.error);
+    error("error in unit file line %u", lx.line);
+    if (lx.cur < lx.end) {
+        for (p = lx.cur; p < lx.end && *p != '\0' && *p != '\n'; p++) {
+            // nothing
+        }
+        if (p - lx.cur > 64) {
+            verbose("\t%.*s...", 64, lx.cur);
+        } else {
+            verbose("\t%.*s", (int)(p - lx.cur), lx.cur);
+        }
+    }
+    unitlex_fini(&lx);
+    destroy_byte_array(frag);
+    return NULL;
 }
 
-static inline int iskey(int ch)
+// Parses a systemd unit file.
+struct unit *systemd_parse_unit_file(const char *name, const struct text *txt)
 {
-    return isdigit(ch) || isalpha(ch) || ch == '-';
+    byte_array_t *frag;
+    struct unit *u;
+
+    if ((frag = systemd_parse_fragment(name, txt)) == NULL) {
+        return NULL;
+    }
+    u = unit_create(name);
+    (void)unit_apply_binary(u, byte_array_data(frag), byte_array_size(frag));
+    destroy_byte_array(frag);
+    return u;
 }
 
-static inline int isvalue(int ch)
+// Where to look for unit files, in order of precedence.  There are many, many
+// places they could be, so we will only check the most likely.
+static const char *systemd_unit_path[] = {
+    "/etc/systemd/system",
+    "/run/systemd/system",
+    "/usr/lib/systemd/system",
+    ".",
+    NULL,
+};
+
+static int systemd_dropin_cmp(const void *a, const void *b)
 {
-    return isprint(ch) || ch == '\t';
+    return strcmp(*(const char *const *)a, *(const char *const *)b);
 }
 
-// Parse a systemd unit file.
-struct unit *systemd_parse_unit_file(const char *name, const struct text *txt)
+// Applies a single drop-in to a unit, from the cache if it is still valid,
+// otherwise by parsing it and caching the result.
+static int systemd_apply_dropin(struct unit *u,
+                                const char *name,
+                                const char *conf,
+                                const char *path)
 {
-    char section[256] = "", key[256] = "", value[1024] = "";
-    const char *cur = txt->beg, *end = txt->beg + txt->len;
-    const char *p, *q, *r;
-    struct unit *u;
-    unsigned int s, k, v;
-    int lno;
-    char ch;
+    struct text *txt;
+    byte_array_t *frag;
+    struct stat sb;
+    char *key;
+    int res = -1;
 
-    verbose("parsing unit file for '%s' service", name);
+    if (stat(path, &sb) != 0 || !S_ISREG(sb.st_mode)) {
+        debug("ignoring drop-in %s", path);
+        return 0;
+    }
+    key = charstr_printf("%s%s.d:%s", name, DOT_SERVICE, conf);
+    if (unitcache_apply(key, &sb, u) == 0) {
+        res = 0;
+    } else if ((txt = text_map_file(path)) != NULL) {
+        verbose("applying drop-in %s", path);
+        if ((frag = systemd_parse_fragment(name, txt)) != NULL) {
+            res = unit_apply_binary(u,
+                                    byte_array_data(frag),
+                                    byte_array_size(frag));
+            unitcache_store(key, &sb, frag);
+            destroy_byte_array(frag);
+        }
+        text_free(txt);
+    }
+    fsfree(key);
+    return res;
+}
 
-    u = unit_create(name);
-    for (lno = 1; cur < end; lno++) {
-        if (*cur == '\0') {
-            // Premature end of input
-            goto eof;
-        } else if (*cur == '\n') {
-            // Blank line
-            cur++;
-        } else if (*cur == '#' || *cur == ';') {
-            // Comment line
-            for (p = cur; p < end && *p != '\0' && *p != '\n'; p++) {
-                // nothing
-            }
-            if (p >= end || *p == '\0') {
-                goto eof;
-            }
-            cur = p + 1;
-        } else if (*cur == '[') {
-            // Section header
-            p = cur + 1;
-            for (s = 0, q = p; q < end && issectionname(*q); q++) {
-                if (s < sizeof(section)) {
-                    section[s++] = *q;
-                }
-            }
-            if (q >= end || *q == '\0') {
-                goto eof;
-            }
-            if (s == 0) {
-                error("expected section name");
-                goto error;
-            }
-            if (*q != ']') {
-                error("expected ']'");
-                goto error;
-            }
-            r = q + 1;
-            if (r >= end || *r == '\0') {
-                goto eof;
-            }
-            if (*r != '\n') {
-                error("expected end of line");
-                goto error;
-            }
-            r++;
-            // At this point:
-            // - cur points to the start of the line
-            // - p points to the start of the section name
-            // - q points to the closing bracket
-            // - r points to the start of the next line
-            // - section contains as much of the section name as will fit
-            // - s is the length of the section name in the input
-            if (s >= sizeof(section) - 1) {
-                error("section name too long");
-                goto error;
-            }
-            section[s] = '\0';
-            cur = r;
+// Applies the drop-ins for a service to its unit.  Drop-ins are the *.conf
+// files in a <name>.service.d directory next to any of the directories in the
+// search path.  A drop-in hides any drop-in of the same name further down
+// the search path, and the drop-ins are applied in lexical order of their
+// names, regardless of which directory they are in.
+int systemd_apply_dropins(struct unit *u, const char *name)
+{
+    hash_table_t *dropins;
+    hash_elem_t *he;
+    list_t *confs;
+    list_elem_t *e;
+    struct dirent *de;
+    const char **dir, **confv;
+    char *path, *conf;
+    size_t i, n;
+    DIR *dirp;
+    int res = 0;
+
+    dropins = make_hash_table(16, (void *)hash_string, (void *)strcmp);
+    confs = make_list();
+    for (dir = systemd_unit_path; *dir != NULL; dir++) {
+        path = charstr_printf("%s%s/%s%s.d", root, *dir, name, DOT_SERVICE);
+        if ((dirp = opendir(path)) == NULL) {
+            fsfree(path);
             continue;
-        } else {
-            // Key-value pair
-            for (k = 0, p = cur; p < end && iskey(*p); p++) {
-                if (k < sizeof(key)) {
-                    key[k] = *p;
-                }
-                k++;
-            }
-            if (p >= end || *p == '\0') {
-                goto eof;
-            }
-            if (k == 0) {
-                error("expected key");
-                goto error;
-            }
-            for (q = p; q < end && isblank(*q); q++) {
-                // nothing
-            }
-            if (q >= end || *q == '\0') {
-                goto eof;
-            }
-            if (*q != '=') {
-                error("expected '='");
-                goto error;
-            }
-            for (q++; q < end && isblank(*q); q++) {
-                // nothing
-            }
-            if (q >= end || *q == '\0') {
-                goto eof;
-            }
-            for (v = 0, r = q; r < end && isvalue(*r); r++) {
-                ch = *r;
-                if (ch == '\\' && r + 1 < end && r[1] == '\n') {
-                    // Line continuation
-                    ch = ' ';
-                    r++; // now at end of line
-                    lno++;
-                    // Skip comment lines
-                    while (r + 1 < end && (r[1] == '#' || r[1] == ';')) {
-                        do {
-                            r++;
-                        } while (r < end && *r != '\0' && *r != '\n');
-                        // now at end of line
-                        lno++;
-                    }
-                }
-#if NORMALIZE_WHITESPACE
-                // Replace tabs with spaces
-                if (ch == '\t') {
-                    ch = ' ';
-                }
-                // Collapse consecutive spaces into one
-                if (ch == ' ' && v > 0 && v < sizeof(value)
-                    && value[v - 1] == ' ') {
-                    continue;
-                }
-#endif
-                if (v < sizeof(value)) {
-                    value[v] = ch;
-                }
-                v++;
-            }
-#if NORMALIZE_WHITESPACE
-            // Remove trailing space
-            if (v > 0 && v < sizeof(value) && value[v - 1] == ' ') {
-                v--;
-            }
-#endif
-            if (r >= end || *r == '\0') {
-                goto eof;
-            }
-            // At this point:
-            // - cur points to the start of the line and the key
-            // - p points to the first character after the key
-            // - key contains as much of the key as will fit
-            // - k is the length of the key in the input
-            // - q points to the first character of the value
-            // - r points to the end of the line
-            // - value contains as much of the value as will fit
-            // - v is the length of the value in the input
-            //   (adjusted for line continuations)
-            if (k >= sizeof(key) - 1) {
-                error("key too long");
-                goto error;
-            }
-            key[k] = '\0';
-            if (v >= sizeof(value) - 1) {
-                error("value too long");
-                goto error;
+        }
+        while ((de = readdir(dirp)) != NULL) {
+            if (de->d_name[0] == '.'
+                || !charstr_ends_with(de->d_name, ".conf")
+                || hash_table_get(dropins, de->d_name) != NULL) {
+                continue;
             }
-            value[v] = '\0';
-            if (section[0] == '\0') {
-                error("key-value pair before first section");
-                goto error;
+            conf = charstr_dupstr(de->d_name);
+            hash_table_put(dropins,
+                           conf,
+                           charstr_printf("%s/%s", path, de->d_name));
+            list_append(confs, conf);
+        }
+        closedir(dirp);
+        fsfree(path);
+    }
+    if ((n = list_size(confs)) > 0) {
+        confv = fscalloc(n, sizeof(*confv));
+        for (i = 0, e = list_get_first(confs); e != NULL;
+             i++, e = list_next(e)) {
+            confv[i] = list_elem_get_value(e);
+        }
+        qsort(confv, n, sizeof(*confv), systemd_dropin_cmp);
+        for (i = 0; i < n; i++) {
+            he = hash_table_get(dropins, confv[i]);
+            if (systemd_apply_dropin(u,
+                                     name,
+                                     confv[i],
+                                     hash_elem_get_value(he))
+                != 0) {
+                res = -1;
             }
-            // append unless the value is empty
-            unit_update_value(u, section, key, value, v > 0);
-            cur = r + 1;
         }
+        fsfree(confv);
     }
-    return u;
-eof:
-    error("unexpected end of unit file");
-error:
-    error("error in unit file line %d", lno);
-    if (cur < end) {
-        for (p = cur; p < end && *p != '\0' && *p != '\n'; p++) {
-            // nothing
+    while ((he = hash_table_pop_any(dropins)) != NULL) {
+        fsfree(DQ(hash_elem_get_key(he)));
+        fsfree(DQ(hash_elem_get_value(he)));
+        destroy_hash_element(he);
+    }
+    destroy_hash_table(dropins);
+    destroy_list(confs);
+    return res;
+}
+
+// Adds the units in each of the directories in the search path to an index
+// mapping service names, without suffix, to the paths of their unit files,
+// unless they are already present.  This takes a single pass over each
+// directory, instead of probing each directory for each service.
+void systemd_index_services(hash_table_t *index)
+{
+    struct dirent *de;
+    const char **dir;
+    char *path, *name;
+    DIR *dirp;
+
+    for (dir = systemd_unit_path; *dir != NULL; dir++) {
+        path = charstr_printf("%s%s", root, *dir);
+        debug("indexing units in %s", path);
+        if ((dirp = opendir(path)) == NULL) {
+            debug("failed to open %s: %m", path);
+            fsfree(path);
+            continue;
         }
-        if (p - cur > 64) {
-            verbose("\t%.*s...", 64, cur);
-        } else {
-            verbose("\t%.*s", (int)(p - cur), cur);
+        while ((de = readdir(dirp)) != NULL) {
+            if (de->d_name[0] == '.'
+                || !charstr_ends_with(de->d_name, DOT_SERVICE)) {
+                continue;
+            }
+            name = charstr_dupstr(de->d_name);
+            deservicify(name);
+            if (hash_table_get(index, name) != NULL) {
+                fsfree(name);
+                continue;
+            }
+            hash_table_put(index,
+                           name,
+                           charstr_printf("%s/%s", path, de->d_name));
         }
+        closedir(dirp);
+        fsfree(path);
     }
-    unit_free(u);
-    return NULL;
 }
 
-// Locate a service by its name.  There are many, many places it could be,
-// so we will only check the most likely.
-static const char *systemd_unit_path[] = {
-    "/etc/systemd/system",
-    "/run/systemd/system",
-    "/usr/lib/systemd/system",
-    ".",
-    NULL,
-};
-struct service *systemd_find_service(const char *name)
+// Returns the names, without suffix, of the units in each of the directories
+// in the search path other than the current directory, in
+// search order.  A name may appear more than once if it is present in several
+// directories.
+list_t *systemd_list_services(void)
 {
     char path[1024];
-    struct stat sb;
+    struct dirent *de;
     const char **dir;
-    const char *suffix;
+    list_t *names;
+    char *name;
+    DIR *dirp;
     int res;
 
-    if (charstr_ends_with(name, DOT_SERVICE)) {
-        suffix = "";
-    } else {
-        suffix = DOT_SERVICE;
-    }
+    names = make_list();
     for (dir = systemd_unit_path; *dir != NULL; dir++) {
-        res =
-            snprintf(path, sizeof(path), "%s%s/%s%s", root, *dir, name, suffix);
-        if (res < 0) {
-            return NULL;
+        if (strcmp(*dir, ".") == 0) {
+            continue;
         }
-        if ((size_t)res >= sizeof(path)) {
-            errno = EOVERFLOW;
-            return NULL;
+        res = snprintf(path, sizeof(path), "%s%s", root, *dir);
+        if (res < 0 || (size_t)res >= sizeof(path)) {
+            continue;
         }
-        debug("looking for %s in %s", name, path);
-        if (stat(path, &sb) == 0) {
-            return service_from_file(name, path);
+        if ((dirp = opendir(path)) == NULL) {
+            debug("failed to open %s: %m", path);
+            continue;
         }
-        if (errno != ENOENT && errno != ENOTDIR) {
-            return NULL;
+        while ((de = readdir(dirp)) != NULL) {
+            if (de->d_name[0] == '.'
+                || !charstr_ends_with(de->d_name, DOT_SERVICE)) {
+                continue;
+            }
+            name = charstr_dupstr(de->d_name);
+            deservicify(name);
+            list_append(names, name);
         }
+        closedir(dirp);
     }
-    errno = ENOENT;
-    return NULL;
+    return names;
 }
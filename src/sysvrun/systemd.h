@@ -2,6 +2,8 @@
 
 #include "text.h"
 
+#include <fsdyn/bytearray.h>
+#include <fsdyn/hashtable.h>
 #include <fsdyn/list.h>
 
 #include <stdbool.h>
@@ -9,6 +11,10 @@
 #define DOT_SERVICE ".service"
 
 bool deservicify(char *);
+char *systemd_template_name(const char *);
 list_t *systemd_split_quoted(const char *);
+byte_array_t *systemd_parse_fragment(const char *, const struct text *);
 struct unit *systemd_parse_unit_file(const char *name, const struct text *);
-struct service *systemd_find_service(const char *);
+int systemd_apply_dropins(struct unit *, const char *);
+void systemd_index_services(hash_table_t *);
+list_t *systemd_list_services(void);
@@ -3,7 +3,11 @@
 #include "service.h"
 #include "sysvrun.h"
 
+#include <fsdyn/charstr.h>
+#include <fsdyn/fsalloc.h>
+
 #include <ctype.h>
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
@@ -82,38 +86,87 @@ struct service *sysvinit_parse_init_script(const char *name,
     return svc;
 }
 
-// Locate a service by its name.
+// Where to look for init scripts, in order of precedence.
 static const char *sysvinit_script_path[] = {
     "/etc/init.d",
     ".",
     NULL,
 };
-struct service *sysvinit_find_service(const char *name)
+
+// Adds the init scripts in each of the directories in the search path to an
+// index mapping service names to paths, unless they are already present.
+void sysvinit_index_services(hash_table_t *index)
 {
-    char path[1024];
-    struct stat sb;
+    struct dirent *de;
     const char **dir;
-    int res;
+    char *path;
+    DIR *dirp;
 
     for (dir = sysvinit_script_path; *dir != NULL; dir++) {
-        res = snprintf(path, sizeof(path), "%s%s/%s", root, *dir, name);
-        if (res < 0) {
-            return NULL;
+        path = charstr_printf("%s%s", root, *dir);
+        debug("indexing init scripts in %s", path);
+        if ((dirp = opendir(path)) == NULL) {
+            debug("failed to open %s: %m", path);
+            fsfree(path);
+            continue;
         }
-        if ((size_t)res >= sizeof(path)) {
-            errno = EOVERFLOW;
-            return NULL;
+        while ((de = readdir(dirp)) != NULL) {
+            if (de->d_name[0] == '.'
+                || hash_table_get(index, de->d_name) != NULL) {
+                continue;
+            }
+            hash_table_put(index,
+                           charstr_dupstr(de->d_name),
+                           charstr_printf("%s/%s", path, de->d_name));
         }
-        debug("looking for %s in %s", name, path);
-        if (stat(path, &sb) == 0) {
-            return service_from_file(name, path);
+        closedir(dirp);
+        fsfree(path);
+    }
+}
+
+// Returns the names of the init scripts in the first directory in the search
+// path which contain an embedded unit file.  Other scripts
+// are not ours and are ignored.
+list_t *sysvinit_list_services(void)
+{
+    char path[1024];
+    struct dirent *de;
+    struct text *txt, *line;
+    list_t *names;
+    DIR *dirp;
+    int res;
+
+    names = make_list();
+    res = snprintf(path, sizeof(path), "%s%s", root, sysvinit_script_path[0]);
+    if (res < 0 || (size_t)res >= sizeof(path)) {
+        return names;
+    }
+    if ((dirp = opendir(path)) == NULL) {
+        debug("failed to open %s: %m", path);
+        return names;
+    }
+    while ((de = readdir(dirp)) != NULL) {
+        if (de->d_name[0] == '.') {
+            continue;
+        }
+        res = snprintf(path,
+                       sizeof(path),
+                       "%s%s/%s",
+                       root,
+                       sysvinit_script_path[0],
+                       de->d_name);
+        if (res < 0 || (size_t)res >= sizeof(path)
+            || (txt = text_from_file(path)) == NULL) {
+            continue;
         }
-        if (errno != ENOENT && errno != ENOTDIR) {
-            return NULL;
+        if ((line = text_first_line_equals(txt, BEGIN_EMBED, 0)) != NULL) {
+            list_append(names, charstr_dupstr(de->d_name));
+            text_free(line);
         }
+        text_free(txt);
     }
-    errno = ENOENT;
-    return NULL;
+    closedir(dirp);
+    return names;
 }
 
 char *sysvinit_create_init_script(struct service *svc)
@@ -2,6 +2,9 @@
 
 #include "text.h"
 
+#include <fsdyn/hashtable.h>
+#include <fsdyn/list.h>
+
 #define LSB_BEGIN_INIT_INFO "### BEGIN INIT INFO"
 #define LSB_END_INIT_INFO "### END INIT INFO"
 #define LSB_PROVIDES "# Provides:"
@@ -12,4 +15,5 @@
 #define END_EMBED "SYSVKIT"
 
 struct service *sysvinit_parse_init_script(const char *, const struct text *);
-struct service *sysvinit_find_service(const char *);
+void sysvinit_index_services(hash_table_t *);
+list_t *sysvinit_list_services(void);
@@ -1,11 +1,14 @@
 #include "sysvrun.h"
 
 #include "exitcode.h"
+#include "metrics.h"
 #include "noise.h"
 #include "proctitle.h"
 #include "service.h"
 #include "strlist.h"
 
+#include <fsdyn/charstr.h>
+
 #include <errno.h>
 #include <getopt.h>
 #include <limits.h>
@@ -33,9 +36,15 @@ bool dryrun;
 // Run in foreground
 bool foreground;
 
+// Don't start or stop units the service depends on or which depend on it
+bool ignore_dependencies;
+
 // Output path for convert
 const char *output;
 
+// Address to serve metrics on
+static const char *listen_addr;
+
 // Environment template for commands
 //
 // Denv: variables that we set to hardcoded defaults + variables copied from our
@@ -52,6 +61,7 @@ list_t *Ulist;
 
 static const char *preserve_env[] = {
     // list of environment variables to pass on to services
+    "SYSVKIT_EVENT_LOG",
     "SYSVKIT_LOG_TO_FILE",
     "SYSVKIT_NOISE",
     NULL
@@ -136,6 +146,8 @@ static int sysvrun(struct service *svc, const char *verb)
         return service_status(svc);
     } else if (strcmp(verb, "control") == 0) {
         return service_control(svc);
+    } else if (strcmp(verb, "trace") == 0) {
+        return service_trace(svc);
     }
     fprintf(stderr, "unknown command: %s\n", verb);
     errno = EINVAL;
@@ -145,6 +157,7 @@ static int sysvrun(struct service *svc, const char *verb)
 static void usage(void)
 {
     printf("sysvrun [options] service verb\n");
+    printf("sysvrun [options] metrics\n");
 }
 
 static const struct option options[] = {
@@ -154,6 +167,8 @@ static const struct option options[] = {
     { "dryrun", no_argument, 0, 'n' },
     { "foreground", no_argument, 0, 'f' },
     { "help", no_argument, 0, 'h' },
+    { "ignore-dependencies", no_argument, 0, 'I' },
+    { "listen", required_argument, 0, 'l' },
     { "output", required_argument, 0, 'o' },
     { "root", required_argument, 0, 'r' },
     { "quiet", no_argument, 0, 'q' },
@@ -171,7 +186,7 @@ int main(int argc, char *argv[])
 
     setup_proctitle(argc, argv);
     setup_environment();
-    while ((opt = getopt_long(argc, argv, "dD:fhno:qr:U:u:v", options, NULL))
+    while ((opt = getopt_long(argc, argv, "dD:fhl:no:qr:U:u:v", options, NULL))
            != -1) {
         switch (opt) {
             case 0:
@@ -186,6 +201,12 @@ int main(int argc, char *argv[])
             case 'h':
                 usage();
                 return EXIT_SUCCESS;
+            case 'I':
+                ignore_dependencies = true;
+                break;
+            case 'l':
+                listen_addr = optarg;
+                break;
             case 'n':
                 dryrun = true;
                 break;
@@ -193,7 +214,9 @@ int main(int argc, char *argv[])
                 output = optarg;
                 break;
             case 'r':
-                root = optarg;
+                // The monitor overwrites argv with its process title but
+                // still needs the root to reload the unit.
+                root = charstr_dupstr(optarg);
                 break;
             case 'U':
                 list_append(Ulist, optarg);
@@ -215,7 +238,19 @@ int main(int argc, char *argv[])
     setup_self(argv[0]);
     argc -= optind;
     argv += optind;
-    if (argc != 2) {
+    if (argc == 1 && strcmp(argv[0], "metrics") == 0 && output == NULL) {
+        if (noise_override(NULL) != 0) {
+            error("invalid noise level %s=%s",
+                  NOISE_ENVVAR,
+                  getenv(NOISE_ENVVAR));
+            return EX_USAGE;
+        }
+        if (listen_addr != NULL) {
+            return metrics_serve(listen_addr);
+        }
+        return metrics_print(stdout);
+    }
+    if (argc != 2 || listen_addr != NULL) {
         usage();
         return EX_USAGE;
     }
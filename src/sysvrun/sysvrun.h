@@ -21,6 +21,7 @@ extern const char *self_dir;
 
 extern bool dryrun;
 extern bool foreground;
+extern bool ignore_dependencies;
 
 extern struct environment *Denv;
 extern list_t *Ulist;
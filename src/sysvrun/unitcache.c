@@ -0,0 +1,162 @@
+#define _GNU_SOURCE
+
+#include "unitcache.h"
+
+#include "noise.h"
+#include "strbool.h"
+#include "sysvrun.h"
+#include "unit.h"
+
+#include <fsdyn/bytearray.h>
+#include <fsdyn/charstr.h>
+#include <fsdyn/fsalloc.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Parsed unit files and drop-ins are cached in a binary format, one file per
+// fragment, which is mapped and applied straight to a unit without going
+// through the parser.  A cache file is only used if the file it was created
+// from still has the same device, inode, size and modification time, so when
+// a drop-in changes, only that drop-in is parsed again.  Since a fragment can
+// set ExecStart=, User= and the like, cache files and the cache directory are
+// only trusted if they belong to us and nobody else can write to them.  Set
+// SYSVKIT_UNIT_CACHE to false to disable the cache.
+
+// Returns the path of the cache file for the specified key, or NULL if the
+// cache is disabled.
+static char *unitcache_path(const char *name)
+{
+    const char *value;
+
+    value = getenv(UNITCACHE_ENVVAR);
+    if (value != NULL && strbool(value) == 0) {
+        return NULL;
+    }
+    return charstr_printf("%s%s/%s.cache", root, UNITCACHE_DIR, name);
+}
+
+// Returns true if a cache file or directory is owned by the effective user
+// and neither group- nor world-writable.
+static bool unitcache_trusted(const char *path, const struct stat *sb)
+{
+    if (sb->st_uid != geteuid() || (sb->st_mode & (S_IWGRP | S_IWOTH))) {
+        warning("ignoring %s: not owned by us or writable by others", path);
+        return false;
+    }
+    return true;
+}
+
+// Returns true if the header matches the unit file.
+static bool unitcache_valid(const struct unitcache_header *hdr,
+                            const struct stat *sb)
+{
+    return memcmp(hdr->magic, UNITCACHE_MAGIC, sizeof(hdr->magic)) == 0
+        && hdr->dev == (uint64_t)sb->st_dev && hdr->ino == (uint64_t)sb->st_ino
+        && hdr->size == (uint64_t)sb->st_size
+        && hdr->mtime_sec == (int64_t)sb->st_mtim.tv_sec
+        && hdr->mtime_nsec == (int64_t)sb->st_mtim.tv_nsec;
+}
+
+// Applies a cached fragment to a unit, provided that the cache file matches
+// the file described by sb.  Returns -1 if there is no valid cache file.
+int unitcache_apply(const char *name, const struct stat *sb, struct unit *u)
+{
+    const struct unitcache_header *hdr;
+    struct stat csb;
+    char *path;
+    void *map;
+    int fd, res = -1;
+
+    if ((path = unitcache_path(name)) == NULL) {
+        return -1;
+    }
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+        debug("no cached fragment in %s: %m", path);
+        goto done;
+    }
+    if (fstat(fd, &csb) != 0 || !S_ISREG(csb.st_mode)
+        || !unitcache_trusted(path, &csb)
+        || (size_t)csb.st_size < sizeof(*hdr)) {
+        close(fd);
+        goto done;
+    }
+    map = mmap(NULL, csb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        debug("failed to map %s: %m", path);
+        goto done;
+    }
+    hdr = map;
+    if (!unitcache_valid(hdr, sb)
+        || hdr->len != (uint64_t)csb.st_size - sizeof(*hdr)) {
+        debug("cached fragment in %s is stale", path);
+    } else if (unit_apply_binary(u, (const char *)(hdr + 1), hdr->len) != 0) {
+        warning("invalid cached fragment in %s", path);
+    } else {
+        verbose("applied cached fragment from %s", path);
+        res = 0;
+    }
+    munmap(map, csb.st_size);
+done:
+    fsfree(path);
+    return res;
+}
+
+// Stores a fragment in the cache, along with the identity of the file it was
+// parsed from.  The cache file is replaced atomically, so concurrent readers
+// either see the old one or the new one.  Failure is not an error.
+void unitcache_store(const char *name,
+                     const struct stat *sb,
+                     byte_array_t *frag)
+{
+    struct unitcache_header hdr = { 0 };
+    char *dir, *path, *tmp;
+    struct stat dsb;
+    int fd = -1;
+
+    if ((path = unitcache_path(name)) == NULL) {
+        return;
+    }
+    dir = charstr_printf("%s%s", root, UNITCACHE_DIR);
+    tmp = charstr_printf("%s/.%s.XXXXXX", dir, name);
+    memcpy(hdr.magic, UNITCACHE_MAGIC, sizeof(hdr.magic));
+    hdr.dev = sb->st_dev;
+    hdr.ino = sb->st_ino;
+    hdr.size = sb->st_size;
+    hdr.mtime_sec = sb->st_mtim.tv_sec;
+    hdr.mtime_nsec = sb->st_mtim.tv_nsec;
+    hdr.len = byte_array_size(frag);
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        debug("failed to create %s: %m", dir);
+        goto done;
+    }
+    if (stat(dir, &dsb) != 0 || !S_ISDIR(dsb.st_mode)
+        || !unitcache_trusted(dir, &dsb)) {
+        goto done;
+    }
+    if ((fd = mkostemp(tmp, O_CLOEXEC)) < 0) {
+        debug("failed to create %s: %m", tmp);
+        goto done;
+    }
+    if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr)
+        || write(fd, byte_array_data(frag), hdr.len) != (ssize_t)hdr.len
+        || rename(tmp, path) != 0) {
+        debug("failed to write %s: %m", path);
+        (void)unlink(tmp);
+        goto done;
+    }
+    verbose("cached fragment in %s", path);
+done:
+    if (fd >= 0) {
+        close(fd);
+    }
+    fsfree(tmp);
+    fsfree(dir);
+    fsfree(path);
+}
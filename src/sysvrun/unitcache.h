@@ -0,0 +1,28 @@
+#pragma once
+
+#include <fsdyn/bytearray.h>
+
+#include <stdint.h>
+#include <sys/stat.h>
+
+#define UNITCACHE_ENVVAR "SYSVKIT_UNIT_CACHE"
+#define UNITCACHE_DIR "/run/sysvkit"
+#define UNITCACHE_MAGIC "SVKUNIT2"
+
+// The file header, followed by a fragment of len bytes as returned by
+// systemd_parse_fragment().  The remaining fields identify the unit file or
+// drop-in the fragment was parsed from.
+struct unitcache_header {
+    char magic[8];
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t len;
+};
+
+struct unit;
+
+int unitcache_apply(const char *, const struct stat *, struct unit *);
+void unitcache_store(const char *, const struct stat *, byte_array_t *);
@@ -0,0 +1,390 @@
+#define _GNU_SOURCE
+
+#include "environment.h"
+#include "noise.h"
+#include "strlist.h"
+
+#include <fsdyn/fsalloc.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static unsigned int ec;
+
+static struct environment *test_env(void)
+{
+    struct environment *env;
+
+    env = environment_create();
+    environment_set(env, "FOO", "foo", true);
+    environment_set(env, "BAR", " bar  baz ", true);
+    environment_set(env, "EMPTY", "", true);
+    return env;
+}
+
+// Checks that an environment contains exactly the given variables, in order.
+static bool check_vector(struct environment *env, const char **vars)
+{
+    char *const *vec;
+    size_t i;
+
+    vec = environment_vector(env);
+    for (i = 0; vars[i] != NULL; i++) {
+        if (vec[i] == NULL || strcmp(vec[i], vars[i]) != 0) {
+            printf("# expected \"%s\" got \"%s\"\n",
+                   vars[i],
+                   vec[i] != NULL ? vec[i] : "NULL");
+            return false;
+        }
+    }
+    if (vec[i] != NULL || environment_size(env) != i) {
+        printf("# unexpected \"%s\"\n", vec[i] != NULL ? vec[i] : "NULL");
+        return false;
+    }
+    return true;
+}
+
+static void test_vector(void)
+{
+    struct environment *env, *clone, *other;
+    unsigned int i = 0;
+    bool ok;
+
+#define check(descr, cond)                          \
+    do {                                            \
+        if (cond) {                                 \
+            printf("ok %u - %s\n", i++, descr);     \
+        } else {                                    \
+            printf("not ok %u - %s\n", i++, descr); \
+            ec++;                                   \
+        }                                           \
+    } while (0)
+
+    printf("1..%u\n", 11);
+    env = environment_create();
+    check("empty", check_vector(env, (const char *[]) { NULL }));
+    environment_set(env, "FOO", "foo", true);
+    environment_put(env, "BAR=bar", true);
+    environment_put(env, "FOOBAR", true);
+    environment_set(env, "BA", "ba", true);
+    check("sorted",
+          check_vector(env,
+                       (const char *[]) {
+                           "BA=ba",
+                           "BAR=bar",
+                           "FOO=foo",
+                           "FOOBAR=",
+                           NULL,
+                       }));
+    ok = environment_set(env, "FOO", "bar", false) != 0 && errno == EEXIST;
+    check("no overwrite",
+          ok && strcmp(environment_get(env, "FOO"), "foo") == 0);
+    ok = environment_set(env, "FOO", "bar", true) != 0 && errno == EEXIST;
+    check("overwrite", ok && strcmp(environment_get(env, "FOO"), "bar") == 0);
+    check("get missing",
+          environment_get(env, "FO") == NULL
+              && environment_get(env, "FOOBARBAZ") == NULL);
+    clone = environment_clone(env);
+    check("clone shares vector",
+          environment_vector(clone) == environment_vector(env));
+    environment_unset(clone, "BA");
+    environment_set(clone, "BAZ", "baz", true);
+    check("clone modified",
+          check_vector(clone,
+                       (const char *[]) {
+                           "BAR=bar",
+                           "BAZ=baz",
+                           "FOO=bar",
+                           "FOOBAR=",
+                           NULL,
+                       }));
+    check("original unchanged",
+          check_vector(env,
+                       (const char *[]) {
+                           "BA=ba",
+                           "BAR=bar",
+                           "FOO=bar",
+                           "FOOBAR=",
+                           NULL,
+                       }));
+    other = environment_create();
+    environment_set(other, "A", "a", true);
+    environment_set(other, "FOO", "foo", true);
+    environment_set(other, "Z", "z", true);
+    environment_merge(env, other, false);
+    check("merge",
+          check_vector(env,
+                       (const char *[]) {
+                           "A=a",
+                           "BA=ba",
+                           "BAR=bar",
+                           "FOO=bar",
+                           "FOOBAR=",
+                           "Z=z",
+                           NULL,
+                       }));
+    environment_merge(clone, other, true);
+    check("merge overwrite",
+          check_vector(clone,
+                       (const char *[]) {
+                           "A=a",
+                           "BAR=bar",
+                           "BAZ=baz",
+                           "FOO=foo",
+                           "FOOBAR=",
+                           "Z=z",
+                           NULL,
+                       }));
+    environment_free(other);
+    environment_free(env);
+    env = environment_create();
+    environment_merge(env, clone, true);
+    environment_free(clone);
+    for (int n = 0; n < 100; n++) {
+        environment_unset(env, "A");
+        environment_set(env, "A", "a", false);
+    }
+    check("merge into empty",
+          environment_size(env) == 6
+              && strcmp(environment_get(env, "BAZ"), "baz") == 0);
+    environment_free(env);
+#undef check
+}
+
+// Words are separated by '|' on both sides so that empty words and words
+// containing spaces are visible.
+static struct test_case_expand {
+    const char *in;
+    const char *out;
+} test_cases_expand[] = {
+    { "cmd", "cmd" },
+    { "$FOO", "$FOO" },
+    { "cmd|$FOO", "cmd|foo" },
+    { "cmd|${FOO}", "cmd|foo" },
+    { "cmd|$BAR", "cmd|bar|baz" },
+    { "cmd|${BAR}", "cmd| bar  baz " },
+    { "cmd|x${FOO}y${FOO}z", "cmd|xfooyfooz" },
+    { "cmd|$EMPTY|x", "cmd|x" },
+    { "cmd|${EMPTY}|x", "cmd||x" },
+    { "cmd|$UNSET|${UNSET}", "cmd|" },
+    { "cmd|$$FOO", "cmd|$FOO" },
+    { "cmd|$${FOO}", "cmd|${FOO}" },
+    { "cmd|a$FOO", "cmd|a$FOO" },
+    { "cmd|$FOO-", "cmd|$FOO-" },
+    { "cmd|${FOO", "cmd|${FOO" },
+    { "cmd|${1}", "cmd|${1}" },
+    { "cmd|$", "cmd|$" },
+};
+
+static void test_expand(void)
+{
+    struct test_case_expand *tc;
+    struct environment *env;
+    list_t *in, *out;
+    unsigned int i, n;
+    char *str;
+
+    env = test_env();
+    n = sizeof(test_cases_expand) / sizeof(test_cases_expand[0]);
+    printf("1..%u\n", n);
+    for (i = 0, tc = test_cases_expand; i < n; i++, tc++) {
+        in = strlist_from_delim(tc->in, '|', true, false);
+        out = environment_expand_args(env, in);
+        str = strlist_to_delim(out, '|', false);
+        if (strcmp(str, tc->out) == 0) {
+            printf("ok %u - \"%s\"\n", i, tc->in);
+        } else {
+            printf("not ok %u - \"%s\" expected \"%s\" got \"%s\"\n",
+                   i,
+                   tc->in,
+                   tc->out,
+                   str);
+            ec++;
+        }
+        fsfree(str);
+        strlist_free(out);
+        strlist_free(in);
+    }
+    environment_free(env);
+}
+
+static struct test_case_load {
+    const char *descr;
+    const char *in;
+    const char **vars; // name, value, name, value, ..., NULL
+} test_cases_load[] = {
+    {
+        .descr = "empty",
+        .in = "",
+        .vars = (const char *[]) { NULL },
+    },
+    {
+        .descr = "comments",
+        .in = "# FOO=foo\n; BAR=bar\n\n",
+        .vars = (const char *[]) { "FOO", NULL, "BAR", NULL, NULL },
+    },
+    {
+        .descr = "simple",
+        .in = "FOO=foo\nBAR=bar",
+        .vars = (const char *[]) { "FOO", "foo", "BAR", "bar", NULL },
+    },
+    {
+        .descr = "whitespace",
+        .in = "  FOO = foo bar  \n",
+        .vars = (const char *[]) { "FOO", "foo bar", NULL },
+    },
+    {
+        .descr = "empty value",
+        .in = "FOO=\n",
+        .vars = (const char *[]) { "FOO", "", NULL },
+    },
+    {
+        .descr = "single quotes",
+        .in = "FOO=' foo \\ \"bar\" '\n",
+        .vars = (const char *[]) { "FOO", " foo \\ \"bar\" ", NULL },
+    },
+    {
+        .descr = "double quotes",
+        .in = "FOO=\"a \\\"b\\\" \\$c \\d\"\n",
+        .vars = (const char *[]) { "FOO", "a \"b\" $c \\d", NULL },
+    },
+    {
+        .descr = "mixed quotes",
+        .in = "FOO=a'b'\"c\"d\n",
+        .vars = (const char *[]) { "FOO", "abcd", NULL },
+    },
+    {
+        .descr = "continuation",
+        .in = "FOO=foo \\\nbar\nBAR=\"a\\\nb\"\n",
+        .vars = (const char *[]) { "FOO", "foo bar", "BAR", "ab", NULL },
+    },
+    {
+        .descr = "multiline quotes",
+        .in = "FOO='a\nb'\nBAR=bar\n",
+        .vars = (const char *[]) { "FOO", "a\nb", "BAR", "bar", NULL },
+    },
+    {
+        .descr = "escapes",
+        .in = "FOO=\\ foo\\ \n",
+        .vars = (const char *[]) { "FOO", " foo ", NULL },
+    },
+    {
+        .descr = "redefinition",
+        .in = "FOO=foo\nFOO=bar\n",
+        .vars = (const char *[]) { "FOO", "bar", NULL },
+    },
+    {
+        .descr = "malformed",
+        .in = "FOO\n1FOO=foo\nFOO BAR=bar\nBAZ=baz\n",
+        .vars = (const char *[]) { "FOO", NULL, "BAZ", "baz", NULL },
+    },
+};
+
+static void test_load(void)
+{
+    struct test_case_load *tc;
+    struct environment *env;
+    char path[] = "/tmp/environment_test.XXXXXX";
+    const char **var, *value;
+    unsigned int i, n;
+    bool ok;
+    int fd;
+
+    if ((fd = mkstemp(path)) < 0) {
+        error("%s: %m", path);
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+    n = sizeof(test_cases_load) / sizeof(test_cases_load[0]);
+    printf("1..%u\n", n + 1);
+    for (i = 0, tc = test_cases_load; i < n; i++, tc++) {
+        env = environment_create();
+        ok = false;
+        if ((fd = open(path, O_WRONLY | O_TRUNC)) >= 0) {
+            ok = write(fd, tc->in, strlen(tc->in)) == (ssize_t)strlen(tc->in)
+                && close(fd) == 0 && environment_load(env, path) == 0;
+        }
+        for (var = tc->vars; ok && var[0] != NULL; var += 2) {
+            value = environment_get(env, var[0]);
+            if (var[1] != NULL ? value == NULL || strcmp(value, var[1]) != 0
+                               : value != NULL) {
+                printf("# %s expected %s%s%s got %s%s%s\n",
+                       var[0],
+                       var[1] != NULL ? "\"" : "",
+                       var[1] != NULL ? var[1] : "NULL",
+                       var[1] != NULL ? "\"" : "",
+                       value != NULL ? "\"" : "",
+                       value != NULL ? value : "NULL",
+                       value != NULL ? "\"" : "");
+                ok = false;
+            }
+        }
+        if (ok) {
+            printf("ok %u - %s\n", i, tc->descr);
+        } else {
+            printf("not ok %u - %s\n", i, tc->descr);
+            ec++;
+        }
+        environment_free(env);
+    }
+    unlink(path);
+    env = environment_create();
+    if (environment_load(env, path) != 0 && errno == ENOENT) {
+        printf("ok %u - missing file\n", i);
+    } else {
+        printf("not ok %u - missing file\n", i);
+        ec++;
+    }
+    environment_free(env);
+}
+
+static void usage(void) __attribute__((__noreturn__));
+static void usage(void)
+{
+    fprintf(stderr, "usage: %s [-dhqv]\n", program_invocation_short_name);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+
+    while ((opt = getopt(argc, argv, "dhqv")) != -1) {
+        switch (opt) {
+            case 'd':
+                if (noisy >= DEBUG) {
+                    noisy++;
+                } else {
+                    noisy = DEBUG;
+                }
+                break;
+            case 'h':
+                usage();
+                break;
+            case 'q':
+                noisy = QUIET;
+                break;
+            case 'v':
+                noisy = VERBOSE;
+                break;
+            default:
+                usage();
+                break;
+        }
+    }
+    argc -= optind;
+    argv += optind;
+    if (argc > 0) {
+        usage();
+    }
+
+    test_vector();
+    test_expand();
+    test_load();
+    exit(ec == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -0,0 +1,170 @@
+#define _GNU_SOURCE
+
+#include "noise.h"
+#include "specifier.h"
+
+#include <fsdyn/fsalloc.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static unsigned int ec;
+
+static const char *lookup(void *ctx, char spec)
+{
+    (void)ctx;
+    switch (spec) {
+        case 'n':
+            return "foo@bar.service";
+        case 'i':
+            return "bar";
+        case 'e':
+            return "";
+        default:
+            return NULL;
+    }
+}
+
+static struct test_case_expand {
+    const char *in;
+    const char *out; // NULL if expected to fail
+    int err;
+} test_cases_expand[] = {
+    { "", "", 0 },
+    { "plain", "plain", 0 },
+    { "%n", "foo@bar.service", 0 },
+    { "/run/%i.pid", "/run/bar.pid", 0 },
+    { "%i%i", "barbar", 0 },
+    { "[%e]", "[]", 0 },
+    { "100%%", "100%", 0 },
+    { "%%i", "%i", 0 },
+    { "%%%i%%", "%bar%", 0 },
+    { "a%%b%%c", "a%b%c", 0 },
+    { "%", NULL, EINVAL },
+    { "foo%", NULL, EINVAL },
+    { "%-", NULL, EINVAL },
+    { "%z", NULL, EINVAL },
+};
+
+static void test_expand(void)
+{
+    struct test_case_expand *tc;
+    struct specifier_template *tpl;
+    unsigned int i, n;
+    char *out;
+
+    n = sizeof(test_cases_expand) / sizeof(test_cases_expand[0]);
+    printf("1..%u\n", n);
+    for (i = 0, tc = test_cases_expand; i < n; i++, tc++) {
+        errno = 0;
+        out = NULL;
+        if ((tpl = specifier_compile(tc->in)) != NULL) {
+            out = specifier_expand(tpl, lookup, NULL);
+            specifier_free(tpl);
+        }
+        if (tc->out != NULL ? out != NULL && strcmp(out, tc->out) == 0
+                            : out == NULL && errno == tc->err) {
+            printf("ok %u - \"%s\"\n", i, tc->in);
+        } else {
+            printf("not ok %u - \"%s\" expected ", i, tc->in);
+            if (tc->out != NULL) {
+                printf("\"%s\"", tc->out);
+            } else {
+                printf("errno %d", tc->err);
+            }
+            if (out != NULL) {
+                printf(" got \"%s\"\n", out);
+            } else {
+                printf(" got errno %d\n", errno);
+            }
+            ec++;
+        }
+        fsfree(out);
+    }
+}
+
+static struct test_case_unescape {
+    const char *in;
+    const char *out;
+} test_cases_unescape[] = {
+    { "", "" },
+    { "foo", "foo" },
+    { "foo-bar", "foo/bar" },
+    { "-dev-sda1", "/dev/sda1" },
+    { "foo\\x2dbar", "foo-bar" },
+    { "\\x41\\x62", "Ab" },
+    { "\\x4", "\\x4" },
+    { "\\xzz", "\\xzz" },
+};
+
+static void test_unescape(void)
+{
+    struct test_case_unescape *tc;
+    unsigned int i, n;
+    char *out;
+
+    n = sizeof(test_cases_unescape) / sizeof(test_cases_unescape[0]);
+    printf("1..%u\n", n);
+    for (i = 0, tc = test_cases_unescape; i < n; i++, tc++) {
+        out = specifier_unescape(tc->in, strlen(tc->in));
+        if (strcmp(out, tc->out) == 0) {
+            printf("ok %u - \"%s\" -> \"%s\"\n", i, tc->in, out);
+        } else {
+            printf("not ok %u - \"%s\" expected \"%s\" got \"%s\"\n",
+                   i,
+                   tc->in,
+                   tc->out,
+                   out);
+            ec++;
+        }
+        fsfree(out);
+    }
+}
+
+static void usage(void) __attribute__((__noreturn__));
+static void usage(void)
+{
+    fprintf(stderr, "usage: %s [-dhqv]\n", program_invocation_short_name);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+
+    while ((opt = getopt(argc, argv, "dhqv")) != -1) {
+        switch (opt) {
+            case 'd':
+                if (noisy >= DEBUG) {
+                    noisy++;
+                } else {
+                    noisy = DEBUG;
+                }
+                break;
+            case 'h':
+                usage();
+                break;
+            case 'q':
+                noisy = QUIET;
+                break;
+            case 'v':
+                noisy = VERBOSE;
+                break;
+            default:
+                usage();
+                break;
+        }
+    }
+    argc -= optind;
+    argv += optind;
+    if (argc > 0) {
+        usage();
+    }
+
+    test_expand();
+    test_unescape();
+    exit(ec == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
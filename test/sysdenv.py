@@ -1,5 +1,6 @@
 from shlex import quote as Q
 from sysvenv import SysVEnv, SysVService
+import time
 import types
 
 DOT_SERVICE = ".service"
@@ -18,6 +19,23 @@ def servicify(name):
     return name
 
 
+# Polls cond until it returns something true, and returns that.  Gives up
+# and returns the last value after timeout seconds.
+def wait_until(cond, timeout=5):
+    deadline = time.monotonic() + timeout
+    while True:
+        value = cond()
+        if value or time.monotonic() >= deadline:
+            return value
+        time.sleep(0.1)
+
+
+# Waits for a file written by a service to appear and returns its text.
+def wait_for_file(path, timeout=5):
+    assert wait_until(path.exists, timeout), "{} not created".format(path)
+    return path.read_text()
+
+
 class Environment(types.SimpleNamespace):
     def __init__(self):
         pass
@@ -43,6 +61,12 @@ class SysdService:  # XXX make this a subclass of SysVService
         self._environment = Environment()
         self._exec = {}
         self._pidfile = None
+        # names of services this one requires or is ordered after
+        self.requires = []
+        self.after = []
+        # credentials
+        self.group = None
+        self.supplementary_groups = []
         self.unit_file = self.env.unit_d / servicify(self._name)
         self.init_script = self.env.init_d / self._name
 
@@ -56,6 +80,16 @@ class SysdService:  # XXX make this a subclass of SysVService
             unit_file.write(self.unit())
         path.chmod(0o640)
 
+    # Writes a drop-in for this service next to its unit file.
+    def write_dropin(self, conf, text):
+        dropin_d = self.unit_file.parent / (servicify(self._name) + ".d")
+        dropin_d.mkdir(0o750, exist_ok=True)
+        path = dropin_d / conf
+        with path.open(mode="w") as dropin:
+            dropin.write(text)
+        path.chmod(0o640)
+        return path
+
     @property
     def name(self):
         return self._name
@@ -77,9 +111,10 @@ class SysdService:  # XXX make this a subclass of SysVService
         return "simple"
 
     @type.setter
-    def type(self, type):
-        assert type(type) == str and type in ["simple", "exec", "forking"]
-        self._type = type
+    def type(self, value):
+        assert type(value) == str
+        assert value in ["simple", "exec", "forking", "notify"]
+        self._type = value
 
     def exec(self, op, command, *args):
         assert op in EXEC_OPS
@@ -117,6 +152,12 @@ class SysdService:  # XXX make this a subclass of SysVService
         lines = []
         lines.append("[Unit]")
         lines.append("Description=" + self.description)
+        if self.requires:
+            lines.append(
+                "Requires=" + " ".join(servicify(n) for n in self.requires)
+            )
+        if self.after:
+            lines.append("After=" + " ".join(servicify(n) for n in self.after))
         lines.append("[Service]")
         lines.append("Type=" + self.type)
         for op in EXEC_OPS:
@@ -128,6 +169,12 @@ class SysdService:  # XXX make this a subclass of SysVService
                 )
         if self._pidfile:
             lines.append("PIDFile={}".format(str(self._pidfile)))
+        if self.group:
+            lines.append("Group=" + self.group)
+        if self.supplementary_groups:
+            lines.append(
+                "SupplementaryGroups=" + " ".join(self.supplementary_groups)
+            )
         lines.append("[Install]")
         lines.append("WantedBy=multi-user.target")  # XXX hardcode for now
         lines.append("")
@@ -156,11 +203,12 @@ class SysdService:  # XXX make this a subclass of SysVService
     def direct_invoke(self, command, **kwargs):
         assert False
 
-    def invoke(self, command, **kwargs):
+    def invoke(self, command, *extra, **kwargs):
         self.write()
         args = []
         args.extend(["--unit-file", self.unit_file])
         args.extend([deservicify(self.name), command])
+        args.extend(extra)
         return self.env.sysvrun(*args, **kwargs)
 
 
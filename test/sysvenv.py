@@ -164,6 +164,7 @@ class SysVEnv:
         verbose=False,
         debug=False,
         output=None,
+        input=None,
     ):
         extra = ["--root", self.root]
         if quiet:
@@ -190,11 +191,12 @@ class SysVEnv:
             argv,
             cwd=env["PWD"],
             env=env,
+            stdin=subprocess.PIPE if input is not None else None,
             stdout=subprocess.PIPE,
             stderr=subprocess.PIPE,
         )
         try:
-            out, err = proc.communicate(timeout=timeout)
+            out, err = proc.communicate(input=input, timeout=timeout)
         except subprocess.TimeoutExpired:
             proc.kill()
             out, err = proc.communicate()
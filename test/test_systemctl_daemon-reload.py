@@ -1,4 +1,4 @@
-# systemctl daemon-reload: no-op.
+# systemctl daemon-reload: nothing to reload.
 def test_systemctl_daemon_reload(sysvenv):
     out, err, status = sysvenv.systemctl("daemon-reload")
     assert status == 0
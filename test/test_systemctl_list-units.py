@@ -0,0 +1,41 @@
+# systemctl list-units: sysvrun services are queried through their monitors,
+# a service whose monitor is not listening is reported as stopped.
+def test_systemctl_list_units(sysdenv, root):
+    sysdsvc = sysdenv.create_service("foo")
+    sysdsvc.execstart = [sysdenv.mockd, "sleep"]
+    assert sysdsvc.convert(debug=True)
+    other = sysdenv.create_service("bar")
+    other.execstart = [sysdenv.mockd, "sleep"]
+    assert other.convert(debug=True)
+    _, _, status = sysdsvc.invoke("start", debug=True)
+    assert status == 0
+    out, _, status = sysdenv.systemctl("list-units")
+    assert status == 0
+    lines = out.decode("utf-8").splitlines()
+    assert len(lines) == 2
+    assert lines[1].split() == ["foo.service", "disabled", "active", "running"]
+    out, _, status = sysdenv.systemctl("list-units", "--all")
+    assert status == 0
+    lines = out.decode("utf-8").splitlines()
+    assert len(lines) == 3
+    assert lines[1].split() == ["bar.service", "disabled", "inactive", "stopped"]
+    assert lines[2].split() == ["foo.service", "disabled", "active", "running"]
+    _, _, status = sysdsvc.invoke("stop", debug=True)
+    assert status == 0
+
+
+# systemctl status --all: one line per service, fails if any service fails.
+def test_systemctl_status_all(sysvenv):
+    svc0 = sysvenv.create_service("foo")
+    svc0.direct_enable()
+    svc0.will_do("status", 0)
+    svc1 = sysvenv.create_service("bar")
+    svc1.will_do("status", 3)
+    out, _, status = sysvenv.systemctl("status", "--all")
+    assert status == 4
+    lines = out.decode("utf-8").splitlines()
+    assert lines == [
+        "bar is disabled and inactive",
+        "foo is enabled and active",
+    ]
+    assert svc0.did("status") and svc1.did("status")
@@ -1,3 +1,9 @@
+import os
+import signal
+
+import pytest
+
+
 # systemctl start: successful.
 def test_systemctl_start_ok(sysvenv):
     service = sysvenv.create_service("foo")
@@ -87,3 +93,50 @@ def test_systemctl_is_active_multi(sysvenv):
     assert svc0.did("status")
     assert svc1.did("status")
     assert svc2.did("status")
+
+
+# systemctl restart --jobs: output is in order regardless of concurrency, and
+# the exit code is that of the failed service.
+@pytest.mark.parametrize("jobs", [1, 4])
+def test_systemctl_restart_jobs(sysvenv, jobs):
+    services = [sysvenv.create_service(f"svc{i}") for i in range(8)]
+    services[5].will_do("restart", 1)
+    out, err, status = sysvenv.systemctl(
+        f"--jobs={jobs}", "restart", *services, verbose=True
+    )
+    assert status == 1
+    lines = out.decode("utf-8").splitlines()
+    assert lines == [f"restarting {svc.name}" for svc in services]
+    for svc in services:
+        assert svc.did("restart")
+
+
+# systemctl start --jobs: an init script which leaves a daemon behind holding
+# its standard output and error does not keep systemctl waiting.
+def test_systemctl_start_jobs_daemon(sysvenv):
+    services = [sysvenv.create_service(f"svc{i}") for i in range(2)]
+    pidfile = sysvenv.root / "daemon.pid"
+    with services[0].script.open("w") as script:
+        script.write(
+            "#!/bin/sh\n"
+            '[ "$1" = start ] || exit 3\n'
+            "sleep 30 &\n"
+            f"echo $! >{pidfile}\n"
+            "echo starting daemon\n"
+        )
+    services[1].will_do("status", 3)
+    try:
+        out, err, status = sysvenv.systemctl(
+            "--jobs=2", "start", *services, verbose=True
+        )
+        assert status == 0
+        lines = out.decode("utf-8").splitlines()
+        assert lines == [
+            "starting daemon",
+            f"{services[1].name} is stopped",
+            f"starting {services[1].name}",
+        ]
+        assert services[1].did("start")
+    finally:
+        if pidfile.exists():
+            os.kill(int(pidfile.read_text()), signal.SIGTERM)
@@ -0,0 +1,226 @@
+from sysdenv import wait_for_file
+import json
+import os
+import select
+import socket
+import subprocess
+import time
+
+
+# sysvrun control: stats reports the service state and counters
+def test_control_stats(sysdenv, root):
+    sysdsvc = sysdenv.create_service("foo")
+    sysdsvc.execstart = [sysdenv.mockd, "sleep"]
+    _, _, status = sysdsvc.invoke("start", debug=True)
+    assert status == 0
+    out, _, status = sysdsvc.invoke("control", input=b"stats\n", debug=True)
+    assert status == 0
+    stats = json.loads(out.decode("utf-8"))
+    assert stats["state"] == "running"
+    assert stats["pid"] > 0
+    assert stats["processes"] >= 1
+    assert stats["restarts"] == 0
+    assert stats["procwatch_connects"] == 1
+    _, _, status = sysdsvc.invoke("stop", debug=True)
+    assert status == 0
+
+
+# sysvrun metrics: running services are discovered and reported
+def test_metrics(sysdenv, root):
+    sysdsvc = sysdenv.create_service("foo")
+    sysdsvc.execstart = [sysdenv.mockd, "sleep"]
+    _, _, status = sysdsvc.invoke("start", debug=True)
+    assert status == 0
+    out, _, status = sysdenv.sysvrun("metrics", debug=True)
+    assert status == 0
+    lines = out.decode("utf-8").splitlines()
+    assert 'sysvkit_up{service="foo"} 1' in lines
+    assert 'sysvkit_state{service="foo",state="running"} 1' in lines
+    _, _, status = sysdsvc.invoke("stop", debug=True)
+    assert status == 0
+    out, _, status = sysdenv.sysvrun("metrics", debug=True)
+    assert status == 0
+    assert 'service="foo"' not in out.decode("utf-8")
+
+
+# sysvrun control: daemon-reload picks up changed drop-ins
+def test_control_daemon_reload(sysdenv, root):
+    sysdsvc = sysdenv.create_service("foo")
+    sysdsvc.execstart = [sysdenv.mockd, "sleep"]
+    _, _, status = sysdsvc.invoke("start", debug=True)
+    assert status == 0
+    sysdsvc.write_dropin("type.conf", "[Service]\nType=forking\n")
+    out, _, status = sysdsvc.invoke(
+        "control", input=b"daemon-reload\n", debug=True
+    )
+    assert status == 0
+    assert out.strip() == b"error"
+    sysdsvc.write_dropin("type.conf", "[Service]\nDescription=foo\n")
+    out, _, status = sysdsvc.invoke(
+        "control", input=b"daemon-reload\n", debug=True
+    )
+    assert status == 0
+    assert out.strip() == b"ok"
+    _, _, status = sysdsvc.invoke("stop", debug=True)
+    assert status == 0
+
+
+# sysvrun control: a reloaded unit is only used once the service restarts
+def test_control_daemon_reload_deferred(sysdenv, root):
+    marker = sysdenv.run_d / "reloaded"
+    sysdsvc = sysdenv.create_service("foo")
+    sysdsvc.type = "exec"
+    sysdsvc.execstart = [sysdenv.mockd, "sleep"]
+    _, _, status = sysdsvc.invoke("start", debug=True)
+    assert status == 0
+    out, _, status = sysdsvc.invoke("control", input=b"stats\n", debug=True)
+    assert status == 0
+    pid = json.loads(out.decode("utf-8"))["pid"]
+    execstart = '/bin/sh -c "touch {} && exec sleep 30"'.format(marker)
+    sysdsvc.write_dropin(
+        "exec.conf",
+        "[Service]\nExecStart=\nExecStart={}\nStartLimitBurst=3\n".format(
+            execstart
+        ),
+    )
+    out, _, status = sysdsvc.invoke(
+        "control", input=b"daemon-reload\n", debug=True
+    )
+    assert status == 0
+    assert out.strip() == b"ok"
+    out, _, status = sysdsvc.invoke("control", input=b"stats\n", debug=True)
+    assert status == 0
+    stats = json.loads(out.decode("utf-8"))
+    assert stats["pid"] == pid
+    assert stats["start_limit_burst"] == 5
+    assert not marker.exists()
+    out, _, status = sysdsvc.invoke("control", input=b"restart\n", debug=True)
+    assert status == 0
+    wait_for_file(marker)
+    out, _, status = sysdsvc.invoke("control", input=b"stats\n", debug=True)
+    assert status == 0
+    assert json.loads(out.decode("utf-8"))["start_limit_burst"] == 3
+    _, _, status = sysdsvc.invoke("stop", debug=True)
+    assert status == 0
+
+
+# Polls the monitor's restart delay until it reaches the given step.
+def wait_restart_step(sysdsvc, step):
+    for _ in range(100):
+        out, _, status = sysdsvc.invoke("control", input=b"stats\n")
+        if status == 0:
+            stats = json.loads(out.decode("utf-8"))
+            if stats["restart_step"] >= step:
+                return stats["restart_step"], stats["restart_delay"]
+        time.sleep(0.1)
+    assert False, "restart step {} not reached".format(step)
+
+
+# sysvrun control: the fixed RestartSec delay is subject to jitter
+def test_control_restart_delay(sysdenv, root):
+    sysdsvc = sysdenv.create_service("foo")
+    sysdsvc.execstart = [sysdenv.mockd, "exit:1"]
+    sysdsvc.write_dropin(
+        "restart.conf", "[Service]\nRestart=on-failure\nRestartSec=2\n"
+    )
+    _, _, status = sysdsvc.invoke("start", debug=True)
+    assert status == 0
+    step, delay = wait_restart_step(sysdsvc, 1)
+    assert step == 1
+    assert 1500000 <= delay <= 2000000
+    _, _, status = sysdsvc.invoke("stop", debug=True)
+    assert status == 0
+
+
+# sysvrun control: with RestartSteps, the delay grows geometrically
+def test_control_restart_backoff(sysdenv, root):
+    sysdsvc = sysdenv.create_service("foo")
+    sysdsvc.execstart = [sysdenv.mockd, "exit:1"]
+    sysdsvc.write_dropin(
+        "restart.conf",
+        "[Service]\nRestart=on-failure\nRestartSec=1\n"
+        "RestartSteps=2\nRestartMaxDelaySec=4\n",
+    )
+    _, _, status = sysdsvc.invoke("start", debug=True)
+    assert status == 0
+    step, delay = wait_restart_step(sysdsvc, 1)
+    assert step == 1
+    assert 750000 <= delay <= 1000000
+    step, delay = wait_restart_step(sysdsvc, 2)
+    assert step == 2
+    assert 1500000 <= delay <= 2000000
+    _, _, status = sysdsvc.invoke("stop", debug=True)
+    assert status == 0
+
+
+# Runs sysvrun control as a coprocess.
+def control_coprocess(sysdenv, sysdsvc):
+    sysdsvc.write()
+    argv = [
+        sysdenv.sysvrun_bin,
+        "--root",
+        sysdenv.root,
+        "--unit-file",
+        sysdsvc.unit_file,
+        sysdsvc.name,
+        "control",
+    ]
+    env = {"ROOT": str(sysdenv.root), "PATH": "/usr/sbin:/usr/bin:/sbin:/bin"}
+    return subprocess.Popen(
+        [str(arg) for arg in argv],
+        cwd=sysdenv.root,
+        env=env,
+        stdin=subprocess.PIPE,
+        stdout=subprocess.PIPE,
+    )
+
+
+# Sends a request to a control coprocess and waits for the response.
+def control_request(proc, request):
+    proc.stdin.write(request + b"\n")
+    proc.stdin.flush()
+    ready, _, _ = select.select([proc.stdout], [], [], 5)
+    assert ready, "no response to {}".format(request)
+    return proc.stdout.readline().strip()
+
+
+# sysvrun control: requests are answered one at a time, even from a pipe
+def test_control_coprocess(sysdenv, root):
+    sysdsvc = sysdenv.create_service("foo")
+    sysdsvc.execstart = [sysdenv.mockd, "sleep"]
+    _, _, status = sysdsvc.invoke("start", debug=True)
+    assert status == 0
+    proc = control_coprocess(sysdenv, sysdsvc)
+    assert control_request(proc, b"status") == b"running"
+    stats = json.loads(control_request(proc, b"stats").decode("utf-8"))
+    assert stats["state"] == "running"
+    proc.stdin.close()
+    assert proc.wait(timeout=5) == 0
+    _, _, status = sysdsvc.invoke("stop", debug=True)
+    assert status == 0
+
+
+# sysvrun control: a request is not repeated when the client reconnects
+def test_control_reconnect(sysdenv, root):
+    sysdsvc = sysdenv.create_service("foo")
+    sysdsvc.execstart = [sysdenv.mockd, "sleep"]
+    _, _, status = sysdsvc.invoke("start", debug=True)
+    assert status == 0
+    proc = control_coprocess(sysdenv, sysdsvc)
+    assert control_request(proc, b"restart") == b"ok"
+    # Crowd out the coprocess's connection.
+    address = "\0" + os.path.basename(sysdenv.sysvrun_bin) + "/foo.service"
+    socks = []
+    for _ in range(16):
+        sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        sock.connect(address)
+        sock.recv(4096)  # banner
+        socks.append(sock)
+    stats = json.loads(control_request(proc, b"stats").decode("utf-8"))
+    assert stats["restarts"] == 1
+    for sock in socks:
+        sock.close()
+    proc.stdin.close()
+    assert proc.wait(timeout=5) == 0
+    _, _, status = sysdsvc.invoke("stop", debug=True)
+    assert status == 0
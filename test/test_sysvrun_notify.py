@@ -0,0 +1,80 @@
+from sysdenv import wait_until
+import json
+import time
+
+
+# sysvrun start: Type=notify service reports readiness
+def test_notify_ready(sysdenv, root):
+    sysdsvc = sysdenv.create_service("foo")
+    sysdsvc.type = "notify"
+    sysdsvc.execstart = [sysdenv.mockd, "syslog", "sleep:1", "notify", "sleep"]
+    _, _, status = sysdsvc.invoke("start", debug=True)
+    assert status == 0
+    _, _, status = sysdsvc.invoke("status", debug=True)
+    assert status == 0
+    _, _, status = sysdsvc.invoke("stop", debug=True)
+    assert status == 0
+    _, _, status = sysdsvc.invoke("status", debug=True)
+    assert status == 3
+
+
+# sysvrun start: Type=notify service exits without reporting readiness
+def test_notify_not_ready(sysdenv, root):
+    sysdsvc = sysdenv.create_service("foo")
+    sysdsvc.type = "notify"
+    sysdsvc.execstart = [sysdenv.mockd, "syslog", "sleep:1", "exit"]
+    _, _, status = sysdsvc.invoke("start", debug=True)
+    assert status != 0
+    _, _, status = sysdsvc.invoke("status", debug=True)
+    assert status == 3
+
+
+# sysvrun start: a service which pings the watchdog keeps running
+def test_watchdog_ping(sysdenv, root):
+    sysdsvc = sysdenv.create_service("foo")
+    sysdsvc.type = "notify"
+    pings = ["sleep:500ms", "notify:WATCHDOG=1"] * 4
+    sysdsvc.execstart = [sysdenv.mockd, "notify", *pings, "sleep"]
+    sysdsvc.write_dropin("watchdog.conf", "[Service]\nWatchdogSec=1\n")
+    _, _, status = sysdsvc.invoke("start", debug=True)
+    assert status == 0
+    time.sleep(2)
+    out, _, status = sysdsvc.invoke("control", input=b"stats\n", debug=True)
+    assert status == 0
+    stats = json.loads(out.decode("utf-8"))
+    assert stats["state"] == "running"
+    assert stats["restarts"] == 0
+    _, _, status = sysdsvc.invoke("stop", debug=True)
+    assert status == 0
+
+
+# sysvrun start: a service which does not ping the watchdog is killed
+def test_watchdog_timeout(sysdenv, root):
+    sysdsvc = sysdenv.create_service("foo")
+    sysdsvc.type = "notify"
+    sysdsvc.execstart = [sysdenv.mockd, "notify", "sleep"]
+    sysdsvc.write_dropin("watchdog.conf", "[Service]\nWatchdogSec=500ms\n")
+    _, _, status = sysdsvc.invoke("start", debug=True)
+    assert status == 0
+    status = wait_until(lambda: sysdsvc.invoke("status", debug=True)[2])
+    assert status == 3
+
+
+# sysvrun start: WATCHDOG_PID is only set for services whose main process
+# is the one we start
+def test_watchdog_pid_forking(sysdenv, root):
+    output = sysdenv.run_d / "wdpid"
+    sysdsvc = sysdenv.create_service("foo")
+    sysdsvc.type = "forking"
+    sysdsvc.pidfile = True
+    script = (
+        "echo ${{WATCHDOG_PID-unset}} >{0}.tmp && mv {0}.tmp {0} && "
+        "exec {1} daemon pidfile sleep".format(output, sysdenv.mockd)
+    )
+    sysdsvc.execstart = ["/bin/sh", "-c", script]
+    sysdsvc.write_dropin("watchdog.conf", "[Service]\nWatchdogSec=10\n")
+    _, _, status = sysdsvc.invoke("start", debug=True)
+    assert status == 0
+    assert output.read_text().strip() == "unset"
+    _, _, status = sysdsvc.invoke("stop", debug=True)
+    assert status == 0
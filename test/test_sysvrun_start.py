@@ -1,3 +1,7 @@
+from sysdenv import wait_for_file
+import grp
+
+
 # sysvrun start: start directly
 def test_start_direct(sysdenv, root):
     sysdsvc = sysdenv.create_service("foo")
@@ -29,3 +33,231 @@ def test_start_systemctl(sysdenv, root):
     sysvsvc = sysdsvc.convert()
     out, err, status = sysvsvc.invoke("start", debug=True)
     assert status == 0
+
+
+# sysvrun start: required services are started first, in dependency order
+def test_start_requires(sysdenv, root):
+    svcs = {}
+    for name in ["alpha", "beta", "gamma", "delta"]:
+        svcs[name] = sysdenv.create_service(name)
+        svcs[name].execstart = [sysdenv.mockd, "sleep"]
+    # alpha requires beta and gamma, which can start concurrently, and
+    # gamma requires delta, which beta is ordered after
+    svcs["alpha"].requires = ["beta", "gamma"]
+    svcs["gamma"].requires = ["delta"]
+    svcs["beta"].after = ["delta"]
+    for svc in svcs.values():
+        svc.write()
+    _, _, status = svcs["alpha"].invoke("start", debug=True)
+    assert status == 0
+    for svc in svcs.values():
+        _, _, status = svc.invoke("status", debug=True)
+        assert status == 0
+    for svc in svcs.values():
+        _, _, status = svc.invoke("stop", debug=True)
+        assert status == 0
+
+
+# sysvrun start: a dependency cycle is detected and nothing is started
+def test_start_requires_cycle(sysdenv, root):
+    svcs = {}
+    for name in ["alpha", "beta", "gamma"]:
+        svcs[name] = sysdenv.create_service(name)
+        svcs[name].execstart = [sysdenv.mockd, "sleep"]
+    svcs["alpha"].requires = ["beta"]
+    svcs["beta"].requires = ["gamma"]
+    svcs["gamma"].requires = ["beta"]
+    for svc in svcs.values():
+        svc.write()
+    _, err, status = svcs["alpha"].invoke("start", debug=True)
+    assert status != 0
+    assert b"dependency cycle" in err
+    for svc in svcs.values():
+        _, _, status = svc.invoke("status", debug=True)
+        assert status == 3
+
+
+# sysvrun stop: units which require the service are stopped first
+def test_stop_requiring(sysdenv, root):
+    svcs = {}
+    for name in ["epsilon", "zeta", "eta", "theta"]:
+        svcs[name] = sysdenv.create_service(name)
+        svcs[name].execstart = [sysdenv.mockd, "sleep"]
+    # zeta and eta require epsilon, theta requires eta
+    svcs["zeta"].requires = ["epsilon"]
+    svcs["eta"].requires = ["epsilon"]
+    svcs["theta"].requires = ["eta"]
+    for svc in svcs.values():
+        svc.write()
+    _, _, status = svcs["theta"].invoke("start", debug=True)
+    assert status == 0
+    _, _, status = svcs["zeta"].invoke("start", debug=True)
+    assert status == 0
+    # --ignore-dependencies leaves the units which require epsilon running
+    _, _, status = svcs["eta"].invoke("stop", "--ignore-dependencies")
+    assert status == 0
+    _, _, status = svcs["eta"].invoke("status", debug=True)
+    assert status == 3
+    _, _, status = svcs["theta"].invoke("status", debug=True)
+    assert status == 0
+    _, _, status = svcs["epsilon"].invoke("stop", debug=True)
+    assert status == 0
+    for svc in svcs.values():
+        _, _, status = svc.invoke("status", debug=True)
+        assert status == 3
+
+
+# sysvrun start: a command which cannot be executed is reported
+def test_start_exec_failure(sysdenv, root):
+    sysdsvc = sysdenv.create_service("iota")
+    sysdsvc.execstart = ["/dev/null"]
+    _, _, status = sysdsvc.invoke("start", debug=True)
+    assert status != 0
+    _, _, status = sysdsvc.invoke("status", debug=True)
+    assert status != 0
+
+
+# sysvrun start: the primary and supplementary groups are applied
+def test_start_groups(sysdenv, root):
+    output = sysdenv.run_d / "groups"
+    sysdsvc = sysdenv.create_service("kappa")
+    sysdsvc.type = "exec"
+    script = "id -G >{0}.tmp && mv {0}.tmp {0}".format(output)
+    sysdsvc.execstart = ["/bin/sh", "-c", script]
+    sysdsvc.group = "daemon"
+    sysdsvc.supplementary_groups = ["adm"]
+    _, _, status = sysdsvc.invoke("start", debug=True)
+    assert status == 0
+    gids = sorted(str(grp.getgrnam(name).gr_gid) for name in ["daemon", "adm"])
+    assert sorted(wait_for_file(output).split()) == gids
+
+
+# sysvrun start: a unit file is reparsed when it changes after being cached
+def test_start_unit_cache(sysdenv, root):
+    (sysdenv.root / "run").mkdir(exist_ok=True)
+    sysdsvc = sysdenv.create_service("lambda")
+    sysdsvc.execstart = ["/dev/null"]
+    sysdsvc.write()
+    _, _, status = sysdsvc.invoke("status", debug=True)
+    assert status == 3
+    assert (sysdenv.root / "run" / "sysvkit" / "lambda.cache").exists()
+    sysdsvc.execstart = [sysdenv.mockd, "sleep"]
+    sysdsvc.write()
+    _, _, status = sysdsvc.invoke("start", debug=True)
+    assert status == 0
+    _, _, status = sysdsvc.invoke("stop", debug=True)
+    assert status == 0
+
+
+# sysvrun start: cache files and directories writable by others are ignored
+def test_start_unit_cache_untrusted(sysdenv, root):
+    cache_d = sysdenv.root / "run" / "sysvkit"
+    cache_d.mkdir(0o755, parents=True)
+    sysdsvc = sysdenv.create_service("lambda")
+    sysdsvc.execstart = ["/dev/null"]
+    sysdsvc.write()
+    _, _, status = sysdsvc.invoke("status")
+    assert status == 3
+    cache = cache_d / "lambda.cache"
+    assert cache.exists()
+    cache.chmod(0o666)
+    _, err, status = sysdsvc.invoke("status", debug=True)
+    assert status == 3
+    assert "ignoring {}".format(cache) in err.decode("utf-8")
+    cache.unlink()
+    cache_d.chmod(0o777)
+    _, _, status = sysdsvc.invoke("status")
+    assert status == 3
+    assert not cache.exists()
+
+
+# sysvrun start: drop-ins are applied in lexical order on top of the unit file
+def test_start_dropins(sysdenv, root):
+    sysdsvc = sysdenv.create_service("mu")
+    sysdsvc.execstart = ["/dev/null"]
+    sysdsvc.write_dropin(
+        "20-sleep.conf",
+        "[Service]\nExecStart=\nExecStart={} sleep\n".format(sysdenv.mockd),
+    )
+    sysdsvc.write_dropin(
+        "10-fail.conf", "[Service]\nExecStart=\nExecStart=/dev/null\n"
+    )
+    # a single-value key is replaced rather than appended to
+    sysdsvc.write_dropin("30-type.conf", "[Service]\nType=exec\n")
+    _, _, status = sysdsvc.invoke("start", debug=True)
+    assert status == 0
+    _, _, status = sysdsvc.invoke("stop", debug=True)
+    assert status == 0
+
+
+# sysvrun start: an instance is loaded from its template, with specifiers
+def test_start_instance(sysdenv, root):
+    output = sysdenv.run_d / "instance"
+    sysdsvc = sysdenv.create_service("nu@")
+    sysdsvc.type = "exec"
+    script = "echo %n %N %p %i %I >{0}.tmp && mv {0}.tmp {0}".format(output)
+    sysdsvc.execstart = ["/bin/sh", "-c", script]
+    sysdsvc.write()
+    _, _, status = sysdenv.sysvrun("nu@a-b", "start", debug=True)
+    assert status == 0
+    assert wait_for_file(output).split() == [
+        "nu@a-b.service",
+        "nu@a-b",
+        "nu",
+        "a-b",
+        "a/b",
+    ]
+
+
+# sysvrun start: specifiers in Environment= do not split the assignment
+def test_start_environment_specifier(sysdenv, root):
+    output = sysdenv.run_d / "omicron"
+    sysdsvc = sysdenv.create_service("omicron@")
+    sysdsvc.type = "exec"
+    script = "printenv INST >{0}.tmp && mv {0}.tmp {0}".format(output)
+    sysdsvc.execstart = ["/bin/sh", "-c", script]
+    sysdsvc.write()
+    sysdsvc.write_dropin("env.conf", "[Service]\nEnvironment=INST=%I\n")
+    _, _, status = sysdenv.sysvrun("omicron@a\\x20b", "start", debug=True)
+    assert status == 0
+    assert wait_for_file(output) == "a b\n"
+
+
+# sysvrun start: specifiers in EnvironmentFile= do not split the path
+def test_start_environment_file_specifier(sysdenv, root):
+    output = sysdenv.run_d / "pi"
+    envfile = sysdenv.root / "etc" / "default" / "pi" / "a b.env"
+    envfile.parent.mkdir(0o755, parents=True, exist_ok=True)
+    envfile.write_text("INST=loaded\n")
+    sysdsvc = sysdenv.create_service("pi@")
+    sysdsvc.type = "exec"
+    script = "printenv INST >{0}.tmp && mv {0}.tmp {0}".format(output)
+    sysdsvc.execstart = ["/bin/sh", "-c", script]
+    sysdsvc.write()
+    sysdsvc.write_dropin(
+        "env.conf", "[Service]\nEnvironmentFile=/etc/default/pi/%I.env\n"
+    )
+    _, _, status = sysdenv.sysvrun("pi@a\\x20b", "start", debug=True)
+    assert status == 0
+    assert wait_for_file(output) == "loaded\n"
+
+
+# sysvrun start: variables from EnvironmentFile= are substituted in ExecStart=
+def test_start_environment_file(sysdenv, root):
+    output = sysdenv.run_d / "xi"
+    envfile = sysdenv.root / "etc" / "default" / "xi"
+    envfile.parent.mkdir(0o755, parents=True, exist_ok=True)
+    envfile.write_text("# words\nWORDS='a  b'\nONE = \"x y\"\n")
+    sysdsvc = sysdenv.create_service("xi")
+    sysdsvc.type = "exec"
+    script = 'for a; do echo "$a"; done >{0}.tmp && mv {0}.tmp {0}'.format(
+        output
+    )
+    sysdsvc.execstart = ["/bin/sh", "-c", script, "sh", "$WORDS", "${ONE}"]
+    sysdsvc.write_dropin(
+        "env.conf",
+        "[Service]\nEnvironmentFile=/etc/default/xi -/etc/default/none\n",
+    )
+    _, _, status = sysdsvc.invoke("start", debug=True)
+    assert status == 0
+    assert wait_for_file(output).splitlines() == ["a", "b", "x y"]
@@ -0,0 +1,28 @@
+# sysvrun trace: the monitor records its lifecycle in the event log
+def test_trace(sysdenv, root):
+    env = {"SYSVKIT_EVENT_LOG": str(sysdenv.run_d)}
+    sysdsvc = sysdenv.create_service("foo")
+    sysdsvc.execstart = [sysdenv.mockd, "sleep"]
+    _, _, status = sysdsvc.invoke("start", env=env, debug=True)
+    assert status == 0
+    _, _, status = sysdsvc.invoke("stop", env=env, debug=True)
+    assert status == 0
+    evlog = sysdenv.run_d / "sysvrun.foo.evlog"
+    assert evlog.stat().st_mode & 0o777 == 0o640
+    out, _, status = sysdsvc.invoke("trace", env=env, debug=True)
+    assert status == 0
+    types = [line.split()[3] for line in out.decode("utf-8").splitlines()]
+    assert types[0] == "start"
+    assert "fork" in types
+    assert "exec" in types
+    assert "exit" in types
+    assert types[-1] == "stop"
+
+
+# sysvrun trace: fails if there is no event log
+def test_trace_missing(sysdenv, root):
+    env = {"SYSVKIT_EVENT_LOG": str(sysdenv.run_d)}
+    sysdsvc = sysdenv.create_service("foo")
+    sysdsvc.execstart = [sysdenv.mockd, "sleep"]
+    _, _, status = sysdsvc.invoke("trace", env=env, debug=True)
+    assert status != 0
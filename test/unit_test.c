@@ -0,0 +1,196 @@
+#define _GNU_SOURCE
+
+#include "noise.h"
+#include "unit.h"
+
+#include <fsdyn/fsalloc.h>
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static unsigned int ec;
+
+// Checks that a key has the expected value, or does not exist if the
+// expected value is NULL.
+static bool check_value(struct unit *u,
+                        const char *section,
+                        const char *key,
+                        const char *expected)
+{
+    const char *value;
+
+    value = unit_get_value(u, section, key);
+    if (expected == NULL ? value == NULL
+                         : value != NULL && strcmp(value, expected) == 0) {
+        return true;
+    }
+    printf("# %s expected %s%s%s got %s%s%s\n",
+           key,
+           expected != NULL ? "\"" : "",
+           expected != NULL ? expected : "NULL",
+           expected != NULL ? "\"" : "",
+           value != NULL ? "\"" : "",
+           value != NULL ? value : "NULL",
+           value != NULL ? "\"" : "");
+    return false;
+}
+
+static void test_update(void)
+{
+    char key[16], value[16];
+    struct unit *u;
+    unsigned int i = 0;
+    bool ok;
+
+#define check(descr, cond)                          \
+    do {                                            \
+        if (cond) {                                 \
+            printf("ok %u - %s\n", i++, descr);     \
+        } else {                                    \
+            printf("not ok %u - %s\n", i++, descr); \
+            ec++;                                   \
+        }                                           \
+    } while (0)
+
+    printf("1..%u\n", 7);
+    u = unit_create("test");
+    unit_set_value(u, "Service", "Environment", "A=a");
+    // Grow the vector of keys several times after setting a value, then
+    // append to it.
+    for (int n = 0; n < 64; n++) {
+        snprintf(key, sizeof(key), "Key%d", n);
+        snprintf(value, sizeof(value), "%d", n);
+        unit_set_value(u, "Service", key, value);
+    }
+    unit_append_value(u, "Service", "Environment", "B=b");
+    check("append after growth",
+          check_value(u, "Service", "Environment", "A=a B=b"));
+    unit_append_value(u, "Service", "Environment", "C=c");
+    check("append again",
+          check_value(u, "Service", "Environment", "A=a B=b C=c"));
+    // Delete a key in front of another, which shifts it down, then append
+    // to the one which moved.
+    unit_update_value(u, "Service", "Key0", NULL, false);
+    unit_append_value(u, "Service", "Key1", "x");
+    check("append after delete", check_value(u, "Service", "Key1", "1 x"));
+    check("deleted", check_value(u, "Service", "Key0", NULL));
+    unit_set_value(u, "Service", "Environment", "E=e");
+    unit_append_value(u, "Service", "Environment", "F=f");
+    check("append after set",
+          check_value(u, "Service", "Environment", "E=e F=f"));
+    ok = true;
+    for (int n = 2; n < 64; n++) {
+        snprintf(key, sizeof(key), "Key%d", n);
+        snprintf(value, sizeof(value), "%d", n);
+        ok = check_value(u, "Service", key, value) && ok;
+    }
+    check("other keys", ok);
+    check("missing", check_value(u, "Unit", "Environment", NULL));
+    unit_free(u);
+#undef check
+}
+
+// Assignments are separated by '|' and their parts by ':'.
+static struct test_case_apply {
+    const char *descr;
+    const char *in;
+    const char *key;
+    const char *value;
+} test_cases_apply[] = {
+    {
+        .descr = "single value replaced",
+        .in = "Service:Type:simple|Service:Type:forking",
+        .key = "Type",
+        .value = "forking",
+    },
+    {
+        .descr = "list appended",
+        .in = "Service:Environment:A=a|Service:Environment:B=b",
+        .key = "Environment",
+        .value = "A=a B=b",
+    },
+    {
+        .descr = "unknown key replaced",
+        .in = "Service:Foo:a|Service:Foo:b",
+        .key = "Foo",
+        .value = "b",
+    },
+};
+
+static void test_apply(void)
+{
+    struct test_case_apply *tc;
+    struct unit *u;
+    unsigned int i, n;
+    char *buf;
+    size_t len;
+
+    n = sizeof(test_cases_apply) / sizeof(test_cases_apply[0]);
+    printf("1..%u\n", n);
+    for (i = 0, tc = test_cases_apply; i < n; i++, tc++) {
+        len = strlen(tc->in) + 1;
+        buf = fsalloc(len);
+        for (size_t j = 0; j < len; j++) {
+            buf[j] = tc->in[j] == '|' || tc->in[j] == ':' ? '\0' : tc->in[j];
+        }
+        u = unit_create("test");
+        if (unit_apply_binary(u, buf, len) == 0
+            && check_value(u, "Service", tc->key, tc->value)) {
+            printf("ok %u - %s\n", i, tc->descr);
+        } else {
+            printf("not ok %u - %s\n", i, tc->descr);
+            ec++;
+        }
+        unit_free(u);
+        fsfree(buf);
+    }
+}
+
+static void usage(void) __attribute__((__noreturn__));
+static void usage(void)
+{
+    fprintf(stderr, "usage: %s [-dhqv]\n", program_invocation_short_name);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+
+    while ((opt = getopt(argc, argv, "dhqv")) != -1) {
+        switch (opt) {
+            case 'd':
+                if (noisy >= DEBUG) {
+                    noisy++;
+                } else {
+                    noisy = DEBUG;
+                }
+                break;
+            case 'h':
+                usage();
+                break;
+            case 'q':
+                noisy = QUIET;
+                break;
+            case 'v':
+                noisy = VERBOSE;
+                break;
+            default:
+                usage();
+                break;
+        }
+    }
+    argc -= optind;
+    argv += optind;
+    if (argc > 0) {
+        usage();
+    }
+
+    test_update();
+    test_apply();
+    exit(ec == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
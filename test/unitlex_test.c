@@ -0,0 +1,254 @@
+#define _GNU_SOURCE
+
+#include "noise.h"
+#include "unitlex.h"
+
+#include <fsdyn/bytearray.h>
+#include <fsdyn/fsalloc.h>
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static unsigned int ec;
+
+// Each token is rendered as section/key=value on a line of its own, and an
+// error as its message followed by the line number.
+static struct test_case {
+    const char *descr;
+    const char *in;
+    const char *out;
+} test_cases[] = {
+    {
+        .descr = "empty",
+        .in = "",
+        .out = "",
+    },
+    {
+        .descr = "blank lines and comments",
+        .in = "\n# comment\n; comment\n\n",
+        .out = "",
+    },
+    {
+        .descr = "single key",
+        .in = "[Service]\nType=simple\n",
+        .out = "Service/Type=simple\n",
+    },
+    {
+        .descr = "several sections",
+        .in = "[Unit]\nDescription=foo\n[Service]\nType=simple\n",
+        .out = "Unit/Description=foo\nService/Type=simple\n",
+    },
+    {
+        .descr = "space around equals sign",
+        .in = "[Service]\nType \t= \tsimple\n",
+        .out = "Service/Type=simple\n",
+    },
+    {
+        .descr = "empty value",
+        .in = "[Service]\nExecStart=\n",
+        .out = "Service/ExecStart=\n",
+    },
+    {
+        .descr = "trailing space",
+        .in = "[Service]\nType=simple \n",
+        .out = "Service/Type=simple\n",
+    },
+    {
+        .descr = "whitespace normalization",
+        .in = "[Service]\nExecStart=/bin/foo  -a\t-b \t \n",
+        .out = "Service/ExecStart=/bin/foo -a -b\n",
+    },
+    {
+        .descr = "line continuation",
+        .in = "[Service]\nExecStart=/bin/foo \\\n  -a \\\n-b\nType=simple\n",
+        .out = "Service/ExecStart=/bin/foo -a -b\nService/Type=simple\n",
+    },
+    {
+        .descr = "comment within continuation",
+        .in = "[Service]\nExecStart=/bin/foo\\\n# comment\n-a\n",
+        .out = "Service/ExecStart=/bin/foo -a\n",
+    },
+    {
+        .descr = "carriage return after section name",
+        .in = "[Service]\r\nType=simple\r\n",
+        .out = "expected end of line 1\n",
+    },
+    {
+        .descr = "CRLF line endings",
+        .in = "[Service]\nType=simple\r\n",
+        .out = "Service/Type=simple\n",
+    },
+    {
+        .descr = "key before section",
+        .in = "Type=simple\n",
+        .out = "key-value pair before first section 1\n",
+    },
+    {
+        .descr = "missing equals sign",
+        .in = "[Service]\n\nType simple\n",
+        .out = "expected '=' 3\n",
+    },
+    {
+        .descr = "empty section name",
+        .in = "[]\n",
+        .out = "expected section name 1\n",
+    },
+    {
+        .descr = "unterminated section name",
+        .in = "[Service\n",
+        .out = "expected ']' 1\n",
+    },
+    {
+        .descr = "missing final newline",
+        .in = "[Service]\nType=simple",
+        .out = "unexpected end of unit file 2\n",
+    },
+    {
+        .descr = "error after continuation",
+        .in = "[Service]\nExecStart=foo \\\nbar\nType\n",
+        .out = "Service/ExecStart=foo bar\nexpected '=' 4\n",
+    },
+};
+
+// Tokenizes a string and renders the result.
+static char *tokenize(const char *in, size_t len)
+{
+    struct unitlex_token tok;
+    struct unitlex lx;
+    byte_array_t *ba;
+    char *out;
+    int res;
+
+    ba = make_byte_array(SIZE_MAX);
+    unitlex_init(&lx, in, len);
+    while ((res = unitlex_next(&lx, &tok)) > 0) {
+        byte_array_appendf(ba,
+                           "%.*s/%.*s=%.*s\n",
+                           (int)tok.section_len,
+                           tok.section,
+                           (int)tok.key_len,
+                           tok.key,
+                           (int)tok.value_len,
+                           tok.value);
+    }
+    if (res < 0) {
+        byte_array_appendf(ba, "%s %u\n", lx.error, lx.line);
+    }
+    unitlex_fini(&lx);
+    out = strdup(byte_array_data(ba));
+    destroy_byte_array(ba);
+    return out;
+}
+
+// Runs the test cases above, after announcing the given total number of tests.
+static void test_unitlex(unsigned int total)
+{
+    struct test_case *tc;
+    unsigned int i, n;
+    char *out;
+
+    n = sizeof(test_cases) / sizeof(test_cases[0]);
+    printf("1..%u\n", total);
+    for (i = 0, tc = test_cases; i < n; i++, tc++) {
+        out = tokenize(tc->in, strlen(tc->in));
+        if (strcmp(out, tc->out) == 0) {
+            printf("ok %u - %s\n", i, tc->descr);
+        } else {
+            printf("not ok %u - %s\n", i, tc->descr);
+            printf("# expected:\n%s# got:\n%s", tc->out, out);
+            ec++;
+        }
+        free(out);
+    }
+}
+
+// Checks that a value much longer than any fixed buffer survives intact,
+// both when it can be returned in place and when it has to be rewritten.
+static void test_unitlex_long(unsigned int i, bool rewrite)
+{
+    static const char prefix[] = "[Service]\nEnvironment=";
+    static const char expect[] = "Service/Environment=";
+    size_t vlen = 1 << 20, plen = strlen(prefix), elen = strlen(expect);
+    char *in, *out, *exp;
+
+    in = malloc(plen + vlen + 1);
+    exp = malloc(elen + vlen + 2);
+    memcpy(in, prefix, plen);
+    memcpy(exp, expect, elen);
+    for (size_t j = 0; j < vlen; j++) {
+        in[plen + j] = exp[elen + j] = 'a' + j % 26;
+    }
+    in[plen + vlen] = '\n';
+    exp[elen + vlen] = '\n';
+    exp[elen + vlen + 1] = '\0';
+    if (rewrite) {
+        // split the value in two with a line continuation
+        memcpy(in + plen + vlen / 2, "\\\n", 2);
+        exp[elen + vlen / 2] = ' ';
+        memmove(exp + elen + vlen / 2 + 1,
+                exp + elen + vlen / 2 + 2,
+                vlen / 2);
+    }
+    out = tokenize(in, plen + vlen + 1);
+    if (strcmp(out, exp) == 0) {
+        printf("ok %u - long value%s\n", i, rewrite ? ", rewritten" : "");
+    } else {
+        printf("not ok %u - long value%s\n", i, rewrite ? ", rewritten" : "");
+        ec++;
+    }
+    free(out);
+    free(exp);
+    free(in);
+}
+
+static void usage(void) __attribute__((__noreturn__));
+static void usage(void)
+{
+    fprintf(stderr, "usage: %s [-dhqv]\n", program_invocation_short_name);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int n;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "dhqv")) != -1) {
+        switch (opt) {
+            case 'd':
+                if (noisy >= DEBUG) {
+                    noisy++;
+                } else {
+                    noisy = DEBUG;
+                }
+                break;
+            case 'h':
+                usage();
+                break;
+            case 'q':
+                noisy = QUIET;
+                break;
+            case 'v':
+                noisy = VERBOSE;
+                break;
+            default:
+                usage();
+                break;
+        }
+    }
+    argc -= optind;
+    argv += optind;
+    if (argc > 0) {
+        usage();
+    }
+
+    n = sizeof(test_cases) / sizeof(test_cases[0]);
+    test_unitlex(n + 2);
+    test_unitlex_long(n, false);
+    test_unitlex_long(n + 1, true);
+    exit(ec == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}